@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_EXT_BASE_MPSC_QUEUE_H_
+#define INCLUDE_PERFETTO_EXT_BASE_MPSC_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <utility>
+
+namespace perfetto {
+namespace base {
+
+// An unbounded lock-free multi-producer single-consumer FIFO queue.
+// Push() can be called concurrently from any thread. Pop() and empty() must be
+// called only from one (consumer) thread at a time.
+//
+// This is D. Vyukov's intrusive MPSC queue: Push() links the element with one
+// atomic exchange and Pop() is lock-free. Each element lives in its own node.
+// Popped nodes are kept in a small cache for reuse by later Push() calls, so
+// that a queue that is drained about as fast as it is filled does not
+// allocate. Push() falls back to the heap if the cache is empty, and Pop()
+// frees the nodes that don't fit in it.
+//
+// The cache is a bounded array of nodes with a sequence number per slot (D.
+// Vyukov's bounded MPMC queue, with the consumer as the only writer). Unlike
+// a linked freelist, taking a node from it is not subject to the ABA problem
+// when several producers race.
+//
+// A producer that has swapped |tail_| but not linked the node into the list
+// yet makes Pop() return false even though empty() is false. The element
+// becomes visible as soon as the producer completes the Push(), so a consumer
+// that sees this should retry rather than wait for a new element.
+//
+// empty() and Push() use sequentially consistent accesses to |tail_|. A
+// consumer that publishes "I'm going to sleep" with a sequentially consistent
+// store and then finds the queue empty is guaranteed that any concurrent
+// producer will see the flag after its Push(), and can wake it up.
+template <typename T>
+class MpscQueue {
+ public:
+  MpscQueue() : head_(&stub_), tail_(&stub_) {
+    for (size_t i = 0; i < kNodeCacheSize; i++)
+      node_cache_[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  ~MpscQueue() {
+    T value;
+    while (Pop(&value)) {
+    }
+    while (Node* node = TakeCachedNode())
+      delete node;
+  }
+
+  // Can be called from any thread.
+  void Push(T value) {
+    Node* node = TakeCachedNode();
+    if (!node)
+      node = new Node();
+    node->value = std::move(value);
+    Enqueue(node);
+  }
+
+  // Moves the oldest element into |value|. Returns false if the queue is empty
+  // or a Push() is in progress (see above).
+  bool Pop(T* value) {
+    Node* head = head_;
+    Node* next = head->next.load(std::memory_order_acquire);
+    if (head == &stub_) {
+      if (!next)
+        return false;
+      // Skip the stub.
+      head_ = next;
+      head = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (!next) {
+      // |head| is the last node. It can be popped only once it's not the
+      // |tail_| anymore, so the stub is pushed after it.
+      if (head != tail_.load(std::memory_order_acquire))
+        return false;
+      Enqueue(&stub_);
+      next = head->next.load(std::memory_order_acquire);
+      if (!next)
+        return false;
+    }
+    head_ = next;
+    *value = std::move(head->value);
+    // Don't keep the moved-from value alive until the node is reused.
+    head->value = T();
+    if (!CacheNode(head))
+      delete head;
+    return true;
+  }
+
+  // Returns true if there are no elements, including ones whose Push() is in
+  // progress.
+  bool empty() const {
+    return head_ == &stub_ && tail_.load(std::memory_order_seq_cst) == &stub_;
+  }
+
+ private:
+  struct Node {
+    std::atomic<Node*> next{nullptr};
+    T value;
+  };
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  // A slot of |node_cache_|. |seq| is the position of the next write to the
+  // slot if it is free, and that position + 1 if it holds a node.
+  struct CacheSlot {
+    std::atomic<size_t> seq{0};
+    Node* node = nullptr;
+  };
+
+  static constexpr size_t kNodeCacheSize = 64;
+  static_assert((kNodeCacheSize & (kNodeCacheSize - 1)) == 0,
+                "kNodeCacheSize must be a power of two");
+
+  void Enqueue(Node* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = tail_.exchange(node, std::memory_order_seq_cst);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // Called only by the consumer. Returns false if the cache is full.
+  bool CacheNode(Node* node) {
+    CacheSlot& slot = node_cache_[cache_write_pos_ & (kNodeCacheSize - 1)];
+    // The slot is free once the producer that took its previous node is done
+    // with it.
+    if (slot.seq.load(std::memory_order_acquire) != cache_write_pos_)
+      return false;
+    slot.node = node;
+    slot.seq.store(cache_write_pos_ + 1, std::memory_order_release);
+    cache_write_pos_++;
+    return true;
+  }
+
+  // Can be called from any thread. Returns nullptr if the cache is empty.
+  Node* TakeCachedNode() {
+    size_t pos = cache_read_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      CacheSlot& slot = node_cache_[pos & (kNodeCacheSize - 1)];
+      size_t seq = slot.seq.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq - (pos + 1));
+      if (diff == 0) {
+        if (cache_read_pos_.compare_exchange_weak(pos, pos + 1,
+                                                  std::memory_order_relaxed)) {
+          Node* node = slot.node;
+          // Hands the slot back to the consumer for its next lap.
+          slot.seq.store(pos + kNodeCacheSize, std::memory_order_release);
+          return node;
+        }
+        // |pos| was reloaded by the failed compare_exchange.
+      } else if (diff < 0) {
+        // Not written yet, or the producer that took the node of the previous
+        // lap hasn't released the slot yet.
+        return nullptr;
+      } else {
+        // Another producer took the node at |pos|.
+        pos = cache_read_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Accessed only by the consumer.
+  Node* head_;
+
+  // Its |value| is unused.
+  Node stub_;
+
+  std::atomic<Node*> tail_;
+
+  CacheSlot node_cache_[kNodeCacheSize];
+  // Accessed only by the consumer.
+  size_t cache_write_pos_ = 0;
+  std::atomic<size_t> cache_read_pos_{0};
+};
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_EXT_BASE_MPSC_QUEUE_H_
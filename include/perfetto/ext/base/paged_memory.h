@@ -53,6 +53,31 @@ class PagedMemory {
     // reserved and the user should call EnsureCommitted() before writing to
     // memory addresses.
     kDontCommit = 1 << 1,
+
+    // Asks the kernel to back the memory with transparent huge pages
+    // (madvise(MADV_HUGEPAGE)), to reduce TLB misses on large buffers. Only
+    // supported on Linux and Android, ignored elsewhere.
+    kTransparentHugePages = 1 << 2,
+
+    // Backs the memory with huge pages reserved in the hugetlbfs pool
+    // (MAP_HUGETLB). Falls back on kTransparentHugePages if the pool doesn't
+    // have enough free pages. The size is rounded up to the huge page size.
+    // The pages are reserved in the pool upfront, also with kDontCommit.
+    // Only supported on Linux and Android.
+    kExplicitHugePages = 1 << 3,
+
+    // Prefers the NUMA node of the cpu the calling thread is running on when
+    // faulting in the memory (mbind(MPOL_PREFERRED)). Only supported on Linux
+    // and Android.
+    kLocalNumaNode = 1 << 4,
+  };
+
+  // The pages actually obtained for the memory, which can differ from the
+  // AllocationFlags if huge pages are not available.
+  enum class Backing {
+    kRegularPages,
+    kTransparentHugePages,
+    kExplicitHugePages,
   };
 
   // Allocates |size| bytes using mmap(MAP_ANONYMOUS). The returned memory is
@@ -78,9 +103,13 @@ class PagedMemory {
   inline void* Get() const noexcept { return p_; }
   inline bool IsValid() const noexcept { return !!p_; }
   inline size_t size() const noexcept { return size_; }
+  inline Backing backing() const noexcept { return backing_; }
+
+  // The NUMA node preferred for the memory with kLocalNumaNode, or -1.
+  inline int numa_node() const noexcept { return numa_node_; }
 
  private:
-  PagedMemory(char* p, size_t size);
+  PagedMemory(char* p, size_t size, char* mapping, size_t mapping_size);
 
   PagedMemory(const PagedMemory&) = delete;
   // Defaulted for implementation of move constructor + assignment.
@@ -90,9 +119,16 @@ class PagedMemory {
 
   // The size originally passed to Allocate(). The actual virtual memory
   // reservation will be larger due to: (i) guard pages; (ii) rounding up to
-  // the system page size.
+  // the system (or huge) page size.
   size_t size_ = 0;
 
+  // The whole virtual memory reservation, including the guard pages.
+  char* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+
+  Backing backing_ = Backing::kRegularPages;
+  int numa_node_ = -1;
+
 #if TRACK_COMMITTED_SIZE()
   size_t committed_size_ = 0u;
 #endif  // TRACK_COMMITTED_SIZE()
@@ -80,6 +80,13 @@ enum class SockPeerCredMode {
 #endif
 };
 
+// A contiguous chunk of a message passed to SendScattered(). The chunks are
+// sent back to back, as if they were a single buffer.
+struct SendBuffer {
+  const void* data;
+  size_t size;
+};
+
 // UnixSocketRaw is a basic wrapper around sockets. It exposes wrapper
 // methods that take care of most common pitfalls (e.g., marking fd as
 // O_CLOEXEC, avoiding SIGPIPE, properly handling partial writes). It is used as
@@ -140,6 +147,16 @@ class UnixSocketRaw {
                const int* send_fds = nullptr,
                size_t num_fds = 0);
 
+  // Like Send(), but gathers the message from |num_bufs| buffers with a single
+  // sendmsg(), without copying them into a contiguous buffer first.
+  // |num_bufs| must be <= kMaxSendBuffers.
+  ssize_t SendScattered(const SendBuffer* bufs,
+                        size_t num_bufs,
+                        const int* send_fds = nullptr,
+                        size_t num_fds = 0);
+
+  static constexpr size_t kMaxSendBuffers = 8;
+
   // |fd_vec| and |max_files| are ignored on Windows.
   ssize_t Receive(void* msg,
                   size_t len,
@@ -315,6 +332,14 @@ class PERFETTO_EXPORT UnixSocket {
   // Does not append a null string terminator to msg in any case.
   bool Send(const void* msg, size_t len, const int* send_fds, size_t num_fds);
 
+  // Like Send(), but gathers the message from up to
+  // UnixSocketRaw::kMaxSendBuffers buffers. Used to send a header and a large
+  // payload that has been serialized separately without concatenating them.
+  bool SendScattered(const SendBuffer* bufs,
+                     size_t num_bufs,
+                     const int* send_fds = nullptr,
+                     size_t num_fds = 0);
+
   inline bool Send(const void* msg, size_t len, int send_fd = -1) {
     if (send_fd != -1)
       return Send(msg, len, &send_fd, 1);
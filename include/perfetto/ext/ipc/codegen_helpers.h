@@ -19,6 +19,8 @@
 #ifndef INCLUDE_PERFETTO_EXT_IPC_CODEGEN_HELPERS_H_
 #define INCLUDE_PERFETTO_EXT_IPC_CODEGEN_HELPERS_H_
 
+#include <stddef.h>
+
 #include <memory>
 
 #include "perfetto/ext/ipc/basic_types.h"
@@ -28,9 +30,10 @@
 // A templated protobuf message decoder. Returns nullptr in case of failure.
 template <typename T>
 ::std::unique_ptr<::perfetto::ipc::ProtoMessage> _IPC_Decoder(
-    const std::string& proto_data) {
+    const void* proto_data,
+    size_t proto_size) {
   ::std::unique_ptr<::perfetto::ipc::ProtoMessage> msg(new T());
-  if (msg->ParseFromString(proto_data))
+  if (msg->ParseFromArray(proto_data, proto_size))
     return msg;
   return nullptr;
 }
@@ -21,6 +21,7 @@
 
 #include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "perfetto/base/export.h"
@@ -138,6 +139,27 @@ class PERFETTO_EXPORT SharedMemoryArbiter {
   // DataSourceDescriptor.will_notify_on_stop=true).
   virtual void SetBatchCommitsDuration(uint32_t batch_commits_duration_ms) = 0;
 
+  // Enables or disables adaptive commit batching. When enabled, the duration
+  // set via SetBatchCommitsDuration() becomes an upper bound (if zero, a
+  // default upper bound of 100ms is used) and the actual length of each
+  // batching period is derived from the commit rate observed over the previous
+  // periods: producers that commit rarely batch for the whole period, while
+  // producers that commit at a high rate use shorter periods sized to the
+  // expected time to fill the commit watermark. Independently of the period,
+  // pending commits are flushed as soon as the completed-but-uncommitted chunks
+  // exceed a quarter of the SMB, to avoid stalling writers.
+  virtual void SetAdaptiveBatchCommits(bool enabled) = 0;
+
+  // Sets the trace filter bytecode (see TraceConfig.TraceFilter) for the
+  // packets written into |target_buffer|. TraceWriter(s) created afterwards for
+  // that buffer strip the fields that are not allowed by the filter from their
+  // packets before committing them, so that those fields don't take space in
+  // the shared memory buffer. An empty |bytecode| removes the filter. This is
+  // called by the transport layer when a data source is set up with a
+  // DataSourceConfig.trace_filter_bytecode.
+  virtual void SetTraceFilterForBuffer(BufferID target_buffer,
+                                       const std::string& bytecode) = 0;
+
   // Called to enable direct producer-side patching of chunks that have not yet
   // been committed to the service. The return value indicates whether direct
   // patching was successfully enabled. It will be true if
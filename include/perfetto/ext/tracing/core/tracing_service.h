@@ -239,6 +239,22 @@ class PERFETTO_EXPORT ConsumerEndpoint {
   using SaveTraceForBugreportCallback =
       std::function<void(bool /*success*/, const std::string& /*msg*/)>;
   virtual void SaveTraceForBugreport(SaveTraceForBugreportCallback) = 0;
+
+  // Creates a read-only snapshot of the running tracing session identified by
+  // |unique_session_name| (see TraceConfig.unique_session_name) and makes the
+  // calling consumer the owner of it. Data sources of the source session are
+  // flushed first, then the contents of its buffers are copied into a new set
+  // of buffers. The source session keeps running, unaffected. The caller can
+  // then ReadBuffers() and FreeBuffers() on the clone as if it was a session
+  // that it created and disabled. The calling consumer must not own any other
+  // tracing session and must have the same uid of the source session.
+  // Args:
+  // - success: if true, the snapshot was created.
+  // - msg: human readable diagnostic messages to debug failures.
+  using CloneSessionCallback =
+      std::function<void(bool /*success*/, const std::string& /*msg*/)>;
+  virtual void CloneSession(const std::string& unique_session_name,
+                            CloneSessionCallback) = 0;
 };  // class ConsumerEndpoint.
 
 // The public API of the tracing Service business logic.
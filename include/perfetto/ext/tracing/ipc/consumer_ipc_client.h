@@ -17,6 +17,8 @@
 #ifndef INCLUDE_PERFETTO_EXT_TRACING_IPC_CONSUMER_IPC_CLIENT_H_
 #define INCLUDE_PERFETTO_EXT_TRACING_IPC_CONSUMER_IPC_CLIENT_H_
 
+#include <stddef.h>
+
 #include <memory>
 #include <string>
 
@@ -45,6 +47,17 @@ class PERFETTO_EXPORT ConsumerIPCClient {
   static std::unique_ptr<TracingService::ConsumerEndpoint>
   Connect(const char* service_sock_name, Consumer*, base::TaskRunner*);
 
+  // As above, but ReadBuffers() also passes to the service a shared memory
+  // buffer of |readback_shmem_size_bytes|, through which the service returns
+  // the trace packets without copying them through the IPC socket. Falls back
+  // transparently to the IPC socket if the service doesn't support it, and on
+  // platforms without fd passing (Windows).
+  static std::unique_ptr<TracingService::ConsumerEndpoint> Connect(
+      const char* service_sock_name,
+      Consumer*,
+      base::TaskRunner*,
+      size_t readback_shmem_size_bytes);
+
  protected:
   ConsumerIPCClient() = delete;
 };
@@ -18,6 +18,8 @@
 #define INCLUDE_PERFETTO_PROTOZERO_PROTO_DECODER_H_
 
 #include <stdint.h>
+#include <string.h>
+
 #include <array>
 #include <memory>
 #include <vector>
@@ -277,12 +279,18 @@ class PackedRepeatedFieldIterator {
 // [ field 0 (invalid) ] [ fields 1 .. N ] [ repeated fields ]
 //                                        ^                  ^
 //                                        num_fields_        size_
+// By default the slot of a field in |fields_| is its id. When |field_slots_|
+// is set, fields are instead stored densely: field_slots_[id] is the slot of
+// the field |id|, or 0 if the field is not stored at all (its value is
+// dropped and Get() returns the invalid field 0).
 class PERFETTO_EXPORT TypedProtoDecoderBase : public ProtoDecoder {
  public:
   // If the field |id| is known at compile time, prefer the templated
   // specialization at<kFieldNumber>().
   const Field& Get(uint32_t id) const {
-    return PERFETTO_LIKELY(id < num_fields_) ? fields_[id] : fields_[0];
+    if (PERFETTO_UNLIKELY(id >= num_field_ids_))
+      return fields_[0];
+    return fields_[field_slots_ ? field_slots_[id] : id];
   }
 
   // Returns an object that allows to iterate over all instances of a repeated
@@ -291,7 +299,7 @@ class PERFETTO_EXPORT TypedProtoDecoderBase : public ProtoDecoder {
   template <typename T>
   RepeatedFieldIterator<T> GetRepeated(uint32_t field_id) const {
     return RepeatedFieldIterator<T>(field_id, &fields_[num_fields_],
-                                    &fields_[size_], &fields_[field_id]);
+                                    &fields_[size_], &Get(field_id));
   }
 
   // Returns an objects that allows to iterate over all entries of a packed
@@ -323,18 +331,22 @@ class PERFETTO_EXPORT TypedProtoDecoderBase : public ProtoDecoder {
 
  protected:
   TypedProtoDecoderBase(Field* storage,
+                        const uint16_t* field_slots,
+                        uint32_t num_field_ids,
                         uint32_t num_fields,
                         uint32_t capacity,
                         const uint8_t* buffer,
                         size_t length)
       : ProtoDecoder(buffer, length),
         fields_(storage),
+        field_slots_(field_slots),
+        num_field_ids_(num_field_ids),
         num_fields_(num_fields),
         size_(num_fields),
         capacity_(capacity) {
     // The reason why Field needs to be trivially de/constructible is to avoid
     // implicit initializers on all the ~1000 entries. We need it to initialize
-    // only on the first |max_field_id| fields, the remaining capacity doesn't
+    // only the first |num_fields| fields, the remaining capacity doesn't
     // require initialization.
     static_assert(std::is_trivially_constructible<Field>::value &&
                       std::is_trivially_destructible<Field>::value &&
@@ -358,14 +370,23 @@ class PERFETTO_EXPORT TypedProtoDecoderBase : public ProtoDecoder {
   // case of a large number of repeated fields.
   Field* fields_;
 
+  // Maps field ids to slots in |fields_|, see the comment at the top of the
+  // class. Has |num_field_ids_| entries. If null, the slot of a field is its
+  // id.
+  const uint16_t* field_slots_;
+
+  // MAX_FIELD_ID + 1. Fields with higher ids are skipped.
+  uint32_t num_field_ids_;
+
   // Number of fields without accounting repeated storage. This is equal to
-  // MAX_FIELD_ID + 1 (to account for the invalid 0th field).
+  // the number of stored fields + 1 (to account for the invalid 0th field),
+  // i.e. MAX_FIELD_ID + 1 when |field_slots_| is null.
   // This value is always <= size_ (and hence <= capacity);
   uint32_t num_fields_;
 
-  // Number of active |fields_| entries. This is initially equal to the highest
-  // number of fields for the message (num_fields_ == MAX_FIELD_ID + 1) and can
-  // grow up to |capacity_| in the case of repeated fields.
+  // Number of active |fields_| entries. This is initially equal to
+  // |num_fields_| and can grow up to |capacity_| in the case of repeated
+  // fields.
   uint32_t size_;
 
   // Initially equal to kFieldsCapacity of the TypedProtoDecoder
@@ -375,25 +396,121 @@ class PERFETTO_EXPORT TypedProtoDecoderBase : public ProtoDecoder {
   uint32_t capacity_;
 };
 
+// The list of field ids that a TypedProtoDecoder should store, when the caller
+// knows upfront which fields it is going to read. Example usage:
+//   TracePacket::Decoder packet(
+//       data, size,
+//       FieldSubset<TracePacket::kTimestampFieldNumber,
+//                   TracePacket::kTrackEventFieldNumber>());
+// The values of all the other fields are dropped while parsing and their
+// accessors behave as if the fields were not set.
+template <uint32_t... FIELD_IDS>
+struct FieldSubset {};
+
+namespace internal {
+
+constexpr bool AllFieldIdsInRange(uint32_t) {
+  return true;
+}
+
+template <typename... Ids>
+constexpr bool AllFieldIdsInRange(uint32_t max_field_id,
+                                  uint32_t id,
+                                  Ids... ids) {
+  return id > 0 && id <= max_field_id &&
+         AllFieldIdsInRange(max_field_id, ids...);
+}
+
+// Returns the field id -> slot table for a FieldSubset. The table is built
+// the first time and shared by all the decoders using the same subset.
+template <int MAX_FIELD_ID, uint32_t... FIELD_IDS>
+const uint16_t* GetFieldSubsetSlots() {
+  struct Table {
+    Table() {
+      memset(slots, 0, sizeof(slots));
+      const uint32_t ids[] = {FIELD_IDS...};
+      uint16_t next_slot = 1;
+      for (uint32_t id : ids) {
+        if (!slots[id])
+          slots[id] = next_slot++;
+      }
+    }
+    uint16_t slots[MAX_FIELD_ID + 1];
+  };
+  static const Table table;
+  return table.slots;
+}
+
+}  // namespace internal
+
 // Template class instantiated by the auto-generated decoder classes declared in
 // xxx.pbzero.h files.
-template <int MAX_FIELD_ID, bool HAS_NONPACKED_REPEATED_FIELDS>
+// NUM_STORED_FIELDS is the number of fields that have a slot in the storage.
+// It is lower than MAX_FIELD_ID for messages with sparse field ids, for which
+// the plugin generates a constant field id -> slot table.
+template <int MAX_FIELD_ID,
+          bool HAS_NONPACKED_REPEATED_FIELDS,
+          int NUM_STORED_FIELDS = MAX_FIELD_ID>
 class TypedProtoDecoder : public TypedProtoDecoderBase {
  public:
   TypedProtoDecoder(const uint8_t* buffer, size_t length)
       : TypedProtoDecoderBase(on_stack_storage_,
+                              /*field_slots=*/nullptr,
+                              /*num_field_ids=*/MAX_FIELD_ID + 1,
                               /*num_fields=*/MAX_FIELD_ID + 1,
                               kCapacity,
                               buffer,
                               length) {
     static_assert(MAX_FIELD_ID <= kMaxDecoderFieldId, "Field ordinal too high");
+    static_assert(NUM_STORED_FIELDS == MAX_FIELD_ID,
+                  "Dense decoders must be constructed with a slot table");
+    TypedProtoDecoderBase::ParseAllFields();
+  }
+
+  // |field_slots| must have MAX_FIELD_ID + 1 entries, all <=
+  // NUM_STORED_FIELDS, and must outlive the decoder.
+  TypedProtoDecoder(const uint8_t* buffer,
+                    size_t length,
+                    const uint16_t* field_slots)
+      : TypedProtoDecoderBase(on_stack_storage_,
+                              field_slots,
+                              /*num_field_ids=*/MAX_FIELD_ID + 1,
+                              /*num_fields=*/NUM_STORED_FIELDS + 1,
+                              kCapacity,
+                              buffer,
+                              length) {
+    static_assert(MAX_FIELD_ID <= kMaxDecoderFieldId, "Field ordinal too high");
+    TypedProtoDecoderBase::ParseAllFields();
+  }
+
+  // Stores only the fields in FIELD_IDS. This saves the cost of initializing
+  // the slots of all the other fields, which dominates the decoding of small
+  // messages with many (or sparse) field ids.
+  template <uint32_t... FIELD_IDS>
+  TypedProtoDecoder(const uint8_t* buffer,
+                    size_t length,
+                    FieldSubset<FIELD_IDS...>)
+      : TypedProtoDecoderBase(
+            on_stack_storage_,
+            internal::GetFieldSubsetSlots<MAX_FIELD_ID, FIELD_IDS...>(),
+            /*num_field_ids=*/MAX_FIELD_ID + 1,
+            /*num_fields=*/sizeof...(FIELD_IDS) + 1,
+            kCapacity,
+            buffer,
+            length) {
+    static_assert(MAX_FIELD_ID <= kMaxDecoderFieldId, "Field ordinal too high");
+    static_assert(sizeof...(FIELD_IDS) > 0, "Empty FieldSubset");
+    static_assert(sizeof...(FIELD_IDS) <= NUM_STORED_FIELDS,
+                  "Too many fields in FieldSubset");
+    static_assert(internal::AllFieldIdsInRange(MAX_FIELD_ID, FIELD_IDS...),
+                  "FieldSubset contains an invalid field id");
     TypedProtoDecoderBase::ParseAllFields();
   }
 
   template <uint32_t FIELD_ID>
   const Field& at() const {
     static_assert(FIELD_ID <= MAX_FIELD_ID, "FIELD_ID > MAX_FIELD_ID");
-    return fields_[FIELD_ID];
+    return fields_[field_slots_ ? field_slots_[FIELD_ID] : FIELD_ID];
   }
 
   TypedProtoDecoder(TypedProtoDecoder&& other) noexcept
@@ -416,10 +533,12 @@ class TypedProtoDecoder : public TypedProtoDecoderBase {
   static constexpr size_t kMaxDecoderFieldId = 999;
 
   // If we the message has no repeated fields we need at most N Field entries
-  // in the on-stack storage, where N is the highest field id.
+  // in the on-stack storage, where N is the number of stored fields (i.e. the
+  // highest field id, unless the fields are stored densely).
   // Otherwise we need some room to store repeated fields.
   static constexpr size_t kCapacity =
-      1 + (HAS_NONPACKED_REPEATED_FIELDS ? kMaxDecoderFieldId : MAX_FIELD_ID);
+      1 + (HAS_NONPACKED_REPEATED_FIELDS ? kMaxDecoderFieldId
+                                         : NUM_STORED_FIELDS);
 
   Field on_stack_storage_[kCapacity];
 };
@@ -22,6 +22,7 @@
 #include <cinttypes>
 #include <type_traits>
 
+#include "perfetto/base/compiler.h"
 #include "perfetto/base/logging.h"
 
 namespace protozero {
@@ -235,6 +236,17 @@ void StaticAssertSingleBytePreamble() {
 inline const uint8_t* ParseVarInt(const uint8_t* start,
                                   const uint8_t* end,
                                   uint64_t* out_value) {
+  // Fast path for one and two byte varints, by far the most common case
+  // (field preambles, lengths of small messages, enums, small ints).
+  if (PERFETTO_LIKELY(start < end && *start < 0x80)) {
+    *out_value = *start;
+    return start + 1;
+  }
+  if (PERFETTO_LIKELY(end - start >= 2 && start[1] < 0x80)) {
+    *out_value = (start[0] & 0x7fu) | (static_cast<uint64_t>(start[1]) << 7);
+    return start + 2;
+  }
+
   const uint8_t* pos = start;
   uint64_t value = 0;
   for (uint32_t shift = 0; pos < end && shift < 64u; shift += 7) {
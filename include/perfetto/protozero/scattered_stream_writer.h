@@ -106,6 +106,14 @@ class PERFETTO_EXPORT ScatteredStreamWriter {
 
   uint8_t* write_ptr() const { return write_ptr_; }
 
+  // Moves the write pointer back by |size| bytes, discarding them. The caller
+  // must ensure that all the discarded bytes belong to the current range, i.e.
+  // that no GetNewBuffer() happened while writing them.
+  void Rewind(size_t size) {
+    assert(size <= static_cast<size_t>(write_ptr_ - cur_range_.begin));
+    write_ptr_ -= size;
+  }
+
   uint64_t written() const {
     return written_previously_ +
            static_cast<uint64_t>(write_ptr_ - cur_range_.begin);
@@ -105,6 +105,14 @@ struct TracingInitArgs {
   // delay, i.e. commits will be sent to the service at the next opportunity.
   uint32_t shmem_batch_commits_duration_ms = 0;
 
+  // [Optional] If true, the batching period above is treated as an upper bound
+  // and adapted at runtime to the observed commit rate: short periods for
+  // producers that fill the shared memory buffer quickly, the full period for
+  // mostly idle ones. This reduces the number of commit IPCs of high-rate
+  // producers without risking to exhaust the shared memory buffer. For more
+  // details, see the SetAdaptiveBatchCommits method in shared_memory_arbiter.h.
+  bool shmem_adaptive_batch_commits = false;
+
   // [Optional] If set, the policy object is notified when certain SDK events
   // occur and may apply policy decisions, such as denying connections. The
   // embedder is responsible for ensuring the object remains alive for the
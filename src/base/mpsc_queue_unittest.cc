@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/ext/base/mpsc_queue.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace base {
+namespace {
+
+TEST(MpscQueueTest, SingleThread) {
+  MpscQueue<int> queue;
+  int value = 0;
+  EXPECT_TRUE(queue.empty());
+  EXPECT_FALSE(queue.Pop(&value));
+
+  queue.Push(1);
+  EXPECT_FALSE(queue.empty());
+  ASSERT_TRUE(queue.Pop(&value));
+  EXPECT_EQ(value, 1);
+  EXPECT_TRUE(queue.empty());
+  EXPECT_FALSE(queue.Pop(&value));
+
+  for (int i = 0; i < 10; i++)
+    queue.Push(i);
+  for (int i = 0; i < 5; i++) {
+    ASSERT_TRUE(queue.Pop(&value));
+    EXPECT_EQ(value, i);
+  }
+  queue.Push(10);
+  for (int i = 5; i <= 10; i++) {
+    ASSERT_TRUE(queue.Pop(&value));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(MpscQueueTest, DestroysRemainingElements) {
+  std::shared_ptr<int> ptr(new int(42));
+  {
+    MpscQueue<std::shared_ptr<int>> queue;
+    queue.Push(ptr);
+    queue.Push(ptr);
+    std::shared_ptr<int> popped;
+    ASSERT_TRUE(queue.Pop(&popped));
+    EXPECT_EQ(ptr.use_count(), 3);
+  }
+  EXPECT_EQ(ptr.use_count(), 1);
+}
+
+TEST(MpscQueueTest, ReusesPoppedNodes) {
+  // More than fit in the node cache, so that some of the popped nodes are
+  // freed and some are reused.
+  constexpr int kNumElements = 1000;
+  std::shared_ptr<int> ptr(new int(42));
+  MpscQueue<std::shared_ptr<int>> queue;
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < kNumElements; i++)
+      queue.Push(ptr);
+    EXPECT_EQ(ptr.use_count(), kNumElements + 1);
+    std::shared_ptr<int> popped;
+    for (int i = 0; i < kNumElements; i++) {
+      ASSERT_TRUE(queue.Pop(&popped));
+      EXPECT_EQ(popped, ptr);
+    }
+    EXPECT_TRUE(queue.empty());
+    // The cached nodes don't hold on to the popped values.
+    popped.reset();
+    EXPECT_EQ(ptr.use_count(), 1);
+  }
+}
+
+TEST(MpscQueueTest, ManyProducers) {
+  constexpr int kNumThreads = 4;
+  constexpr int kNumPerThread = 10000;
+  MpscQueue<int> queue;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&queue, t] {
+      for (int i = 0; i < kNumPerThread; i++)
+        queue.Push(t * kNumPerThread + i);
+    });
+  }
+
+  // The elements pushed by each thread are popped in order.
+  std::vector<int> next(kNumThreads, 0);
+  for (int popped = 0; popped < kNumThreads * kNumPerThread;) {
+    int value;
+    if (!queue.Pop(&value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    int t = value / kNumPerThread;
+    ASSERT_EQ(value % kNumPerThread, next[static_cast<size_t>(t)]++);
+    popped++;
+  }
+  for (auto& thread : threads)
+    thread.join();
+  EXPECT_TRUE(queue.empty());
+}
+
+}  // namespace
+}  // namespace base
+}  // namespace perfetto
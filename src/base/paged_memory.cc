@@ -25,8 +25,16 @@
 #include <sys/mman.h>
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/container_annotations.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/utils.h"
 
 namespace perfetto {
@@ -47,6 +55,114 @@ size_t GuardSize() {
   return GetSysPageSize();
 }
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+
+// Returns the value of the |field| (e.g. "Hugepagesize:") line of
+// /proc/meminfo, without the " kB" unit if any.
+Optional<uint64_t> ReadMeminfoField(const char* field) {
+  std::string meminfo;
+  if (!ReadFile("/proc/meminfo", &meminfo))
+    return nullopt;
+  for (const std::string& line : SplitString(meminfo, "\n")) {
+    if (!StartsWith(line, field))
+      continue;
+    return StringToUInt64(
+        StripSuffix(TrimLeading(StripPrefix(line, field)), " kB"));
+  }
+  return nullopt;
+}
+
+// Returns the size of the default huge pages used by MAP_HUGETLB, or 0 if
+// unknown.
+size_t GetHugePageSize() {
+  static const size_t huge_page_size = [] {
+    Optional<uint64_t> size_kb = ReadMeminfoField("Hugepagesize:");
+    return size_kb ? static_cast<size_t>(*size_kb * 1024) : size_t(0);
+  }();
+  return huge_page_size;
+}
+
+// MADV_HUGEPAGE is accepted even if transparent huge pages are disabled
+// system-wide, in which case it has no effect.
+bool TransparentHugePagesEnabled() {
+  static const bool enabled = [] {
+    std::string mode;
+    if (!ReadFile("/sys/kernel/mm/transparent_hugepage/enabled", &mode))
+      return false;
+    return !Contains(mode, "[never]");
+  }();
+  return enabled;
+}
+
+// Maps |*size| bytes, rounded up to the huge page size, of huge pages from the
+// hugetlbfs pool, surrounded by guard regions. Returns nullptr if the pool
+// doesn't have enough free pages.
+// The pages are always reserved in the pool by mmap(), even if they are not
+// committed yet: without the reservation (MAP_NORESERVE), touching a page after
+// other processes drained the pool would raise SIGBUS.
+char* MapExplicitHugePages(size_t* size,
+                           char** mapping,
+                           size_t* mapping_size) {
+  const size_t huge_page_size = GetHugePageSize();
+  if (huge_page_size == 0)
+    return nullptr;
+  // Huge page sizes are powers of two.
+  const size_t huge_size = (*size + huge_page_size - 1) & ~(huge_page_size - 1);
+  // Reserve enough address space to align the huge pages, leaving at least one
+  // guard page on each side.
+  const size_t reserved_size = huge_size + huge_page_size + GuardSize() * 2;
+  void* reserved = mmap(nullptr, reserved_size, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserved == MAP_FAILED)
+    return nullptr;
+  const uintptr_t start =
+      (reinterpret_cast<uintptr_t>(reserved) + GuardSize() + huge_page_size -
+       1) &
+      ~(huge_page_size - 1);
+  void* ptr = mmap(reinterpret_cast<void*>(start), huge_size,
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0);
+  if (ptr == MAP_FAILED) {
+    munmap(reserved, reserved_size);
+    return nullptr;
+  }
+  *size = huge_size;
+  *mapping = reinterpret_cast<char*>(reserved);
+  *mapping_size = reserved_size;
+  return reinterpret_cast<char*>(ptr);
+}
+
+// Sets the NUMA node of the cpu the calling thread runs on as the preferred
+// node for the memory in [p, p + size). Unlike MPOL_BIND, MPOL_PREFERRED falls
+// back on the other nodes if the node runs out of memory. Returns the node, or
+// -1 if NUMA policies are not supported.
+int PreferLocalNumaNode(void* p, size_t size) {
+#if defined(__NR_getcpu) && defined(__NR_mbind)
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (syscall(__NR_getcpu, &cpu, &node, nullptr) != 0)
+    return -1;
+  constexpr size_t kBitsPerWord = sizeof(unsigned long) * 8;
+  unsigned long nodemask[1024 / kBitsPerWord] = {};
+  if (node >= ArraySize(nodemask) * kBitsPerWord)
+    return -1;
+  nodemask[node / kBitsPerWord] |= 1ul << (node % kBitsPerWord);
+  constexpr int kMpolPreferred = 1;  // From <linux/mempolicy.h>.
+  // The kernel reads |maxnode| - 1 bits of the mask.
+  if (syscall(__NR_mbind, p, size, kMpolPreferred, nodemask,
+              ArraySize(nodemask) * kBitsPerWord + 1, 0) != 0) {
+    return -1;
+  }
+  return static_cast<int>(node);
+#else
+  ignore_result(p, size);
+  return -1;
+#endif
+}
+
+#endif  // OS_LINUX || OS_ANDROID
+
 }  // namespace
 
 // static
@@ -60,19 +176,54 @@ PagedMemory PagedMemory::Allocate(size_t req_size, int flags) {
     return PagedMemory();
   PERFETTO_CHECK(ptr);
   char* usable_region = reinterpret_cast<char*>(ptr) + GuardSize();
+  auto memory = PagedMemory(usable_region, req_size,
+                            reinterpret_cast<char*>(ptr), outer_size);
 #else   // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
-  void* ptr = mmap(nullptr, outer_size, PROT_READ | PROT_WRITE,
-                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if (ptr == MAP_FAILED && (flags & kMayFail))
-    return PagedMemory();
-  PERFETTO_CHECK(ptr && ptr != MAP_FAILED);
-  char* usable_region = reinterpret_cast<char*>(ptr) + GuardSize();
-  int res = mprotect(ptr, GuardSize(), PROT_NONE);
-  res |= mprotect(usable_region + rounded_up_size, GuardSize(), PROT_NONE);
-  PERFETTO_CHECK(res == 0);
-#endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  char* usable_region = nullptr;
+  char* mapping = nullptr;
+  size_t mapping_size = 0;
+  Backing backing = Backing::kRegularPages;
+  int numa_node = -1;
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  if (flags & kExplicitHugePages) {
+    usable_region =
+        MapExplicitHugePages(&rounded_up_size, &mapping, &mapping_size);
+    if (usable_region) {
+      backing = Backing::kExplicitHugePages;
+    } else {
+      flags |= kTransparentHugePages;
+    }
+  }
+#endif
+  if (!usable_region) {
+    void* ptr = mmap(nullptr, outer_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED && (flags & kMayFail))
+      return PagedMemory();
+    PERFETTO_CHECK(ptr && ptr != MAP_FAILED);
+    usable_region = reinterpret_cast<char*>(ptr) + GuardSize();
+    int res = mprotect(ptr, GuardSize(), PROT_NONE);
+    res |= mprotect(usable_region + rounded_up_size, GuardSize(), PROT_NONE);
+    PERFETTO_CHECK(res == 0);
+    mapping = reinterpret_cast<char*>(ptr);
+    mapping_size = outer_size;
+  }
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  if (backing == Backing::kRegularPages && (flags & kTransparentHugePages) &&
+      TransparentHugePagesEnabled() &&
+      madvise(usable_region, rounded_up_size, MADV_HUGEPAGE) == 0) {
+    backing = Backing::kTransparentHugePages;
+  }
+  if (flags & kLocalNumaNode)
+    numa_node = PreferLocalNumaNode(usable_region, rounded_up_size);
+#endif
 
-  auto memory = PagedMemory(usable_region, req_size);
+  auto memory = PagedMemory(usable_region, req_size, mapping, mapping_size);
+  memory.backing_ = backing;
+  memory.numa_node_ = numa_node;
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 #if TRACK_COMMITTED_SIZE()
   size_t initial_commit = req_size;
   if (flags & kDontCommit)
@@ -85,7 +236,9 @@ PagedMemory PagedMemory::Allocate(size_t req_size, int flags) {
 PagedMemory::PagedMemory() {}
 
 // clang-format off
-PagedMemory::PagedMemory(char* p, size_t size) : p_(p), size_(size) {
+PagedMemory::PagedMemory(char* p, size_t size, char* mapping,
+                         size_t mapping_size)
+    : p_(p), size_(size), mapping_(mapping), mapping_size_(mapping_size) {
   ANNOTATE_NEW_BUFFER(p_, size_, committed_size_)
 }
 
@@ -105,13 +258,11 @@ PagedMemory::~PagedMemory() {
   if (!p_)
     return;
   PERFETTO_CHECK(size_);
-  char* start = p_ - GuardSize();
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
-  BOOL res = VirtualFree(start, 0, MEM_RELEASE);
+  BOOL res = VirtualFree(mapping_, 0, MEM_RELEASE);
   PERFETTO_CHECK(res != 0);
 #else   // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
-  const size_t outer_size = RoundUpToSysPageSize(size_) + GuardSize() * 2;
-  int res = munmap(start, outer_size);
+  int res = munmap(mapping_, mapping_size_);
   PERFETTO_CHECK(res == 0);
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
   ANNOTATE_DELETE_BUFFER(p_, size_, committed_size_)
@@ -127,6 +278,9 @@ bool PagedMemory::AdviseDontNeed(void* p, size_t size) {
   return false;
 #else   // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) ||
         // PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  // Huge pages from the hugetlbfs pool can only be discarded in whole pages.
+  if (backing_ == Backing::kExplicitHugePages)
+    return false;
   // http://man7.org/linux/man-pages/man2/madvise.2.html
   int res = madvise(p, size, MADV_DONTNEED);
   PERFETTO_DCHECK(res == 0);
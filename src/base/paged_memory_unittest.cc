@@ -172,6 +172,39 @@ TEST(PagedMemoryTest, GuardRegions) {
   EXPECT_DEATH_IF_SUPPORTED({ raw[kSize] = 'x'; }, ".*");
 }
 
+// Huge pages and NUMA policies are best effort: check that the memory is
+// usable whatever backing was obtained.
+TEST(PagedMemoryTest, HugePagesAndNumaNode) {
+  const int kFlagsToTest[] = {
+      PagedMemory::kTransparentHugePages | PagedMemory::kLocalNumaNode,
+      PagedMemory::kExplicitHugePages,
+      PagedMemory::kExplicitHugePages | PagedMemory::kDontCommit,
+  };
+  for (int flags : kFlagsToTest) {
+    const size_t kSize = 3 * 1024 * 1024 + 1;
+    PagedMemory mem = PagedMemory::Allocate(kSize, flags);
+    ASSERT_TRUE(mem.IsValid());
+    ASSERT_EQ(kSize, mem.size());
+    mem.EnsureCommitted(kSize);
+    char* p = reinterpret_cast<char*>(mem.Get());
+    for (size_t i = 0; i < kSize; i += 4096) {
+      ASSERT_EQ(0, p[i]);
+      p[i] = 1;
+    }
+    p[kSize - 1] = 1;
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+    if (!(flags & PagedMemory::kExplicitHugePages))
+      EXPECT_NE(PagedMemory::Backing::kExplicitHugePages, mem.backing());
+    if (!(flags & PagedMemory::kLocalNumaNode))
+      EXPECT_EQ(-1, mem.numa_node());
+#else
+    EXPECT_EQ(PagedMemory::Backing::kRegularPages, mem.backing());
+    EXPECT_EQ(-1, mem.numa_node());
+#endif
+  }
+}
+
 // Disable this on:
 // MacOS: because it doesn't seem to have an equivalent rlimit to bound mmap().
 // Fuchsia: doesn't support rlimit.
@@ -18,12 +18,20 @@
 
 #include "perfetto/ext/base/unix_task_runner.h"
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
 #include <thread>
+#include <vector>
 
 #include "perfetto/ext/base/event_fd.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/pipe.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/base/utils.h"
 #include "src/base/test/gtest_test_suite.h"
 #include "test/gtest_and_gmock.h"
@@ -105,6 +113,34 @@ TEST_F(TaskRunnerTest, PostDelayedTaskFromOtherThread) {
   thread.join();
 }
 
+// Posts from several threads, sometimes while the task runner is blocked and
+// sometimes while it's running tasks, to check that no wake-up is lost.
+TEST_F(TaskRunnerTest, PostImmediateTaskFromManyThreads) {
+  auto& task_runner = this->task_runner;
+  constexpr int kNumThreads = 4;
+  constexpr int kNumTasksPerThread = 1000;
+  int num_tasks_run = 0;
+  std::vector<int> next_task(kNumThreads, 0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&task_runner, &num_tasks_run, &next_task, t] {
+      for (int i = 0; i < kNumTasksPerThread; i++) {
+        task_runner.PostTask([&task_runner, &num_tasks_run, &next_task, t, i] {
+          EXPECT_EQ(next_task[static_cast<size_t>(t)]++, i);
+          if (++num_tasks_run == kNumThreads * kNumTasksPerThread)
+            task_runner.Quit();
+        });
+        if (i % 100 == 0)
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    });
+  }
+  task_runner.Run();
+  for (auto& thread : threads)
+    thread.join();
+  EXPECT_EQ(num_tasks_run, kNumThreads * kNumTasksPerThread);
+}
+
 TEST_F(TaskRunnerTest, AddFileDescriptorWatch) {
   auto& task_runner = this->task_runner;
   EventFd evt;
@@ -201,6 +237,33 @@ TEST_F(TaskRunnerTest, ReplaceFileDescriptorWatchFromAnotherWatch) {
   EXPECT_FALSE(watch_ran);
 }
 
+// The watch task queued for the old watch must not run the new one, nor trip
+// over its state.
+TEST_F(TaskRunnerTest, ReplaceFileDescriptorWatchWhileTaskQueued) {
+  auto& task_runner = this->task_runner;
+  EventFd evt;
+  evt.Notify();
+
+  bool old_watch_ran = false;
+  int new_watch_count = 0;
+  task_runner.AddFileDescriptorWatch(
+      evt.fd(), [&old_watch_ran] { old_watch_ran = true; });
+  // Runs before the task of the first watch, which is queued by the first
+  // iteration of the loop.
+  task_runner.PostTask([&task_runner, &evt, &new_watch_count] {
+    task_runner.RemoveFileDescriptorWatch(evt.fd());
+    task_runner.AddFileDescriptorWatch(evt.fd(), [&evt, &new_watch_count] {
+      evt.Clear();
+      new_watch_count++;
+    });
+  });
+  task_runner.PostDelayedTask([&task_runner] { task_runner.Quit(); }, 10);
+  task_runner.Run();
+
+  EXPECT_FALSE(old_watch_ran);
+  EXPECT_EQ(new_watch_count, 1);
+}
+
 TEST_F(TaskRunnerTest, AddFileDescriptorWatchFromAnotherThread) {
   auto& task_runner = this->task_runner;
   EventFd evt;
@@ -385,6 +448,58 @@ TEST_F(TaskRunnerTest, FileDescriptorClosedEvent) {
   task_runner.Run();
 }
 
+// Regular files are always readable. epoll(7) doesn't accept them, so the
+// epoll-based task runner has to special-case them.
+TEST_F(TaskRunnerTest, FileDescriptorWatchOnRegularFile) {
+  auto& task_runner = this->task_runner;
+  TempFile file = TempFile::Create();
+  int event_count = 0;
+  task_runner.AddFileDescriptorWatch(file.fd(), [&] {
+    if (++event_count == 3) {
+      task_runner.RemoveFileDescriptorWatch(file.fd());
+      task_runner.PostDelayedTask([&task_runner] { task_runner.Quit(); }, 10);
+    }
+  });
+  task_runner.Run();
+  EXPECT_EQ(event_count, 3);
+}
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+// A forked child keeps using the watches of the parent. With epoll, it must do
+// so without changing the epoll instance shared with the parent.
+TEST_F(TaskRunnerTest, FileDescriptorWatchesAfterFork) {
+  auto& task_runner = this->task_runner;
+  EventFd evt;
+  int watch_count = 0;
+  task_runner.AddFileDescriptorWatch(evt.fd(), [&] {
+    evt.Clear();
+    watch_count++;
+    task_runner.Quit();
+  });
+
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0 /* child */) {
+    evt.Notify();
+    task_runner.Run();
+    // Mustn't remove the fd from the epoll set of the parent.
+    task_runner.RemoveFileDescriptorWatch(evt.fd());
+    _exit(watch_count == 1 ? 0 : 1);
+  }
+
+  int status = 0;
+  ASSERT_EQ(pid, PERFETTO_EINTR(waitpid(pid, &status, 0)));
+  ASSERT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+
+  evt.Notify();
+  task_runner.PostDelayedTask([&task_runner] { task_runner.Quit(); }, 1000);
+  task_runner.Run();
+  EXPECT_EQ(watch_count, 1);
+}
+#endif
+
 #endif
 
 }  // namespace
@@ -400,15 +400,34 @@ void UnixSocketRaw::Shutdown() {
   fd_.reset();
 }
 
-#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
-
 ssize_t UnixSocketRaw::Send(const void* msg,
                             size_t len,
-                            const int* /*send_fds*/,
+                            const int* send_fds,
                             size_t num_fds) {
+  SendBuffer buf{msg, len};
+  return SendScattered(&buf, 1, send_fds, num_fds);
+}
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+
+ssize_t UnixSocketRaw::SendScattered(const SendBuffer* bufs,
+                                     size_t num_bufs,
+                                     const int* /*send_fds*/,
+                                     size_t num_fds) {
   PERFETTO_DCHECK(num_fds == 0);
-  return sendto(*fd_, static_cast<const char*>(msg), static_cast<int>(len), 0,
-                nullptr, 0);
+  PERFETTO_CHECK(num_bufs <= kMaxSendBuffers);
+  ssize_t total_sent = 0;
+  for (size_t i = 0; i < num_bufs; i++) {
+    int len = static_cast<int>(bufs[i].size);
+    int sent = sendto(*fd_, static_cast<const char*>(bufs[i].data), len, 0,
+                      nullptr, 0);
+    if (sent < 0)
+      return total_sent > 0 ? total_sent : sent;
+    total_sent += sent;
+    if (sent < len)
+      break;
+  }
+  return total_sent;
 }
 
 ssize_t UnixSocketRaw::Receive(void* msg,
@@ -448,15 +467,20 @@ ssize_t UnixSocketRaw::SendMsgAllPosix(struct msghdr* msg) {
   return total_sent;
 }
 
-ssize_t UnixSocketRaw::Send(const void* msg,
-                            size_t len,
-                            const int* send_fds,
-                            size_t num_fds) {
+ssize_t UnixSocketRaw::SendScattered(const SendBuffer* bufs,
+                                     size_t num_bufs,
+                                     const int* send_fds,
+                                     size_t num_fds) {
   PERFETTO_DCHECK(fd_);
+  PERFETTO_CHECK(num_bufs <= kMaxSendBuffers);
   msghdr msg_hdr = {};
-  iovec iov = {const_cast<void*>(msg), len};
-  msg_hdr.msg_iov = &iov;
-  msg_hdr.msg_iovlen = 1;
+  iovec iov[kMaxSendBuffers];
+  for (size_t i = 0; i < num_bufs; i++) {
+    iov[i].iov_base = const_cast<void*>(bufs[i].data);
+    iov[i].iov_len = bufs[i].size;
+  }
+  msg_hdr.msg_iov = iov;
+  msg_hdr.msg_iovlen = static_cast<decltype(msg_hdr.msg_iovlen)>(num_bufs);
   alignas(cmsghdr) char control_buf[256];
 
   if (num_fds > 0) {
@@ -902,13 +926,25 @@ bool UnixSocket::Send(const void* msg,
                       size_t len,
                       const int* send_fds,
                       size_t num_fds) {
+  SendBuffer buf{msg, len};
+  return SendScattered(&buf, 1, send_fds, num_fds);
+}
+
+bool UnixSocket::SendScattered(const SendBuffer* bufs,
+                               size_t num_bufs,
+                               const int* send_fds,
+                               size_t num_fds) {
   if (state_ != State::kConnected) {
     errno = ENOTCONN;
     return false;
   }
 
+  size_t len = 0;
+  for (size_t i = 0; i < num_bufs; i++)
+    len += bufs[i].size;
+
   sock_raw_.SetBlocking(true);
-  const ssize_t sz = sock_raw_.Send(msg, len, send_fds, num_fds);
+  const ssize_t sz = sock_raw_.SendScattered(bufs, num_bufs, send_fds, num_fds);
   sock_raw_.SetBlocking(false);
 
   if (sz == static_cast<ssize_t>(len)) {
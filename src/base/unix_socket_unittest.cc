@@ -891,6 +891,39 @@ TEST_F(UnixSocketTest, PartialSendMsgAll) {
   ASSERT_EQ(hdr.msg_iov, nullptr);
   ASSERT_EQ(memcmp(send_buf, recv_buf, sizeof(send_buf)), 0);
 }
+
+TEST_F(UnixSocketTest, SendScattered) {
+  UnixSocketRaw send_sock;
+  UnixSocketRaw recv_sock;
+  std::tie(send_sock, recv_sock) =
+      UnixSocketRaw::CreatePairPosix(kTestSocket.family(), SockType::kStream);
+  ASSERT_TRUE(send_sock);
+  ASSERT_TRUE(recv_sock);
+
+  ScopedFile null_fd(base::OpenFile("/dev/null", O_RDONLY));
+  int send_fd = *null_fd;
+  std::string payload(64 * 1024, 'x');
+  const SendBuffer bufs[] = {
+      {"hdr:", 4}, {"", 0}, {payload.data(), payload.size()}, {":end", 4}};
+  std::thread th([&send_sock, &bufs, send_fd] {
+    ASSERT_EQ(send_sock.SendScattered(bufs, ArraySize(bufs), &send_fd, 1),
+              static_cast<ssize_t>(64 * 1024 + 8));
+  });
+
+  std::string received;
+  ScopedFile recv_fd;
+  while (received.size() < payload.size() + 8) {
+    char buf[4096];
+    ssize_t rsize = recv_sock.Receive(buf, sizeof(buf), &recv_fd, 1);
+    ASSERT_GT(rsize, 0);
+    received.append(buf, static_cast<size_t>(rsize));
+  }
+  th.join();
+  EXPECT_EQ(received, "hdr:" + payload + ":end");
+  ASSERT_TRUE(recv_fd);
+  char rd_buf[1];
+  ASSERT_EQ(read(*recv_fd, rd_buf, sizeof(rd_buf)), 0);
+}
 #endif  // !OS_WIN
 
 }  // namespace
@@ -49,10 +49,26 @@ void UnixTaskRunner::WakeUp() {
   event_.Notify();
 }
 
+void UnixTaskRunner::WakeUpIfParked() {
+  // Pairs with the store in Run(): either Run() sees the task that has just
+  // been pushed, or this sees |parked_|. The exchange() coalesces the wake-ups
+  // of concurrent posts into a single Notify().
+  if (parked_.load(std::memory_order_seq_cst) &&
+      parked_.exchange(false, std::memory_order_relaxed)) {
+    WakeUp();
+  }
+}
+
 void UnixTaskRunner::Run() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   created_thread_id_ = GetThreadId();
   quit_ = false;
+#if PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    EnsureEpollFdLocked();
+  }
+#endif
   for (;;) {
     int poll_timeout_ms;
     {
@@ -62,6 +78,13 @@ void UnixTaskRunner::Run() {
       poll_timeout_ms = GetDelayMsToNextTaskLocked();
       UpdateWatchTasksLocked();
     }
+    if (poll_timeout_ms != 0) {
+      // From now on PostTask() wakes us up. Check the queue again, as the tasks
+      // posted before this point didn't.
+      parked_.store(true, std::memory_order_seq_cst);
+      if (!immediate_tasks_.empty())
+        poll_timeout_ms = 0;
+    }
 
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
     DWORD timeout =
@@ -69,6 +92,7 @@ void UnixTaskRunner::Run() {
     DWORD ret =
         WaitForMultipleObjects(static_cast<DWORD>(poll_fds_.size()),
                                &poll_fds_[0], /*bWaitAll=*/false, timeout);
+    parked_.store(false, std::memory_order_relaxed);
     // Unlike poll(2), WaitForMultipleObjects() returns only *one* handle in the
     // set, even when >1 is signalled. In order to avoid starvation,
     // PostFileDescriptorWatches() will WaitForSingleObject() each other handle
@@ -76,10 +100,17 @@ void UnixTaskRunner::Run() {
     // WaitForSingleObject() for the one handle that WaitForMultipleObject()
     // returned.
     PostFileDescriptorWatches(ret);
+#elif PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+    int ret = PERFETTO_EINTR(epoll_wait(*epoll_fd_, epoll_events_,
+                                        kMaxEpollEvents, poll_timeout_ms));
+    PERFETTO_CHECK(ret >= 0);
+    parked_.store(false, std::memory_order_relaxed);
+    PostFileDescriptorWatches(static_cast<uint64_t>(ret));
 #else
     int ret = PERFETTO_EINTR(poll(
         &poll_fds_[0], static_cast<nfds_t>(poll_fds_.size()), poll_timeout_ms));
     PERFETTO_CHECK(ret >= 0);
+    parked_.store(false, std::memory_order_relaxed);
     PostFileDescriptorWatches(0 /*ignored*/);
 #endif
 
@@ -101,12 +132,16 @@ bool UnixTaskRunner::QuitCalled() {
 }
 
 bool UnixTaskRunner::IsIdleForTesting() {
-  std::lock_guard<std::mutex> lock(lock_);
+  PERFETTO_DCHECK_THREAD(thread_checker_);
   return immediate_tasks_.empty();
 }
 
 void UnixTaskRunner::UpdateWatchTasksLocked() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
+#if PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+  // The epoll set is updated directly by Add/RemoveFileDescriptorWatch().
+  return;
+#else
 #if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
   if (!watch_tasks_changed_)
     return;
@@ -124,19 +159,16 @@ void UnixTaskRunner::UpdateWatchTasksLocked() {
     poll_fds_.push_back({handle, POLLIN | POLLHUP, 0});
 #endif
   }
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
 }
 
 void UnixTaskRunner::RunImmediateAndDelayedTask() {
-  // If locking overhead becomes an issue, add a separate work queue.
-  std::function<void()> immediate_task;
+  ImmediateTask immediate_task;
+  const bool has_immediate_task = immediate_tasks_.Pop(&immediate_task);
   std::function<void()> delayed_task;
   TimeMillis now = GetWallTimeMs();
   {
     std::lock_guard<std::mutex> lock(lock_);
-    if (!immediate_tasks_.empty()) {
-      immediate_task = std::move(immediate_tasks_.front());
-      immediate_tasks_.pop_front();
-    }
     if (!delayed_tasks_.empty()) {
       auto it = delayed_tasks_.begin();
       if (now >= it->first) {
@@ -147,27 +179,56 @@ void UnixTaskRunner::RunImmediateAndDelayedTask() {
   }
 
   errno = 0;
-  if (immediate_task)
-    RunTaskWithWatchdogGuard(immediate_task);
+  if (has_immediate_task && immediate_task.is_watch) {
+    RunFileDescriptorWatch(immediate_task.watch_fd,
+                           immediate_task.watch_generation);
+  } else if (has_immediate_task && immediate_task.task) {
+    RunTaskWithWatchdogGuard(immediate_task.task);
+  }
   errno = 0;
   if (delayed_task)
     RunTaskWithWatchdogGuard(delayed_task);
 }
 
-void UnixTaskRunner::PostFileDescriptorWatches(uint64_t windows_wait_result) {
+void UnixTaskRunner::PostFileDescriptorWatches(uint64_t wait_result) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
+#if PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+  std::lock_guard<std::mutex> lock(lock_);
+  for (size_t i = 0; i < wait_result; i++) {
+    const PlatformHandle handle = epoll_events_[i].data.fd;
+
+    // The wake-up event is handled inline to avoid an infinite recursion of
+    // posted tasks.
+    if (handle == event_.fd()) {
+      event_.Clear();
+      continue;
+    }
+
+    // Drop the events of removed watches and of fds whose task is queued
+    // already (possible only after EnsureEpollFdLocked() rebuilt the set).
+    auto it = watch_tasks_.find(handle);
+    if (it == watch_tasks_.end() || it->second.pending)
+      continue;
+
+    // The fd was registered with EPOLLONESHOT, so epoll won't report it again
+    // until RunFileDescriptorWatch() re-arms it.
+    it->second.pending = true;
+    PostWatchTask(handle, it->second.generation);
+  }
+#else
+  std::lock_guard<std::mutex> lock(lock_);
   for (size_t i = 0; i < poll_fds_.size(); i++) {
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
     const PlatformHandle handle = poll_fds_[i];
-    // |windows_wait_result| is the result of WaitForMultipleObjects() call. If
+    // |wait_result| is the result of WaitForMultipleObjects() call. If
     // one of the objects was signalled, it will have a value between
     // [0, poll_fds_.size()].
-    if (i != windows_wait_result &&
+    if (i != wait_result &&
         WaitForSingleObject(handle, 0) != WAIT_OBJECT_0) {
       continue;
     }
 #else
-    base::ignore_result(windows_wait_result);
+    base::ignore_result(wait_result);
     const PlatformHandle handle = poll_fds_[i].fd;
     if (!(poll_fds_[i].revents & (POLLIN | POLLHUP)))
       continue;
@@ -181,17 +242,18 @@ void UnixTaskRunner::PostFileDescriptorWatches(uint64_t windows_wait_result) {
       continue;
     }
 
-    // Binding to |this| is safe since we are the only object executing the
-    // task.
-    PostTask(std::bind(&UnixTaskRunner::RunFileDescriptorWatch, this, handle));
+    // The watch might have been removed by another thread since |poll_fds_|
+    // was built.
+    auto it = watch_tasks_.find(handle);
+    if (it == watch_tasks_.end())
+      continue;
+    PostWatchTask(handle, it->second.generation);
 
     // Flag the task as pending.
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
     // On Windows this is done by marking the WatchTask entry as pending. This
     // is more expensive than Linux as requires rebuilding the |poll_fds_|
     // vector on each call. There doesn't seem to be a good alternative though.
-    auto it = watch_tasks_.find(handle);
-    PERFETTO_CHECK(it != watch_tasks_.end());
     PERFETTO_DCHECK(!it->second.pending);
     it->second.pending = true;
 #else
@@ -201,20 +263,29 @@ void UnixTaskRunner::PostFileDescriptorWatches(uint64_t windows_wait_result) {
     poll_fds_[i].fd = -poll_fds_[i].fd;
 #endif
   }
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
 }
 
-void UnixTaskRunner::RunFileDescriptorWatch(PlatformHandle fd) {
+void UnixTaskRunner::RunFileDescriptorWatch(PlatformHandle fd,
+                                            uint64_t watch_generation) {
   std::function<void()> task;
   {
     std::lock_guard<std::mutex> lock(lock_);
     auto it = watch_tasks_.find(fd);
-    if (it == watch_tasks_.end())
+    // The watch might have been removed, or removed and added again, since the
+    // task was posted.
+    if (it == watch_tasks_.end() || it->second.generation != watch_generation)
       return;
     WatchTask& watch_task = it->second;
 
+#if PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+    // The fd is re-armed once the task has run, see below.
+    PERFETTO_DCHECK(watch_task.pending);
+#else
     // Make poll(2) pay attention to the fd again. Since another thread may have
     // updated this watch we need to refresh the set first.
     UpdateWatchTasksLocked();
+#endif
 
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
     // On Windows we manually track the presence of outstanding tasks for the
@@ -222,7 +293,7 @@ void UnixTaskRunner::RunFileDescriptorWatch(PlatformHandle fd) {
     // task to the |poll_fds_| vector.
     PERFETTO_DCHECK(watch_task.pending);
     watch_task.pending = false;
-#else
+#elif !PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
     size_t fd_index = watch_task.poll_fd_index;
     PERFETTO_DCHECK(fd_index < poll_fds_.size());
     PERFETTO_DCHECK(::abs(poll_fds_[fd_index].fd) == fd);
@@ -232,6 +303,18 @@ void UnixTaskRunner::RunFileDescriptorWatch(PlatformHandle fd) {
   }
   errno = 0;
   RunTaskWithWatchdogGuard(task);
+
+#if PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+  // Re-arming after the task, rather than before, lets epoll notice if the task
+  // has replaced the file behind the fd (e.g. with dup2()).
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = watch_tasks_.find(fd);
+  // The task might have removed (and re-added) the watch.
+  if (it != watch_tasks_.end() && it->second.generation == watch_generation &&
+      it->second.pending) {
+    ArmEpollWatchLocked(fd, &it->second);
+  }
+#endif
 }
 
 int UnixTaskRunner::GetDelayMsToNextTaskLocked() const {
@@ -246,14 +329,22 @@ int UnixTaskRunner::GetDelayMsToNextTaskLocked() const {
 }
 
 void UnixTaskRunner::PostTask(std::function<void()> task) {
-  bool was_empty;
-  {
-    std::lock_guard<std::mutex> lock(lock_);
-    was_empty = immediate_tasks_.empty();
-    immediate_tasks_.push_back(std::move(task));
-  }
-  if (was_empty)
-    WakeUp();
+  ImmediateTask immediate_task;
+  immediate_task.task = std::move(task);
+  immediate_tasks_.Push(std::move(immediate_task));
+  WakeUpIfParked();
+}
+
+void UnixTaskRunner::PostWatchTask(PlatformHandle fd,
+                                   uint64_t watch_generation) {
+  // Doesn't wake up Run(): this is called either on the task runner thread,
+  // which is going to run the queued tasks next, or by
+  // AddFileDescriptorWatch(), which calls WakeUp() anyway.
+  ImmediateTask immediate_task;
+  immediate_task.watch_fd = fd;
+  immediate_task.watch_generation = watch_generation;
+  immediate_task.is_watch = true;
+  immediate_tasks_.Push(std::move(immediate_task));
 }
 
 void UnixTaskRunner::PostDelayedTask(std::function<void()> task,
@@ -271,11 +362,22 @@ void UnixTaskRunner::AddFileDescriptorWatch(PlatformHandle fd,
   PERFETTO_DCHECK(PlatformHandleChecker::IsValid(fd));
   {
     std::lock_guard<std::mutex> lock(lock_);
+#if PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+    EnsureEpollFdLocked();
+#endif
     PERFETTO_DCHECK(!watch_tasks_.count(fd));
     WatchTask& watch_task = watch_tasks_[fd];
     watch_task.callback = std::move(task);
+    watch_task.generation = ++last_watch_generation_;
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
     watch_task.pending = false;
+#elif PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+    watch_task.pending = false;
+    watch_task.always_ready = !AddToEpollLocked(fd);
+    if (watch_task.always_ready) {
+      watch_task.pending = true;
+      PostWatchTask(fd, watch_task.generation);
+    }
 #else
     watch_task.poll_fd_index = SIZE_MAX;
 #endif
@@ -290,11 +392,98 @@ void UnixTaskRunner::RemoveFileDescriptorWatch(PlatformHandle fd) {
     std::lock_guard<std::mutex> lock(lock_);
     PERFETTO_DCHECK(watch_tasks_.count(fd));
     watch_tasks_.erase(fd);
+#if PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+    EnsureEpollFdLocked();
+    // This fails if the caller has already closed the fd, in which case the
+    // kernel has dropped it from the epoll set already.
+    epoll_ctl(*epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+#endif
     watch_tasks_changed_ = true;
   }
   // No need to schedule a wake-up for this.
 }
 
+#if PERFETTO_BUILDFLAG(PERFETTO_EPOLL_TASK_RUNNER)
+void UnixTaskRunner::EnsureEpollFdLocked() {
+  const PlatformProcessId pid = GetProcessId();
+  if (epoll_fd_ && epoll_pid_ == pid)
+    return;
+  // After a fork() the child shares the epoll instance with the parent, so
+  // changing it would change the set of fds watched by the parent too. Build a
+  // new one instead.
+  epoll_fd_.reset(epoll_create1(EPOLL_CLOEXEC));
+  PERFETTO_CHECK(epoll_fd_);
+  epoll_pid_ = pid;
+  for (auto& it : watch_tasks_) {
+    WatchTask& watch_task = it.second;
+    // The tasks of |always_ready| watches are already queued.
+    if (watch_task.always_ready || AddToEpollLocked(it.first))
+      continue;
+    watch_task.always_ready = true;
+    if (!watch_task.pending) {
+      watch_task.pending = true;
+      PostWatchTask(it.first, watch_task.generation);
+    }
+  }
+}
+
+void UnixTaskRunner::ArmEpollWatchLocked(PlatformHandle fd,
+                                         WatchTask* watch_task) {
+  watch_task->pending = false;
+  if (!watch_task->always_ready) {
+    struct epoll_event ev {};
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(*epoll_fd_, EPOLL_CTL_MOD, fd, &ev) == 0)
+      return;
+    // The fd has been closed without removing its watch. If it has been reused
+    // for another file (e.g. by dup2()), poll(2) would watch the new file, so
+    // do the same. That fails with ENOENT if epoll can watch the new file and
+    // with EPERM if it can't. Otherwise (EBADF) the fd isn't watched anymore,
+    // as with poll(2).
+    if (errno == ENOENT) {
+      if (AddToEpollLocked(fd))
+        return;
+    } else if (errno != EPERM) {
+      return;
+    }
+    watch_task->always_ready = true;
+  }
+  watch_task->pending = true;
+  PostWatchTask(fd, watch_task->generation);
+}
+
+bool UnixTaskRunner::AddToEpollLocked(PlatformHandle fd) {
+  struct epoll_event ev {};
+  ev.events = EPOLLIN;
+  // The wake-up event is never disabled, see PostFileDescriptorWatches().
+  if (fd != event_.fd())
+    ev.events |= EPOLLONESHOT;
+  ev.data.fd = fd;
+  if (epoll_ctl(*epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == 0)
+    return true;
+  switch (errno) {
+    case EPERM:
+      // epoll(7) refuses regular files and directories.
+      return false;
+    case ENOSPC:
+    case ENOMEM:
+      // Out of epoll watches (see /proc/sys/fs/epoll/max_user_watches). Keep
+      // the watch working, at the cost of running its task on every loop
+      // iteration.
+      PERFETTO_PLOG("Can't add fd %d to epoll, treating it as always ready",
+                    static_cast<int>(fd));
+      return false;
+    default:
+      // EBADF: the fd isn't open. poll(2) would report it as POLLNVAL, which
+      // doesn't run the watch either.
+      PERFETTO_PLOG("Can't add fd %d to epoll, ignoring it",
+                    static_cast<int>(fd));
+      return true;
+  }
+}
+#endif
+
 bool UnixTaskRunner::RunsTasksOnCurrentThread() const {
   return GetThreadId() == created_thread_id_;
 }
@@ -0,0 +1,200 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/unix_task_runner.h"
+
+namespace {
+
+// Number of tasks or fd events dispatched per benchmark iteration.
+constexpr int kEventsPerIteration = 1000;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(1);
+  } else {
+    b->Arg(1)->Arg(100)->Arg(1000);
+  }
+}
+
+// A set of connected socket pairs, with the read end of each one watched by
+// the task runner, like the producer sockets of the tracing service.
+class ConnectedSockets {
+ public:
+  bool Create(size_t num_sockets) {
+    // Each socket pair takes two fds.
+    struct rlimit limit {};
+    getrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < num_sockets * 2 + 64) {
+      limit.rlim_cur = limit.rlim_max;
+      if (setrlimit(RLIMIT_NOFILE, &limit) != 0 ||
+          limit.rlim_cur < num_sockets * 2 + 64) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < num_sockets; i++) {
+      int fds[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        return false;
+      rd_.emplace_back(fds[0]);
+      wr_.emplace_back(fds[1]);
+    }
+    return true;
+  }
+
+  size_t size() const { return rd_.size(); }
+  int rd(size_t i) const { return *rd_[i]; }
+  int wr(size_t i) const { return *wr_[i]; }
+
+ private:
+  std::vector<perfetto::base::ScopedFile> rd_;
+  std::vector<perfetto::base::ScopedFile> wr_;
+};
+
+}  // namespace
+
+// Passes a token around the ring of sockets: each fd watch reads it and writes
+// it into the next socket. Measures the fd event dispatch throughput.
+static void BM_UnixTaskRunner_FdEvents(benchmark::State& state) {
+  perfetto::base::UnixTaskRunner task_runner;
+  ConnectedSockets sockets;
+  if (!sockets.Create(static_cast<size_t>(state.range(0)))) {
+    state.SkipWithError("Failed to create the sockets");
+    return;
+  }
+
+  int remaining = 0;
+  for (size_t i = 0; i < sockets.size(); i++) {
+    size_t next = (i + 1) % sockets.size();
+    task_runner.AddFileDescriptorWatch(
+        sockets.rd(i), [&task_runner, &sockets, &remaining, i, next] {
+          char token;
+          PERFETTO_CHECK(read(sockets.rd(i), &token, 1) == 1);
+          if (--remaining == 0) {
+            task_runner.Quit();
+            return;
+          }
+          PERFETTO_CHECK(write(sockets.wr(next), &token, 1) == 1);
+        });
+  }
+
+  for (auto _ : state) {
+    remaining = kEventsPerIteration;
+    PERFETTO_CHECK(write(sockets.wr(0), "x", 1) == 1);
+    task_runner.Run();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          kEventsPerIteration);
+}
+
+BENCHMARK(BM_UnixTaskRunner_FdEvents)->Apply(BenchmarkArgs);
+
+// Runs a chain of posted tasks while the sockets are idle. Measures the cost
+// that each Run() loop iteration pays for the watched fds.
+static void BM_UnixTaskRunner_PostTask(benchmark::State& state) {
+  perfetto::base::UnixTaskRunner task_runner;
+  ConnectedSockets sockets;
+  if (!sockets.Create(static_cast<size_t>(state.range(0)))) {
+    state.SkipWithError("Failed to create the sockets");
+    return;
+  }
+  for (size_t i = 0; i < sockets.size(); i++)
+    task_runner.AddFileDescriptorWatch(sockets.rd(i), [] {});
+
+  int remaining = 0;
+  std::function<void()> task;
+  task = [&task_runner, &remaining, &task] {
+    if (--remaining == 0) {
+      task_runner.Quit();
+      return;
+    }
+    task_runner.PostTask(task);
+  };
+
+  for (auto _ : state) {
+    remaining = kEventsPerIteration;
+    task_runner.PostTask(task);
+    task_runner.Run();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          kEventsPerIteration);
+}
+
+BENCHMARK(BM_UnixTaskRunner_PostTask)->Apply(BenchmarkArgs);
+
+// Posts tasks from N other threads, as the tracing muxer does from the app
+// threads. Measures the contention between producers and the wake-up cost.
+static void BM_UnixTaskRunner_PostTaskFromThreads(benchmark::State& state) {
+  perfetto::base::UnixTaskRunner task_runner;
+  const int num_threads = static_cast<int>(state.range(0));
+  const int tasks_per_thread = kEventsPerIteration / num_threads;
+
+  int remaining = 0;
+  std::atomic<int> iteration{0};
+  std::atomic<bool> quit{false};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&] {
+      for (int last_iteration = 0;;) {
+        int cur_iteration;
+        while ((cur_iteration = iteration.load()) == last_iteration) {
+          if (quit.load())
+            return;
+          std::this_thread::yield();
+        }
+        last_iteration = cur_iteration;
+        for (int i = 0; i < tasks_per_thread; i++) {
+          task_runner.PostTask([&task_runner, &remaining] {
+            if (--remaining == 0)
+              task_runner.Quit();
+          });
+        }
+      }
+    });
+  }
+
+  for (auto _ : state) {
+    remaining = tasks_per_thread * num_threads;
+    iteration++;
+    task_runner.Run();
+  }
+  quit = true;
+  for (auto& thread : threads)
+    thread.join();
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          tasks_per_thread * num_threads);
+}
+
+BENCHMARK(BM_UnixTaskRunner_PostTaskFromThreads)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->UseRealTime();
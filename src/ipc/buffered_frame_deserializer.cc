@@ -23,6 +23,8 @@
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/utils.h"
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/proto_utils.h"
 
 #include "protos/perfetto/ipc/wire_protocol.gen.h"
 
@@ -33,6 +35,110 @@ namespace {
 
 // The header is just the number of bytes of the Frame protobuf message.
 constexpr size_t kHeaderSize = sizeof(uint32_t);
+
+using protozero::proto_utils::ProtoWireType;
+
+// Decodes an InvokeMethod or InvokeMethodReply frame into |frame|, without
+// copying its args_proto / reply_proto: |payload| is pointed to it instead, and
+// |has_payload| is set if the frame has one. Returns false if the frame is of
+// any other type or has fields not handled here, in which case it must be
+// decoded with ParseFromArray() instead.
+bool DecodeInvokeFrame(const char* data,
+                       size_t size,
+                       Frame* frame,
+                       base::StringView* payload,
+                       bool* has_payload) {
+  protozero::ProtoDecoder dec(data, size);
+  bool has_request_id = false;
+  uint64_t request_id = 0;
+  uint32_t msg_field_id = 0;
+  const uint8_t* msg_data = nullptr;
+  size_t msg_size = 0;
+  for (auto field = dec.ReadField(); field.valid(); field = dec.ReadField()) {
+    if (field.id() == Frame::kRequestIdFieldNumber &&
+        field.type() == ProtoWireType::kVarInt) {
+      has_request_id = true;
+      request_id = field.as_uint64();
+    } else if ((field.id() == Frame::kMsgInvokeMethodFieldNumber ||
+                field.id() == Frame::kMsgInvokeMethodReplyFieldNumber) &&
+               field.type() == ProtoWireType::kLengthDelimited &&
+               msg_field_id == 0) {
+      msg_field_id = field.id();
+      msg_data = field.data();
+      msg_size = field.size();
+    } else {
+      return false;
+    }
+  }
+  if (dec.bytes_left() != 0 || msg_field_id == 0)
+    return false;
+
+  frame->Clear();
+  if (has_request_id)
+    frame->set_request_id(request_id);
+  *has_payload = false;
+  protozero::ProtoDecoder msg_dec(msg_data, msg_size);
+  if (msg_field_id == Frame::kMsgInvokeMethodFieldNumber) {
+    Frame::InvokeMethod* req = frame->mutable_msg_invoke_method();
+    for (auto field = msg_dec.ReadField(); field.valid();
+         field = msg_dec.ReadField()) {
+      const bool is_varint = field.type() == ProtoWireType::kVarInt;
+      switch (field.id()) {
+        case Frame::InvokeMethod::kServiceIdFieldNumber:
+          if (!is_varint)
+            return false;
+          req->set_service_id(field.as_uint32());
+          break;
+        case Frame::InvokeMethod::kMethodIdFieldNumber:
+          if (!is_varint)
+            return false;
+          req->set_method_id(field.as_uint32());
+          break;
+        case Frame::InvokeMethod::kDropReplyFieldNumber:
+          if (!is_varint)
+            return false;
+          req->set_drop_reply(field.as_bool());
+          break;
+        case Frame::InvokeMethod::kArgsProtoFieldNumber:
+          if (field.type() != ProtoWireType::kLengthDelimited)
+            return false;
+          *payload = base::StringView(field.as_string());
+          *has_payload = true;
+          break;
+        default:
+          return false;
+      }
+    }
+  } else {
+    Frame::InvokeMethodReply* reply = frame->mutable_msg_invoke_method_reply();
+    for (auto field = msg_dec.ReadField(); field.valid();
+         field = msg_dec.ReadField()) {
+      const bool is_varint = field.type() == ProtoWireType::kVarInt;
+      switch (field.id()) {
+        case Frame::InvokeMethodReply::kSuccessFieldNumber:
+          if (!is_varint)
+            return false;
+          reply->set_success(field.as_bool());
+          break;
+        case Frame::InvokeMethodReply::kHasMoreFieldNumber:
+          if (!is_varint)
+            return false;
+          reply->set_has_more(field.as_bool());
+          break;
+        case Frame::InvokeMethodReply::kReplyProtoFieldNumber:
+          if (field.type() != ProtoWireType::kLengthDelimited)
+            return false;
+          *payload = base::StringView(field.as_string());
+          *has_payload = true;
+          break;
+        default:
+          return false;
+      }
+    }
+  }
+  return msg_dec.bytes_left() == 0;
+}
+
 }  // namespace
 
 BufferedFrameDeserializer::BufferedFrameDeserializer(size_t max_capacity)
@@ -59,12 +165,20 @@ BufferedFrameDeserializer::BeginReceive() {
     buf_.AdviseDontNeed(buf() + page_size, capacity_ - page_size);
   }
 
+  // The payloads of the frames that haven't been popped yet can point into the
+  // consumed part of the buffer, which is about to be overwritten. Normally all
+  // of them are popped before the next receive, otherwise copy them out.
+  if (consumed_size_ > 0) {
+    for (DecodedFrame& decoded : decoded_frames_)
+      CopyPayloadIntoFrame(&decoded);
+    ShiftOutConsumedFrames();
+  }
+
   PERFETTO_CHECK(capacity_ > size_);
   return ReceiveBuffer{buf() + size_, capacity_ - size_};
 }
 
 bool BufferedFrameDeserializer::EndReceive(size_t recv_size) {
-  const auto page_size = base::GetSysPageSize();
   PERFETTO_CHECK(recv_size + size_ <= capacity_);
   size_ += recv_size;
 
@@ -84,11 +198,11 @@ bool BufferedFrameDeserializer::EndReceive(size_t recv_size) {
   //
   // C Is the more likely case and the one we are optimizing for. A, B, D can
   // happen because of the streaming nature of the socket.
-  // The invariant of this function is that, when it returns, buf_ is either
-  // empty (we drained all the complete frames) or starts with the header of the
-  // next, still incomplete, frame.
+  // The invariant of this function is that, when it returns, the part of buf_
+  // after |consumed_size_| is either empty (we drained all the complete frames)
+  // or starts with the header of the next, still incomplete, frame.
 
-  size_t consumed_size = 0;
+  size_t consumed_size = consumed_size_;
   for (;;) {
     if (size_ < consumed_size + kHeaderSize)
       break;  // Case A, not enough data to read even the header.
@@ -123,52 +237,109 @@ bool BufferedFrameDeserializer::EndReceive(size_t recv_size) {
   }
 
   PERFETTO_DCHECK(consumed_size <= size_);
-  if (consumed_size > 0) {
-    // Shift out the consumed data from the buffer. In the typical case (C)
-    // there is nothing to shift really, just setting size_ = 0 is enough.
-    // Shifting is only for the (unlikely) case D.
-    size_ -= consumed_size;
-    if (size_ > 0) {
-      // Case D. We consumed some frames but there is a leftover at the end of
-      // the buffer. Shift out the consumed bytes, so that on the next round
-      // |buf_| starts with the header of the next unconsumed frame.
-      const char* move_begin = buf() + consumed_size;
-      PERFETTO_CHECK(move_begin > buf());
-      PERFETTO_CHECK(move_begin + size_ <= buf() + capacity_);
-      memmove(buf(), move_begin, size_);
-    }
-    // If we just finished decoding a large frame that used more than one page,
-    // release the extra memory in the buffer. Large frames should be quite
-    // rare.
-    if (consumed_size > page_size) {
-      size_t size_rounded_up = (size_ / page_size + 1) * page_size;
-      if (size_rounded_up < capacity_) {
-        char* madvise_begin = buf() + size_rounded_up;
-        const size_t madvise_size = capacity_ - size_rounded_up;
-        PERFETTO_CHECK(madvise_begin > buf() + size_);
-        PERFETTO_CHECK(madvise_begin + madvise_size <= buf() + capacity_);
-        buf_.AdviseDontNeed(madvise_begin, madvise_size);
-      }
+  consumed_size_ = consumed_size;
+  // At this point |consumed_size_| == |size_| for case C, < |size_| for cases
+  // A, B, D.
+  return true;
+}
+
+void BufferedFrameDeserializer::ShiftOutConsumedFrames() {
+  const auto page_size = base::GetSysPageSize();
+  const size_t consumed_size = consumed_size_;
+  PERFETTO_DCHECK(consumed_size > 0 && consumed_size <= size_);
+  consumed_size_ = 0;
+
+  // Shift out the consumed data from the buffer. In the typical case (C)
+  // there is nothing to shift really, just setting size_ = 0 is enough.
+  // Shifting is only for the (unlikely) case D.
+  size_ -= consumed_size;
+  if (size_ > 0) {
+    // Case D. We consumed some frames but there is a leftover at the end of
+    // the buffer. Shift out the consumed bytes, so that on the next round
+    // |buf_| starts with the header of the next unconsumed frame.
+    const char* move_begin = buf() + consumed_size;
+    PERFETTO_CHECK(move_begin > buf());
+    PERFETTO_CHECK(move_begin + size_ <= buf() + capacity_);
+    memmove(buf(), move_begin, size_);
+  }
+  // If we just finished decoding a large frame that used more than one page,
+  // release the extra memory in the buffer. Large frames should be quite
+  // rare.
+  if (consumed_size > page_size) {
+    size_t size_rounded_up = (size_ / page_size + 1) * page_size;
+    if (size_rounded_up < capacity_) {
+      char* madvise_begin = buf() + size_rounded_up;
+      const size_t madvise_size = capacity_ - size_rounded_up;
+      PERFETTO_CHECK(madvise_begin > buf() + size_);
+      PERFETTO_CHECK(madvise_begin + madvise_size <= buf() + capacity_);
+      buf_.AdviseDontNeed(madvise_begin, madvise_size);
     }
   }
-  // At this point |size_| == 0 for case C, > 0 for cases A, B, D.
-  return true;
 }
 
 std::unique_ptr<Frame> BufferedFrameDeserializer::PopNextFrame() {
   if (decoded_frames_.empty())
     return nullptr;
-  std::unique_ptr<Frame> frame = std::move(decoded_frames_.front());
+  CopyPayloadIntoFrame(&decoded_frames_.front());
+  base::StringView payload;
+  return PopNextFrame(&payload);
+}
+
+std::unique_ptr<Frame> BufferedFrameDeserializer::PopNextFrame(
+    base::StringView* payload) {
+  if (decoded_frames_.empty())
+    return nullptr;
+  DecodedFrame& decoded = decoded_frames_.front();
+  std::unique_ptr<Frame> frame = std::move(decoded.frame);
+  *payload = decoded.payload;
   decoded_frames_.pop_front();
   return frame;
 }
 
+void BufferedFrameDeserializer::RecycleFrame(std::unique_ptr<Frame> frame) {
+  spare_frame_ = std::move(frame);
+}
+
 void BufferedFrameDeserializer::DecodeFrame(const char* data, size_t size) {
   if (size == 0)
     return;
-  std::unique_ptr<Frame> frame(new Frame);
-  if (frame->ParseFromArray(data, size))
-    decoded_frames_.push_back(std::move(frame));
+  DecodedFrame decoded;
+  decoded.frame = std::move(spare_frame_);
+  if (!decoded.frame)
+    decoded.frame.reset(new Frame);
+  Frame* frame = decoded.frame.get();
+  if (DecodeInvokeFrame(data, size, frame, &decoded.payload,
+                        &decoded.payload_in_buf)) {
+    decoded_frames_.push_back(std::move(decoded));
+    return;
+  }
+  if (!frame->ParseFromArray(data, size))
+    return;
+  if (frame->has_msg_invoke_method()) {
+    decoded.payload = base::StringView(frame->msg_invoke_method().args_proto());
+  } else if (frame->has_msg_invoke_method_reply()) {
+    decoded.payload =
+        base::StringView(frame->msg_invoke_method_reply().reply_proto());
+  }
+  decoded_frames_.push_back(std::move(decoded));
+}
+
+// static
+void BufferedFrameDeserializer::CopyPayloadIntoFrame(DecodedFrame* decoded) {
+  if (!decoded->payload_in_buf)
+    return;
+  decoded->payload_in_buf = false;
+  const base::StringView& payload = decoded->payload;
+  Frame* frame = decoded->frame.get();
+  if (frame->has_msg_invoke_method()) {
+    Frame::InvokeMethod* req = frame->mutable_msg_invoke_method();
+    req->set_args_proto(payload.data(), payload.size());
+    decoded->payload = base::StringView(req->args_proto());
+  } else {
+    Frame::InvokeMethodReply* reply = frame->mutable_msg_invoke_method_reply();
+    reply->set_reply_proto(payload.data(), payload.size());
+    decoded->payload = base::StringView(reply->reply_proto());
+  }
 }
 
 // static
@@ -182,5 +353,55 @@ std::string BufferedFrameDeserializer::Serialize(const Frame& frame) {
   return buf;
 }
 
+// static
+std::string BufferedFrameDeserializer::SerializeWithoutPayload(
+    const Frame& frame,
+    size_t payload_size) {
+  using protozero::proto_utils::MakeTagLengthDelimited;
+  using protozero::proto_utils::WriteVarInt;
+
+  uint32_t msg_field_id;
+  uint32_t payload_field_id;
+  std::string msg;
+  if (frame.has_msg_invoke_method()) {
+    PERFETTO_DCHECK(!frame.msg_invoke_method().has_args_proto());
+    msg_field_id = Frame::kMsgInvokeMethodFieldNumber;
+    payload_field_id = Frame::InvokeMethod::kArgsProtoFieldNumber;
+    msg = frame.msg_invoke_method().SerializeAsString();
+  } else {
+    PERFETTO_CHECK(frame.has_msg_invoke_method_reply());
+    PERFETTO_DCHECK(!frame.msg_invoke_method_reply().has_reply_proto());
+    msg_field_id = Frame::kMsgInvokeMethodReplyFieldNumber;
+    payload_field_id = Frame::InvokeMethodReply::kReplyProtoFieldNumber;
+    msg = frame.msg_invoke_method_reply().SerializeAsString();
+  }
+
+  // The payload is the last field of the nested message, which in turn is the
+  // last field of the frame. Only their preambles need to account for it.
+  uint8_t preamble[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+  uint8_t* end =
+      WriteVarInt(MakeTagLengthDelimited(payload_field_id), preamble);
+  end = WriteVarInt(payload_size, end);
+  msg.append(reinterpret_cast<const char*>(preamble),
+             static_cast<size_t>(end - preamble));
+
+  std::string buf(kHeaderSize, '\0');
+  if (frame.has_request_id()) {
+    Frame request_id_only;
+    request_id_only.set_request_id(frame.request_id());
+    buf.append(request_id_only.SerializeAsString());
+  }
+  end = WriteVarInt(MakeTagLengthDelimited(msg_field_id), preamble);
+  end = WriteVarInt(msg.size() + payload_size, end);
+  buf.append(reinterpret_cast<const char*>(preamble),
+             static_cast<size_t>(end - preamble));
+  buf.append(msg);
+
+  const uint32_t frame_size =
+      static_cast<uint32_t>(buf.size() - kHeaderSize + payload_size);
+  memcpy(&buf[0], base::AssumeLittleEndian(&frame_size), kHeaderSize);
+  return buf;
+}
+
 }  // namespace ipc
 }  // namespace perfetto
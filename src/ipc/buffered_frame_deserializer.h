@@ -23,6 +23,7 @@
 #include <memory>
 
 #include "perfetto/ext/base/paged_memory.h"
+#include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/ipc/basic_types.h"
 
@@ -65,8 +66,9 @@ using Frame = ::perfetto::protos::gen::IPCFrame;
 // auto buf = rpc_frame_decoder.BeginReceive();
 // size_t rsize = socket.recv(buf.first, buf.second);
 // rpc_frame_decoder.EndReceive(rsize);
-// while (Frame frame = rpc_frame_decoder.PopNextFrame()) {
-//   ... process |frame|
+// base::StringView payload;
+// while (Frame frame = rpc_frame_decoder.PopNextFrame(&payload)) {
+//   ... process |frame| and its |payload|
 // }
 //
 // Design goals:
@@ -80,6 +82,9 @@ using Frame = ::perfetto::protos::gen::IPCFrame;
 //   that a malicious sends an abnormally large frame and OOMs us.
 // - Simplicity: just use a linear mmap region. No reallocations or scattering.
 //   Takes care of madvise()-ing unused memory.
+// - Don't copy the method arguments / replies, which make up the bulk of the
+//   traffic, out of the buffer. They are handed out as views into the buffer,
+//   so the consumed frames are shifted out only on the next BeginReceive().
 
 class BufferedFrameDeserializer {
  public:
@@ -97,8 +102,17 @@ class BufferedFrameDeserializer {
   // in common that doesn't justify having its own class.
   static std::string Serialize(const Frame&);
 
+  // Like Serialize(), for an InvokeMethod or InvokeMethodReply frame whose
+  // args_proto / reply_proto is not set in |frame| but sent separately. Returns
+  // the bytes that, followed by the |payload_size| bytes of the payload, form
+  // the serialized frame. This allows to send a large payload with
+  // UnixSocket::SendScattered() without copying it into the frame.
+  // |frame| must not have any other field than the request_id and the
+  // InvokeMethod / InvokeMethodReply.
+  static std::string SerializeWithoutPayload(const Frame&, size_t payload_size);
+
   // Returns a buffer that can be passed to recv(). The buffer is deliberately
-  // not initialized.
+  // not initialized. Invalidates the payloads returned by PopNextFrame().
   ReceiveBuffer BeginReceive();
 
   // Must be called soon after BeginReceive().
@@ -112,10 +126,33 @@ class BufferedFrameDeserializer {
   // if no further frames have been decoded.
   std::unique_ptr<Frame> PopNextFrame();
 
+  // Like PopNextFrame(), but doesn't copy the args_proto / reply_proto of
+  // InvokeMethod / InvokeMethodReply frames into the returned frame. |payload|
+  // is set to it instead (or to an empty view for other frames). It can point
+  // into the receive buffer, so it is valid only until the next BeginReceive()
+  // and as long as the returned frame is not recycled.
+  std::unique_ptr<Frame> PopNextFrame(base::StringView* payload);
+
+  // Gives back a frame returned by PopNextFrame(), once the caller is done
+  // with it. Its memory is reused to decode the next frame.
+  void RecycleFrame(std::unique_ptr<Frame>);
+
   size_t capacity() const { return capacity_; }
-  size_t size() const { return size_; }
+
+  // The number of received bytes that haven't been decoded into frames yet.
+  size_t size() const { return size_ - consumed_size_; }
 
  private:
+  struct DecodedFrame {
+    std::unique_ptr<Frame> frame;
+
+    // The args_proto / reply_proto of |frame|, for InvokeMethod(Reply) frames.
+    base::StringView payload;
+
+    // True if |payload| points into |buf_| rather than into |frame|.
+    bool payload_in_buf = false;
+  };
+
   BufferedFrameDeserializer(const BufferedFrameDeserializer&) = delete;
   BufferedFrameDeserializer& operator=(const BufferedFrameDeserializer&) =
       delete;
@@ -123,6 +160,12 @@ class BufferedFrameDeserializer {
   // If a valid frame is decoded it is added to |decoded_frames_|.
   void DecodeFrame(const char*, size_t);
 
+  // Copies the payload of |decoded| into its frame, if it's in |buf_|.
+  static void CopyPayloadIntoFrame(DecodedFrame* decoded);
+
+  // Shifts the frames consumed by EndReceive() out of |buf_|.
+  void ShiftOutConsumedFrames();
+
   char* buf() { return reinterpret_cast<char*>(buf_.Get()); }
 
   base::PagedMemory buf_;
@@ -132,7 +175,15 @@ class BufferedFrameDeserializer {
   // EndReceive()). This is always <= |capacity_|.
   size_t size_ = 0;
 
-  std::list<std::unique_ptr<Frame>> decoded_frames_;
+  // The number of bytes at the start of |buf_| taken by frames that have been
+  // decoded already, whose payloads can still be referenced. They are shifted
+  // out on the next BeginReceive(). This is always <= |size_|.
+  size_t consumed_size_ = 0;
+
+  std::list<DecodedFrame> decoded_frames_;
+
+  // The last frame passed to RecycleFrame(), if any.
+  std::unique_ptr<Frame> spare_frame_;
 };
 
 }  // namespace ipc
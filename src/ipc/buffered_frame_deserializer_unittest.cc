@@ -377,6 +377,135 @@ TEST(BufferedFrameDeserializerTest, FillCapacity) {
   }
 }
 
+// Checks that a recycled frame is used to decode the next one, and that nothing
+// of its previous contents is left over.
+TEST(BufferedFrameDeserializerTest, RecycleFrame) {
+  BufferedFrameDeserializer bfd;
+  Frame frame;
+  frame.set_request_id(42);
+  frame.mutable_msg_bind_service_reply()->add_methods()->set_name("foo");
+  std::string payload = frame.SerializeAsString();
+  uint32_t payload_size = static_cast<uint32_t>(payload.size());
+  BufferedFrameDeserializer::ReceiveBuffer rbuf = bfd.BeginReceive();
+  memcpy(rbuf.data, base::AssumeLittleEndian(&payload_size), kHeaderSize);
+  memcpy(rbuf.data + kHeaderSize, payload.data(), payload.size());
+  ASSERT_TRUE(bfd.EndReceive(kHeaderSize + payload.size()));
+  std::unique_ptr<Frame> decoded_frame = bfd.PopNextFrame();
+  ASSERT_TRUE(decoded_frame);
+  EXPECT_EQ(decoded_frame->request_id(), 42u);
+  Frame* recycled_frame = decoded_frame.get();
+  bfd.RecycleFrame(std::move(decoded_frame));
+
+  std::vector<char> simple_frame = GetSimpleFrame(100);
+  rbuf = bfd.BeginReceive();
+  CheckedMemcpy(rbuf, simple_frame);
+  ASSERT_TRUE(bfd.EndReceive(simple_frame.size()));
+  decoded_frame = bfd.PopNextFrame();
+  ASSERT_EQ(decoded_frame.get(), recycled_frame);
+  EXPECT_FALSE(decoded_frame->has_request_id());
+  EXPECT_FALSE(decoded_frame->has_msg_bind_service_reply());
+  EXPECT_TRUE(FrameEq(simple_frame, *decoded_frame));
+}
+
+// Checks that a frame serialized without its payload, followed by the payload,
+// decodes as the frame with the payload.
+TEST(BufferedFrameDeserializerTest, SerializeWithoutPayload) {
+  const std::string payload(1000, 'x');
+  Frame frame;
+  frame.set_request_id(42);
+  frame.mutable_msg_invoke_method_reply()->set_success(true);
+  frame.mutable_msg_invoke_method_reply()->set_has_more(true);
+  std::string serialized =
+      BufferedFrameDeserializer::SerializeWithoutPayload(frame, payload.size());
+  serialized.append(payload);
+
+  uint32_t frame_size = 0;
+  memcpy(base::AssumeLittleEndian(&frame_size), serialized.data(), kHeaderSize);
+  ASSERT_EQ(frame_size, serialized.size() - kHeaderSize);
+  Frame decoded_frame;
+  ASSERT_TRUE(decoded_frame.ParseFromArray(serialized.data() + kHeaderSize,
+                                           frame_size));
+  frame.mutable_msg_invoke_method_reply()->set_reply_proto(payload);
+  EXPECT_EQ(decoded_frame.SerializeAsString(), frame.SerializeAsString());
+}
+
+// Checks that the payloads of InvokeMethod frames are returned in place and
+// round-trip through SerializeWithoutPayload().
+TEST(BufferedFrameDeserializerTest, PayloadInPlace) {
+  BufferedFrameDeserializer bfd;
+  std::string encoded;
+  for (uint32_t i = 1; i <= 3; i++) {
+    Frame frame;
+    frame.set_request_id(i);
+    auto* req = frame.mutable_msg_invoke_method();
+    req->set_service_id(10 + i);
+    req->set_method_id(20 + i);
+    req->set_drop_reply(i == 2);
+    std::string payload(i * 100, static_cast<char>('a' + i));
+    encoded.append(
+        BufferedFrameDeserializer::SerializeWithoutPayload(frame, i * 100));
+    encoded.append(payload);
+  }
+  BufferedFrameDeserializer::ReceiveBuffer rbuf = bfd.BeginReceive();
+  ASSERT_GE(rbuf.size, encoded.size());
+  memcpy(rbuf.data, encoded.data(), encoded.size());
+  ASSERT_TRUE(bfd.EndReceive(encoded.size()));
+
+  for (uint32_t i = 1; i <= 3; i++) {
+    base::StringView payload;
+    std::unique_ptr<Frame> frame = bfd.PopNextFrame(&payload);
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(frame->request_id(), i);
+    ASSERT_TRUE(frame->has_msg_invoke_method());
+    EXPECT_EQ(frame->msg_invoke_method().service_id(), 10 + i);
+    EXPECT_EQ(frame->msg_invoke_method().method_id(), 20 + i);
+    EXPECT_EQ(frame->msg_invoke_method().drop_reply(), i == 2);
+    EXPECT_FALSE(frame->msg_invoke_method().has_args_proto());
+    EXPECT_EQ(payload.ToStdString(),
+              std::string(i * 100, static_cast<char>('a' + i)));
+    EXPECT_GE(payload.data(), rbuf.data);
+    EXPECT_LT(payload.data(), rbuf.data + encoded.size());
+  }
+  EXPECT_FALSE(bfd.PopNextFrame());
+  EXPECT_EQ(0u, bfd.size());
+}
+
+// Checks that the payloads of frames still to be popped survive the next
+// receive, and that frames with unexpected fields are still decoded.
+TEST(BufferedFrameDeserializerTest, PayloadCopiedOnNextReceive) {
+  BufferedFrameDeserializer bfd;
+  Frame frame;
+  frame.set_request_id(1);
+  frame.mutable_msg_invoke_method_reply()->set_success(true);
+  frame.mutable_msg_invoke_method_reply()->set_reply_proto("reply1");
+  std::string encoded = BufferedFrameDeserializer::Serialize(frame);
+  frame.set_request_id(2);
+  frame.mutable_msg_invoke_method_reply()->set_reply_proto("reply2");
+  frame.add_data_for_testing("unexpected");
+  encoded.append(BufferedFrameDeserializer::Serialize(frame));
+
+  BufferedFrameDeserializer::ReceiveBuffer rbuf = bfd.BeginReceive();
+  memcpy(rbuf.data, encoded.data(), encoded.size());
+  ASSERT_TRUE(bfd.EndReceive(encoded.size()));
+  rbuf = bfd.BeginReceive();
+  memset(rbuf.data, 0, encoded.size());
+  ASSERT_TRUE(bfd.EndReceive(0));
+
+  base::StringView payload;
+  std::unique_ptr<Frame> decoded_frame = bfd.PopNextFrame(&payload);
+  ASSERT_TRUE(decoded_frame);
+  EXPECT_EQ(decoded_frame->request_id(), 1u);
+  EXPECT_TRUE(decoded_frame->msg_invoke_method_reply().success());
+  EXPECT_EQ(payload.ToStdString(), "reply1");
+
+  decoded_frame = bfd.PopNextFrame();
+  ASSERT_TRUE(decoded_frame);
+  EXPECT_EQ(decoded_frame->request_id(), 2u);
+  EXPECT_EQ(decoded_frame->msg_invoke_method_reply().reply_proto(), "reply2");
+  EXPECT_EQ(decoded_frame->data_for_testing_size(), 1);
+  EXPECT_FALSE(bfd.PopNextFrame());
+}
+
 }  // namespace
 }  // namespace ipc
 }  // namespace perfetto
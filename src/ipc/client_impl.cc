@@ -122,8 +122,8 @@ RequestID ClientImpl::BeginInvoke(ServiceID service_id,
   req->set_service_id(service_id);
   req->set_method_id(remote_method_id);
   req->set_drop_reply(drop_reply);
-  req->set_args_proto(method_args.SerializeAsString());
-  if (!SendFrame(frame, fd)) {
+  std::string args_proto = method_args.SerializeAsString();
+  if (!SendFrame(frame, fd, &args_proto)) {
     PERFETTO_DLOG("BeginInvoke() failed while sending the frame");
     return 0;
   }
@@ -138,15 +138,28 @@ RequestID ClientImpl::BeginInvoke(ServiceID service_id,
   return request_id;
 }
 
-bool ClientImpl::SendFrame(const Frame& frame, int fd) {
+bool ClientImpl::SendFrame(const Frame& frame,
+                           int fd,
+                           const std::string* payload) {
   // Serialize the frame into protobuf, add the size header, and send it.
-  std::string buf = BufferedFrameDeserializer::Serialize(frame);
+  std::string buf;
+  base::SendBuffer bufs[2];
+  size_t num_bufs = 1;
+  if (payload) {
+    buf = BufferedFrameDeserializer::SerializeWithoutPayload(frame,
+                                                             payload->size());
+    bufs[num_bufs++] = {payload->data(), payload->size()};
+  } else {
+    buf = BufferedFrameDeserializer::Serialize(frame);
+  }
+  bufs[0] = {buf.data(), buf.size()};
 
   // TODO(primiano): this should do non-blocking I/O. But then what if the
   // socket buffer is full? We might want to either drop the request or throttle
   // the send and PostTask the reply later? Right now we are making Send()
   // blocking as a workaround. Propagate bakpressure to the caller instead.
-  bool res = sock_->Send(buf.data(), buf.size(), fd);
+  bool res = sock_->SendScattered(bufs, num_bufs, fd == -1 ? nullptr : &fd,
+                                  fd == -1 ? 0 : 1);
   PERFETTO_CHECK(res || !sock_->is_connected());
   return res;
 }
@@ -216,13 +229,19 @@ void ClientImpl::OnDataAvailable(base::UnixSocket*) {
       return sock_->Shutdown(true);  // In turn will trigger an OnDisconnect().
       // TODO(fmayer): check this.
     }
-  } while (rsize > 0);
 
-  while (std::unique_ptr<Frame> frame = frame_deserializer_.PopNextFrame())
-    OnFrameReceived(*frame);
+    // Dispatch the frames before the next receive, which invalidates their
+    // payloads (they are not copied out of the receive buffer).
+    base::StringView payload;
+    while (std::unique_ptr<Frame> frame =
+               frame_deserializer_.PopNextFrame(&payload)) {
+      OnFrameReceived(*frame, payload);
+      frame_deserializer_.RecycleFrame(std::move(frame));
+    }
+  } while (rsize > 0);
 }
 
-void ClientImpl::OnFrameReceived(const Frame& frame) {
+void ClientImpl::OnFrameReceived(const Frame& frame, base::StringView payload) {
   auto queued_requests_it = queued_requests_.find(frame.request_id());
   if (queued_requests_it == queued_requests_.end()) {
     PERFETTO_DLOG("OnFrameReceived(): got invalid request_id=%" PRIu64,
@@ -238,7 +257,8 @@ void ClientImpl::OnFrameReceived(const Frame& frame) {
   }
   if (req.type == Frame::kMsgInvokeMethodFieldNumber &&
       frame.has_msg_invoke_method_reply()) {
-    return OnInvokeMethodReply(std::move(req), frame.msg_invoke_method_reply());
+    return OnInvokeMethodReply(std::move(req), frame.msg_invoke_method_reply(),
+                               payload);
   }
   if (frame.has_msg_request_error()) {
     PERFETTO_DLOG("Host error: %s", frame.msg_request_error().error().c_str());
@@ -288,7 +308,8 @@ void ClientImpl::OnBindServiceReply(QueuedRequest req,
 }
 
 void ClientImpl::OnInvokeMethodReply(QueuedRequest req,
-                                     const Frame::InvokeMethodReply& reply) {
+                                     const Frame::InvokeMethodReply& reply,
+                                     base::StringView reply_proto) {
   base::WeakPtr<ServiceProxy> service_proxy = req.service_proxy;
   if (!service_proxy)
     return;
@@ -297,7 +318,8 @@ void ClientImpl::OnInvokeMethodReply(QueuedRequest req,
     // If this becomes a hotspot, optimize by maintaining a dedicated hashtable.
     for (const auto& method : service_proxy->GetDescriptor().methods) {
       if (req.method_name == method.name) {
-        decoded_reply = method.reply_proto_decoder(reply.reply_proto());
+        decoded_reply =
+            method.reply_proto_decoder(reply_proto.data(), reply_proto.size());
         break;
       }
     }
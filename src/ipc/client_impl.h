@@ -23,6 +23,7 @@
 
 #include "perfetto/base/task_runner.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/unix_socket.h"
 #include "perfetto/ext/ipc/client.h"
 #include "src/ipc/buffered_frame_deserializer.h"
@@ -84,12 +85,17 @@ class ClientImpl : public Client, public base::UnixSocket::EventListener {
   ClientImpl& operator=(const ClientImpl&) = delete;
 
   void TryConnect();
-  bool SendFrame(const Frame&, int fd = -1);
-  void OnFrameReceived(const Frame&);
+  // If |payload| is not null, it is sent as the args_proto of |frame| without
+  // copying it into the frame.
+  bool SendFrame(const Frame&,
+                 int fd = -1,
+                 const std::string* payload = nullptr);
+  void OnFrameReceived(const Frame&, base::StringView payload);
   void OnBindServiceReply(QueuedRequest,
                           const protos::gen::IPCFrame_BindServiceReply&);
   void OnInvokeMethodReply(QueuedRequest,
-                           const protos::gen::IPCFrame_InvokeMethodReply&);
+                           const protos::gen::IPCFrame_InvokeMethodReply&,
+                           base::StringView reply_proto);
 
   bool invoking_method_reply_ = false;
   const char* socket_name_ = nullptr;
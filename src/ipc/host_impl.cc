@@ -134,22 +134,27 @@ void HostImpl::OnDataAvailable(base::UnixSocket* sock) {
     }
     if (!frame_deserializer.EndReceive(rsize))
       return OnDisconnect(client->sock.get());
-  } while (rsize > 0);
 
-  for (;;) {
-    std::unique_ptr<Frame> frame = frame_deserializer.PopNextFrame();
-    if (!frame)
-      break;
-    OnReceivedFrame(client, *frame);
-  }
+    // Dispatch the frames before the next receive, which invalidates their
+    // payloads (they are not copied out of the receive buffer).
+    base::StringView payload;
+    for (;;) {
+      std::unique_ptr<Frame> frame = frame_deserializer.PopNextFrame(&payload);
+      if (!frame)
+        break;
+      OnReceivedFrame(client, *frame, payload);
+      frame_deserializer.RecycleFrame(std::move(frame));
+    }
+  } while (rsize > 0);
 }
 
 void HostImpl::OnReceivedFrame(ClientConnection* client,
-                               const Frame& req_frame) {
+                               const Frame& req_frame,
+                               base::StringView payload) {
   if (req_frame.has_msg_bind_service())
     return OnBindService(client, req_frame);
   if (req_frame.has_msg_invoke_method())
-    return OnInvokeMethod(client, req_frame);
+    return OnInvokeMethod(client, req_frame, payload);
 
   PERFETTO_DLOG("Received invalid RPC frame from client %" PRIu64, client->id);
   Frame reply_frame;
@@ -180,7 +185,8 @@ void HostImpl::OnBindService(ClientConnection* client, const Frame& req_frame) {
 }
 
 void HostImpl::OnInvokeMethod(ClientConnection* client,
-                              const Frame& req_frame) {
+                              const Frame& req_frame,
+                              base::StringView args_proto) {
   const Frame::InvokeMethod& req = req_frame.msg_invoke_method();
   Frame reply_frame;
   RequestID request_id = req_frame.request_id();
@@ -198,10 +204,21 @@ void HostImpl::OnInvokeMethod(ClientConnection* client,
     return SendFrame(client, reply_frame);
 
   const ServiceDescriptor::Method& method = methods[method_id - 1];
-  std::unique_ptr<ProtoMessage> decoded_req_args(
-      method.request_proto_decoder(req.args_proto()));
-  if (!decoded_req_args)
-    return SendFrame(client, reply_frame);
+  std::unique_ptr<ProtoMessage>& cached_req_args =
+      svc_it->second.cached_request_args[method_id - 1];
+  std::unique_ptr<ProtoMessage> decoded_req_args;
+  if (cached_req_args) {
+    decoded_req_args = std::move(cached_req_args);
+    if (!decoded_req_args->ParseFromArray(args_proto.data(),
+                                          args_proto.size())) {
+      return SendFrame(client, reply_frame);
+    }
+  } else {
+    decoded_req_args =
+        method.request_proto_decoder(args_proto.data(), args_proto.size());
+    if (!decoded_req_args)
+      return SendFrame(client, reply_frame);
+  }
 
   Deferred<ProtoMessage> deferred_reply;
   base::WeakPtr<HostImpl> host_weak_ptr = weak_ptr_factory_.GetWeakPtr();
@@ -223,6 +240,10 @@ void HostImpl::OnInvokeMethod(ClientConnection* client,
   method.invoker(service, *decoded_req_args, std::move(deferred_reply));
   service->received_fd_ = nullptr;
   service->client_info_ = ClientInfo();
+
+  // Services don't retain the request arguments past the invocation (they only
+  // get a const reference), so they can be reused for the next one.
+  cached_req_args = std::move(decoded_req_args);
 }
 
 void HostImpl::ReplyToMethodInvocation(ClientID client_id,
@@ -242,23 +263,39 @@ void HostImpl::ReplyToMethodInvocation(ClientID client_id,
   auto* reply_frame_data = reply_frame.mutable_msg_invoke_method_reply();
   reply_frame_data->set_has_more(reply.has_more());
   if (reply.success()) {
-    std::string reply_proto = reply->SerializeAsString();
-    reply_frame_data->set_reply_proto(reply_proto);
     reply_frame_data->set_success(true);
+    // Replies can be large (e.g., ReadBuffers()), send them straight from
+    // |reply_proto| rather than copying them into the frame.
+    std::string reply_proto = reply->SerializeAsString();
+    return SendFrame(client, reply_frame, reply.fd(), &reply_proto);
   }
   SendFrame(client, reply_frame, reply.fd());
 }
 
 // static
-void HostImpl::SendFrame(ClientConnection* client, const Frame& frame, int fd) {
-  std::string buf = BufferedFrameDeserializer::Serialize(frame);
+void HostImpl::SendFrame(ClientConnection* client,
+                         const Frame& frame,
+                         int fd,
+                         const std::string* payload) {
+  std::string buf;
+  base::SendBuffer bufs[2];
+  size_t num_bufs = 1;
+  if (payload) {
+    buf = BufferedFrameDeserializer::SerializeWithoutPayload(frame,
+                                                             payload->size());
+    bufs[num_bufs++] = {payload->data(), payload->size()};
+  } else {
+    buf = BufferedFrameDeserializer::Serialize(frame);
+  }
+  bufs[0] = {buf.data(), buf.size()};
 
   // When a new Client connects in OnNewClientConnection we set a timeout on
   // Send (see call to SetTxTimeout).
   //
   // The old behaviour was to do a blocking I/O call, which caused crashes from
   // misbehaving producers (see b/169051440).
-  bool res = client->sock->Send(buf.data(), buf.size(), fd);
+  bool res = client->sock->SendScattered(
+      bufs, num_bufs, fd == -1 ? nullptr : &fd, fd == -1 ? 0 : 1);
   // If we timeout |res| will be false, but the UnixSocket will have called
   // UnixSocket::ShutDown() and thus |is_connected()| is false.
   PERFETTO_CHECK(res || !client->sock->is_connected());
@@ -299,7 +336,10 @@ const HostImpl::ExposedService* HostImpl::GetServiceByName(
 HostImpl::ExposedService::ExposedService(ServiceID id_,
                                          const std::string& name_,
                                          std::unique_ptr<Service> instance_)
-    : id(id_), name(name_), instance(std::move(instance_)) {}
+    : id(id_),
+      name(name_),
+      instance(std::move(instance_)),
+      cached_request_args(instance->GetDescriptor().methods.size()) {}
 
 HostImpl::ExposedService::ExposedService(ExposedService&&) noexcept = default;
 HostImpl::ExposedService& HostImpl::ExposedService::operator=(
@@ -23,6 +23,7 @@
 #include <vector>
 
 #include "perfetto/base/task_runner.h"
+#include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/thread_checker.h"
 #include "perfetto/ext/base/unix_socket.h"
 #include "perfetto/ext/ipc/deferred.h"
@@ -67,19 +68,33 @@ class HostImpl : public Host, public base::UnixSocket::EventListener {
     ServiceID id;
     std::string name;
     std::unique_ptr<Service> instance;
+
+    // The request arguments decoded for the last invocation of each method,
+    // indexed by method id - 1. They are decoded into again by the next
+    // invocation, reusing their memory.
+    std::vector<std::unique_ptr<ProtoMessage>> cached_request_args;
   };
 
   HostImpl(const HostImpl&) = delete;
   HostImpl& operator=(const HostImpl&) = delete;
 
   bool Initialize(const char* socket_name);
-  void OnReceivedFrame(ClientConnection*, const Frame&);
+  void OnReceivedFrame(ClientConnection*,
+                       const Frame&,
+                       base::StringView payload);
   void OnBindService(ClientConnection*, const Frame&);
-  void OnInvokeMethod(ClientConnection*, const Frame&);
+  void OnInvokeMethod(ClientConnection*,
+                      const Frame&,
+                      base::StringView args_proto);
   void ReplyToMethodInvocation(ClientID, RequestID, AsyncResult<ProtoMessage>);
   const ExposedService* GetServiceByName(const std::string&);
 
-  static void SendFrame(ClientConnection*, const Frame&, int fd = -1);
+  // If |payload| is not null, it is sent as the args_proto / reply_proto of
+  // |frame| without copying it into the frame.
+  static void SendFrame(ClientConnection*,
+                        const Frame&,
+                        int fd = -1,
+                        const std::string* payload = nullptr);
 
   base::TaskRunner* const task_runner_;
   std::map<ServiceID, ExposedService> services_;
@@ -40,6 +40,7 @@ namespace {
 using ::perfetto::ipc::gen::ReplyProto;
 using ::perfetto::ipc::gen::RequestProto;
 using ::testing::_;
+using ::testing::InSequence;
 using ::testing::Invoke;
 using ::testing::InvokeWithoutArgs;
 using ::testing::Return;
@@ -59,10 +60,10 @@ class FakeService : public Service {
         static_cast<const RequestProto&>(req), &deferred_reply);
   }
 
-  static std::unique_ptr<ProtoMessage> RequestDecoder(
-      const std::string& proto) {
+  static std::unique_ptr<ProtoMessage> RequestDecoder(const void* data,
+                                                      size_t size) {
     std::unique_ptr<ProtoMessage> reply(new RequestProto());
-    EXPECT_TRUE(reply->ParseFromString(proto));
+    EXPECT_TRUE(reply->ParseFromArray(data, size));
     return reply;
   }
 
@@ -278,6 +279,46 @@ TEST_F(HostImplTest, InvokeMethod) {
   task_runner_->RunUntilCheckpoint("on_reply_received");
 }
 
+// The request args are decoded into an object cached per method. Checks that
+// the fields set by an invocation don't leak into the next one.
+TEST_F(HostImplTest, CachedRequestArgsAreResetBetweenInvocations) {
+  FakeService* fake_service = new FakeService("FakeService");
+  ASSERT_TRUE(host_->ExposeService(std::unique_ptr<Service>(fake_service)));
+  auto on_bind = task_runner_->CreateCheckpoint("on_bind");
+  cli_->BindService("FakeService");
+  EXPECT_CALL(*cli_, OnServiceBound(_)).WillOnce(InvokeWithoutArgs(on_bind));
+  task_runner_->RunUntilCheckpoint("on_bind");
+
+  auto on_second_call = task_runner_->CreateCheckpoint("on_second_call");
+  const RequestProto* first_req = nullptr;
+  {
+    InSequence seq;
+    EXPECT_CALL(*fake_service, OnFakeMethod1(_, _))
+        .WillOnce(Invoke([&first_req](const RequestProto& req, DeferredBase*) {
+          EXPECT_TRUE(req.has_data());
+          EXPECT_EQ("foo", req.data());
+          first_req = &req;
+        }));
+    EXPECT_CALL(*fake_service, OnFakeMethod1(_, _))
+        .WillOnce(Invoke([&first_req, on_second_call](const RequestProto& req,
+                                                       DeferredBase*) {
+          // The same object is reused, but its fields are cleared.
+          EXPECT_EQ(first_req, &req);
+          EXPECT_FALSE(req.has_data());
+          EXPECT_EQ("", req.data());
+          on_second_call();
+        }));
+  }
+
+  RequestProto req_args;
+  req_args.set_data("foo");
+  cli_->InvokeMethod(cli_->last_bound_service_id_, 1, req_args,
+                     true /*drop_reply*/);
+  cli_->InvokeMethod(cli_->last_bound_service_id_, 1, RequestProto(),
+                     true /*drop_reply*/);
+  task_runner_->RunUntilCheckpoint("on_second_call");
+}
+
 TEST_F(HostImplTest, InvokeMethodDropReply) {
   FakeService* fake_service = new FakeService("FakeService");
   ASSERT_TRUE(host_->ExposeService(std::unique_ptr<Service>(fake_service)));
@@ -150,9 +150,11 @@ LazyKernelSymbolizer::LazyKernelSymbolizer() = default;
 LazyKernelSymbolizer::~LazyKernelSymbolizer() = default;
 
 KernelSymbolMap* LazyKernelSymbolizer::GetOrCreateKernelSymbolMap() {
-  PERFETTO_DCHECK_THREAD(thread_checker_);
+  // Returning an existing map is fine from any thread (FtraceController's
+  // reader workers do so). Creating and destroying it isn't.
   if (symbol_map_)
     return symbol_map_.get();
+  PERFETTO_DCHECK_THREAD(thread_checker_);
 
   symbol_map_.reset(new KernelSymbolMap());
 
@@ -44,6 +44,7 @@ class LazyKernelSymbolizer {
   ~LazyKernelSymbolizer();
 
   // Returns |instance_|, creating it if doesn't exist or was destroyed.
+  // Can be called from other threads only if the map already exists.
   KernelSymbolMap* GetOrCreateKernelSymbolMap();
 
   bool is_valid() const { return !!symbol_map_; }
@@ -25,12 +25,19 @@
 namespace perfetto {
 namespace profiling {
 
+GlobalCallstackTrie::GlobalCallstackTrie(uint32_t first_id, uint32_t id_stride)
+    : string_interner_(first_id, id_stride),
+      mapping_interner_(first_id, id_stride),
+      frame_interner_(first_id, id_stride),
+      id_stride_(id_stride),
+      next_callstack_id_(first_id) {}
+
 GlobalCallstackTrie::Node* GlobalCallstackTrie::GetOrCreateChild(
     Node* self,
     const Interned<Frame>& loc) {
   Node* child = self->GetChild(loc);
   if (!child)
-    child = self->AddChild(loc, ++next_callstack_id_, self);
+    child = self->AddChild(loc, NextCallstackId(), self);
   return child;
 }
 
@@ -145,6 +145,11 @@ class GlobalCallstackTrie {
   };
 
   GlobalCallstackTrie() = default;
+  // Hands out callstack and interning IDs of the form
+  // |first_id| + k * |id_stride|. Tries constructed with the same stride and
+  // distinct |first_id| in [1, id_stride] never produce overlapping IDs, which
+  // lets them emit onto the same interning sequence.
+  GlobalCallstackTrie(uint32_t first_id, uint32_t id_stride);
   ~GlobalCallstackTrie() = default;
   GlobalCallstackTrie(const GlobalCallstackTrie&) = delete;
   GlobalCallstackTrie& operator=(const GlobalCallstackTrie&) = delete;
@@ -177,14 +182,20 @@ class GlobalCallstackTrie {
   Node* GetOrCreateChild(Node* self, const Interned<Frame>& loc);
 
   Interned<Frame> MakeRootFrame();
+  uint64_t NextCallstackId() {
+    uint64_t id = next_callstack_id_;
+    next_callstack_id_ += id_stride_;
+    return id;
+  }
 
   Interner<std::string> string_interner_;
   Interner<Mapping> mapping_interner_;
   Interner<Frame> frame_interner_;
 
-  uint64_t next_callstack_id_ = 0;
+  uint64_t id_stride_ = 1;
+  uint64_t next_callstack_id_ = 1;
 
-  Node root_{MakeRootFrame(), ++next_callstack_id_};
+  Node root_{MakeRootFrame(), NextCallstackId()};
 };
 
 }  // namespace profiling
@@ -30,6 +30,10 @@ namespace profiling {
 using InternID = uint32_t;
 
 // Interner that hands out refcounted references.
+//
+// IDs are handed out as |first_id|, |first_id| + |id_stride|, ... so that
+// several interners can share one ID space without colliding (e.g. one per
+// bookkeeping shard, all emitted on the same trace packet sequence).
 template <typename T>
 class Interner {
  private:
@@ -96,6 +100,12 @@ class Interner {
     Interner::Entry* entry_;
   };
 
+  Interner() = default;
+  Interner(InternID first_id, InternID id_stride)
+      : next_id(first_id), id_stride_(id_stride) {
+    PERFETTO_DCHECK(first_id > 0 && id_stride > 0);
+  }
+
   template <typename... U>
   Interned Intern(U... args) {
     Entry item(this, next_id, std::forward<U...>(args...));
@@ -104,7 +114,7 @@ class Interner {
       // This does not invalidate pointers to entries we hold in Interned. See
       // https://timsong-cpp.github.io/cppwp/n3337/unord.req#8
       auto it_and_inserted = entries_.emplace(std::move(item));
-      next_id++;
+      next_id += id_stride_;
       it = it_and_inserted.first;
       PERFETTO_DCHECK(it_and_inserted.second);
     }
@@ -124,6 +134,7 @@ class Interner {
   }
 
   InternID next_id = 1;
+  InternID id_stride_ = 1;
   std::unordered_set<Entry, typename Entry::Hash> entries_;
   static_assert(sizeof(Interned) == sizeof(void*),
                 "interned things should be small");
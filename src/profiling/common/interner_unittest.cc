@@ -128,6 +128,19 @@ TEST(InternerStringTest, IdsConsecutive) {
   ASSERT_EQ(interner.entry_count_for_testing(), 0u);
 }
 
+TEST(InternerStringTest, StridedIdsDisjoint) {
+  Interner<std::string> first(1, 2);
+  Interner<std::string> second(2, 2);
+  Interned<std::string> a = first.Intern("foo");
+  Interned<std::string> b = first.Intern("bar");
+  Interned<std::string> c = second.Intern("foo");
+  Interned<std::string> d = second.Intern("bar");
+  EXPECT_EQ(a.id(), 1u);
+  EXPECT_EQ(b.id(), 3u);
+  EXPECT_EQ(c.id(), 2u);
+  EXPECT_EQ(d.id(), 4u);
+}
+
 }  // namespace
 }  // namespace profiling
 }  // namespace perfetto
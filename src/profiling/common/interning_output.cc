@@ -57,7 +57,7 @@ void InterningOutputTracker::WriteFixedInterningsPacket(
   }
 }
 
-void InterningOutputTracker::WriteMap(const Interned<Mapping> map,
+void InterningOutputTracker::WriteMap(const Interned<Mapping>& map,
                                       protos::pbzero::InternedData* out) {
   auto map_it_and_inserted = dumped_mappings_.emplace(map.id());
   if (map_it_and_inserted.second) {
@@ -79,7 +79,7 @@ void InterningOutputTracker::WriteMap(const Interned<Mapping> map,
   }
 }
 
-void InterningOutputTracker::WriteFrame(Interned<Frame> frame,
+void InterningOutputTracker::WriteFrame(const Interned<Frame>& frame,
                                         protos::pbzero::InternedData* out) {
   // Trace processor depends on the map being written before the
   // frame. See StackProfileTracker::AddFrame.
@@ -147,17 +147,24 @@ void InterningOutputTracker::WriteFunctionNameString(
 void InterningOutputTracker::WriteCallstack(GlobalCallstackTrie::Node* node,
                                             GlobalCallstackTrie* trie,
                                             protos::pbzero::InternedData* out) {
+  if (IsCallstackNew(node->id()))
+    WriteCallstack(node->id(), trie->BuildInverseCallstack(node), out);
+}
+
+void InterningOutputTracker::WriteCallstack(
+    uint64_t callstack_id,
+    const std::vector<Interned<Frame>>& built_callstack,
+    protos::pbzero::InternedData* out) {
   bool inserted;
-  std::tie(std::ignore, inserted) = dumped_callstacks_.emplace(node->id());
+  std::tie(std::ignore, inserted) = dumped_callstacks_.emplace(callstack_id);
   if (inserted) {
     // There need to be two separate loops over built_callstack because
     // protozero cannot interleave different messages.
-    auto built_callstack = trie->BuildInverseCallstack(node);
     for (const Interned<Frame>& frame : built_callstack)
       WriteFrame(frame, out);
 
     protos::pbzero::Callstack* callstack = out->add_callstacks();
-    callstack->set_iid(node->id());
+    callstack->set_iid(callstack_id);
     for (auto frame_it = built_callstack.crbegin();
          frame_it != built_callstack.crend(); ++frame_it) {
       const Interned<Frame>& frame = *frame_it;
@@ -19,6 +19,7 @@
 
 #include <map>
 #include <set>
+#include <vector>
 
 #include <stdint.h>
 
@@ -36,8 +37,12 @@ class InterningOutputTracker {
   // Writes out a full packet containing the "empty" (zero) internings.
   static void WriteFixedInterningsPacket(TraceWriter* trace_writer,
                                          uint32_t sequence_flags);
-  void WriteMap(const Interned<Mapping> map, protos::pbzero::InternedData* out);
-  void WriteFrame(Interned<Frame> frame, protos::pbzero::InternedData* out);
+  // The Write*() methods only read the interned data: they don't take
+  // references to it.
+  void WriteMap(const Interned<Mapping>& map,
+                protos::pbzero::InternedData* out);
+  void WriteFrame(const Interned<Frame>& frame,
+                  protos::pbzero::InternedData* out);
   void WriteBuildIDString(const Interned<std::string>& str,
                           protos::pbzero::InternedData* out);
   void WriteMappingPathString(const Interned<std::string>& str,
@@ -49,6 +54,11 @@ class InterningOutputTracker {
   void WriteCallstack(GlobalCallstackTrie::Node* node,
                       GlobalCallstackTrie* trie,
                       protos::pbzero::InternedData* out);
+  // Writes out the callstack |callstack_id|, whose frames were already built
+  // by GlobalCallstackTrie::BuildInverseCallstack().
+  void WriteCallstack(uint64_t callstack_id,
+                      const std::vector<Interned<Frame>>& built_callstack,
+                      protos::pbzero::InternedData* out);
 
   bool IsCallstackNew(uint64_t callstack_id) {
     return dumped_callstacks_.find(callstack_id) == dumped_callstacks_.end();
@@ -53,9 +53,9 @@ void HeapTracker::RecordMalloc(
     }
   }
 
-  auto it = allocations_.find(address);
-  if (it != allocations_.end()) {
-    Allocation& alloc = it->second;
+  Allocation* existing = allocations_.Find(address);
+  if (existing) {
+    Allocation& alloc = *existing;
     PERFETTO_DCHECK(alloc.sequence_number != sequence_number);
     if (alloc.sequence_number < sequence_number) {
       // As we are overwriting the previous allocation, the previous allocation
@@ -74,16 +74,23 @@ void HeapTracker::RecordMalloc(
 
       SubtractFromCallstackAllocations(alloc);
       GlobalCallstackTrie::Node* node = callsites_->CreateCallsite(frames);
+      // Take the new reference before dropping the old one, so that a
+      // callstack shared by both is never left unreferenced.
+      uint32_t callstack_index = MaybeCreateCallstackAllocations(node);
+      ReleaseCallstackAllocations(alloc);
       alloc.sample_size = sample_size;
       alloc.alloc_size = alloc_size;
       alloc.sequence_number = sequence_number;
-      alloc.SetCallstackAllocations(MaybeCreateCallstackAllocations(node));
+      alloc.callstack_index = callstack_index;
     }
   } else {
     GlobalCallstackTrie::Node* node = callsites_->CreateCallsite(frames);
-    allocations_.emplace(address,
-                         Allocation(sample_size, alloc_size, sequence_number,
-                                    MaybeCreateCallstackAllocations(node)));
+    Allocation alloc;
+    alloc.sample_size = sample_size;
+    alloc.alloc_size = alloc_size;
+    alloc.sequence_number = sequence_number;
+    alloc.callstack_index = MaybeCreateCallstackAllocations(node);
+    allocations_.Insert(address, alloc);
   }
 
   RecordOperation(sequence_number, {address, timestamp});
@@ -92,7 +99,7 @@ void HeapTracker::RecordMalloc(
 void HeapTracker::RecordOperation(uint64_t sequence_number,
                                   const PendingOperation& operation) {
   if (sequence_number != committed_sequence_number_ + 1) {
-    pending_operations_.emplace(sequence_number, operation);
+    pending_operations_.Insert(sequence_number, operation);
     return;
   }
 
@@ -100,11 +107,15 @@ void HeapTracker::RecordOperation(uint64_t sequence_number,
 
   // At this point some other pending operations might be eligible to be
   // committed.
-  auto it = pending_operations_.begin();
-  while (it != pending_operations_.end() &&
-         it->first == committed_sequence_number_ + 1) {
-    CommitOperation(it->first, it->second);
-    it = pending_operations_.erase(it);
+  while (!pending_operations_.empty()) {
+    uint64_t next_sequence_number = committed_sequence_number_ + 1;
+    const PendingOperation* next =
+        pending_operations_.Find(next_sequence_number);
+    if (!next)
+      break;
+    PendingOperation next_operation = *next;
+    pending_operations_.Erase(next_sequence_number);
+    CommitOperation(next_sequence_number, next_operation);
   }
 }
 
@@ -117,16 +128,17 @@ void HeapTracker::CommitOperation(uint64_t sequence_number,
   uint64_t address = operation.allocation_address;
 
   // We will see many frees for addresses we do not know about.
-  auto leaf_it = allocations_.find(address);
-  if (leaf_it == allocations_.end())
+  Allocation* leaf = allocations_.Find(address);
+  if (!leaf)
     return;
 
-  Allocation& value = leaf_it->second;
+  Allocation& value = *leaf;
   if (value.sequence_number == sequence_number) {
     AddToCallstackAllocations(operation.timestamp, value);
   } else if (value.sequence_number < sequence_number) {
     SubtractFromCallstackAllocations(value);
-    allocations_.erase(leaf_it);
+    ReleaseCallstackAllocations(value);
+    allocations_.Erase(address);
   }
   // else (value.sequence_number > sequence_number:
   //  This allocation has been replaced by a newer one in RecordMalloc.
@@ -18,11 +18,13 @@
 #define SRC_PROFILING_MEMORY_BOOKKEEPING_H_
 
 #include <map>
+#include <unordered_map>
 #include <vector>
 
 #include "perfetto/base/time.h"
 #include "src/profiling/common/callstack_trie.h"
 #include "src/profiling/common/interner.h"
+#include "src/profiling/memory/flat_u64_map.h"
 #include "src/profiling/memory/unwound_messages.h"
 
 // Below is an illustration of the bookkeeping system state where
@@ -108,7 +110,8 @@ class HeapTracker {
 
   // Sum of all the allocations for a given callstack.
   struct CallstackAllocations {
-    explicit CallstackAllocations(GlobalCallstackTrie::Node* n) : node(n) {}
+    CallstackAllocations(GlobalCallstackTrie::Node* n, uint32_t idx)
+        : node(n), index(idx) {}
 
     uint64_t allocs = 0;
 
@@ -118,6 +121,9 @@ class HeapTracker {
     } value = {};
 
     GlobalCallstackTrie::Node* const node;
+    // Index into HeapTracker::callstack_allocations_by_index_, which is what
+    // Allocations refer to this by.
+    const uint32_t index;
 
     ~CallstackAllocations() { GlobalCallstackTrie::DecrementNode(node); }
 
@@ -160,6 +166,8 @@ class HeapTracker {
         // TODO(fmayer): We could probably be smarter than throw away
         // our whole frames cache.
         ClearFrameCache();
+        callstack_allocations_by_index_[alloc.index] = nullptr;
+        free_callstack_indices_.push_back(alloc.index);
         callstack_allocations_.erase(it);
       }
     }
@@ -176,13 +184,15 @@ class HeapTracker {
     }
   }
 
+  // Calls fn(address, sample_size, alloc_size, callstack_id) for every live
+  // allocation, in no particular order.
   template <typename F>
   void GetAllocations(F fn) {
-    for (const auto& addr_and_allocation : allocations_) {
-      const Allocation& alloc = addr_and_allocation.second;
-      fn(addr_and_allocation.first, alloc.sample_size, alloc.alloc_size,
-         alloc.callstack_allocations()->node->id());
-    }
+    allocations_.ForEach(
+        [this, &fn](uint64_t address, const Allocation& alloc) {
+          fn(address, alloc.sample_size, alloc.alloc_size,
+             callstack_allocations(alloc)->node->id());
+        });
   }
 
   void RecordFree(uint64_t address,
@@ -208,45 +218,15 @@ class HeapTracker {
   uint64_t GetTimestampForTesting() { return committed_timestamp_; }
 
  private:
+  // Kept in an open-addressing table with one entry per live allocation, so
+  // this is deliberately small and trivially copyable: the callstack is
+  // referred to by its 32-bit index rather than by pointer, and the
+  // CallstackAllocations::allocs refcount is maintained by HeapTracker.
   struct Allocation {
-    Allocation(uint64_t size,
-               uint64_t asize,
-               uint64_t seq,
-               CallstackAllocations* csa)
-        : sample_size(size), alloc_size(asize), sequence_number(seq) {
-      SetCallstackAllocations(csa);
-    }
-
-    Allocation() = default;
-    Allocation(const Allocation&) = delete;
-    Allocation(Allocation&& other) noexcept {
-      sample_size = other.sample_size;
-      alloc_size = other.alloc_size;
-      sequence_number = other.sequence_number;
-      callstack_allocations_ = other.callstack_allocations_;
-      other.callstack_allocations_ = nullptr;
-    }
-
-    ~Allocation() { SetCallstackAllocations(nullptr); }
-
-    void SetCallstackAllocations(CallstackAllocations* callstack_allocations) {
-      if (callstack_allocations_)
-        callstack_allocations_->allocs--;
-      callstack_allocations_ = callstack_allocations;
-      if (callstack_allocations_)
-        callstack_allocations_->allocs++;
-    }
-
-    CallstackAllocations* callstack_allocations() const {
-      return callstack_allocations_;
-    }
-
     uint64_t sample_size;
     uint64_t alloc_size;
     uint64_t sequence_number;
-
-   private:
-    CallstackAllocations* callstack_allocations_ = nullptr;
+    uint32_t callstack_index;
   };
 
   struct PendingOperation {
@@ -254,17 +234,41 @@ class HeapTracker {
     uint64_t timestamp;
   };
 
-  CallstackAllocations* MaybeCreateCallstackAllocations(
-      GlobalCallstackTrie::Node* node) {
+  // Returns the index of the CallstackAllocations for |node| and takes an
+  // allocation reference on it.
+  uint32_t MaybeCreateCallstackAllocations(GlobalCallstackTrie::Node* node) {
     auto callstack_allocations_it = callstack_allocations_.find(node);
     if (callstack_allocations_it == callstack_allocations_.end()) {
       GlobalCallstackTrie::IncrementNode(node);
+      uint32_t index;
+      if (!free_callstack_indices_.empty()) {
+        index = free_callstack_indices_.back();
+        free_callstack_indices_.pop_back();
+      } else {
+        index = static_cast<uint32_t>(callstack_allocations_by_index_.size());
+        callstack_allocations_by_index_.push_back(nullptr);
+      }
       bool inserted;
       std::tie(callstack_allocations_it, inserted) =
-          callstack_allocations_.emplace(node, node);
+          callstack_allocations_.emplace(
+              std::piecewise_construct, std::forward_as_tuple(node),
+              std::forward_as_tuple(node, index));
       PERFETTO_DCHECK(inserted);
+      callstack_allocations_by_index_[index] =
+          &callstack_allocations_it->second;
     }
-    return &callstack_allocations_it->second;
+    CallstackAllocations& csa = callstack_allocations_it->second;
+    csa.allocs++;
+    return csa.index;
+  }
+
+  CallstackAllocations* callstack_allocations(const Allocation& alloc) const {
+    return callstack_allocations_by_index_[alloc.callstack_index];
+  }
+
+  // Drops the allocation reference taken by MaybeCreateCallstackAllocations.
+  void ReleaseCallstackAllocations(const Allocation& alloc) {
+    callstack_allocations(alloc)->allocs--;
   }
 
   void RecordOperation(uint64_t sequence_number,
@@ -282,10 +286,11 @@ class HeapTracker {
                        const PendingOperation& operation);
 
   void AddToCallstackAllocations(uint64_t ts, const Allocation& alloc) {
+    CallstackAllocations* csa = callstack_allocations(alloc);
     if (dump_at_max_mode_) {
       current_unfreed_ += alloc.sample_size;
-      alloc.callstack_allocations()->value.retain_max.cur += alloc.sample_size;
-      alloc.callstack_allocations()->value.retain_max.cur_count++;
+      csa->value.retain_max.cur += alloc.sample_size;
+      csa->value.retain_max.cur_count++;
 
       if (current_unfreed_ <= max_unfreed_)
         return;
@@ -293,38 +298,36 @@ class HeapTracker {
       if (max_sequence_number_ == alloc.sequence_number - 1) {
         // We know the only CallstackAllocation that has max != cur is the
         // one we just updated.
-        alloc.callstack_allocations()->value.retain_max.max =
-            alloc.callstack_allocations()->value.retain_max.cur;
-        alloc.callstack_allocations()->value.retain_max.max_count =
-            alloc.callstack_allocations()->value.retain_max.cur_count;
+        csa->value.retain_max.max = csa->value.retain_max.cur;
+        csa->value.retain_max.max_count = csa->value.retain_max.cur_count;
       } else {
         for (auto& p : callstack_allocations_) {
           // We need to reset max = cur for every CallstackAllocation, as we
           // do not know which ones have changed since the last max.
           // TODO(fmayer): Add an index to speed this up
-          CallstackAllocations& csa = p.second;
-          csa.value.retain_max.max = csa.value.retain_max.cur;
-          csa.value.retain_max.max_count = csa.value.retain_max.cur_count;
+          CallstackAllocations& other = p.second;
+          other.value.retain_max.max = other.value.retain_max.cur;
+          other.value.retain_max.max_count = other.value.retain_max.cur_count;
         }
       }
       max_sequence_number_ = alloc.sequence_number;
       max_unfreed_ = current_unfreed_;
       max_timestamp_ = ts;
     } else {
-      alloc.callstack_allocations()->value.totals.allocated +=
-          alloc.sample_size;
-      alloc.callstack_allocations()->value.totals.allocation_count++;
+      csa->value.totals.allocated += alloc.sample_size;
+      csa->value.totals.allocation_count++;
     }
   }
 
   void SubtractFromCallstackAllocations(const Allocation& alloc) {
+    CallstackAllocations* csa = callstack_allocations(alloc);
     if (dump_at_max_mode_) {
       current_unfreed_ -= alloc.sample_size;
-      alloc.callstack_allocations()->value.retain_max.cur -= alloc.sample_size;
-      alloc.callstack_allocations()->value.retain_max.cur_count--;
+      csa->value.retain_max.cur -= alloc.sample_size;
+      csa->value.retain_max.cur_count--;
     } else {
-      alloc.callstack_allocations()->value.totals.freed += alloc.sample_size;
-      alloc.callstack_allocations()->value.totals.free_count++;
+      csa->value.totals.freed += alloc.sample_size;
+      csa->value.totals.free_count++;
     }
   }
 
@@ -337,7 +340,12 @@ class HeapTracker {
   std::vector<std::pair<decltype(callstack_allocations_)::iterator, uint64_t>>
       dead_callstack_allocations_;
 
-  std::map<uint64_t /* allocation address */, Allocation> allocations_;
+  // Allocation::callstack_index -> entry of callstack_allocations_. Indices of
+  // erased entries are recycled through free_callstack_indices_.
+  std::vector<CallstackAllocations*> callstack_allocations_by_index_;
+  std::vector<uint32_t> free_callstack_indices_;
+
+  FlatU64Map<Allocation> allocations_;  // Keyed by allocation address.
 
   // An operation is either a commit of an allocation or freeing of an
   // allocation. An operation is a free if its seq_id is larger than
@@ -346,8 +354,10 @@ class HeapTracker {
   //
   // If its seq_id is less than the sequence_number of the corresponding
   // allocation it could be either, but is ignored either way.
-  std::map<uint64_t /* seq_id */, PendingOperation /* allocation address */>
-      pending_operations_;
+  //
+  // Operations are committed strictly in sequence_number order, so only ever
+  // looked up by the next sequence number to commit.
+  FlatU64Map<PendingOperation> pending_operations_;  // Keyed by seq_id.
 
   uint64_t committed_timestamp_ = 0;
   // The sequence number all mallocs and frees have been handled up to.
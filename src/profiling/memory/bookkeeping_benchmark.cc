@@ -0,0 +1,120 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "src/profiling/common/callstack_trie.h"
+#include "src/profiling/memory/bookkeeping.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+constexpr size_t kNumCallstacks = 64;
+constexpr size_t kCallstackDepth = 12;
+
+struct SyntheticCallstacks {
+  SyntheticCallstacks() {
+    for (size_t i = 0; i < kNumCallstacks; ++i) {
+      std::vector<unwindstack::FrameData> stack;
+      for (size_t j = 0; j < kCallstackDepth; ++j) {
+        unwindstack::FrameData frame{};
+        // Share the outer frames between callstacks, like real programs.
+        uint64_t pc = j < kCallstackDepth / 2 ? j : i * kCallstackDepth + j;
+        frame.function_name = "fun" + std::to_string(pc);
+        frame.map_name = "/system/lib64/libfoo.so";
+        frame.pc = 0x1000 + pc;
+        frame.rel_pc = pc;
+        stack.emplace_back(std::move(frame));
+      }
+      stacks.emplace_back(std::move(stack));
+    }
+    build_ids.resize(kCallstackDepth);
+  }
+
+  std::vector<std::vector<unwindstack::FrameData>> stacks;
+  std::vector<std::string> build_ids;
+};
+
+// Replays a malloc / free stream in which |state.range(0)| allocations are
+// live at any time. Every iteration frees a random live allocation and
+// replaces it with a new one. Every fourth pair is delivered out of order, to
+// exercise the pending operations too.
+void BM_HeapTrackerMallocFree(benchmark::State& state, bool dump_at_max) {
+  const size_t live_allocations = static_cast<size_t>(state.range(0));
+  SyntheticCallstacks callstacks;
+  GlobalCallstackTrie callsites;
+  HeapTracker tracker(&callsites, dump_at_max);
+  std::minstd_rand0 rnd(0);
+
+  uint64_t sequence_number = 0;
+  uint64_t next_address = 0x7f0000000000ULL;
+  std::vector<uint64_t> live;
+  live.reserve(live_allocations);
+  for (size_t i = 0; i < live_allocations; ++i) {
+    const auto& stack = callstacks.stacks[rnd() % kNumCallstacks];
+    uint64_t seq = ++sequence_number;
+    tracker.RecordMalloc(stack, callstacks.build_ids, next_address, 32, 32,
+                         seq, seq);
+    live.push_back(next_address);
+    next_address += 48;
+  }
+
+  uint64_t ops = 0;
+  for (auto _ : state) {
+    size_t victim = rnd() % live.size();
+    const auto& stack = callstacks.stacks[rnd() % kNumCallstacks];
+    uint64_t free_seq = ++sequence_number;
+    uint64_t malloc_seq = ++sequence_number;
+    if (ops++ % 4 == 0) {
+      tracker.RecordMalloc(stack, callstacks.build_ids, next_address, 32, 32,
+                           malloc_seq, malloc_seq);
+      tracker.RecordFree(live[victim], free_seq, free_seq);
+    } else {
+      tracker.RecordFree(live[victim], free_seq, free_seq);
+      tracker.RecordMalloc(stack, callstacks.build_ids, next_address, 32, 32,
+                           malloc_seq, malloc_seq);
+    }
+    live[victim] = next_address;
+    next_address += 48;
+  }
+  state.counters["ops"] = benchmark::Counter(
+      static_cast<double>(2 * ops), benchmark::Counter::kIsRate);
+}
+
+void BM_HeapTrackerMallocFree_Totals(benchmark::State& state) {
+  BM_HeapTrackerMallocFree(state, /*dump_at_max=*/false);
+}
+
+void BM_HeapTrackerMallocFree_DumpAtMax(benchmark::State& state) {
+  BM_HeapTrackerMallocFree(state, /*dump_at_max=*/true);
+}
+
+}  // namespace
+
+BENCHMARK(BM_HeapTrackerMallocFree_Totals)
+    ->Arg(1 << 10)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20);
+BENCHMARK(BM_HeapTrackerMallocFree_DumpAtMax)
+    ->Arg(1 << 10)
+    ->Arg(1 << 16)
+    ->Arg(1 << 20);
+
+}  // namespace profiling
+}  // namespace perfetto
@@ -16,6 +16,8 @@
 
 #include "src/profiling/memory/bookkeeping_dump.h"
 
+#include <set>
+
 namespace perfetto {
 namespace profiling {
 namespace {
@@ -27,11 +29,11 @@ using ::perfetto::protos::pbzero::ProfilePacket;
 uint32_t kPacketSizeThreshold = 400000;
 }  // namespace
 
-void DumpState::WriteMap(const Interned<Mapping> map) {
+void DumpState::WriteMap(const Interned<Mapping>& map) {
   intern_state_->WriteMap(map, GetCurrentInternedData());
 }
 
-void DumpState::WriteFrame(Interned<Frame> frame) {
+void DumpState::WriteFrame(const Interned<Frame>& frame) {
   intern_state_->WriteFrame(frame, GetCurrentInternedData());
 }
 
@@ -47,28 +49,49 @@ void DumpState::WriteFunctionNameString(const Interned<std::string>& str) {
   intern_state_->WriteFunctionNameString(str, GetCurrentInternedData());
 }
 
-void DumpState::WriteAllocation(const HeapTracker::CallstackAllocations& alloc,
-                                bool dump_at_max_mode) {
-  if (intern_state_->IsCallstackNew(alloc.node->id())) {
-    callstacks_to_dump_.emplace(alloc.node);
+void TakeHeapSnapshot(HeapTracker* heap_tracker,
+                      GlobalCallstackTrie* callsites,
+                      InterningOutputTracker* intern_state,
+                      HeapSnapshot* snapshot) {
+  std::set<GlobalCallstackTrie::Node*> new_callstacks;
+  heap_tracker->GetCallstackAllocations(
+      [snapshot, intern_state, &new_callstacks](
+          const HeapTracker::CallstackAllocations& alloc) {
+        HeapSnapshot::Sample sample;
+        sample.callstack_id = alloc.node->id();
+        sample.value = alloc.value;
+        snapshot->samples.emplace_back(sample);
+        if (intern_state->IsCallstackNew(alloc.node->id()))
+          new_callstacks.emplace(alloc.node);
+      });
+  snapshot->new_callstacks.reserve(new_callstacks.size());
+  for (GlobalCallstackTrie::Node* node : new_callstacks) {
+    HeapSnapshot::Callstack callstack;
+    callstack.id = node->id();
+    callstack.frames = callsites->BuildInverseCallstack(node);
+    snapshot->new_callstacks.emplace_back(std::move(callstack));
   }
+}
 
+void DumpState::WriteAllocation(const HeapSnapshot::Sample& snapshot_sample,
+                                bool dump_at_max_mode) {
   auto* heap_samples = GetCurrentProcessHeapSamples();
   ProfilePacket::HeapSample* sample = heap_samples->add_samples();
-  sample->set_callstack_id(alloc.node->id());
+  sample->set_callstack_id(snapshot_sample.callstack_id);
   if (dump_at_max_mode) {
-    sample->set_self_max(alloc.value.retain_max.max);
-    sample->set_self_max_count(alloc.value.retain_max.max_count);
+    sample->set_self_max(snapshot_sample.value.retain_max.max);
+    sample->set_self_max_count(snapshot_sample.value.retain_max.max_count);
   } else {
-    sample->set_self_allocated(alloc.value.totals.allocated);
-    sample->set_self_freed(alloc.value.totals.freed);
+    sample->set_self_allocated(snapshot_sample.value.totals.allocated);
+    sample->set_self_freed(snapshot_sample.value.totals.freed);
 
-    sample->set_alloc_count(alloc.value.totals.allocation_count);
-    sample->set_free_count(alloc.value.totals.free_count);
+    sample->set_alloc_count(snapshot_sample.value.totals.allocation_count);
+    sample->set_free_count(snapshot_sample.value.totals.free_count);
   }
 }
 
-void DumpState::DumpCallstacks(GlobalCallstackTrie* callsites) {
+void DumpState::DumpCallstacks(
+    const std::vector<HeapSnapshot::Callstack>& callstacks) {
   // We need a way to signal to consumers when they have fully consumed the
   // InternedData they need to understand the sequence of continued
   // ProfilePackets. The way we do that is to mark the last ProfilePacket as
@@ -79,8 +102,9 @@ void DumpState::DumpCallstacks(GlobalCallstackTrie* callsites) {
   // MakeProfilePacket at the end.
   if (current_trace_packet_)
     current_profile_packet_->set_continued(true);
-  for (GlobalCallstackTrie::Node* node : callstacks_to_dump_) {
-    intern_state_->WriteCallstack(node, callsites, GetCurrentInternedData());
+  for (const HeapSnapshot::Callstack& callstack : callstacks) {
+    intern_state_->WriteCallstack(callstack.id, callstack.frames,
+                                  GetCurrentInternedData());
   }
   MakeProfilePacket();
 }
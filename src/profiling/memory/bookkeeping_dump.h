@@ -19,7 +19,7 @@
 
 #include <cinttypes>
 #include <functional>
-#include <set>
+#include <vector>
 
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "src/profiling/common/interner.h"
@@ -34,6 +34,38 @@
 namespace perfetto {
 namespace profiling {
 
+// The allocations of a heap and the callstacks among them that weren't
+// written to the trace yet. Taken while holding the lock of the bookkeeping
+// shard that owns the HeapTracker, so that DumpState can write it to the trace
+// after the lock is released, without blocking the shard's unwinding worker.
+//
+// The frames are references into the interners of the shard's callstack trie,
+// which are not thread safe: the snapshot must be destroyed while holding the
+// shard lock.
+struct HeapSnapshot {
+  struct Sample {
+    uint64_t callstack_id = 0;
+    // Either |retain_max| or |totals|, depending on the dump_at_max mode.
+    decltype(HeapTracker::CallstackAllocations::value) value = {};
+  };
+
+  struct Callstack {
+    uint64_t id = 0;
+    // Leaf first, as returned by GlobalCallstackTrie::BuildInverseCallstack().
+    std::vector<Interned<Frame>> frames;
+  };
+
+  std::vector<Sample> samples;
+  std::vector<Callstack> new_callstacks;
+};
+
+// Copies the allocations of |heap_tracker| into |snapshot|, along with the
+// callstacks that |intern_state| hasn't seen yet.
+void TakeHeapSnapshot(HeapTracker* heap_tracker,
+                      GlobalCallstackTrie* callsites,
+                      InterningOutputTracker* intern_state,
+                      HeapSnapshot* snapshot);
+
 class DumpState {
  public:
   DumpState(
@@ -54,13 +86,13 @@ class DumpState {
   DumpState(DumpState&&) = delete;
   DumpState& operator=(DumpState&&) = delete;
 
-  void WriteAllocation(const HeapTracker::CallstackAllocations& alloc,
+  void WriteAllocation(const HeapSnapshot::Sample& sample,
                        bool dump_at_max_mode);
-  void DumpCallstacks(GlobalCallstackTrie* callsites);
+  void DumpCallstacks(const std::vector<HeapSnapshot::Callstack>& callstacks);
 
  private:
-  void WriteMap(const Interned<Mapping> map);
-  void WriteFrame(const Interned<Frame> frame);
+  void WriteMap(const Interned<Mapping>& map);
+  void WriteFrame(const Interned<Frame>& frame);
   void WriteBuildIDString(const Interned<std::string>& str);
   void WriteMappingPathString(const Interned<std::string>& str);
   void WriteFunctionNameString(const Interned<std::string>& str);
@@ -94,8 +126,6 @@ class DumpState {
   GetCurrentProcessHeapSamples();
   protos::pbzero::InternedData* GetCurrentInternedData();
 
-  std::set<GlobalCallstackTrie::Node*> callstacks_to_dump_;
-
   TraceWriter* trace_writer_;
   InterningOutputTracker* intern_state_;
 
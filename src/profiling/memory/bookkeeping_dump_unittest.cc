@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/memory/bookkeeping_dump.h"
+
+#include <map>
+#include <tuple>
+
+#include "src/tracing/core/trace_writer_for_testing.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace/interned_data/interned_data.gen.h"
+#include "protos/perfetto/trace/profiling/profile_common.gen.h"
+#include "protos/perfetto/trace/profiling/profile_packet.gen.h"
+#include "protos/perfetto/trace/trace_packet.gen.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+using ::testing::ElementsAre;
+
+// Leaf first, like the frames returned by libunwindstack.
+std::vector<unwindstack::FrameData> MakeStack(
+    const std::vector<std::string>& function_names) {
+  std::vector<unwindstack::FrameData> res;
+  uint64_t pc = 1;
+  for (const std::string& name : function_names) {
+    unwindstack::FrameData data{};
+    data.function_name = name;
+    data.map_name = "map_" + name;
+    data.pc = pc++;
+    res.emplace_back(std::move(data));
+  }
+  return res;
+}
+
+// Two bookkeeping shards, whose tries hand out disjoint IDs, dumped through
+// one interning state, as heapprofd does for the processes of a data source
+// that are handled by different unwinding workers.
+TEST(BookkeepingDumpTest, SnapshotsOfSeveralShards) {
+  GlobalCallstackTrie shard0_callsites(/*first_id=*/1, /*id_stride=*/2);
+  GlobalCallstackTrie shard1_callsites(/*first_id=*/2, /*id_stride=*/2);
+  HeapTracker shard0_heap(&shard0_callsites, /*dump_at_max_mode=*/false);
+  HeapTracker shard1_heap(&shard1_callsites, /*dump_at_max_mode=*/false);
+  std::vector<std::string> build_ids(2, "build_id");
+  shard0_heap.RecordMalloc(MakeStack({"foo", "main"}), build_ids, 0x10, 5, 5,
+                           /*sequence_number=*/1, /*timestamp=*/100);
+  shard1_heap.RecordMalloc(MakeStack({"bar", "main"}), build_ids, 0x10, 7, 7,
+                           /*sequence_number=*/1, /*timestamp=*/100);
+
+  InterningOutputTracker intern_state;
+  TraceWriterForTesting writer;
+  HeapSnapshot shard0_snapshot;
+  HeapSnapshot shard1_snapshot;
+  TakeHeapSnapshot(&shard0_heap, &shard0_callsites, &intern_state,
+                   &shard0_snapshot);
+  TakeHeapSnapshot(&shard1_heap, &shard1_callsites, &intern_state,
+                   &shard1_snapshot);
+  ASSERT_EQ(shard0_snapshot.new_callstacks.size(), 1u);
+  ASSERT_EQ(shard1_snapshot.new_callstacks.size(), 1u);
+
+  // Changes after the snapshot was taken are not part of the dump.
+  shard0_heap.RecordFree(0x10, /*sequence_number=*/2, /*timestamp=*/200);
+
+  uint64_t pid = 1;
+  for (HeapSnapshot* snapshot : {&shard0_snapshot, &shard1_snapshot}) {
+    DumpState dump_state(
+        &writer,
+        [pid](protos::pbzero::ProfilePacket::ProcessHeapSamples* proto) {
+          proto->set_pid(pid);
+        },
+        &intern_state);
+    for (const HeapSnapshot::Sample& sample : snapshot->samples)
+      dump_state.WriteAllocation(sample, /*dump_at_max_mode=*/false);
+    dump_state.DumpCallstacks(snapshot->new_callstacks);
+    pid++;
+  }
+
+  // pid -> (callstack id, self_allocated, self_freed)
+  std::map<uint64_t, std::vector<std::tuple<uint64_t, uint64_t, uint64_t>>>
+      samples;
+  std::map<uint64_t, std::vector<uint64_t>> callstacks;
+  std::map<uint64_t, uint64_t> frame_function_names;
+  std::map<uint64_t, std::string> function_names;
+  for (const auto& packet : writer.GetAllTracePackets()) {
+    for (const auto& dump : packet.profile_packet().process_dumps()) {
+      for (const auto& sample : dump.samples()) {
+        samples[dump.pid()].emplace_back(sample.callstack_id(),
+                                         sample.self_allocated(),
+                                         sample.self_freed());
+      }
+    }
+    for (const auto& callstack : packet.interned_data().callstacks())
+      callstacks[callstack.iid()] = callstack.frame_ids();
+    for (const auto& frame : packet.interned_data().frames())
+      frame_function_names[frame.iid()] = frame.function_name_id();
+    for (const auto& str : packet.interned_data().function_names())
+      function_names[str.iid()] = str.str();
+  }
+
+  ASSERT_EQ(samples[1].size(), 1u);
+  ASSERT_EQ(samples[2].size(), 1u);
+  uint64_t shard0_callstack = std::get<0>(samples[1][0]);
+  uint64_t shard1_callstack = std::get<0>(samples[2][0]);
+  EXPECT_NE(shard0_callstack, shard1_callstack);
+  EXPECT_EQ(samples[1][0], std::make_tuple(shard0_callstack, 5u, 0u));
+  EXPECT_EQ(samples[2][0], std::make_tuple(shard1_callstack, 7u, 0u));
+
+  // Each callstack is interned once, with the frames of its own shard (root
+  // first).
+  EXPECT_EQ(callstacks.size(), 2u);
+  auto function_names_of = [&](uint64_t callstack_id) {
+    std::vector<std::string> names;
+    for (uint64_t frame_id : callstacks[callstack_id])
+      names.push_back(function_names[frame_function_names[frame_id]]);
+    return names;
+  };
+  EXPECT_THAT(function_names_of(shard0_callstack), ElementsAre("main", "foo"));
+  EXPECT_THAT(function_names_of(shard1_callstack), ElementsAre("main", "bar"));
+}
+
+// The callstacks already written by a previous dump are not part of the
+// snapshot.
+TEST(BookkeepingDumpTest, SnapshotSkipsDumpedCallstacks) {
+  GlobalCallstackTrie callsites;
+  HeapTracker heap(&callsites, /*dump_at_max_mode=*/false);
+  heap.RecordMalloc(MakeStack({"foo", "main"}), {"a", "b"}, 0x10, 5, 5,
+                    /*sequence_number=*/1, /*timestamp=*/100);
+
+  InterningOutputTracker intern_state;
+  TraceWriterForTesting writer;
+  for (size_t expected_new_callstacks : {1u, 0u}) {
+    HeapSnapshot snapshot;
+    TakeHeapSnapshot(&heap, &callsites, &intern_state, &snapshot);
+    EXPECT_EQ(snapshot.samples.size(), 1u);
+    EXPECT_EQ(snapshot.new_callstacks.size(), expected_new_callstacks);
+    DumpState dump_state(
+        &writer, [](protos::pbzero::ProfilePacket::ProcessHeapSamples*) {},
+        &intern_state);
+    for (const HeapSnapshot::Sample& sample : snapshot.samples)
+      dump_state.WriteAllocation(sample, /*dump_at_max_mode=*/false);
+    dump_state.DumpCallstacks(snapshot.new_callstacks);
+  }
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
@@ -71,6 +71,11 @@ bool Contained(const StackRange& base, const char* ptr) {
 
 }  // namespace
 
+// static
+constexpr size_t Client::kFreeBatchSize;
+// static
+constexpr size_t Client::kFreeBatchSlots;
+
 uint64_t GetMaxTries(const ClientConfiguration& client_config) {
   if (!client_config.block_client)
     return 1u;
@@ -365,6 +370,11 @@ bool Client::RecordMalloc(uint32_t heap_id,
     return postfork_return_value_;
   }
 
+  // Send the staged frees first, so they do not hold up committing this
+  // allocation (which has a later sequence number) in heapprofd.
+  if (!FlushFreeBatches())
+    return false;
+
   AllocMetadata metadata;
   const char* stackptr = reinterpret_cast<char*>(__builtin_frame_address(0));
   unwindstack::AsmGetRegs(metadata.register_data);
@@ -437,15 +447,77 @@ bool Client::RecordFree(uint32_t heap_id, const uint64_t alloc_address) {
       1 + sequence_number_[heap_id].fetch_add(1, std::memory_order_acq_rel);
   current_entry.addr = alloc_address;
   current_entry.heap_id = heap_id;
+
+  FreeBatchSlot& slot = FreeBatchSlotForCurrentThread();
+  if (client_config_.batch_frees &&
+      !slot.busy.exchange(true, std::memory_order_acquire)) {
+    slot.entries[slot.header.num_entries++] = current_entry;
+    int64_t bytes_free = 0;
+    bool sent = false;
+    if (slot.header.num_entries == kFreeBatchSize) {
+      bytes_free = SendFreeBatchLocked(&slot);
+      sent = true;
+    }
+    slot.busy.store(false, std::memory_order_release);
+    if (!sent)
+      return true;
+    if (bytes_free == -1)
+      return false;
+    return MaybeSendControlSocketByteAfterFree(bytes_free);
+  }
+
+  // Either batching is disabled, or another thread hashing to the same slot
+  // is using it. Rather than wait, send this free on its own.
   WireMessage msg = {};
   msg.record_type = RecordType::Free;
   msg.free_header = &current_entry;
-  // Do not send control socket byte, as frees are very cheap to handle, so we
-  // just delay to the next alloc. Sending the control socket byte is ~10x the
-  // rest of the client overhead.
   int64_t bytes_free = SendWireMessageWithRetriesIfBlocking(msg);
   if (bytes_free == -1)
     return false;
+  return MaybeSendControlSocketByteAfterFree(bytes_free);
+}
+
+bool Client::FlushFreeBatches() {
+  if (!client_config_.batch_frees)
+    return true;
+  for (FreeBatchSlot& slot : free_batches_) {
+    // Busy slots are being appended to or sent right now; their owner takes
+    // care of them.
+    if (slot.busy.exchange(true, std::memory_order_acquire))
+      continue;
+    int64_t bytes_free = 0;
+    if (slot.header.num_entries > 0)
+      bytes_free = SendFreeBatchLocked(&slot);
+    slot.busy.store(false, std::memory_order_release);
+    if (bytes_free == -1)
+      return false;
+  }
+  return true;
+}
+
+Client::FreeBatchSlot& Client::FreeBatchSlotForCurrentThread() {
+  // Thread stacks are usually a lot larger than 64 KiB, so dropping the low
+  // bits maps most frames of a thread to the same slot.
+  uintptr_t sp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  return free_batches_[(sp >> 16) % kFreeBatchSlots];
+}
+
+int64_t Client::SendFreeBatchLocked(FreeBatchSlot* slot) {
+  WireMessage msg = {};
+  msg.record_type = RecordType::FreeBatch;
+  msg.free_batch_header = &slot->header;
+  msg.free_batch_entries = slot->entries;
+  int64_t bytes_free = SendWireMessageWithRetriesIfBlocking(msg);
+  // On failure the client is torn down, so there is no point in keeping the
+  // entries around.
+  slot->header.num_entries = 0;
+  return bytes_free;
+}
+
+bool Client::MaybeSendControlSocketByteAfterFree(int64_t bytes_free) {
+  // Do not send control socket byte, as frees are very cheap to handle, so we
+  // just delay to the next alloc. Sending the control socket byte is ~10x the
+  // rest of the client overhead.
   // Seems like we are filling up the shmem with frees. Flush.
   if (static_cast<uint64_t>(bytes_free) < shmem_.size() / 2 &&
       shmem_.GetAndResetReaderPaused()) {
@@ -85,6 +85,10 @@ class Client {
   // Add address to buffer of deallocations. Flushes the buffer if necessary.
   bool RecordFree(uint32_t heap_id,
                   uint64_t alloc_address) PERFETTO_WARN_UNUSED_RESULT;
+  // Sends all staged frees that are not currently being appended to by another
+  // thread. Called before every malloc record. No-op unless
+  // ClientConfiguration.batch_frees is set.
+  bool FlushFreeBatches() PERFETTO_WARN_UNUSED_RESULT;
   bool RecordHeapInfo(uint32_t heap_id,
                       const char* heap_name,
                       uint64_t interval);
@@ -110,11 +114,35 @@ class Client {
   uint64_t adaptive_sampling_max_sampling_interval_bytes() {
     return client_config_.adaptive_sampling_max_sampling_interval_bytes;
   }
-  uint64_t write_avail() { return shmem_.write_avail(); }
+  uint64_t write_avail() {
+    return shmem_.write_avail(shmem_.RingForCurrentThread());
+  }
 
   bool IsConnected();
 
  private:
+  // Number of frees that are staged before they get sent as a single
+  // RecordType::FreeBatch record.
+  static constexpr size_t kFreeBatchSize = 32;
+  // Number of independent staging areas. Threads are spread across them by
+  // their stack address, which approximates a thread-local staging area
+  // without relying on TLS (which could allocate) inside the malloc hooks.
+  static constexpr size_t kFreeBatchSlots = 8;
+
+  struct FreeBatchSlot {
+    // Held while appending to or sending |entries|. Never waited on: if it is
+    // taken, the free is sent on its own instead.
+    std::atomic<bool> busy{false};
+    FreeBatchHeader header{};
+    FreeEntry entries[kFreeBatchSize];
+  };
+
+  FreeBatchSlot& FreeBatchSlotForCurrentThread();
+  // Requires slot->busy to be held by the caller.
+  int64_t SendFreeBatchLocked(FreeBatchSlot* slot) PERFETTO_WARN_UNUSED_RESULT;
+  bool MaybeSendControlSocketByteAfterFree(int64_t bytes_free)
+      PERFETTO_WARN_UNUSED_RESULT;
+
   const char* GetStackEnd(const char* stacktop);
   bool SendControlSocketByte() PERFETTO_WARN_UNUSED_RESULT;
   int64_t SendWireMessageWithRetriesIfBlocking(const WireMessage&)
@@ -131,6 +159,7 @@ class Client {
   std::atomic<uint64_t>
       sequence_number_[base::ArraySize(ClientConfiguration{}.heaps)] = {};
   SharedRingBuffer shmem_;
+  FreeBatchSlot free_batches_[kFreeBatchSlots];
 
   // Used to detect (during the slow path) the situation where the process has
   // forked during profiling, and is performing malloc operations in the child.
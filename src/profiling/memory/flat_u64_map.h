@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_MEMORY_FLAT_U64_MAP_H_
+#define SRC_PROFILING_MEMORY_FLAT_U64_MAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace perfetto {
+namespace profiling {
+
+// Open-addressing hash map from uint64_t keys to small, trivially copyable
+// values, used for the per-allocation state of HeapTracker.
+//
+// Keys and values are stored inline in a single array and probed linearly.
+// A parallel array of one-byte tags (empty, or 7 bits of the hash) lets
+// lookups skip most non-matching slots without touching them. Deletion
+// shifts subsequent entries of the probe sequence back, so there are no
+// tombstones and lookups never degrade after many insert / erase cycles.
+//
+// Pointers returned by Find and Insert are invalidated by any subsequent
+// Insert or Erase.
+template <typename V>
+class FlatU64Map {
+ public:
+  static_assert(std::is_trivially_copyable<V>::value,
+                "FlatU64Map values must be trivially copyable");
+
+  FlatU64Map() = default;
+
+  V* Find(uint64_t key) {
+    if (size_ == 0)
+      return nullptr;
+    uint64_t hash = Hash(key);
+    uint8_t tag = Tag(hash);
+    for (size_t i = hash & mask_;; i = (i + 1) & mask_) {
+      if (tags_[i] == kEmptyTag)
+        return nullptr;
+      if (tags_[i] == tag && slots_[i].key == key)
+        return &slots_[i].value;
+    }
+  }
+
+  const V* Find(uint64_t key) const {
+    return const_cast<FlatU64Map*>(this)->Find(key);
+  }
+
+  // Inserts |value| for |key| unless |key| is already present. Returns the
+  // value stored for |key| and whether it was inserted.
+  std::pair<V*, bool> Insert(uint64_t key, const V& value) {
+    if ((size_ + 1) * kMaxLoadDenominator > capacity() * kMaxLoadNumerator)
+      Grow();
+    uint64_t hash = Hash(key);
+    uint8_t tag = Tag(hash);
+    size_t i = hash & mask_;
+    for (; tags_[i] != kEmptyTag; i = (i + 1) & mask_) {
+      if (tags_[i] == tag && slots_[i].key == key)
+        return {&slots_[i].value, false};
+    }
+    tags_[i] = tag;
+    slots_[i].key = key;
+    slots_[i].value = value;
+    size_++;
+    return {&slots_[i].value, true};
+  }
+
+  // Returns whether |key| was present.
+  bool Erase(uint64_t key) {
+    if (size_ == 0)
+      return false;
+    uint64_t hash = Hash(key);
+    uint8_t tag = Tag(hash);
+    size_t hole = hash & mask_;
+    for (;; hole = (hole + 1) & mask_) {
+      if (tags_[hole] == kEmptyTag)
+        return false;
+      if (tags_[hole] == tag && slots_[hole].key == key)
+        break;
+    }
+    // Backward-shift: move every later entry of the probe run whose home slot
+    // is not in (hole, cur] into the hole, so that no lookup ever has to step
+    // over an empty slot to reach its key.
+    for (size_t cur = (hole + 1) & mask_; tags_[cur] != kEmptyTag;
+         cur = (cur + 1) & mask_) {
+      size_t home = Hash(slots_[cur].key) & mask_;
+      bool home_in_range = hole <= cur ? (hole < home && home <= cur)
+                                       : (hole < home || home <= cur);
+      if (home_in_range)
+        continue;
+      tags_[hole] = tags_[cur];
+      slots_[hole] = slots_[cur];
+      hole = cur;
+    }
+    tags_[hole] = kEmptyTag;
+    size_--;
+    return true;
+  }
+
+  // Calls fn(uint64_t key, const V& value) for every entry, in no particular
+  // order.
+  template <typename F>
+  void ForEach(F fn) const {
+    for (size_t i = 0; i < tags_.size(); ++i) {
+      if (tags_[i] != kEmptyTag)
+        fn(slots_[i].key, slots_[i].value);
+    }
+  }
+
+  void Clear() {
+    tags_.clear();
+    slots_.clear();
+    size_ = 0;
+    mask_ = 0;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  size_t capacity() const { return tags_.size(); }
+
+ private:
+  struct Slot {
+    uint64_t key;
+    V value;
+  };
+
+  static constexpr uint8_t kEmptyTag = 0;
+  static constexpr size_t kInitialCapacity = 16;
+  // Grow once more than 3/4 of the slots are in use.
+  static constexpr size_t kMaxLoadNumerator = 3;
+  static constexpr size_t kMaxLoadDenominator = 4;
+
+  // Finalizer of MurmurHash3. Addresses and sequence numbers are far from
+  // uniformly distributed in their low bits, so they need to be mixed.
+  static uint64_t Hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+  }
+
+  // Top 7 bits of the hash (independent of the bits used for the slot index),
+  // with the high bit set to distinguish it from kEmptyTag.
+  static uint8_t Tag(uint64_t hash) {
+    return static_cast<uint8_t>(0x80 | (hash >> 57));
+  }
+
+  void Grow() {
+    size_t new_capacity =
+        capacity() == 0 ? kInitialCapacity : capacity() * 2;
+    std::vector<uint8_t> old_tags(new_capacity, kEmptyTag);
+    std::vector<Slot> old_slots(new_capacity);
+    old_tags.swap(tags_);
+    old_slots.swap(slots_);
+    mask_ = new_capacity - 1;
+    for (size_t i = 0; i < old_tags.size(); ++i) {
+      if (old_tags[i] == kEmptyTag)
+        continue;
+      size_t j = Hash(old_slots[i].key) & mask_;
+      while (tags_[j] != kEmptyTag)
+        j = (j + 1) & mask_;
+      tags_[j] = old_tags[i];
+      slots_[j] = old_slots[i];
+    }
+  }
+
+  std::vector<uint8_t> tags_;
+  std::vector<Slot> slots_;
+  size_t size_ = 0;
+  size_t mask_ = 0;
+};
+
+// static
+template <typename V>
+constexpr uint8_t FlatU64Map<V>::kEmptyTag;
+// static
+template <typename V>
+constexpr size_t FlatU64Map<V>::kInitialCapacity;
+// static
+template <typename V>
+constexpr size_t FlatU64Map<V>::kMaxLoadNumerator;
+// static
+template <typename V>
+constexpr size_t FlatU64Map<V>::kMaxLoadDenominator;
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_MEMORY_FLAT_U64_MAP_H_
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/memory/flat_u64_map.h"
+
+#include <map>
+#include <random>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+TEST(FlatU64MapTest, InsertFindErase) {
+  FlatU64Map<int> map;
+  EXPECT_EQ(map.Find(1), nullptr);
+  EXPECT_FALSE(map.Erase(1));
+
+  auto res = map.Insert(1, 10);
+  EXPECT_TRUE(res.second);
+  EXPECT_EQ(*res.first, 10);
+
+  res = map.Insert(1, 20);
+  EXPECT_FALSE(res.second);
+  EXPECT_EQ(*res.first, 10);
+
+  ASSERT_NE(map.Find(1), nullptr);
+  EXPECT_EQ(*map.Find(1), 10);
+  EXPECT_EQ(map.size(), 1u);
+
+  EXPECT_TRUE(map.Erase(1));
+  EXPECT_EQ(map.Find(1), nullptr);
+  EXPECT_TRUE(map.empty());
+}
+
+TEST(FlatU64MapTest, ExtremeKeys) {
+  FlatU64Map<int> map;
+  map.Insert(0, 1);
+  map.Insert(~0ULL, 2);
+  ASSERT_NE(map.Find(0), nullptr);
+  ASSERT_NE(map.Find(~0ULL), nullptr);
+  EXPECT_EQ(*map.Find(0), 1);
+  EXPECT_EQ(*map.Find(~0ULL), 2);
+}
+
+TEST(FlatU64MapTest, ForEach) {
+  FlatU64Map<uint64_t> map;
+  for (uint64_t i = 0; i < 100; ++i)
+    map.Insert(i * 16, i);
+  std::map<uint64_t, uint64_t> seen;
+  map.ForEach([&seen](uint64_t key, uint64_t value) { seen[key] = value; });
+  ASSERT_EQ(seen.size(), 100u);
+  for (uint64_t i = 0; i < 100; ++i)
+    EXPECT_EQ(seen[i * 16], i);
+}
+
+// Replays a random stream of inserts and erases against std::map, to exercise
+// growth and backward-shift deletion across wrapped-around probe runs.
+TEST(FlatU64MapTest, MatchesStdMap) {
+  std::minstd_rand0 rnd(42);
+  FlatU64Map<uint64_t> map;
+  std::map<uint64_t, uint64_t> golden;
+  for (int i = 0; i < 100000; ++i) {
+    // Aligned, clustered keys, like heap addresses.
+    uint64_t key = 0x7f0000000000ULL + (rnd() % 4096) * 16;
+    if (rnd() % 3 == 0) {
+      EXPECT_EQ(map.Erase(key), golden.erase(key) == 1);
+    } else {
+      bool inserted = map.Insert(key, i).second;
+      EXPECT_EQ(inserted, golden.emplace(key, i).second);
+    }
+    ASSERT_EQ(map.size(), golden.size());
+  }
+  for (const auto& key_and_value : golden) {
+    const uint64_t* value = map.Find(key_and_value.first);
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(*value, key_and_value.second);
+  }
+  size_t count = 0;
+  map.ForEach([&count](uint64_t, uint64_t) { count++; });
+  EXPECT_EQ(count, golden.size());
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
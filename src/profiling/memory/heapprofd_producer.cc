@@ -25,6 +25,7 @@
 #include <cinttypes>
 #include <functional>
 #include <string>
+#include <vector>
 
 #include "perfetto/base/compiler.h"
 #include "perfetto/base/logging.h"
@@ -33,10 +34,12 @@
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/thread_task_runner.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/base/watchdog_posix.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "perfetto/ext/tracing/ipc/producer_ipc_client.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/tracing/core/data_source_config.h"
 #include "perfetto/tracing/core/data_source_descriptor.h"
 #include "perfetto/tracing/core/forward_decls.h"
@@ -141,6 +144,7 @@ bool HeapprofdConfigToClientConfiguration(
   cli_config->block_client_timeout_us =
       heapprofd_config.block_client_timeout_us();
   cli_config->all_heaps = heapprofd_config.all_heaps();
+  cli_config->batch_frees = heapprofd_config.batch_frees();
   cli_config->adaptive_sampling_shmem_threshold =
       heapprofd_config.adaptive_sampling_shmem_threshold();
   cli_config->adaptive_sampling_max_sampling_interval_bytes =
@@ -202,8 +206,9 @@ bool HeapprofdConfigToClientConfiguration(
   return true;
 }
 
-// We create kUnwinderThreads unwinding threads. Bookkeeping is done on the main
-// thread.
+// We create kUnwinderThreads unwinding threads. Each of them owns a bookkeeping
+// shard and applies the records it unwinds directly, so the main thread only
+// has to serialize dumps.
 HeapprofdProducer::HeapprofdProducer(HeapprofdMode mode,
                                      base::TaskRunner* task_runner,
                                      bool exit_when_done)
@@ -213,12 +218,32 @@ HeapprofdProducer::HeapprofdProducer(HeapprofdMode mode,
       unwinding_workers_(MakeUnwindingWorkers(this, kUnwinderThreads)),
       socket_delegate_(this),
       weak_factory_(this) {
+  for (uint32_t i = 0; i < kUnwinderThreads; ++i) {
+    shards_.emplace_back(
+        new BookkeepingShard(i, static_cast<uint32_t>(kUnwinderThreads)));
+  }
   CheckDataSourceCpuTask();
   CheckDataSourceMemoryTask();
 }
 
 HeapprofdProducer::~HeapprofdProducer() = default;
 
+HeapprofdProducer::ProcessState::ProcessState(BookkeepingShard* s,
+                                              DataSourceInstanceID ds_id,
+                                              pid_t p,
+                                              const HeapprofdConfig* c)
+    : shard(s), data_source_id(ds_id), pid(p), config(c) {
+  std::lock_guard<std::mutex> l(shard->mutex);
+  shard->process_states[{data_source_id, pid}] = this;
+}
+
+HeapprofdProducer::ProcessState::~ProcessState() {
+  std::lock_guard<std::mutex> l(shard->mutex);
+  shard->process_states.erase({data_source_id, pid});
+  // The HeapTrackers release their callsites in the shard's trie.
+  heap_infos.clear();
+}
+
 void HeapprofdProducer::SetTargetProcess(pid_t target_pid,
                                          std::string target_cmdline) {
   target_process_.pid = target_pid;
@@ -563,6 +588,10 @@ UnwindingWorker& HeapprofdProducer::UnwinderForPID(pid_t pid) {
   return unwinding_workers_[static_cast<uint64_t>(pid) % kUnwinderThreads];
 }
 
+HeapprofdProducer::BookkeepingShard& HeapprofdProducer::ShardForPID(pid_t pid) {
+  return *shards_[static_cast<uint64_t>(pid) % kUnwinderThreads];
+}
+
 void HeapprofdProducer::StopDataSource(DataSourceInstanceID id) {
   auto it = data_sources_.find(id);
   if (it == data_sources_.end()) {
@@ -655,6 +684,8 @@ void HeapprofdProducer::SetStats(
   stats->set_total_unwinding_time_us(process_state.total_unwinding_time_us);
   stats->set_client_spinlock_blocked_us(
       process_state.client_spinlock_blocked_us);
+  stats->set_client_batched_writes(process_state.client_batched_writes);
+  stats->set_client_batched_records(process_state.client_batched_records);
   auto* unwinding_hist = stats->set_unwinding_time_us();
   for (const auto& p : process_state.unwinding_time_us.GetData()) {
     auto* bucket = unwinding_hist->add_buckets();
@@ -669,15 +700,28 @@ void HeapprofdProducer::SetStats(
 void HeapprofdProducer::DumpProcessState(DataSource* data_source,
                                          pid_t pid,
                                          ProcessState* process_state) {
-  for (auto& heap_id_and_heap_info : process_state->heap_infos) {
-    ProcessState::HeapInfo& heap_info = heap_id_and_heap_info.second;
-
-    bool from_startup = data_source->signaled_pids.find(pid) ==
-                        data_source->signaled_pids.cend();
-
-    auto new_heapsamples = [pid, from_startup, process_state, data_source,
-                            &heap_info](
-                               ProfilePacket::ProcessHeapSamples* proto) {
+  struct HeapDump {
+    // The serialized ProcessHeapSamples fields other than the samples, which
+    // are repeated in each packet the dump is split into.
+    std::string header;
+    HeapSnapshot snapshot;
+  };
+  std::vector<HeapDump> heap_dumps;
+  bool from_startup =
+      data_source->signaled_pids.find(pid) == data_source->signaled_pids.cend();
+
+  // Only copy the state under the lock, so that the unwinding worker that owns
+  // the shard is not blocked while the dump is written to the trace.
+  BookkeepingShard* shard = process_state->shard;
+  {
+    std::lock_guard<std::mutex> l(shard->mutex);
+    heap_dumps.resize(process_state->heap_infos.size());
+    size_t i = 0;
+    for (auto& heap_id_and_heap_info : process_state->heap_infos) {
+      ProcessState::HeapInfo& heap_info = heap_id_and_heap_info.second;
+      HeapDump& heap_dump = heap_dumps[i++];
+
+      protozero::HeapBuffered<ProfilePacket::ProcessHeapSamples> proto;
       proto->set_pid(static_cast<uint64_t>(pid));
       proto->set_timestamp(heap_info.heap_tracker.dump_timestamp());
       proto->set_from_startup(from_startup);
@@ -693,19 +737,30 @@ void HeapprofdProducer::DumpProcessState(DataSource* data_source,
       proto->set_orig_sampling_interval_bytes(heap_info.orig_sampling_interval);
       auto* stats = proto->set_stats();
       SetStats(stats, *process_state);
-    };
+      heap_dump.header = proto.SerializeAsString();
 
-    DumpState dump_state(data_source->trace_writer.get(),
-                         std::move(new_heapsamples),
-                         &data_source->intern_state);
+      TakeHeapSnapshot(&heap_info.heap_tracker, &shard->callsites,
+                       &data_source->intern_state, &heap_dump.snapshot);
+    }
+  }
 
-    heap_info.heap_tracker.GetCallstackAllocations(
-        [&dump_state,
-         &data_source](const HeapTracker::CallstackAllocations& alloc) {
-          dump_state.WriteAllocation(alloc, data_source->config.dump_at_max());
-        });
-    dump_state.DumpCallstacks(&callsites_);
+  const bool dump_at_max = data_source->config.dump_at_max();
+  for (const HeapDump& heap_dump : heap_dumps) {
+    const std::string& header = heap_dump.header;
+    DumpState dump_state(
+        data_source->trace_writer.get(),
+        [&header](ProfilePacket::ProcessHeapSamples* proto) {
+          proto->AppendRawProtoBytes(header.data(), header.size());
+        },
+        &data_source->intern_state);
+    for (const HeapSnapshot::Sample& sample : heap_dump.snapshot.samples)
+      dump_state.WriteAllocation(sample, dump_at_max);
+    dump_state.DumpCallstacks(heap_dump.snapshot.new_callstacks);
   }
+
+  // The snapshots hold references into the shard's interners.
+  std::lock_guard<std::mutex> l(shard->mutex);
+  heap_dumps.clear();
 }
 
 void HeapprofdProducer::DumpProcessesInDataSource(DataSource* ds) {
@@ -839,10 +894,11 @@ void HeapprofdProducer::SocketDelegate::OnDataAvailable(
       return;
     }
 
+    pid_t peer_pid = self->peer_pid_linux();
     data_source.process_states.emplace(
-        std::piecewise_construct, std::forward_as_tuple(self->peer_pid_linux()),
-        std::forward_as_tuple(&producer_->callsites_,
-                              data_source.config.dump_at_max()));
+        std::piecewise_construct, std::forward_as_tuple(peer_pid),
+        std::forward_as_tuple(&producer_->ShardForPID(peer_pid),
+                              data_source.id, peer_pid, &data_source.config));
 
     PERFETTO_DLOG("%d: Received FDs.", self->peer_pid_linux());
     int raw_fd = pending_process.shmem.fd();
@@ -927,7 +983,19 @@ void HeapprofdProducer::HandleClientConnection(
     shmem_size = kMaxShmemSize;
   }
 
-  auto shmem = SharedRingBuffer::Create(static_cast<size_t>(shmem_size));
+  uint64_t num_rings = data_source->config.shmem_num_rings();
+  if (!num_rings)
+    num_rings = 1;
+  if (num_rings > SharedRingBuffer::kMaxRings ||
+      (num_rings & (num_rings - 1)) != 0 ||
+      shmem_size / num_rings < base::kPageSize) {
+    PERFETTO_ELOG("Invalid shmem_num_rings %" PRIu64 ". Using one ring.",
+                  num_rings);
+    num_rings = 1;
+  }
+
+  auto shmem = SharedRingBuffer::Create(static_cast<size_t>(shmem_size),
+                                        static_cast<size_t>(num_rings));
   if (!shmem || !shmem->is_valid()) {
     PERFETTO_LOG("Failed to create shared memory.");
     return;
@@ -949,6 +1017,27 @@ void HeapprofdProducer::HandleClientConnection(
 void HeapprofdProducer::PostAllocRecord(
     UnwindingWorker* worker,
     std::unique_ptr<AllocRecord> alloc_rec) {
+  BookkeepingShard& shard = ShardForPID(alloc_rec->pid);
+  bool handled = true;
+  {
+    std::lock_guard<std::mutex> l(shard.mutex);
+    ProcessState* process_state =
+        shard.Find(alloc_rec->data_source_instance_id, alloc_rec->pid);
+    if (!process_state) {
+      PERFETTO_LOG("Invalid PID in alloc record.");
+    } else if (process_state->config->stream_allocations()) {
+      handled = false;
+    } else {
+      HandleAllocRecord(process_state, alloc_rec.get());
+    }
+  }
+  if (handled) {
+    worker->ReturnAllocRecord(std::move(alloc_rec));
+    return;
+  }
+
+  // Streamed allocations are written to the data source's TraceWriter, which
+  // is only used on the main thread.
   // Once we can use C++14, this should be std::moved into the lambda instead.
   auto* raw_alloc_rec = alloc_rec.release();
   auto weak_this = weak_factory_.GetWeakPtr();
@@ -956,7 +1045,7 @@ void HeapprofdProducer::PostAllocRecord(
     std::unique_ptr<AllocRecord> unique_alloc_ref =
         std::unique_ptr<AllocRecord>(raw_alloc_rec);
     if (weak_this) {
-      weak_this->HandleAllocRecord(unique_alloc_ref.get());
+      weak_this->HandleStreamingAllocRecord(unique_alloc_ref.get());
       worker->ReturnAllocRecord(std::move(unique_alloc_ref));
     }
   });
@@ -964,6 +1053,28 @@ void HeapprofdProducer::PostAllocRecord(
 
 void HeapprofdProducer::PostFreeRecord(UnwindingWorker*,
                                        std::vector<FreeRecord> free_recs) {
+  if (free_recs.empty())
+    return;
+  // A batch of free records always comes from a single client.
+  const FreeRecord& first_rec = free_recs.front();
+  BookkeepingShard& shard = ShardForPID(first_rec.pid);
+  {
+    std::lock_guard<std::mutex> l(shard.mutex);
+    ProcessState* process_state =
+        shard.Find(first_rec.data_source_instance_id, first_rec.pid);
+    if (!process_state) {
+      PERFETTO_LOG("Invalid PID in free record.");
+      return;
+    }
+    if (!process_state->config->stream_allocations()) {
+      for (const FreeRecord& free_rec : free_recs) {
+        PERFETTO_DCHECK(free_rec.pid == first_rec.pid);
+        HandleFreeRecord(process_state, free_rec);
+      }
+      return;
+    }
+  }
+
   // Once we can use C++14, this should be std::moved into the lambda instead.
   std::vector<FreeRecord>* raw_free_recs =
       new std::vector<FreeRecord>(std::move(free_recs));
@@ -971,7 +1082,7 @@ void HeapprofdProducer::PostFreeRecord(UnwindingWorker*,
   task_runner_->PostTask([weak_this, raw_free_recs] {
     if (weak_this) {
       for (FreeRecord& free_rec : *raw_free_recs)
-        weak_this->HandleFreeRecord(std::move(free_rec));
+        weak_this->HandleStreamingFreeRecord(std::move(free_rec));
     }
     delete raw_free_recs;
   });
@@ -979,11 +1090,15 @@ void HeapprofdProducer::PostFreeRecord(UnwindingWorker*,
 
 void HeapprofdProducer::PostHeapNameRecord(UnwindingWorker*,
                                            HeapNameRecord rec) {
-  auto weak_this = weak_factory_.GetWeakPtr();
-  task_runner_->PostTask([weak_this, rec] {
-    if (weak_this)
-      weak_this->HandleHeapNameRecord(rec);
-  });
+  BookkeepingShard& shard = ShardForPID(rec.pid);
+  std::lock_guard<std::mutex> l(shard.mutex);
+  ProcessState* process_state =
+      shard.Find(rec.data_source_instance_id, rec.pid);
+  if (!process_state) {
+    PERFETTO_LOG("Invalid PID in heap name record.");
+    return;
+  }
+  HandleHeapNameRecord(process_state, rec);
 }
 
 void HeapprofdProducer::PostSocketDisconnected(UnwindingWorker*,
@@ -997,7 +1112,7 @@ void HeapprofdProducer::PostSocketDisconnected(UnwindingWorker*,
   });
 }
 
-void HeapprofdProducer::HandleAllocRecord(AllocRecord* alloc_rec) {
+void HeapprofdProducer::HandleStreamingAllocRecord(AllocRecord* alloc_rec) {
   const AllocMetadata& alloc_metadata = alloc_rec->alloc_metadata;
   auto it = data_sources_.find(alloc_rec->data_source_instance_id);
   if (it == data_sources_.end()) {
@@ -1006,26 +1121,47 @@ void HeapprofdProducer::HandleAllocRecord(AllocRecord* alloc_rec) {
   }
 
   DataSource& ds = it->second;
-  auto process_state_it = ds.process_states.find(alloc_rec->pid);
-  if (process_state_it == ds.process_states.end()) {
+  if (ds.process_states.count(alloc_rec->pid) == 0) {
     PERFETTO_LOG("Invalid PID in alloc record.");
     return;
   }
 
-  if (ds.config.stream_allocations()) {
-    auto packet = ds.trace_writer->NewTracePacket();
-    auto* streaming_alloc = packet->set_streaming_allocation();
-    streaming_alloc->add_address(alloc_metadata.alloc_address);
-    streaming_alloc->add_size(alloc_metadata.alloc_size);
-    streaming_alloc->add_sample_size(alloc_metadata.sample_size);
-    streaming_alloc->add_clock_monotonic_coarse_timestamp(
-        alloc_metadata.clock_monotonic_coarse_timestamp);
-    streaming_alloc->add_heap_id(alloc_metadata.heap_id);
-    streaming_alloc->add_sequence_number(alloc_metadata.sequence_number);
+  auto packet = ds.trace_writer->NewTracePacket();
+  auto* streaming_alloc = packet->set_streaming_allocation();
+  streaming_alloc->add_address(alloc_metadata.alloc_address);
+  streaming_alloc->add_size(alloc_metadata.alloc_size);
+  streaming_alloc->add_sample_size(alloc_metadata.sample_size);
+  streaming_alloc->add_clock_monotonic_coarse_timestamp(
+      alloc_metadata.clock_monotonic_coarse_timestamp);
+  streaming_alloc->add_heap_id(alloc_metadata.heap_id);
+  streaming_alloc->add_sequence_number(alloc_metadata.sequence_number);
+}
+
+void HeapprofdProducer::HandleStreamingFreeRecord(FreeRecord free_rec) {
+  auto it = data_sources_.find(free_rec.data_source_instance_id);
+  if (it == data_sources_.end()) {
+    PERFETTO_LOG("Invalid data source in free record.");
+    return;
+  }
+
+  DataSource& ds = it->second;
+  if (ds.process_states.count(free_rec.pid) == 0) {
+    PERFETTO_LOG("Invalid PID in free record.");
     return;
   }
 
-  const auto& prefixes = ds.config.skip_symbol_prefix();
+  auto packet = ds.trace_writer->NewTracePacket();
+  auto* streaming_free = packet->set_streaming_free();
+  streaming_free->add_address(free_rec.entry.addr);
+  streaming_free->add_heap_id(free_rec.entry.heap_id);
+  streaming_free->add_sequence_number(free_rec.entry.sequence_number);
+}
+
+// static
+void HeapprofdProducer::HandleAllocRecord(ProcessState* process_state,
+                                          AllocRecord* alloc_rec) {
+  const AllocMetadata& alloc_metadata = alloc_rec->alloc_metadata;
+  const auto& prefixes = process_state->config->skip_symbol_prefix();
   if (!prefixes.empty()) {
     for (unwindstack::FrameData& frame_data : alloc_rec->frames) {
       const std::string& map = frame_data.map_name;
@@ -1038,17 +1174,16 @@ void HeapprofdProducer::HandleAllocRecord(AllocRecord* alloc_rec) {
     }
   }
 
-  ProcessState& process_state = process_state_it->second;
   HeapTracker& heap_tracker =
-      process_state.GetHeapTracker(alloc_rec->alloc_metadata.heap_id);
+      process_state->GetHeapTracker(alloc_rec->alloc_metadata.heap_id);
 
   if (alloc_rec->error)
-    process_state.unwinding_errors++;
+    process_state->unwinding_errors++;
   if (alloc_rec->reparsed_map)
-    process_state.map_reparses++;
-  process_state.heap_samples++;
-  process_state.unwinding_time_us.Add(alloc_rec->unwinding_time_us);
-  process_state.total_unwinding_time_us += alloc_rec->unwinding_time_us;
+    process_state->map_reparses++;
+  process_state->heap_samples++;
+  process_state->unwinding_time_us.Add(alloc_rec->unwinding_time_us);
+  process_state->total_unwinding_time_us += alloc_rec->unwinding_time_us;
 
   // abspc may no longer refer to the same functions, as we had to reparse
   // maps. Reset the cache.
@@ -1062,51 +1197,17 @@ void HeapprofdProducer::HandleAllocRecord(AllocRecord* alloc_rec) {
       alloc_metadata.clock_monotonic_coarse_timestamp);
 }
 
-void HeapprofdProducer::HandleFreeRecord(FreeRecord free_rec) {
-  auto it = data_sources_.find(free_rec.data_source_instance_id);
-  if (it == data_sources_.end()) {
-    PERFETTO_LOG("Invalid data source in free record.");
-    return;
-  }
-
-  DataSource& ds = it->second;
-  auto process_state_it = ds.process_states.find(free_rec.pid);
-  if (process_state_it == ds.process_states.end()) {
-    PERFETTO_LOG("Invalid PID in free record.");
-    return;
-  }
-
-  if (ds.config.stream_allocations()) {
-    auto packet = ds.trace_writer->NewTracePacket();
-    auto* streaming_free = packet->set_streaming_free();
-    streaming_free->add_address(free_rec.entry.addr);
-    streaming_free->add_heap_id(free_rec.entry.heap_id);
-    streaming_free->add_sequence_number(free_rec.entry.sequence_number);
-    return;
-  }
-
-  ProcessState& process_state = process_state_it->second;
-
+// static
+void HeapprofdProducer::HandleFreeRecord(ProcessState* process_state,
+                                         const FreeRecord& free_rec) {
   const FreeEntry& entry = free_rec.entry;
-  HeapTracker& heap_tracker = process_state.GetHeapTracker(entry.heap_id);
+  HeapTracker& heap_tracker = process_state->GetHeapTracker(entry.heap_id);
   heap_tracker.RecordFree(entry.addr, entry.sequence_number, 0);
 }
 
-void HeapprofdProducer::HandleHeapNameRecord(HeapNameRecord rec) {
-  auto it = data_sources_.find(rec.data_source_instance_id);
-  if (it == data_sources_.end()) {
-    PERFETTO_LOG("Invalid data source in free record.");
-    return;
-  }
-
-  DataSource& ds = it->second;
-  auto process_state_it = ds.process_states.find(rec.pid);
-  if (process_state_it == ds.process_states.end()) {
-    PERFETTO_LOG("Invalid PID in free record.");
-    return;
-  }
-
-  ProcessState& process_state = process_state_it->second;
+// static
+void HeapprofdProducer::HandleHeapNameRecord(ProcessState* process_state,
+                                             const HeapNameRecord& rec) {
   const HeapName& entry = rec.entry;
   if (entry.heap_name[0] != '\0') {
     std::string heap_name = entry.heap_name;
@@ -1114,7 +1215,7 @@ void HeapprofdProducer::HandleHeapNameRecord(HeapNameRecord rec) {
       PERFETTO_ELOG("Invalid zero heap ID.");
       return;
     }
-    ProcessState::HeapInfo& hi = process_state.GetHeapInfo(entry.heap_id);
+    ProcessState::HeapInfo& hi = process_state->GetHeapInfo(entry.heap_id);
     if (!hi.heap_name.empty() && hi.heap_name != heap_name) {
       PERFETTO_ELOG("Overriding heap name %s with %s", hi.heap_name.c_str(),
                     heap_name.c_str());
@@ -1122,7 +1223,7 @@ void HeapprofdProducer::HandleHeapNameRecord(HeapNameRecord rec) {
     hi.heap_name = entry.heap_name;
   }
   if (entry.sample_interval != 0) {
-    ProcessState::HeapInfo& hi = process_state.GetHeapInfo(entry.heap_id);
+    ProcessState::HeapInfo& hi = process_state->GetHeapInfo(entry.heap_id);
     if (!hi.sampling_interval)
       hi.orig_sampling_interval = entry.sample_interval;
     hi.sampling_interval = entry.sample_interval;
@@ -1185,11 +1286,17 @@ void HeapprofdProducer::HandleSocketDisconnected(
                ds.shutting_down);
 
   ProcessState& process_state = process_state_it->second;
-  process_state.disconnected = !ds.shutting_down;
-  process_state.error_state = stats.error_state;
-  process_state.client_spinlock_blocked_us = stats.client_spinlock_blocked_us;
-  process_state.buffer_corrupted =
-      stats.num_writes_corrupt > 0 || stats.num_reads_corrupt > 0;
+  {
+    std::lock_guard<std::mutex> l(process_state.shard->mutex);
+    process_state.disconnected = !ds.shutting_down;
+    process_state.error_state = stats.error_state;
+    process_state.client_spinlock_blocked_us =
+        stats.client_spinlock_blocked_us;
+    process_state.client_batched_writes = stats.num_batched_writes;
+    process_state.client_batched_records = stats.num_batched_records;
+    process_state.buffer_corrupted =
+        stats.num_writes_corrupt > 0 || stats.num_reads_corrupt > 0;
+  }
 
   DumpProcessState(&ds, pid, &process_state);
   ds.process_states.erase(pid);
@@ -21,6 +21,9 @@
 #include <cinttypes>
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
 #include <vector>
 
 #include "perfetto/base/task_runner.h"
@@ -136,9 +139,8 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
                               pid_t,
                               SharedRingBuffer::Stats) override;
 
-  void HandleAllocRecord(AllocRecord*);
-  void HandleFreeRecord(FreeRecord);
-  void HandleHeapNameRecord(HeapNameRecord);
+  void HandleStreamingAllocRecord(AllocRecord*);
+  void HandleStreamingFreeRecord(FreeRecord);
   void HandleSocketDisconnected(DataSourceInstanceID,
                                 pid_t,
                                 SharedRingBuffer::Stats);
@@ -171,6 +173,32 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
     kConnected,
   };
 
+  struct ProcessState;
+
+  // Bookkeeping state for the processes handled by one unwinding worker.
+  // Records are applied directly on that worker's thread; the main thread
+  // takes |mutex| to create, dump and destroy the ProcessStates that live in
+  // the shard. Each shard has its own callstack trie, handing out IDs that are
+  // disjoint from the other shards', so dumps from different shards can share
+  // the interning state of a data source.
+  struct BookkeepingShard {
+    BookkeepingShard(uint32_t index, uint32_t num_shards)
+        : callsites(index + 1, num_shards) {}
+
+    ProcessState* Find(DataSourceInstanceID ds_id, pid_t pid) {
+      auto it = process_states.find({ds_id, pid});
+      return it == process_states.end() ? nullptr : it->second;
+    }
+
+    std::mutex mutex;
+    GlobalCallstackTrie callsites;
+    // Owned by DataSource::process_states on the main thread.
+    std::map<std::pair<DataSourceInstanceID, pid_t>, ProcessState*>
+        process_states;
+  };
+
+  // Registers itself with |shard| on construction and unregisters on
+  // destruction. Only accessed while holding shard->mutex.
   struct ProcessState {
     struct HeapInfo {
       HeapInfo(GlobalCallstackTrie* cs, bool dam) : heap_tracker(cs, dam) {}
@@ -180,8 +208,20 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
       uint64_t sampling_interval = 0u;
       uint64_t orig_sampling_interval = 0u;
     };
-    ProcessState(GlobalCallstackTrie* c, bool d)
-        : callsites(c), dump_at_max_mode(d) {}
+    ProcessState(BookkeepingShard* shard,
+                 DataSourceInstanceID ds_id,
+                 pid_t pid,
+                 const HeapprofdConfig* config);
+    ~ProcessState();
+    ProcessState(const ProcessState&) = delete;
+    ProcessState& operator=(const ProcessState&) = delete;
+
+    BookkeepingShard* const shard;
+    const DataSourceInstanceID data_source_id;
+    const pid_t pid;
+    // Owned by the DataSource, which outlives this.
+    const HeapprofdConfig* const config;
+
     bool disconnected = false;
     SharedRingBuffer::ErrorState error_state =
         SharedRingBuffer::ErrorState::kNoError;
@@ -193,8 +233,8 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
 
     uint64_t total_unwinding_time_us = 0;
     uint64_t client_spinlock_blocked_us = 0;
-    GlobalCallstackTrie* callsites;
-    bool dump_at_max_mode;
+    uint64_t client_batched_writes = 0;
+    uint64_t client_batched_records = 0;
     LogHistogram unwinding_time_us;
     std::map<uint32_t, HeapInfo> heap_infos;
 
@@ -203,7 +243,7 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
       if (it == heap_infos.end()) {
         std::tie(it, std::ignore) = heap_infos.emplace(
             std::piecewise_construct, std::forward_as_tuple(heap_id),
-            std::forward_as_tuple(callsites, dump_at_max_mode));
+            std::forward_as_tuple(&shard->callsites, config->dump_at_max()));
       }
       return it->second;
     }
@@ -264,7 +304,12 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
 
   void DoContinuousDump(DataSourceInstanceID id, uint32_t dump_interval);
 
+  static void HandleAllocRecord(ProcessState*, AllocRecord*);
+  static void HandleFreeRecord(ProcessState*, const FreeRecord&);
+  static void HandleHeapNameRecord(ProcessState*, const HeapNameRecord&);
+
   UnwindingWorker& UnwinderForPID(pid_t);
+  BookkeepingShard& ShardForPID(pid_t);
   bool IsPidProfiled(pid_t);
   DataSource* GetDataSourceForProcess(const Process& proc);
   void RecordOtherSourcesAsRejected(DataSource* active_ds, const Process& proc);
@@ -303,8 +348,10 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
   // TraceWriters.
   std::unique_ptr<TracingService::ProducerEndpoint> endpoint_;
 
-  // Must outlive data_sources_ - HeapTracker references the trie.
-  GlobalCallstackTrie callsites_;
+  // Must outlive data_sources_ - ProcessStates register themselves with a
+  // shard and their HeapTrackers reference the shard's trie. One per
+  // unwinding worker.
+  std::vector<std::unique_ptr<BookkeepingShard>> shards_;
 
   // Must outlive data_sources_ - DataSource can hold
   // SystemProperties::Handle-s.
@@ -313,6 +360,7 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
 
   std::map<FlushRequestID, size_t> flushes_in_progress_;
   std::map<DataSourceInstanceID, DataSource> data_sources_;
+  // Must be destroyed before shards_ - the worker threads write into them.
   std::vector<UnwindingWorker> unwinding_workers_;
 
   // Specific to mode_ == kChild
@@ -202,6 +202,18 @@ TEST(HeapprofdConfigToClientConfigurationTest, AdaptiveSamplingWithMax) {
             4 * 4096u);
 }
 
+TEST(HeapprofdConfigToClientConfigurationTest, BatchFrees) {
+  HeapprofdConfig cfg;
+  cfg.add_heaps("foo");
+  cfg.set_sampling_interval_bytes(4096);
+  ClientConfiguration cli_config;
+  ASSERT_TRUE(HeapprofdConfigToClientConfiguration(cfg, &cli_config));
+  EXPECT_FALSE(cli_config.batch_frees);
+  cfg.set_batch_frees(true);
+  ASSERT_TRUE(HeapprofdConfigToClientConfiguration(cfg, &cli_config));
+  EXPECT_TRUE(cli_config.batch_frees);
+}
+
 TEST(HeapprofdConfigToClientConfigurationTest, AllHeaps) {
   HeapprofdConfig cfg;
   cfg.set_all_heaps(true);
@@ -18,6 +18,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -49,10 +50,22 @@ constexpr auto kGuardSize = base::kPageSize * 1024 * 16;  // 64 MB.
 constexpr auto kFDSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
 #endif
 
+bool IsPowerOfTwo(size_t v) {
+  return v != 0 && (v & (v - 1)) == 0;
+}
+
 }  // namespace
 
+// static
+constexpr size_t SharedRingBuffer::kMaxRings;
 
-SharedRingBuffer::SharedRingBuffer(CreateFlag, size_t size) {
+SharedRingBuffer::SharedRingBuffer(CreateFlag, size_t size, size_t num_rings) {
+  if (num_rings == 0 || num_rings > kMaxRings || !IsPowerOfTwo(num_rings) ||
+      size / num_rings < base::kPageSize) {
+    PERFETTO_ELOG("Invalid number of SharedRingBuffer sub-rings (%zu)",
+                  num_rings);
+    return;
+  }
   size_t size_with_meta = size + kMetaPageSize;
   base::ScopedFile fd;
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
@@ -88,11 +101,13 @@ SharedRingBuffer::SharedRingBuffer(CreateFlag, size_t size) {
     }
   }
 #endif
-  Initialize(std::move(fd));
+  Initialize(std::move(fd), num_rings);
   if (!is_valid())
     return;
 
-  new (meta_) MetadataPage();
+  for (size_t i = 0; i < num_rings; ++i)
+    new (ring_meta(i)) MetadataPage();
+  meta_->num_rings = num_rings;
 }
 
 SharedRingBuffer::~SharedRingBuffer() {
@@ -102,7 +117,7 @@ SharedRingBuffer::~SharedRingBuffer() {
                 "MetadataPage must be trivially destructible");
 
   if (is_valid()) {
-    size_t outer_size = kMetaPageSize + size_ * 2 + kGuardSize;
+    size_t outer_size = kMetaPageSize + ring_stride_ * num_rings_ + kGuardSize;
     munmap(meta_, outer_size);
   }
 
@@ -119,7 +134,7 @@ SharedRingBuffer::~SharedRingBuffer() {
     close(fd);
 }
 
-void SharedRingBuffer::Initialize(base::ScopedFile mem_fd) {
+void SharedRingBuffer::Initialize(base::ScopedFile mem_fd, size_t num_rings) {
 #if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
   int seals = fcntl(*mem_fd, F_GET_SEALS);
   if (seals == -1) {
@@ -160,36 +175,78 @@ void SharedRingBuffer::Initialize(base::ScopedFile mem_fd) {
     return;
   }
 
-  // Map first the whole buffer (including the initial metadata page) @ off=0.
-  void* reg1 = mmap(region, size_with_meta, PROT_READ | PROT_WRITE,
+  // Map first the metadata page @ off=0.
+  void* meta = mmap(region, kMetaPageSize, PROT_READ | PROT_WRITE,
                     MAP_SHARED | MAP_FIXED, *mem_fd, 0);
-
-  // Then map again the buffer, skipping the metadata page. The final result is:
-  // [ METADATA ] [ RING BUFFER SHMEM ] [ RING BUFFER SHMEM ]
-  void* reg2 = mmap(region + size_with_meta, size, PROT_READ | PROT_WRITE,
-                    MAP_SHARED | MAP_FIXED, *mem_fd,
-                    /*offset=*/kMetaPageSize);
-
-  if (reg1 != region || reg2 != region + size_with_meta) {
+  if (meta != region) {
     PERFETTO_PLOG("mmap(MAP_SHARED) failed");
     munmap(region, outer_size);
     return;
   }
-  set_size(size);
+
+  if (num_rings == 0) {
+    // Make a local copy, the other end can change it at any time.
+    num_rings = static_cast<size_t>(
+        reinterpret_cast<volatile MetadataPage*>(region)->num_rings);
+    if (num_rings == 0)
+      num_rings = 1;
+  }
+  size_t ring_size = size / num_rings;
+  if (num_rings > kMaxRings || !IsPowerOfTwo(num_rings) ||
+      ring_size < base::kPageSize) {
+    PERFETTO_ELOG("SharedRingBuffer has invalid number of sub-rings (%zu)",
+                  num_rings);
+    munmap(region, outer_size);
+    return;
+  }
+
+  // Then map every sub-ring twice, so that records wrapping around the end of
+  // a sub-ring can be accessed contiguously. The final result is:
+  // [ METADATA ] [ RING 0 ] [ RING 0 ] [ RING 1 ] [ RING 1 ] ...
+  for (size_t i = 0; i < num_rings; ++i) {
+    uint8_t* ring_start = region + kMetaPageSize + 2 * ring_size * i;
+    off_t offset = static_cast<off_t>(kMetaPageSize + ring_size * i);
+    void* reg1 = mmap(ring_start, ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_FIXED, *mem_fd, offset);
+    void* reg2 = mmap(ring_start + ring_size, ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_FIXED, *mem_fd, offset);
+    if (reg1 != ring_start || reg2 != ring_start + ring_size) {
+      PERFETTO_PLOG("mmap(MAP_SHARED) failed");
+      munmap(region, outer_size);
+      return;
+    }
+  }
+  set_size(ring_size);
+  num_rings_ = num_rings;
+  ring_stride_ = 2 * ring_size;
   meta_ = reinterpret_cast<MetadataPage*>(region);
   mem_ = region + kMetaPageSize;
   mem_fd_ = std::move(mem_fd);
 }
 
+size_t SharedRingBuffer::RingForCurrentThread() const {
+  if (num_rings_ == 1)
+    return 0;
+  // This runs for every sampled allocation, so avoid gettid(), which is a
+  // syscall on glibc. pthread_t is usually the address of the thread's control
+  // block, so mix the bits before taking the low ones.
+  uint64_t thread = static_cast<uint64_t>(pthread_self());
+  return static_cast<size_t>((thread * 0x9E3779B97F4A7C15ULL) >> 32) &
+         (num_rings_ - 1);
+}
+
 SharedRingBuffer::Buffer SharedRingBuffer::BeginWrite(
     const ScopedSpinlock& spinlock,
-    size_t size) {
+    size_t size,
+    size_t ring) {
   PERFETTO_DCHECK(spinlock.locked());
+  PERFETTO_DCHECK(ring < num_rings_);
+  MetadataPage* meta = ring_meta(ring);
   Buffer result;
 
-  base::Optional<PointerPositions> opt_pos = GetPointerPositions();
+  base::Optional<PointerPositions> opt_pos = GetPointerPositions(ring);
   if (!opt_pos) {
-    meta_->stats.num_writes_corrupt++;
+    IncrementStat(&meta->stats.num_writes_corrupt);
     errno = EBADF;
     return result;
   }
@@ -205,18 +262,19 @@ SharedRingBuffer::Buffer SharedRingBuffer::BeginWrite(
   }
 
   if (size_with_header > write_avail(pos)) {
-    meta_->stats.num_writes_overflow++;
+    IncrementStat(&meta->stats.num_writes_overflow);
     errno = EAGAIN;
     return result;
   }
 
-  uint8_t* wr_ptr = at(pos.write_pos);
+  uint8_t* wr_ptr = at(ring, pos.write_pos);
 
   result.size = size;
   result.data = wr_ptr + kHeaderSize;
   result.bytes_free = write_avail(pos);
-  meta_->stats.bytes_written += size;
-  meta_->stats.num_writes_succeeded++;
+  result.ring = ring;
+  IncrementStat(&meta->stats.bytes_written, size);
+  IncrementStat(&meta->stats.num_writes_succeeded);
 
   // We can make this a relaxed store, as this gets picked up by the acquire
   // load in GetPointerPositions (and the release store below).
@@ -226,7 +284,7 @@ SharedRingBuffer::Buffer SharedRingBuffer::BeginWrite(
   // This needs to happen after the store above, so the reader never observes an
   // incorrect byte count. This is matched by the acquire load in
   // GetPointerPositions.
-  meta_->write_pos.fetch_add(size_with_header, std::memory_order_release);
+  meta->write_pos.fetch_add(size_with_header, std::memory_order_release);
   return result;
 }
 
@@ -246,9 +304,23 @@ void SharedRingBuffer::EndWrite(Buffer buf) {
 }
 
 SharedRingBuffer::Buffer SharedRingBuffer::BeginRead() {
-  base::Optional<PointerPositions> opt_pos = GetPointerPositions();
+  for (size_t i = 0; i < num_rings_; ++i) {
+    size_t ring = next_read_ring_;
+    next_read_ring_ = (next_read_ring_ + 1) & (num_rings_ - 1);
+    Buffer buf = BeginReadRing(ring);
+    if (buf || errno != EAGAIN)
+      return buf;
+  }
+  IncrementStat(&meta_->stats.num_reads_nodata);
+  errno = EAGAIN;
+  return Buffer();  // No data
+}
+
+SharedRingBuffer::Buffer SharedRingBuffer::BeginReadRing(size_t ring) {
+  MetadataPage* meta = ring_meta(ring);
+  base::Optional<PointerPositions> opt_pos = GetPointerPositions(ring);
   if (!opt_pos) {
-    meta_->stats.num_reads_corrupt++;
+    IncrementStat(&meta->stats.num_reads_corrupt);
     errno = EBADF;
     return Buffer();
   }
@@ -257,17 +329,15 @@ SharedRingBuffer::Buffer SharedRingBuffer::BeginRead() {
   size_t avail_read = read_avail(pos);
 
   if (avail_read < kHeaderSize) {
-    meta_->stats.num_reads_nodata++;
     errno = EAGAIN;
     return Buffer();  // No data
   }
 
-  uint8_t* rd_ptr = at(pos.read_pos);
+  uint8_t* rd_ptr = at(ring, pos.read_pos);
   PERFETTO_DCHECK(reinterpret_cast<uintptr_t>(rd_ptr) % kAlignment == 0);
   const size_t size = reinterpret_cast<std::atomic<uint32_t>*>(rd_ptr)->load(
       std::memory_order_acquire);
   if (size == 0) {
-    meta_->stats.num_reads_nodata++;
     errno = EAGAIN;
     return Buffer();
   }
@@ -278,22 +348,39 @@ SharedRingBuffer::Buffer SharedRingBuffer::BeginRead() {
         "Corrupted header detected, size=%zu"
         ", read_avail=%zu, rd=%" PRIu64 ", wr=%" PRIu64,
         size, avail_read, pos.read_pos, pos.write_pos);
-    meta_->stats.num_reads_corrupt++;
+    IncrementStat(&meta->stats.num_reads_corrupt);
     errno = EBADF;
     return Buffer();
   }
 
   rd_ptr += kHeaderSize;
   PERFETTO_DCHECK(reinterpret_cast<uintptr_t>(rd_ptr) % kAlignment == 0);
-  return Buffer(rd_ptr, size, write_avail(pos));
+  return Buffer(rd_ptr, size, write_avail(pos), ring);
 }
 
 void SharedRingBuffer::EndRead(Buffer buf) {
   if (!buf)
     return;
+  PERFETTO_DCHECK(buf.ring < num_rings_);
+  MetadataPage* meta = ring_meta(buf.ring);
   size_t size_with_header = base::AlignUp<kAlignment>(buf.size + kHeaderSize);
-  meta_->read_pos.fetch_add(size_with_header, std::memory_order_relaxed);
-  meta_->stats.num_reads_succeeded++;
+  meta->read_pos.fetch_add(size_with_header, std::memory_order_relaxed);
+  IncrementStat(&meta->stats.num_reads_succeeded);
+}
+
+// static
+void SharedRingBuffer::AddRingStats(const RingStats& ring_stats,
+                                    Stats* stats) {
+  constexpr auto kRelaxed = std::memory_order_relaxed;
+  stats->bytes_written += ring_stats.bytes_written.load(kRelaxed);
+  stats->num_writes_succeeded += ring_stats.num_writes_succeeded.load(kRelaxed);
+  stats->num_writes_corrupt += ring_stats.num_writes_corrupt.load(kRelaxed);
+  stats->num_writes_overflow += ring_stats.num_writes_overflow.load(kRelaxed);
+  stats->num_reads_succeeded += ring_stats.num_reads_succeeded.load(kRelaxed);
+  stats->num_reads_corrupt += ring_stats.num_reads_corrupt.load(kRelaxed);
+  stats->num_reads_nodata += ring_stats.num_reads_nodata.load(kRelaxed);
+  stats->num_batched_writes += ring_stats.num_batched_writes.load(kRelaxed);
+  stats->num_batched_records += ring_stats.num_batched_records.load(kRelaxed);
 }
 
 bool SharedRingBuffer::IsCorrupt(const PointerPositions& pos) {
@@ -314,16 +401,20 @@ SharedRingBuffer::SharedRingBuffer(SharedRingBuffer&& other) noexcept {
 SharedRingBuffer& SharedRingBuffer::operator=(
     SharedRingBuffer&& other) noexcept {
   mem_fd_ = std::move(other.mem_fd_);
-  std::tie(meta_, mem_, size_, size_mask_) =
-      std::tie(other.meta_, other.mem_, other.size_, other.size_mask_);
-  std::tie(other.meta_, other.mem_, other.size_, other.size_mask_) =
-      std::make_tuple(nullptr, nullptr, 0, 0);
+  std::tie(meta_, mem_, size_, size_mask_, num_rings_, ring_stride_,
+           next_read_ring_) =
+      std::tie(other.meta_, other.mem_, other.size_, other.size_mask_,
+               other.num_rings_, other.ring_stride_, other.next_read_ring_);
+  std::tie(other.meta_, other.mem_, other.size_, other.size_mask_,
+           other.num_rings_, other.ring_stride_, other.next_read_ring_) =
+      std::make_tuple(nullptr, nullptr, 0, 0, 1, 0, 0);
   return *this;
 }
 
 // static
-base::Optional<SharedRingBuffer> SharedRingBuffer::Create(size_t size) {
-  auto buf = SharedRingBuffer(CreateFlag(), size);
+base::Optional<SharedRingBuffer> SharedRingBuffer::Create(size_t size,
+                                                         size_t num_rings) {
+  auto buf = SharedRingBuffer(CreateFlag(), size, num_rings);
   if (!buf.is_valid())
     return base::nullopt;
   return base::make_optional(std::move(buf));
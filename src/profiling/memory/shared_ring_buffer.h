@@ -44,6 +44,14 @@ namespace profiling {
 // - Reads are atomic, no fragmentation.
 // - The reader sees writes in write order (% discarding).
 //
+// The buffer can be split into a power of two number of sub-rings of equal
+// size, each with its own spin-lock and read / write pointers. Writes still
+// take the spin-lock of their sub-ring, but writers pick a sub-ring by their
+// thread, so that threads of a many-threaded client are spread over several
+// locks rather than all contending on the same one. The reader consumes the
+// sub-rings round-robin; writes from the same thread are still seen in write
+// order, but writes from different threads can be reordered.
+//
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 // *IMPORTANT*: The ring buffer must be written under the assumption that the
 // other end modifies arbitrary shared memory without holding the spin-lock.
@@ -59,8 +67,8 @@ class SharedRingBuffer {
   class Buffer {
    public:
     Buffer() {}
-    Buffer(uint8_t* d, size_t s, uint64_t f)
-        : data(d), size(s), bytes_free(f) {}
+    Buffer(uint8_t* d, size_t s, uint64_t f, size_t r = 0)
+        : data(d), size(s), bytes_free(f), ring(r) {}
 
     Buffer(const Buffer&) = delete;
     Buffer& operator=(const Buffer&) = delete;
@@ -73,6 +81,8 @@ class SharedRingBuffer {
     uint8_t* data = nullptr;
     size_t size = 0;
     uint64_t bytes_free = 0;
+    // Index of the sub-ring this buffer belongs to.
+    size_t ring = 0;
   };
 
   enum ErrorState : uint64_t {
@@ -90,6 +100,12 @@ class SharedRingBuffer {
     PERFETTO_CROSS_ABI_ALIGNED(uint64_t) num_reads_succeeded;
     PERFETTO_CROSS_ABI_ALIGNED(uint64_t) num_reads_corrupt;
     PERFETTO_CROSS_ABI_ALIGNED(uint64_t) num_reads_nodata;
+    // Writes that carried a batch of records (e.g. RecordType::FreeBatch),
+    // and the total number of records in them. Their ratio is the average
+    // batch size. These come after the fields above so that their offsets
+    // stay the same for clients and services built before batching.
+    PERFETTO_CROSS_ABI_ALIGNED(uint64_t) num_batched_writes;
+    PERFETTO_CROSS_ABI_ALIGNED(uint64_t) num_batched_records;
 
     // Fields below get set by GetStats as copies of atomics in MetadataPage.
     PERFETTO_CROSS_ABI_ALIGNED(uint64_t) failed_spinlocks;
@@ -97,7 +113,39 @@ class SharedRingBuffer {
     PERFETTO_CROSS_ABI_ALIGNED(ErrorState) error_state;
   };
 
-  static base::Optional<SharedRingBuffer> Create(size_t);
+  // The counters of a sub-ring, as stored in its MetadataPage. Each is only
+  // updated by one thread at a time (the holder of the sub-ring's spin-lock
+  // for the write counters, the reader for the read ones), but GetStats reads
+  // them without taking the spin-locks of the sub-rings. Same layout as Stats.
+  struct RingStats {
+    PERFETTO_CROSS_ABI_ALIGNED(std::atomic<uint64_t>) bytes_written;
+    PERFETTO_CROSS_ABI_ALIGNED(std::atomic<uint64_t>) num_writes_succeeded;
+    PERFETTO_CROSS_ABI_ALIGNED(std::atomic<uint64_t>) num_writes_corrupt;
+    PERFETTO_CROSS_ABI_ALIGNED(std::atomic<uint64_t>) num_writes_overflow;
+
+    PERFETTO_CROSS_ABI_ALIGNED(std::atomic<uint64_t>) num_reads_succeeded;
+    PERFETTO_CROSS_ABI_ALIGNED(std::atomic<uint64_t>) num_reads_corrupt;
+    PERFETTO_CROSS_ABI_ALIGNED(std::atomic<uint64_t>) num_reads_nodata;
+    PERFETTO_CROSS_ABI_ALIGNED(std::atomic<uint64_t>) num_batched_writes;
+    PERFETTO_CROSS_ABI_ALIGNED(std::atomic<uint64_t>) num_batched_records;
+
+    // Unused, in place of the fields of Stats that are copied from atomics in
+    // the MetadataPage.
+    alignas(sizeof(uint64_t)) uint64_t reserved[3];
+  };
+
+  static_assert(sizeof(RingStats) == sizeof(Stats),
+                "RingStats needs to have the same layout as Stats");
+
+  // Maximum number of sub-rings. All their MetadataPages need to fit into the
+  // first page of the buffer.
+  static constexpr size_t kMaxRings = 16;
+
+  // |size| is the total size of all sub-rings. It must be a power of two
+  // number of pages, and each of the |num_rings| sub-rings must be at least
+  // one page.
+  static base::Optional<SharedRingBuffer> Create(size_t size,
+                                                 size_t num_rings = 1);
   static base::Optional<SharedRingBuffer> Attach(base::ScopedFile);
 
   ~SharedRingBuffer();
@@ -107,24 +155,40 @@ class SharedRingBuffer {
   SharedRingBuffer& operator=(SharedRingBuffer&&) noexcept;
 
   bool is_valid() const { return !!mem_; }
+  // Size of a single sub-ring, which bounds the size of a single write.
   size_t size() const { return size_; }
+  size_t num_rings() const { return num_rings_; }
   int fd() const { return *mem_fd_; }
-  size_t write_avail() {
-    auto pos = GetPointerPositions();
+  size_t write_avail(size_t ring = 0) {
+    auto pos = GetPointerPositions(ring);
     if (!pos)
       return 0;
     return write_avail(*pos);
   }
 
-  Buffer BeginWrite(const ScopedSpinlock& spinlock, size_t size);
+  // Returns the sub-ring the calling thread should write into.
+  size_t RingForCurrentThread() const;
+
+  // |spinlock| needs to be the lock of |ring|, see AcquireLock.
+  Buffer BeginWrite(const ScopedSpinlock& spinlock,
+                    size_t size,
+                    size_t ring = 0);
   void EndWrite(Buffer buf);
 
+  // Returns the next record of any of the sub-rings, visiting them
+  // round-robin.
   Buffer BeginRead();
   void EndRead(Buffer);
 
+  // |spinlock| needs to be the lock of the first sub-ring. The returned stats
+  // are summed over all sub-rings.
   Stats GetStats(ScopedSpinlock& spinlock) {
     PERFETTO_DCHECK(spinlock.locked());
-    Stats stats = meta_->stats;
+    Stats stats{};
+    // Only used for reporting, so do not wait for the writers that hold the
+    // locks of the other sub-rings.
+    for (size_t i = 0; i < num_rings_; ++i)
+      AddRingStats(ring_meta(i)->stats, &stats);
     stats.failed_spinlocks =
         meta_->failed_spinlocks.load(std::memory_order_relaxed);
     stats.error_state = meta_->error_state.load(std::memory_order_relaxed);
@@ -135,11 +199,21 @@ class SharedRingBuffer {
 
   void SetErrorState(ErrorState error) { meta_->error_state.store(error); }
 
+  // Accounts a successful BeginWrite as a batch of |num_records| records.
+  void AddBatchedWrite(const ScopedSpinlock& spinlock,
+                       uint64_t num_records,
+                       size_t ring = 0) {
+    PERFETTO_DCHECK(spinlock.locked());
+    IncrementStat(&ring_meta(ring)->stats.num_batched_writes);
+    IncrementStat(&ring_meta(ring)->stats.num_batched_records, num_records);
+  }
+
   // This is used by the caller to be able to hold the SpinLock after
   // BeginWrite has returned. This is so that additional bookkeeping can be
   // done under the lock. This will be used to increment the sequence_number.
-  ScopedSpinlock AcquireLock(ScopedSpinlock::Mode mode) {
-    auto lock = ScopedSpinlock(&meta_->spinlock, mode);
+  ScopedSpinlock AcquireLock(ScopedSpinlock::Mode mode, size_t ring = 0) {
+    PERFETTO_DCHECK(ring < num_rings_);
+    auto lock = ScopedSpinlock(&ring_meta(ring)->spinlock, mode);
     if (PERFETTO_UNLIKELY(!lock.locked()))
       meta_->failed_spinlocks.fetch_add(1, std::memory_order_relaxed);
     return lock;
@@ -175,7 +249,10 @@ class SharedRingBuffer {
     size_ = std::numeric_limits<size_t>::max() / 2;
   }
 
-  // Exposed for fuzzers.
+  // Exposed for fuzzers. There is one of these for each sub-ring, laid out
+  // back to back at the start of the first page. The fields that are not
+  // specific to a sub-ring (everything but the spinlock, the read and write
+  // positions and the stats) are only used in the first one.
   struct MetadataPage {
     static_assert(std::is_trivially_constructible<Spinlock>::value,
                   "Spinlock needs to be trivially constructible.");
@@ -189,17 +266,19 @@ class SharedRingBuffer {
     PERFETTO_CROSS_ABI_ALIGNED(std::atomic<ErrorState>) error_state;
     alignas(sizeof(uint64_t)) std::atomic<bool> shutting_down;
     alignas(sizeof(uint64_t)) std::atomic<bool> reader_paused;
-    // For stats that are only accessed by a single thread or under the
-    // spinlock, members of this struct are directly modified. Other stats use
-    // the atomics above this struct.
-    //
-    // When the user requests stats, the atomics above get copied into this
-    // struct, which is then returned.
-    alignas(sizeof(uint64_t)) Stats stats;
+    // Stats that are only modified by a single thread or under the spinlock.
+    // Other stats use the atomics above this struct. GetStats sums these over
+    // all sub-rings and adds the atomics above.
+    alignas(sizeof(uint64_t)) RingStats stats;
+    // Number of sub-rings. Zero, as set by services that predate sub-rings,
+    // means one.
+    PERFETTO_CROSS_ABI_ALIGNED(uint64_t) num_rings;
   };
 
-  static_assert(sizeof(MetadataPage) == 144,
+  static_assert(sizeof(MetadataPage) == 168,
                 "metadata page size needs to be ABI independent");
+  static_assert(sizeof(MetadataPage) * kMaxRings <= base::kPageSize,
+                "metadata of all sub-rings needs to fit into one page");
 
  private:
   struct PointerPositions {
@@ -211,15 +290,28 @@ class SharedRingBuffer {
   struct AttachFlag {};
   SharedRingBuffer(const SharedRingBuffer&) = delete;
   SharedRingBuffer& operator=(const SharedRingBuffer&) = delete;
-  SharedRingBuffer(CreateFlag, size_t size);
+  SharedRingBuffer(CreateFlag, size_t size, size_t num_rings);
   SharedRingBuffer(AttachFlag, base::ScopedFile mem_fd) {
-    Initialize(std::move(mem_fd));
+    Initialize(std::move(mem_fd), /*num_rings=*/0);
   }
 
-  void Initialize(base::ScopedFile mem_fd);
+  // If |num_rings| is 0, it is read from the metadata page.
+  void Initialize(base::ScopedFile mem_fd, size_t num_rings);
   bool IsCorrupt(const PointerPositions& pos);
+  Buffer BeginReadRing(size_t ring);
+  static void AddRingStats(const RingStats& ring_stats, Stats* stats);
+
+  // See RingStats: there are no concurrent updates, so this does not need an
+  // atomic read-modify-write.
+  static void IncrementStat(std::atomic<uint64_t>* stat, uint64_t n = 1) {
+    stat->store(stat->load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+  }
+
+  inline MetadataPage* ring_meta(size_t ring) { return meta_ + ring; }
 
-  inline base::Optional<PointerPositions> GetPointerPositions() {
+  inline base::Optional<PointerPositions> GetPointerPositions(size_t ring) {
+    const MetadataPage* meta = ring_meta(ring);
     PointerPositions pos;
     // We need to acquire load the write_pos to make sure we observe a
     // consistent ring buffer in BeginRead, otherwise it is possible that we
@@ -227,8 +319,8 @@ class SharedRingBuffer {
     // payload.
     //
     // This is matched by a release at the end of BeginWrite.
-    pos.write_pos = meta_->write_pos.load(std::memory_order_acquire);
-    pos.read_pos = meta_->read_pos.load(std::memory_order_relaxed);
+    pos.write_pos = meta->write_pos.load(std::memory_order_acquire);
+    pos.read_pos = meta->read_pos.load(std::memory_order_relaxed);
 
     base::Optional<PointerPositions> result;
     if (IsCorrupt(pos))
@@ -253,16 +345,24 @@ class SharedRingBuffer {
     return size_ - read_avail(pos);
   }
 
-  inline uint8_t* at(uint64_t pos) { return mem_ + (pos & size_mask_); }
+  inline uint8_t* at(size_t ring, uint64_t pos) {
+    return mem_ + ring * ring_stride_ + (pos & size_mask_);
+  }
 
   base::ScopedFile mem_fd_;
   MetadataPage* meta_ = nullptr;  // Start of the mmaped region.
   uint8_t* mem_ = nullptr;  // Start of the contents (i.e. meta_ + kPageSize).
 
-  // Size of the ring buffer contents, without including metadata or the 2nd
+  // Size of one sub-ring's contents, without including metadata or the 2nd
   // mmap.
   size_t size_ = 0;
   size_t size_mask_ = 0;
+  size_t num_rings_ = 1;
+  // Distance between the starts of two sub-rings in the mapping, i.e. twice
+  // the size of a sub-ring.
+  size_t ring_stride_ = 0;
+  // Sub-ring BeginRead looks at first.
+  size_t next_read_ring_ = 0;
 
   // Remember to update the move ctor when adding new fields.
 };
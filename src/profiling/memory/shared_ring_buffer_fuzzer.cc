@@ -66,6 +66,8 @@ int FuzzRingBuffer(const uint8_t* data, size_t size) {
   memcpy(&header, data, sizeof(header));
   header.spinlock.locked = false;
   header.spinlock.poisoned = false;
+  // The payload is a single ring.
+  header.num_rings = 1;
 
   PERFETTO_CHECK(ftruncate(*fd, static_cast<off_t>(total_size_pages *
                                                    base::kPageSize)) == 0);
@@ -21,6 +21,7 @@
 #include <random>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "perfetto/ext/base/optional.h"
 #include "test/gtest_and_gmock.h"
@@ -34,13 +35,16 @@ std::string ToString(const SharedRingBuffer::Buffer& buf_and_size) {
                      buf_and_size.size);
 }
 
-bool TryWrite(SharedRingBuffer* wr, const char* src, size_t size) {
+bool TryWrite(SharedRingBuffer* wr,
+              const char* src,
+              size_t size,
+              size_t ring) {
   SharedRingBuffer::Buffer buf;
   {
-    auto lock = wr->AcquireLock(ScopedSpinlock::Mode::Try);
+    auto lock = wr->AcquireLock(ScopedSpinlock::Mode::Try, ring);
     if (!lock.locked())
       return false;
-    buf = wr->BeginWrite(lock, size);
+    buf = wr->BeginWrite(lock, size, ring);
   }
   if (!buf)
     return false;
@@ -49,6 +53,10 @@ bool TryWrite(SharedRingBuffer* wr, const char* src, size_t size) {
   return true;
 }
 
+bool TryWrite(SharedRingBuffer* wr, const char* src, size_t size) {
+  return TryWrite(wr, src, size, wr->RingForCurrentThread());
+}
+
 void StructuredTest(SharedRingBuffer* wr, SharedRingBuffer* rd) {
   ASSERT_TRUE(wr);
   ASSERT_TRUE(wr->is_valid());
@@ -186,9 +194,9 @@ TEST(SharedRingBufferTest, SingleThreadAttach) {
   StructuredTest(&*buf1, &*buf2);
 }
 
-TEST(SharedRingBufferTest, MultiThreadingTest) {
+void MultiThreadedTest(size_t num_rings) {
   constexpr auto kBufSize = base::kPageSize * 1024;  // 4 MB
-  SharedRingBuffer rd = *SharedRingBuffer::Create(kBufSize);
+  SharedRingBuffer rd = *SharedRingBuffer::Create(kBufSize, num_rings);
   SharedRingBuffer wr =
       *SharedRingBuffer::Attach(base::ScopedFile(dup(rd.fd())));
 
@@ -254,6 +262,83 @@ TEST(SharedRingBufferTest, MultiThreadingTest) {
   reader_thread.join();
 }
 
+TEST(SharedRingBufferTest, MultiThreadingTest) {
+  MultiThreadedTest(1);
+}
+
+TEST(SharedRingBufferTest, MultiThreadingSubRings) {
+  MultiThreadedTest(4);
+}
+
+TEST(SharedRingBufferTest, SubRingsAttach) {
+  constexpr auto kBufSize = base::kPageSize * 16;
+  base::Optional<SharedRingBuffer> buf1 =
+      SharedRingBuffer::Create(kBufSize, /*num_rings=*/4);
+  ASSERT_TRUE(buf1);
+  base::Optional<SharedRingBuffer> buf2 =
+      SharedRingBuffer::Attach(base::ScopedFile(dup(buf1->fd())));
+  ASSERT_TRUE(buf2);
+  EXPECT_EQ(buf2->num_rings(), 4u);
+  EXPECT_EQ(buf2->size(), base::kPageSize * 4);
+  StructuredTest(&*buf2, &*buf1);
+}
+
+TEST(SharedRingBufferTest, SubRingsRoundRobin) {
+  constexpr auto kBufSize = base::kPageSize * 16;
+  base::Optional<SharedRingBuffer> rd =
+      SharedRingBuffer::Create(kBufSize, /*num_rings=*/4);
+  ASSERT_TRUE(rd);
+  base::Optional<SharedRingBuffer> wr =
+      SharedRingBuffer::Attach(base::ScopedFile(dup(rd->fd())));
+  ASSERT_TRUE(wr);
+
+  ASSERT_TRUE(TryWrite(&*wr, "a1", 3, /*ring=*/1));
+  ASSERT_TRUE(TryWrite(&*wr, "a2", 3, /*ring=*/1));
+  ASSERT_TRUE(TryWrite(&*wr, "b1", 3, /*ring=*/3));
+  // Filling one sub-ring does not affect the others.
+  std::string data(base::kPageSize * 4 - sizeof(uint64_t), '.');
+  ASSERT_TRUE(TryWrite(&*wr, data.data(), data.size(), /*ring=*/2));
+  ASSERT_FALSE(TryWrite(&*wr, "c", 1, /*ring=*/2));
+  ASSERT_TRUE(TryWrite(&*wr, "d", 1, /*ring=*/0));
+
+  std::vector<std::string> read;
+  for (;;) {
+    auto buf = rd->BeginRead();
+    if (!buf)
+      break;
+    read.push_back(ToString(buf));
+    rd->EndRead(std::move(buf));
+  }
+  ASSERT_EQ(read.size(), 5u);
+  // Writes to the same sub-ring stay in order, sub-rings are interleaved.
+  EXPECT_EQ(read[0], "d");
+  EXPECT_EQ(read[1], std::string("a1", 3));
+  EXPECT_EQ(read[2], data);
+  EXPECT_EQ(read[3], std::string("b1", 3));
+  EXPECT_EQ(read[4], std::string("a2", 3));
+
+  SharedRingBuffer::Stats stats;
+  {
+    auto lock = rd->AcquireLock(ScopedSpinlock::Mode::Try);
+    ASSERT_TRUE(lock.locked());
+    stats = rd->GetStats(lock);
+  }
+  EXPECT_EQ(stats.num_writes_succeeded, 5u);
+  EXPECT_EQ(stats.num_writes_overflow, 1u);
+  EXPECT_EQ(stats.num_reads_succeeded, 5u);
+}
+
+TEST(SharedRingBufferTest, InvalidNumRings) {
+  constexpr auto kBufSize = base::kPageSize * 4;
+  EXPECT_EQ(SharedRingBuffer::Create(kBufSize, 0), base::nullopt);
+  EXPECT_EQ(SharedRingBuffer::Create(kBufSize, 3), base::nullopt);
+  // Less than a page per sub-ring.
+  EXPECT_EQ(SharedRingBuffer::Create(kBufSize, 8), base::nullopt);
+  EXPECT_EQ(SharedRingBuffer::Create(base::kPageSize * 64,
+                                     SharedRingBuffer::kMaxRings * 2),
+            base::nullopt);
+}
+
 TEST(SharedRingBufferTest, InvalidSize) {
   constexpr auto kBufSize = base::kPageSize * 4 + 1;
   base::Optional<SharedRingBuffer> wr = SharedRingBuffer::Create(kBufSize);
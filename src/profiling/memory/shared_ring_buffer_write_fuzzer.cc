@@ -71,6 +71,8 @@ int FuzzRingBufferWrite(const uint8_t* data, size_t size) {
   SharedRingBuffer::MetadataPage& metadata_page = header.metadata_page;
   metadata_page.spinlock.locked = false;
   metadata_page.spinlock.poisoned = false;
+  // The payload is a single ring.
+  metadata_page.num_rings = 1;
 
   PERFETTO_CHECK(ftruncate(*fd, static_cast<off_t>(total_size_pages *
                                                    base::kPageSize)) == 0);
@@ -355,6 +355,19 @@ void UnwindingWorker::HandleBuffer(UnwindingWorker* self,
       client_data->free_records.clear();
       client_data->free_records.reserve(kRecordBatchSize);
     }
+  } else if (msg.record_type == RecordType::FreeBatch) {
+    for (uint64_t i = 0; i < msg.free_batch_header->num_entries; ++i) {
+      FreeRecord rec;
+      rec.pid = peer_pid;
+      rec.data_source_instance_id = data_source_instance_id;
+      memcpy(&rec.entry, &msg.free_batch_entries[i], sizeof(rec.entry));
+      client_data->free_records.emplace_back(std::move(rec));
+      if (client_data->free_records.size() == kRecordBatchSize) {
+        delegate->PostFreeRecord(self, std::move(client_data->free_records));
+        client_data->free_records.clear();
+        client_data->free_records.reserve(kRecordBatchSize);
+      }
+    }
   } else if (msg.record_type == RecordType::HeapName) {
     HeapNameRecord rec;
     rec.pid = peer_pid;
@@ -56,21 +56,29 @@ void UnsafeMemcpy(char* dest, const char* src, size_t n)
   }
 }
 
+// |batched_records| is the number of records carried by a batch message, or
+// zero for messages that carry a single record.
 template <typename F>
-int64_t WithBuffer(SharedRingBuffer* shmem, size_t total_size, F fn) {
+int64_t WithBuffer(SharedRingBuffer* shmem,
+                   size_t total_size,
+                   F fn,
+                   uint64_t batched_records = 0) {
   if (total_size > shmem->size()) {
     errno = EMSGSIZE;
     return -1;
   }
   SharedRingBuffer::Buffer buf;
+  size_t ring = shmem->RingForCurrentThread();
   {
-    ScopedSpinlock lock = shmem->AcquireLock(ScopedSpinlock::Mode::Try);
+    ScopedSpinlock lock = shmem->AcquireLock(ScopedSpinlock::Mode::Try, ring);
     if (!lock.locked()) {
       PERFETTO_DLOG("Failed to acquire spinlock.");
       errno = EAGAIN;
       return -1;
     }
-    buf = shmem->BeginWrite(lock, total_size);
+    buf = shmem->BeginWrite(lock, total_size, ring);
+    if (buf && batched_records)
+      shmem->AddBatchedWrite(lock, batched_records, ring);
   }
   if (!buf) {
     PERFETTO_DLOG("Buffer overflow.");
@@ -114,6 +122,24 @@ int64_t SendWireMessage(SharedRingBuffer* shmem, const WireMessage& msg) {
                    sizeof(*msg.free_header));
           });
     }
+    case RecordType::FreeBatch: {
+      uint64_t num_entries = msg.free_batch_header->num_entries;
+      size_t entries_size =
+          static_cast<size_t>(num_entries) * sizeof(*msg.free_batch_entries);
+      size_t total_size = sizeof(msg.record_type) +
+                          sizeof(*msg.free_batch_header) + entries_size;
+      return WithBuffer(
+          shmem, total_size,
+          [msg, entries_size](SharedRingBuffer::Buffer* buf) {
+            uint8_t* wr = buf->data;
+            memcpy(wr, &msg.record_type, sizeof(msg.record_type));
+            wr += sizeof(msg.record_type);
+            memcpy(wr, msg.free_batch_header, sizeof(*msg.free_batch_header));
+            wr += sizeof(*msg.free_batch_header);
+            memcpy(wr, msg.free_batch_entries, entries_size);
+          },
+          num_entries);
+    }
     case RecordType::HeapName: {
       constexpr size_t total_size =
           sizeof(msg.record_type) + sizeof(*msg.heap_name_header);
@@ -155,6 +181,20 @@ bool ReceiveWireMessage(char* buf, size_t size, WireMessage* out) {
       PERFETTO_DFATAL_OR_ELOG("Cannot read free header.");
       return false;
     }
+  } else if (*record_type == RecordType::FreeBatch) {
+    if (!ViewAndAdvance<FreeBatchHeader>(&buf, &out->free_batch_header, end)) {
+      PERFETTO_DFATAL_OR_ELOG("Cannot read free batch header.");
+      return false;
+    }
+    // Compare entry counts rather than byte sizes, so that a bogus
+    // num_entries cannot overflow the multiplication.
+    uint64_t max_entries =
+        static_cast<uint64_t>(end - buf) / sizeof(FreeEntry);
+    if (out->free_batch_header->num_entries > max_entries) {
+      PERFETTO_DFATAL_OR_ELOG("Free batch overflows the record.");
+      return false;
+    }
+    out->free_batch_entries = reinterpret_cast<FreeEntry*>(buf);
   } else if (*record_type == RecordType::HeapName) {
     if (!ViewAndAdvance<HeapName>(&buf, &out->heap_name_header, end)) {
       PERFETTO_DFATAL_OR_ELOG("Cannot read free header.");
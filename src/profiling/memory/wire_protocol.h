@@ -69,6 +69,8 @@ constexpr size_t kMaxRegisterDataSize =
 // record size (uint64_t) | record type (RecordType = uint64_t) | record
 // If record type is Malloc, the record format is AllocMetdata | raw stack.
 // If the record type is Free, the record is a FreeEntry.
+// If the record type is FreeBatch, the record is a FreeBatchHeader followed by
+// FreeBatchHeader::num_entries FreeEntry-s.
 // If record type is HeapName, the record is a HeapName.
 // On connect, heapprofd sends one ClientConfiguration struct over the control
 // socket.
@@ -96,6 +98,7 @@ struct ClientConfiguration {
   PERFETTO_CROSS_ABI_ALIGNED(bool) disable_fork_teardown;
   PERFETTO_CROSS_ABI_ALIGNED(bool) disable_vfork_detection;
   PERFETTO_CROSS_ABI_ALIGNED(bool) all_heaps;
+  PERFETTO_CROSS_ABI_ALIGNED(bool) batch_frees;
   // Just double check that the array sizes are in correct order.
 };
 
@@ -103,6 +106,7 @@ enum class RecordType : uint64_t {
   Free = 0,
   Malloc = 1,
   HeapName = 2,
+  FreeBatch = 3,
 };
 
 // Make the whole struct 8-aligned. This is to make sizeof(AllocMetdata)
@@ -131,6 +135,10 @@ struct FreeEntry {
   PERFETTO_CROSS_ABI_ALIGNED(uint32_t) heap_id;
 };
 
+struct FreeBatchHeader {
+  PERFETTO_CROSS_ABI_ALIGNED(uint64_t) num_entries;
+};
+
 struct HeapName {
   PERFETTO_CROSS_ABI_ALIGNED(uint64_t) sample_interval;
   PERFETTO_CROSS_ABI_ALIGNED(uint32_t) heap_id;
@@ -142,6 +150,8 @@ static_assert(sizeof(AllocMetadata) == 328,
               "AllocMetadata needs to be the same size across ABIs.");
 static_assert(sizeof(FreeEntry) == 24,
               "FreeEntry needs to be the same size across ABIs.");
+static_assert(sizeof(FreeBatchHeader) == 8,
+              "FreeBatchHeader needs to be the same size across ABIs.");
 static_assert(sizeof(HeapName) == 80,
               "HeapName needs to be the same size across ABIs.");
 static_assert(sizeof(ClientConfiguration) == 4656,
@@ -159,6 +169,10 @@ struct WireMessage {
   AllocMetadata* alloc_header;
   FreeEntry* free_header;
   HeapName* heap_name_header;
+  // For RecordType::FreeBatch, points to free_batch_header->num_entries
+  // entries.
+  FreeBatchHeader* free_batch_header;
+  FreeEntry* free_batch_entries;
 
   char* payload;
   size_t payload_size;
@@ -132,6 +132,51 @@ TEST(WireProtocolTest, FreeMessage) {
   shmem_server->EndRead(std::move(buf));
 }
 
+TEST(WireProtocolTest, FreeBatchMessage) {
+  FreeEntry entries[3] = {};
+  for (uint64_t i = 0; i < 3; ++i) {
+    entries[i].sequence_number = 0x100 + i;
+    entries[i].addr = 0x222222222222222 + i;
+    entries[i].heap_id = static_cast<uint32_t>(i);
+  }
+  FreeBatchHeader header = {};
+  header.num_entries = 3;
+  WireMessage msg = {};
+  msg.record_type = RecordType::FreeBatch;
+  msg.free_batch_header = &header;
+  msg.free_batch_entries = entries;
+
+  auto shmem_client = SharedRingBuffer::Create(kShmemSize);
+  ASSERT_TRUE(shmem_client);
+  ASSERT_TRUE(shmem_client->is_valid());
+  auto shmem_server = SharedRingBuffer::Attach(CopyFD(shmem_client->fd()));
+
+  ASSERT_GE(SendWireMessage(&shmem_client.value(), msg), 0);
+
+  auto buf = shmem_server->BeginRead();
+  ASSERT_TRUE(buf);
+  WireMessage recv_msg;
+  ASSERT_TRUE(ReceiveWireMessage(reinterpret_cast<char*>(buf.data), buf.size,
+                                 &recv_msg));
+
+  ASSERT_EQ(recv_msg.record_type, msg.record_type);
+  ASSERT_EQ(recv_msg.free_batch_header->num_entries, 3u);
+  for (size_t i = 0; i < 3; ++i)
+    EXPECT_EQ(recv_msg.free_batch_entries[i], entries[i]);
+
+  shmem_server->EndRead(std::move(buf));
+
+  SharedRingBuffer::Stats stats;
+  {
+    auto lock = shmem_server->AcquireLock(ScopedSpinlock::Mode::Try);
+    ASSERT_TRUE(lock.locked());
+    stats = shmem_server->GetStats(lock);
+  }
+  EXPECT_EQ(stats.num_writes_succeeded, 1u);
+  EXPECT_EQ(stats.num_batched_writes, 1u);
+  EXPECT_EQ(stats.num_batched_records, 3u);
+}
+
 TEST(GetHeapSamplingInterval, Default) {
   ClientConfiguration cli_config{};
   cli_config.all_heaps = true;
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/perf/callchain_aggregator.h"
+
+#include <algorithm>
+
+#include <linux/perf_event.h>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+// Separates the userspace frames of a callchain from the kernel ones (which
+// are below it in the trie). Cannot be a valid userspace address.
+constexpr uint64_t kKernelMarker = static_cast<uint64_t>(PERF_CONTEXT_KERNEL);
+
+}  // namespace
+
+void CallchainAggregator::AddSample(pid_t pid,
+                                    uint64_t timestamp,
+                                    const std::vector<uint64_t>& kernel_ips,
+                                    const std::vector<uint64_t>& user_ips) {
+  PERFETTO_DCHECK(!user_ips.empty());
+  PERFETTO_DCHECK(kernel_ips.empty() || kernel_ips[0] == kKernelMarker);
+
+  ProcessTrie& trie = processes_[pid];  // insert if new
+  size_t nodes_before = trie.nodes.size();
+  if (trie.nodes.empty())
+    trie.nodes.push_back(Node{0, 0, 0});  // root
+
+  // Insert outermost frame first.
+  uint32_t node = 0;
+  for (auto it = user_ips.crbegin(); it != user_ips.crend(); ++it)
+    node = GetOrCreateChild(&trie, node, *it);
+  if (!kernel_ips.empty()) {
+    node = GetOrCreateChild(&trie, node, kKernelMarker);
+    for (size_t i = kernel_ips.size() - 1; i > 0; i--)
+      node = GetOrCreateChild(&trie, node, kernel_ips[i]);
+  }
+  trie.nodes[node].count++;
+
+  // Samples are read one cpu at a time, so they are not in timestamp order.
+  trie.last_timestamp = std::max(trie.last_timestamp, timestamp);
+  num_nodes_ += trie.nodes.size() - nodes_before;
+}
+
+std::vector<pid_t> CallchainAggregator::GetPids() const {
+  std::vector<pid_t> ret;
+  ret.reserve(processes_.size());
+  for (const auto& pid_and_trie : processes_)
+    ret.push_back(pid_and_trie.first);
+  return ret;
+}
+
+AggregatedSamples CallchainAggregator::TakeSamples(pid_t pid) {
+  AggregatedSamples ret;
+  ret.pid = pid;
+  auto it = processes_.find(pid);
+  if (it == processes_.end())
+    return ret;
+
+  const ProcessTrie& trie = it->second;
+  ret.timestamp = trie.last_timestamp;
+
+  std::vector<uint64_t> ips;
+  for (uint32_t i = 1; i < trie.nodes.size(); i++) {
+    if (trie.nodes[i].count == 0)
+      continue;
+
+    // Walking up to the root gives the frames innermost first.
+    ips.clear();
+    for (uint32_t n = i; n != 0; n = trie.nodes[n].parent)
+      ips.push_back(trie.nodes[n].ip);
+
+    AggregatedCallchain callchain;
+    callchain.count = trie.nodes[i].count;
+    auto marker = std::find(ips.begin(), ips.end(), kKernelMarker);
+    if (marker != ips.end()) {
+      callchain.kernel_ips.reserve(
+          static_cast<size_t>(marker - ips.begin()) + 1);
+      callchain.kernel_ips.push_back(kKernelMarker);
+      callchain.kernel_ips.insert(callchain.kernel_ips.end(), ips.begin(),
+                                  marker);
+      callchain.user_ips.assign(marker + 1, ips.end());
+    } else {
+      callchain.user_ips = ips;
+    }
+    ret.callchains.emplace_back(std::move(callchain));
+  }
+
+  num_nodes_ -= trie.nodes.size();
+  processes_.erase(it);
+  return ret;
+}
+
+// static
+uint32_t CallchainAggregator::GetOrCreateChild(ProcessTrie* trie,
+                                               uint32_t parent,
+                                               uint64_t ip) {
+  auto key = std::make_pair(parent, ip);
+  auto it = trie->children.find(key);
+  if (it != trie->children.end())
+    return it->second;
+
+  auto child = static_cast<uint32_t>(trie->nodes.size());
+  trie->nodes.push_back(Node{ip, parent, 0});
+  trie->children.emplace(key, child);
+  return child;
+}
+
+}  // namespace profiling
+}  // namespace perfetto
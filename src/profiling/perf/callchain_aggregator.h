@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_PERF_CALLCHAIN_AGGREGATOR_H_
+#define SRC_PROFILING_PERF_CALLCHAIN_AGGREGATOR_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "src/profiling/perf/common_types.h"
+
+namespace perfetto {
+namespace profiling {
+
+// Counts identical frame pointer callchains (see
+// |EventConfig.frame_pointer_callchains|) per process, so that each unique
+// callchain is symbolized and written once per aggregation period, instead of
+// once per sample.
+//
+// The callchains of a process are kept in a trie of raw instruction pointers,
+// outermost frame at the root, so that the common prefixes of the callchains
+// are stored once.
+class CallchainAggregator {
+ public:
+  // |kernel_ips| and |user_ips| as in |ParsedSample|. |user_ips| must not be
+  // empty.
+  void AddSample(pid_t pid,
+                 uint64_t timestamp,
+                 const std::vector<uint64_t>& kernel_ips,
+                 const std::vector<uint64_t>& user_ips);
+
+  std::vector<pid_t> GetPids() const;
+
+  // Returns the callchains of |pid| aggregated since the last call (in no
+  // particular order), and forgets them.
+  AggregatedSamples TakeSamples(pid_t pid);
+
+  bool empty() const { return processes_.empty(); }
+  // Number of trie nodes across all processes.
+  size_t num_nodes() const { return num_nodes_; }
+
+ private:
+  struct Node {
+    uint64_t ip;
+    uint32_t parent;
+    // Number of samples with this node as the innermost frame.
+    uint64_t count;
+  };
+
+  struct ProcessTrie {
+    // Index 0 is the root, which has no instruction pointer.
+    std::vector<Node> nodes;
+    // (parent index, ip) -> child index
+    std::map<std::pair<uint32_t, uint64_t>, uint32_t> children;
+    uint64_t last_timestamp = 0;
+  };
+
+  static uint32_t GetOrCreateChild(ProcessTrie* trie,
+                                   uint32_t parent,
+                                   uint64_t ip);
+
+  std::map<pid_t, ProcessTrie> processes_;
+  size_t num_nodes_ = 0;
+};
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_PERF_CALLCHAIN_AGGREGATOR_H_
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/perf/callchain_aggregator.h"
+
+#include <linux/perf_event.h>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+constexpr uint64_t kKernelCtx = static_cast<uint64_t>(PERF_CONTEXT_KERNEL);
+
+const AggregatedCallchain* FindCallchain(
+    const AggregatedSamples& samples,
+    const std::vector<uint64_t>& user_ips) {
+  for (const AggregatedCallchain& callchain : samples.callchains) {
+    if (callchain.user_ips == user_ips)
+      return &callchain;
+  }
+  return nullptr;
+}
+
+TEST(CallchainAggregatorTest, CountsIdenticalCallchains) {
+  CallchainAggregator aggregator;
+  aggregator.AddSample(1, 100, {}, {0x30, 0x20, 0x10});
+  aggregator.AddSample(1, 300, {}, {0x30, 0x20, 0x10});
+  aggregator.AddSample(1, 200, {}, {0x40, 0x20, 0x10});
+  aggregator.AddSample(1, 200, {}, {0x20, 0x10});
+
+  // The common prefix (0x10, 0x20) is stored once.
+  EXPECT_EQ(aggregator.num_nodes(), 5u);
+  EXPECT_THAT(aggregator.GetPids(), ElementsAre(1));
+
+  AggregatedSamples samples = aggregator.TakeSamples(1);
+  EXPECT_EQ(samples.pid, 1);
+  EXPECT_EQ(samples.timestamp, 300u);
+  ASSERT_EQ(samples.callchains.size(), 3u);
+
+  const AggregatedCallchain* callchain =
+      FindCallchain(samples, {0x30, 0x20, 0x10});
+  ASSERT_NE(callchain, nullptr);
+  EXPECT_EQ(callchain->count, 2u);
+  EXPECT_THAT(callchain->kernel_ips, IsEmpty());
+
+  callchain = FindCallchain(samples, {0x40, 0x20, 0x10});
+  ASSERT_NE(callchain, nullptr);
+  EXPECT_EQ(callchain->count, 1u);
+
+  callchain = FindCallchain(samples, {0x20, 0x10});
+  ASSERT_NE(callchain, nullptr);
+  EXPECT_EQ(callchain->count, 1u);
+
+  EXPECT_TRUE(aggregator.empty());
+  EXPECT_EQ(aggregator.num_nodes(), 0u);
+}
+
+TEST(CallchainAggregatorTest, KeepsKernelFramesSeparate) {
+  CallchainAggregator aggregator;
+  aggregator.AddSample(1, 100, {kKernelCtx, 0xf2, 0xf1}, {0x20, 0x10});
+  aggregator.AddSample(1, 100, {}, {0x20, 0x10});
+
+  AggregatedSamples samples = aggregator.TakeSamples(1);
+  ASSERT_EQ(samples.callchains.size(), 2u);
+  for (const AggregatedCallchain& callchain : samples.callchains) {
+    EXPECT_THAT(callchain.user_ips, ElementsAre(0x20, 0x10));
+    EXPECT_EQ(callchain.count, 1u);
+    if (!callchain.kernel_ips.empty()) {
+      EXPECT_THAT(callchain.kernel_ips, ElementsAre(kKernelCtx, 0xf2, 0xf1));
+    }
+  }
+}
+
+TEST(CallchainAggregatorTest, SeparatesProcesses) {
+  CallchainAggregator aggregator;
+  aggregator.AddSample(1, 100, {}, {0x20, 0x10});
+  aggregator.AddSample(2, 100, {}, {0x20, 0x10});
+  EXPECT_THAT(aggregator.GetPids(), ElementsAre(1, 2));
+
+  AggregatedSamples samples = aggregator.TakeSamples(2);
+  ASSERT_EQ(samples.callchains.size(), 1u);
+  EXPECT_EQ(samples.callchains[0].count, 1u);
+  EXPECT_THAT(aggregator.GetPids(), ElementsAre(1));
+
+  // Nothing left for an already taken pid.
+  EXPECT_THAT(aggregator.TakeSamples(2).callchains, IsEmpty());
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
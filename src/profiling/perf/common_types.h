@@ -18,6 +18,7 @@
 #define SRC_PROFILING_PERF_COMMON_TYPES_H_
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <linux/perf_event.h>
@@ -55,7 +56,12 @@ struct ParsedSample {
   std::unique_ptr<unwindstack::Regs> regs;
   std::vector<char> stack;
   bool stack_maxed = false;
+  // Kernel part of the callchain, innermost frame first. Starts with the
+  // PERF_CONTEXT_KERNEL marker if not empty.
   std::vector<uint64_t> kernel_ips;
+  // Userspace part of the callchain (without the marker), innermost frame
+  // first. Only collected when using frame pointer callchains.
+  std::vector<uint64_t> user_ips;
 };
 
 // Entry in an unwinding queue. Either a sample that requires unwinding, or a
@@ -90,6 +96,34 @@ struct CompletedSample {
   unwindstack::ErrorCode unwind_error = unwindstack::ERROR_NONE;
 };
 
+// A unique frame pointer callchain of a process, and the number of times it
+// was sampled. See |CallchainAggregator|.
+struct AggregatedCallchain {
+  // Same layout as in |ParsedSample|.
+  std::vector<uint64_t> kernel_ips;
+  std::vector<uint64_t> user_ips;
+  uint64_t count = 0;
+
+  // Filled in by the unwinder, which symbolizes the callchain.
+  std::vector<unwindstack::FrameData> frames;
+  std::vector<std::string> build_ids;
+};
+
+// Aggregated samples of a single process, over one aggregation period.
+struct AggregatedSamples {
+  // move-only
+  AggregatedSamples() = default;
+  AggregatedSamples(const AggregatedSamples&) = delete;
+  AggregatedSamples& operator=(const AggregatedSamples&) = delete;
+  AggregatedSamples(AggregatedSamples&&) noexcept = default;
+  AggregatedSamples& operator=(AggregatedSamples&&) noexcept = default;
+
+  pid_t pid = 0;
+  // Of the latest aggregated sample.
+  uint64_t timestamp = 0;
+  std::vector<AggregatedCallchain> callchains;
+};
+
 }  // namespace profiling
 }  // namespace perfetto
 
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/perf/elf_cache.h"
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace profiling {
+
+void ElfCache::PopulateMaps(unwindstack::Maps* maps) {
+  if (entries_.empty())
+    return;
+  for (auto& map_info : *maps) {
+    if (map_info->elf() || map_info->name().empty() ||
+        (map_info->flags() & unwindstack::MAPS_FLAGS_DEVICE_MAP)) {
+      continue;
+    }
+    const std::string& name = map_info->name();
+    auto name_it = build_id_by_name_.find(NameKey(name, map_info->offset()));
+    if (name_it == build_id_by_name_.end())
+      continue;
+
+    // Reads the build id note from the file, and remembers it in the
+    // MapInfo. Does not parse the rest of the file.
+    std::string build_id = map_info->GetBuildID();
+    if (build_id.empty())
+      continue;
+    auto it = entries_.find(Key(build_id, map_info->offset()));
+    if (it == entries_.end()) {
+      // The file was replaced since it was cached.
+      invalidations_++;
+      continue;
+    }
+    hits_++;
+    Entry& entry = *it->second;
+    map_info->set_elf(entry.elf);
+    map_info->set_elf_offset(entry.elf_offset);
+    map_info->set_elf_start_offset(entry.elf_start_offset);
+    lru_.splice(lru_.begin(), lru_, it->second);
+  }
+}
+
+void ElfCache::Add(unwindstack::MapInfo* map_info) {
+  if (max_entries_ == 0)
+    return;
+  std::shared_ptr<unwindstack::Elf>& elf = map_info->elf();
+  if (!elf || !elf->valid())
+    return;
+  // An Elf read from process memory (e.g. of a mapping without a backing
+  // file, or of a file that could not be opened) describes the memory of a
+  // single process, not the file, so it can't be reused by other mappings.
+  const std::string& name = map_info->name();
+  if (name.empty() || name[0] == '[' || map_info->memory_backed_elf() ||
+      (map_info->flags() & unwindstack::MAPS_FLAGS_DEVICE_MAP)) {
+    return;
+  }
+  std::string build_id = map_info->GetBuildID();
+  if (build_id.empty())
+    return;
+
+  Key key(std::move(build_id), map_info->offset());
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return;
+  }
+
+  Entry entry;
+  entry.key = key;
+  entry.name = name;
+  entry.elf = elf;
+  entry.elf_offset = map_info->elf_offset();
+  entry.elf_start_offset = map_info->elf_start_offset();
+  build_id_by_name_[NameKey(entry.name, key.second)] = key.first;
+  lru_.emplace_front(std::move(entry));
+  entries_.emplace(std::move(key), lru_.begin());
+  if (entries_.size() > max_entries_)
+    Evict();
+}
+
+void ElfCache::Clear() {
+  lru_.clear();
+  entries_.clear();
+  build_id_by_name_.clear();
+}
+
+void ElfCache::Evict() {
+  PERFETTO_DCHECK(!lru_.empty());
+  Entry& entry = lru_.back();
+  auto name_it = build_id_by_name_.find(NameKey(entry.name, entry.key.second));
+  if (name_it != build_id_by_name_.end() && name_it->second == entry.key.first)
+    build_id_by_name_.erase(name_it);
+  entries_.erase(entry.key);
+  lru_.pop_back();
+}
+
+}  // namespace profiling
+}  // namespace perfetto
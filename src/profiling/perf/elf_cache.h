@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_PERF_ELF_CACHE_H_
+#define SRC_PROFILING_PERF_ELF_CACHE_H_
+
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <unwindstack/Elf.h>
+#include <unwindstack/Maps.h>
+
+namespace perfetto {
+namespace profiling {
+
+// Bounded LRU cache of libunwindstack's parsed Elf objects, keyed by the build
+// id of the file and the offset of the mapping. An Elf object holds the parsed
+// section headers, unwind tables (together with the caches of already decoded
+// DWARF entries) and symbol tables of a binary, so reusing it saves most of
+// the cost of the first unwind through a binary.
+//
+// Unlike libunwindstack's own Elf cache (which is keyed by file name, and is
+// periodically dropped by the Unwinder to bound its memory use), this cache
+// outlives data sources and periodic clears, and does not hand out a stale Elf
+// if the file at a given path was replaced.
+//
+// Not thread safe.
+class ElfCache {
+ public:
+  explicit ElfCache(size_t max_entries) : max_entries_(max_entries) {}
+
+  // Attaches cached Elf objects to the mappings in |maps| that do not have
+  // one yet. Only reads the build id of mappings whose name and offset match
+  // a cached entry. Must be called after every (re)parse of |maps|, before
+  // unwinding with it.
+  void PopulateMaps(unwindstack::Maps* maps);
+
+  // Remembers the Elf object libunwindstack created for |map_info|, if it is
+  // valid, was read from a file (rather than from process memory) and the
+  // file has a build id. Called once for each file-backed mapping of the
+  // unwound frames, so the cache is filled with the binaries that are
+  // actually being sampled.
+  void Add(unwindstack::MapInfo* map_info);
+
+  void Clear();
+
+  size_t size() const { return entries_.size(); }
+  uint64_t hits() const { return hits_; }
+  // Number of mappings whose file changed since it was cached.
+  uint64_t invalidations() const { return invalidations_; }
+
+ private:
+  // (build id, mapping offset)
+  using Key = std::pair<std::string, uint64_t>;
+  // (file name, mapping offset)
+  using NameKey = std::pair<std::string, uint64_t>;
+
+  struct Entry {
+    Key key;
+    std::string name;
+    std::shared_ptr<unwindstack::Elf> elf;
+    uint64_t elf_offset = 0;
+    uint64_t elf_start_offset = 0;
+  };
+
+  void Evict();
+
+  const size_t max_entries_;
+  // Most recently used first.
+  std::list<Entry> lru_;
+  std::map<Key, std::list<Entry>::iterator> entries_;
+  // Last build id seen for a file name. Used to only read the build id of
+  // mappings that are likely to be in the cache.
+  std::map<NameKey, std::string> build_id_by_name_;
+  uint64_t hits_ = 0;
+  uint64_t invalidations_ = 0;
+};
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_PERF_ELF_CACHE_H_
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/perf/elf_cache.h"
+
+#include <fcntl.h>
+
+#include <unwindstack/Regs.h>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "src/profiling/common/unwind_support.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+void __attribute__((noinline)) ElfCacheTestFunction() {}
+
+UnwindingMetadata ParseSelfMaps() {
+  base::ScopedFile proc_maps(base::OpenFile("/proc/self/maps", O_RDONLY));
+  base::ScopedFile proc_mem(base::OpenFile("/proc/self/mem", O_RDONLY));
+  return UnwindingMetadata(std::move(proc_maps), std::move(proc_mem));
+}
+
+// Returns the mapping of the test binary's code, with the Elf object
+// libunwindstack creates for it when unwinding through it.
+unwindstack::MapInfo* GetCodeMapWithElf(UnwindingMetadata* metadata) {
+  unwindstack::MapInfo* map_info = metadata->fd_maps.Find(
+      reinterpret_cast<uint64_t>(&ElfCacheTestFunction));
+  if (map_info)
+    map_info->GetElf(metadata->fd_mem, unwindstack::Regs::CurrentArch());
+  return map_info;
+}
+
+TEST(ElfCacheTest, ReusesElfAfterMapsReparse) {
+  UnwindingMetadata metadata = ParseSelfMaps();
+  unwindstack::MapInfo* map_info = GetCodeMapWithElf(&metadata);
+  ASSERT_NE(map_info, nullptr);
+  ASSERT_TRUE(map_info->elf() && map_info->elf()->valid());
+  if (map_info->GetBuildID().empty())
+    GTEST_SKIP() << "Test binary built without a build id";
+
+  ElfCache cache(/*max_entries=*/4);
+  cache.Add(map_info);
+  cache.Add(map_info);
+  EXPECT_EQ(cache.size(), 1u);
+  std::shared_ptr<unwindstack::Elf> elf = map_info->elf();
+
+  metadata.ReparseMaps();
+  map_info = metadata.fd_maps.Find(
+      reinterpret_cast<uint64_t>(&ElfCacheTestFunction));
+  ASSERT_NE(map_info, nullptr);
+  ASSERT_FALSE(map_info->elf());
+
+  cache.PopulateMaps(&metadata.fd_maps);
+  EXPECT_EQ(map_info->elf(), elf);
+  EXPECT_EQ(cache.hits(), 1u);
+  EXPECT_EQ(cache.invalidations(), 0u);
+}
+
+TEST(ElfCacheTest, ClearDropsEntries) {
+  UnwindingMetadata metadata = ParseSelfMaps();
+  unwindstack::MapInfo* map_info = GetCodeMapWithElf(&metadata);
+  ASSERT_NE(map_info, nullptr);
+  if (map_info->GetBuildID().empty())
+    GTEST_SKIP() << "Test binary built without a build id";
+
+  ElfCache cache(/*max_entries=*/4);
+  cache.Add(map_info);
+  ASSERT_EQ(cache.size(), 1u);
+  cache.Clear();
+  EXPECT_EQ(cache.size(), 0u);
+
+  metadata.ReparseMaps();
+  cache.PopulateMaps(&metadata.fd_maps);
+  map_info = metadata.fd_maps.Find(
+      reinterpret_cast<uint64_t>(&ElfCacheTestFunction));
+  ASSERT_NE(map_info, nullptr);
+  EXPECT_FALSE(map_info->elf());
+  EXPECT_EQ(cache.hits(), 0u);
+}
+
+TEST(ElfCacheTest, DoesNotCacheMemoryBackedElf) {
+  UnwindingMetadata metadata = ParseSelfMaps();
+  int on_stack = 0;
+  unwindstack::MapInfo* map_info =
+      metadata.fd_maps.Find(reinterpret_cast<uint64_t>(&on_stack));
+  ASSERT_NE(map_info, nullptr);
+  ASSERT_EQ(map_info->name(), "[stack]");
+  // The stack is not an ELF file, libunwindstack falls back to reading it from
+  // process memory.
+  map_info->GetElf(metadata.fd_mem, unwindstack::Regs::CurrentArch());
+
+  ElfCache cache(/*max_entries=*/4);
+  cache.Add(map_info);
+  EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST(ElfCacheTest, DisabledWithZeroEntries) {
+  UnwindingMetadata metadata = ParseSelfMaps();
+  unwindstack::MapInfo* map_info = GetCodeMapWithElf(&metadata);
+  ASSERT_NE(map_info, nullptr);
+
+  ElfCache cache(/*max_entries=*/0);
+  cache.Add(map_info);
+  EXPECT_EQ(cache.size(), 0u);
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
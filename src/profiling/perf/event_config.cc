@@ -39,6 +39,7 @@ constexpr uint64_t kDefaultSamplingFrequencyHz = 10;
 constexpr uint32_t kDefaultDataPagesPerRingBuffer = 256;  // 1 MB: 256x 4k pages
 constexpr uint32_t kDefaultReadTickPeriodMs = 100;
 constexpr uint32_t kDefaultRemoteDescriptorTimeoutMs = 100;
+constexpr uint32_t kDefaultAggregationPeriodMs = 1000;
 
 base::Optional<std::string> Normalize(const std::string& src) {
   // Construct a null-terminated string that will be mutated by the normalizer.
@@ -299,6 +300,8 @@ base::Optional<EventConfig> EventConfig::Create(
   // Callstack sampling.
   bool sample_callstacks = false;
   bool kernel_frames = false;
+  bool frame_pointer_callchains = false;
+  uint32_t aggregation_period_ms = 0;
   TargetFilter target_filter;
   bool legacy_config = pb_config.all_cpus();  // all_cpus was mandatory before
   if (pb_config.has_callstack_sampling() || legacy_config) {
@@ -317,6 +320,17 @@ base::Optional<EventConfig> EventConfig::Create(
     // Inclusion of kernel callchains.
     kernel_frames = pb_config.callstack_sampling().kernel_frames() ||
                     pb_config.kernel_frames();
+
+    // Userspace frames from the kernel's frame pointer walk, aggregated in
+    // the producer.
+    frame_pointer_callchains =
+        pb_config.callstack_sampling().frame_pointer_callchains();
+    if (frame_pointer_callchains) {
+      aggregation_period_ms =
+          pb_config.callstack_sampling().aggregation_period_ms()
+              ? pb_config.callstack_sampling().aggregation_period_ms()
+              : kDefaultAggregationPeriodMs;
+    }
   }
 
   // Ring buffer options.
@@ -390,7 +404,10 @@ base::Optional<EventConfig> EventConfig::Create(
   pe.clockid = CLOCK_MONOTONIC_RAW;
   pe.use_clockid = true;
 
-  if (sample_callstacks) {
+  if (sample_callstacks && frame_pointer_callchains) {
+    pe.sample_type |= PERF_SAMPLE_CALLCHAIN;
+    pe.exclude_callchain_kernel = !kernel_frames;
+  } else if (sample_callstacks) {
     pe.sample_type |= PERF_SAMPLE_STACK_USER | PERF_SAMPLE_REGS_USER;
     // PERF_SAMPLE_STACK_USER:
     // Needs to be < ((u16)(~0u)), and have bottom 8 bits clear.
@@ -411,7 +428,8 @@ base::Optional<EventConfig> EventConfig::Create(
 
   return EventConfig(
       raw_ds_config, pe, timebase_event, sample_callstacks,
-      std::move(target_filter), kernel_frames, ring_buffer_pages.value(),
+      std::move(target_filter), kernel_frames, frame_pointer_callchains,
+      aggregation_period_ms, ring_buffer_pages.value(),
       read_tick_period_ms, samples_per_tick_limit, remote_descriptor_timeout_ms,
       pb_config.unwind_state_clear_period_ms(), max_enqueued_footprint_bytes,
       pb_config.target_installed_by());
@@ -423,6 +441,8 @@ EventConfig::EventConfig(const DataSourceConfig& raw_ds_config,
                          bool sample_callstacks,
                          TargetFilter target_filter,
                          bool kernel_frames,
+                         bool frame_pointer_callchains,
+                         uint32_t aggregation_period_ms,
                          uint32_t ring_buffer_pages,
                          uint32_t read_tick_period_ms,
                          uint64_t samples_per_tick_limit,
@@ -435,6 +455,8 @@ EventConfig::EventConfig(const DataSourceConfig& raw_ds_config,
       sample_callstacks_(sample_callstacks),
       target_filter_(std::move(target_filter)),
       kernel_frames_(kernel_frames),
+      frame_pointer_callchains_(frame_pointer_callchains),
+      aggregation_period_ms_(aggregation_period_ms),
       ring_buffer_pages_(ring_buffer_pages),
       read_tick_period_ms_(read_tick_period_ms),
       samples_per_tick_limit_(samples_per_tick_limit),
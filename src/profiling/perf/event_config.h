@@ -134,6 +134,8 @@ class EventConfig {
   bool sample_callstacks() const { return sample_callstacks_; }
   const TargetFilter& filter() const { return target_filter_; }
   bool kernel_frames() const { return kernel_frames_; }
+  bool frame_pointer_callchains() const { return frame_pointer_callchains_; }
+  uint32_t aggregation_period_ms() const { return aggregation_period_ms_; }
   perf_event_attr* perf_attr() const {
     return const_cast<perf_event_attr*>(&perf_event_attr_);
   }
@@ -150,6 +152,8 @@ class EventConfig {
               bool sample_callstacks,
               TargetFilter target_filter,
               bool kernel_frames,
+              bool frame_pointer_callchains,
+              uint32_t aggregation_period_ms,
               uint32_t ring_buffer_pages,
               uint32_t read_tick_period_ms,
               uint64_t samples_per_tick_limit,
@@ -177,6 +181,15 @@ class EventConfig {
   // If true, include kernel frames in the callstacks.
   const bool kernel_frames_;
 
+  // If true, the userspace callchains are walked by the kernel (using frame
+  // pointers) instead of being unwound by the producer, and are aggregated
+  // before being written.
+  const bool frame_pointer_callchains_;
+
+  // How often the aggregated callchains should be written. Set iff
+  // |frame_pointer_callchains_|.
+  const uint32_t aggregation_period_ms_;
+
   // Size (in 4k pages) of each per-cpu ring buffer shared with the kernel.
   // Must be a power of two.
   const uint32_t ring_buffer_pages_;
@@ -328,6 +328,43 @@ TEST(EventConfigTest, CallstackSamplingModeDetection) {
   }
 }
 
+TEST(EventConfigTest, FramePointerCallchains) {
+  {  // user stack and registers replaced by the kernel's callchain
+    protos::gen::PerfEventConfig cfg;
+    cfg.mutable_callstack_sampling()->set_frame_pointer_callchains(true);
+
+    base::Optional<EventConfig> event_config =
+        EventConfig::Create(AsDataSourceConfig(cfg));
+
+    ASSERT_TRUE(event_config.has_value());
+    EXPECT_TRUE(event_config->sample_callstacks());
+    EXPECT_TRUE(event_config->frame_pointer_callchains());
+    EXPECT_EQ(event_config->aggregation_period_ms(), 1000u);
+
+    const perf_event_attr* attr = event_config->perf_attr();
+    EXPECT_EQ(attr->sample_type &
+                  (PERF_SAMPLE_STACK_USER | PERF_SAMPLE_REGS_USER |
+                   PERF_SAMPLE_CALLCHAIN),
+              static_cast<uint64_t>(PERF_SAMPLE_CALLCHAIN));
+    EXPECT_FALSE(attr->exclude_callchain_user);
+    EXPECT_TRUE(attr->exclude_callchain_kernel);
+  }
+  {  // with kernel frames, and an explicit aggregation period
+    protos::gen::PerfEventConfig cfg;
+    cfg.mutable_callstack_sampling()->set_frame_pointer_callchains(true);
+    cfg.mutable_callstack_sampling()->set_kernel_frames(true);
+    cfg.mutable_callstack_sampling()->set_aggregation_period_ms(5000);
+
+    base::Optional<EventConfig> event_config =
+        EventConfig::Create(AsDataSourceConfig(cfg));
+
+    ASSERT_TRUE(event_config.has_value());
+    EXPECT_EQ(event_config->aggregation_period_ms(), 5000u);
+    EXPECT_FALSE(event_config->perf_attr()->exclude_callchain_user);
+    EXPECT_FALSE(event_config->perf_attr()->exclude_callchain_kernel);
+  }
+}
+
 }  // namespace
 }  // namespace profiling
 }  // namespace perfetto
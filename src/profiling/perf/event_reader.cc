@@ -16,6 +16,8 @@
 
 #include "src/profiling/perf/event_reader.h"
 
+#include <algorithm>
+
 #include <linux/perf_event.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -340,6 +342,21 @@ ParsedSample EventReader::ParseSampleRecord(uint32_t cpu,
     sample.kernel_ips.resize(static_cast<size_t>(chain_len));
     parse_pos = ReadValues<uint64_t>(sample.kernel_ips.data(), parse_pos,
                                      static_cast<size_t>(chain_len));
+
+    // If the userspace frames were requested as well, split them out (the
+    // kernel part, if any, comes first). Drop any further context markers.
+    if (!event_attr_.exclude_callchain_user) {
+      auto user_it = std::find(sample.kernel_ips.begin(),
+                               sample.kernel_ips.end(),
+                               static_cast<uint64_t>(PERF_CONTEXT_USER));
+      if (user_it != sample.kernel_ips.end()) {
+        for (auto it = user_it + 1; it != sample.kernel_ips.end(); ++it) {
+          if (*it < static_cast<uint64_t>(PERF_CONTEXT_MAX))
+            sample.user_ips.push_back(*it);
+        }
+        sample.kernel_ips.erase(user_it, sample.kernel_ips.end());
+      }
+    }
   }
 
   if (event_attr_.sample_type & PERF_SAMPLE_REGS_USER) {
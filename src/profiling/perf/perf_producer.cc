@@ -16,6 +16,7 @@
 
 #include "src/profiling/perf/perf_producer.h"
 
+#include <algorithm>
 #include <random>
 #include <utility>
 
@@ -33,6 +34,7 @@
 #include "perfetto/ext/tracing/core/producer.h"
 #include "perfetto/ext/tracing/core/tracing_service.h"
 #include "perfetto/ext/tracing/ipc/producer_ipc_client.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
 #include "perfetto/tracing/core/data_source_config.h"
 #include "perfetto/tracing/core/data_source_descriptor.h"
 #include "src/profiling/common/callstack_trie.h"
@@ -80,6 +82,18 @@ size_t NumberOfCpus() {
   return static_cast<size_t>(sysconf(_SC_NPROCESSORS_CONF));
 }
 
+std::vector<std::unique_ptr<UnwinderHandle>> MakeUnwindingWorkers(
+    Unwinder::Delegate* delegate,
+    size_t n) {
+  PERFETTO_CHECK(n > 0);
+  // See |Unwinder::use_unwindstack_cache_|.
+  bool use_unwindstack_cache = n == 1;
+  std::vector<std::unique_ptr<UnwinderHandle>> ret;
+  for (size_t i = 0; i < n; i++)
+    ret.emplace_back(new UnwinderHandle(delegate, use_unwindstack_cache));
+  return ret;
+}
+
 TraceWriter::TracePacketHandle StartTracePacket(TraceWriter* trace_writer) {
   auto packet = trace_writer->NewTracePacket();
   packet->set_sequence_flags(
@@ -257,10 +271,11 @@ protos::pbzero::Profiling::StackUnwindError ToProtoEnum(
 }  // namespace
 
 PerfProducer::PerfProducer(ProcDescriptorGetter* proc_fd_getter,
-                           base::TaskRunner* task_runner)
+                           base::TaskRunner* task_runner,
+                           size_t num_unwinders)
     : task_runner_(task_runner),
       proc_fd_getter_(proc_fd_getter),
-      unwinding_worker_(this),
+      unwinding_workers_(MakeUnwindingWorkers(this, num_unwinders)),
       weak_factory_(this) {
   proc_fd_getter->SetDelegate(this);
 }
@@ -327,7 +342,8 @@ void PerfProducer::StartDataSource(DataSourceInstanceID ds_id,
   std::tie(ds_it, inserted) = data_sources_.emplace(
       std::piecewise_construct, std::forward_as_tuple(ds_id),
       std::forward_as_tuple(event_config.value(), std::move(writer),
-                            std::move(per_cpu_readers)));
+                            std::move(per_cpu_readers),
+                            unwinding_workers_.size()));
   PERFETTO_CHECK(inserted);
   DataSourceState& ds = ds_it->second;
 
@@ -342,13 +358,14 @@ void PerfProducer::StartDataSource(DataSourceInstanceID ds_id,
       ds_it->second.trace_writer.get(),
       protos::pbzero::TracePacket::SEQ_NEEDS_INCREMENTAL_STATE);
 
-  // Inform unwinder of the new data source instance, and optionally start a
-  // periodic task to clear its cached state.
-  unwinding_worker_->PostStartDataSource(ds_id,
-                                         ds.event_config.kernel_frames());
-  if (ds.event_config.unwind_state_clear_period_ms()) {
-    unwinding_worker_->PostClearCachedStatePeriodic(
-        ds_id, ds.event_config.unwind_state_clear_period_ms());
+  // Inform unwinders of the new data source instance, and optionally start a
+  // periodic task to clear their cached state.
+  for (auto& unwinder : unwinding_workers_) {
+    (*unwinder)->PostStartDataSource(ds_id, ds.event_config.kernel_frames());
+    if (ds.event_config.unwind_state_clear_period_ms()) {
+      (*unwinder)->PostClearCachedStatePeriodic(
+          ds_id, ds.event_config.unwind_state_clear_period_ms());
+    }
   }
 
   // Kick off periodic read task.
@@ -361,6 +378,16 @@ void PerfProducer::StartDataSource(DataSourceInstanceID ds_id,
       },
       TimeToNextReadTickMs(ds_id, tick_period_ms));
 
+  // Kick off periodic writing of aggregated callchains.
+  if (ds.event_config.frame_pointer_callchains()) {
+    task_runner_->PostDelayedTask(
+        [weak_this, ds_id] {
+          if (weak_this)
+            weak_this->FlushAggregatedCallchainsPeriodic(ds_id);
+        },
+        ds.event_config.aggregation_period_ms());
+  }
+
   // Optionally kick off periodic memory footprint limit check.
   uint32_t max_daemon_memory_kb = event_config_pb.max_daemon_memory_kb();
   if (max_daemon_memory_kb > 0) {
@@ -506,12 +533,17 @@ void PerfProducer::TickDataSourceRead(DataSourceInstanceID ds_id) {
     }
   }
 
-  // Wake up the unwinder as we've (likely) pushed samples into its queue.
-  unwinding_worker_->PostProcessQueue();
+  // Wake up the unwinders as we've (likely) pushed samples into their queues.
+  for (auto& unwinder : unwinding_workers_)
+    (*unwinder)->PostProcessQueue();
 
   if (PERFETTO_UNLIKELY(ds.status == DataSourceState::Status::kShuttingDown) &&
       !more_records_available) {
-    unwinding_worker_->PostInitiateDataSourceStop(ds_id);
+    if (ds.event_config.frame_pointer_callchains())
+      FlushAggregatedCallchains(ds_id, &ds, /*final_flush=*/true);
+    ds.pending_unwinder_stops = unwinding_workers_.size();
+    for (auto& unwinder : unwinding_workers_)
+      (*unwinder)->PostInitiateDataSourceStop(ds_id);
   } else {
     // otherwise, keep reading
     auto tick_period_ms = it->second.event_config.read_tick_period_ms();
@@ -558,7 +590,9 @@ bool PerfProducer::ReadAndParsePerCpuBuffer(EventReader* reader,
     }
 
     // If sampling callstacks, we're not interested in kernel threads/workers.
-    if (!sample->regs) {
+    bool frame_pointer_callchains =
+        ds->event_config.frame_pointer_callchains();
+    if (frame_pointer_callchains ? sample->user_ips.empty() : !sample->regs) {
       continue;
     }
 
@@ -603,13 +637,21 @@ bool PerfProducer::ReadAndParsePerCpuBuffer(EventReader* reader,
     PERFETTO_CHECK(process_state == ProcessTrackingStatus::kResolved ||
                    process_state == ProcessTrackingStatus::kResolving);
 
+    // Frame pointer callchains need no unwinding, keep counting them until
+    // the next flush.
+    if (frame_pointer_callchains) {
+      ds->callchain_aggregator.AddSample(pid, sample->common.timestamp,
+                                         sample->kernel_ips, sample->user_ips);
+      continue;
+    }
+
     // Optionally: drop sample if above a given threshold of sampled stacks
     // that are waiting in the unwinding queue.
     uint64_t max_footprint_bytes =
         ds->event_config.max_enqueued_footprint_bytes();
     uint64_t sample_stack_size = sample->stack.size();
     if (max_footprint_bytes) {
-      uint64_t footprint_bytes = unwinding_worker_->GetEnqueuedFootprint();
+      uint64_t footprint_bytes = GetEnqueuedFootprint();
       if (footprint_bytes + sample_stack_size >= max_footprint_bytes) {
         PERFETTO_DLOG("Skipping sample enqueueing due to footprint limit.");
         EmitSkippedSample(ds_id, std::move(sample.value()),
@@ -618,19 +660,7 @@ bool PerfProducer::ReadAndParsePerCpuBuffer(EventReader* reader,
       }
     }
 
-    // Push the sample into the unwinding queue if there is room.
-    auto& queue = unwinding_worker_->unwind_queue();
-    WriteView write_view = queue.BeginWrite();
-    if (write_view.valid) {
-      queue.at(write_view.write_pos) =
-          UnwindEntry{ds_id, std::move(sample.value())};
-      queue.CommitWrite();
-      unwinding_worker_->IncrementEnqueuedFootprint(sample_stack_size);
-    } else {
-      PERFETTO_DLOG("Unwinder queue full, skipping sample");
-      EmitSkippedSample(ds_id, std::move(sample.value()),
-                        SampleSkipReason::kUnwindEnqueue);
-    }
+    EnqueueSampleForUnwinding(ds_id, ds, std::move(sample.value()));
   }
 
   // Most likely more events in the kernel buffer. Though we might be exactly on
@@ -638,6 +668,31 @@ bool PerfProducer::ReadAndParsePerCpuBuffer(EventReader* reader,
   return true;
 }
 
+void PerfProducer::EnqueueSampleForUnwinding(DataSourceInstanceID ds_id,
+                                             DataSourceState* ds,
+                                             ParsedSample sample) {
+  // Push the sample into the process' unwinding queue if there is room.
+  size_t unwinder_idx = UnwinderIndexForPid(sample.common.pid);
+  UnwinderHandle& unwinder = *unwinding_workers_[unwinder_idx];
+  UnwindQueueStats& queue_stats = ds->unwind_queue_stats[unwinder_idx];
+  auto& queue = unwinder->unwind_queue();
+  WriteView write_view = queue.BeginWrite();
+  if (write_view.valid) {
+    uint64_t sample_stack_size = sample.stack.size();
+    queue.at(write_view.write_pos) = UnwindEntry{ds_id, std::move(sample)};
+    queue.CommitWrite();
+    unwinder->IncrementEnqueuedFootprint(sample_stack_size);
+    queue_stats.samples_enqueued++;
+    queue_stats.max_queue_depth =
+        std::max(queue_stats.max_queue_depth, queue.WriterSize());
+  } else {
+    PERFETTO_DLOG("Unwinder queue full, skipping sample");
+    queue_stats.samples_dropped++;
+    EmitSkippedSample(ds_id, std::move(sample),
+                      SampleSkipReason::kUnwindEnqueue);
+  }
+}
+
 // Note: first-fit makes descriptor request fulfillment not true FIFO. But the
 // edge-cases where it matters are very unlikely.
 void PerfProducer::OnProcDescriptors(pid_t pid,
@@ -669,7 +724,7 @@ void PerfProducer::OnProcDescriptors(pid_t pid,
                     static_cast<int>(pid), static_cast<size_t>(it.first));
 
       proc_status_it->second = ProcessTrackingStatus::kResolved;
-      unwinding_worker_->PostAdoptProcDescriptors(
+      UnwinderForPid(pid)->PostAdoptProcDescriptors(
           it.first, pid, std::move(maps_fd), std::move(mem_fd));
       return;  // done
     }
@@ -679,6 +734,21 @@ void PerfProducer::OnProcDescriptors(pid_t pid,
       static_cast<int>(pid));
 }
 
+size_t PerfProducer::UnwinderIndexForPid(pid_t pid) const {
+  return static_cast<size_t>(pid) % unwinding_workers_.size();
+}
+
+UnwinderHandle& PerfProducer::UnwinderForPid(pid_t pid) {
+  return *unwinding_workers_[UnwinderIndexForPid(pid)];
+}
+
+uint64_t PerfProducer::GetEnqueuedFootprint() {
+  uint64_t footprint_bytes = 0;
+  for (auto& unwinder : unwinding_workers_)
+    footprint_bytes += (*unwinder)->GetEnqueuedFootprint();
+  return footprint_bytes;
+}
+
 void PerfProducer::InitiateDescriptorLookup(DataSourceInstanceID ds_id,
                                             pid_t pid,
                                             uint32_t timeout_ms) {
@@ -732,7 +802,51 @@ void PerfProducer::EvaluateDescriptorLookupTimeout(DataSourceInstanceID ds_id,
     proc_status_it->second = ProcessTrackingStatus::kExpired;
     // Also inform the unwinder of the state change (so that it can discard any
     // of the already-enqueued samples).
-    unwinding_worker_->PostRecordTimedOutProcDescriptors(ds_id, pid);
+    UnwinderForPid(pid)->PostRecordTimedOutProcDescriptors(ds_id, pid);
+  }
+}
+
+void PerfProducer::FlushAggregatedCallchainsPeriodic(
+    DataSourceInstanceID ds_id) {
+  auto it = data_sources_.find(ds_id);
+  if (it == data_sources_.end())
+    return;  // stop recurring
+  DataSourceState& ds = it->second;
+
+  // The final flush is done by the reader, once the buffers are drained.
+  if (ds.status == DataSourceState::Status::kShuttingDown)
+    return;
+
+  FlushAggregatedCallchains(ds_id, &ds, /*final_flush=*/false);
+
+  // repost
+  auto weak_this = weak_factory_.GetWeakPtr();
+  task_runner_->PostDelayedTask(
+      [weak_this, ds_id] {
+        if (weak_this)
+          weak_this->FlushAggregatedCallchainsPeriodic(ds_id);
+      },
+      ds.event_config.aggregation_period_ms());
+}
+
+void PerfProducer::FlushAggregatedCallchains(DataSourceInstanceID ds_id,
+                                             DataSourceState* ds,
+                                             bool final_flush) {
+  PERFETTO_DLOG("Flushing %zu aggregated callchain nodes",
+                ds->callchain_aggregator.num_nodes());
+  for (pid_t pid : ds->callchain_aggregator.GetPids()) {
+    ProcessTrackingStatus status = ds->process_states[pid];
+    if (status == ProcessTrackingStatus::kResolved) {
+      // The unwinder has already been posted the proc-fds.
+      UnwinderForPid(pid)->PostSymbolizeCallchains(
+          ds_id, ds->callchain_aggregator.TakeSamples(pid));
+    } else if (status == ProcessTrackingStatus::kResolving && !final_flush) {
+      continue;  // retry on the next flush
+    } else {
+      PERFETTO_DLOG("Discarding aggregated callchains of pid [%d]",
+                    static_cast<int>(pid));
+      ds->callchain_aggregator.TakeSamples(pid);
+    }
   }
 }
 
@@ -785,6 +899,53 @@ void PerfProducer::EmitSample(DataSourceInstanceID ds_id,
   }
 }
 
+void PerfProducer::PostEmitAggregatedSamples(DataSourceInstanceID ds_id,
+                                             AggregatedSamples samples) {
+  // hack: c++11 lambdas can't be moved into, so stash the samples on the heap.
+  AggregatedSamples* raw_samples = new AggregatedSamples(std::move(samples));
+  auto weak_this = weak_factory_.GetWeakPtr();
+  task_runner_->PostTask([weak_this, ds_id, raw_samples] {
+    if (weak_this)
+      weak_this->EmitAggregatedSamples(ds_id, std::move(*raw_samples));
+    delete raw_samples;
+  });
+}
+
+void PerfProducer::EmitAggregatedSamples(DataSourceInstanceID ds_id,
+                                         AggregatedSamples samples) {
+  auto ds_it = data_sources_.find(ds_id);
+  if (ds_it == data_sources_.end()) {
+    PERFETTO_DLOG("EmitAggregatedSamples(ds: %zu): source gone",
+                  static_cast<size_t>(ds_id));
+    return;
+  }
+  DataSourceState& ds = ds_it->second;
+  if (samples.callchains.empty())
+    return;
+
+  // start packet, timestamp domain defaults to monotonic_raw
+  auto packet = StartTracePacket(ds.trace_writer.get());
+  packet->set_timestamp(samples.timestamp);
+
+  // intern the callsites, and write new interning data (if any)
+  protos::pbzero::InternedData* interned_out = packet->set_interned_data();
+  protozero::PackedVarInt callstack_iids;
+  protozero::PackedVarInt counts;
+  for (const AggregatedCallchain& callchain : samples.callchains) {
+    GlobalCallstackTrie::Node* callstack_root =
+        callstack_trie_.CreateCallsite(callchain.frames, callchain.build_ids);
+    ds.interning_output.WriteCallstack(callstack_root, &callstack_trie_,
+                                       interned_out);
+    callstack_iids.Append(callstack_root->id());
+    counts.Append(callchain.count);
+  }
+
+  auto* perf_sample = packet->set_perf_sample();
+  perf_sample->set_pid(static_cast<uint32_t>(samples.pid));
+  perf_sample->set_aggregated_callstack_iid(callstack_iids);
+  perf_sample->set_aggregated_count(counts);
+}
+
 void PerfProducer::EmitRingBufferLoss(DataSourceInstanceID ds_id,
                                       size_t cpu,
                                       uint64_t records_lost) {
@@ -865,6 +1026,23 @@ void PerfProducer::EmitSkippedSample(DataSourceInstanceID ds_id,
   }
 }
 
+void PerfProducer::EmitUnwindQueueStats(DataSourceState* ds) {
+  for (size_t i = 0; i < ds->unwind_queue_stats.size(); i++) {
+    const UnwindQueueStats& stats = ds->unwind_queue_stats[i];
+    auto packet = StartTracePacket(ds->trace_writer.get());
+    packet->set_timestamp(static_cast<uint64_t>(base::GetBootTimeNs().count()));
+    packet->set_timestamp_clock_id(
+        protos::pbzero::BuiltinClock::BUILTIN_CLOCK_BOOTTIME);
+
+    auto* perf_sample = packet->set_perf_sample();
+    auto* unwinder_stats = perf_sample->set_unwinder_stats();
+    unwinder_stats->set_unwinder_index(static_cast<uint32_t>(i));
+    unwinder_stats->set_samples_enqueued(stats.samples_enqueued);
+    unwinder_stats->set_samples_dropped(stats.samples_dropped);
+    unwinder_stats->set_max_queue_depth(stats.max_queue_depth);
+  }
+}
+
 void PerfProducer::InitiateReaderStop(DataSourceState* ds) {
   PERFETTO_DLOG("InitiateReaderStop");
   PERFETTO_CHECK(ds->status != DataSourceState::Status::kShuttingDown);
@@ -894,6 +1072,12 @@ void PerfProducer::FinishDataSourceStop(DataSourceInstanceID ds_id) {
   DataSourceState& ds = ds_it->second;
   PERFETTO_CHECK(ds.status == DataSourceState::Status::kShuttingDown);
 
+  // Wait for all unwinders to be done with the source.
+  PERFETTO_CHECK(ds.pending_unwinder_stops > 0);
+  if (--ds.pending_unwinder_stops > 0)
+    return;
+
+  EmitUnwindQueueStats(&ds);
   ds.trace_writer->Flush();
   data_sources_.erase(ds_it);
 
@@ -924,7 +1108,8 @@ void PerfProducer::PurgeDataSource(DataSourceInstanceID ds_id) {
   PERFETTO_LOG("Stopping DataSource(%zu) prematurely",
                static_cast<size_t>(ds_id));
 
-  unwinding_worker_->PostPurgeDataSource(ds_id);
+  for (auto& unwinder : unwinding_workers_)
+    (*unwinder)->PostPurgeDataSource(ds_id);
 
   // Write a packet indicating the abrupt stop.
   {
@@ -938,6 +1123,7 @@ void PerfProducer::PurgeDataSource(DataSourceInstanceID ds_id) {
         protos::pbzero::PerfSample::ProducerEvent::PROFILER_STOP_GUARDRAIL);
   }
 
+  EmitUnwindQueueStats(&ds);
   ds.trace_writer->Flush();
   data_sources_.erase(ds_it);
 
@@ -1038,10 +1224,11 @@ void PerfProducer::Restart() {
   base::TaskRunner* task_runner = task_runner_;
   const char* socket_name = producer_socket_name_;
   ProcDescriptorGetter* proc_fd_getter = proc_fd_getter_;
+  size_t num_unwinders = unwinding_workers_.size();
 
   // Invoke destructor and then the constructor again.
   this->~PerfProducer();
-  new (this) PerfProducer(proc_fd_getter, task_runner);
+  new (this) PerfProducer(proc_fd_getter, task_runner, num_unwinders);
 
   ConnectWithRetries(socket_name);
 }
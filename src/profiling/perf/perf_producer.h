@@ -19,7 +19,9 @@
 
 #include <deque>
 #include <map>
+#include <memory>
 #include <queue>
+#include <vector>
 
 #include <unistd.h>
 
@@ -38,6 +40,7 @@
 #include "src/profiling/common/callstack_trie.h"
 #include "src/profiling/common/interning_output.h"
 #include "src/profiling/common/unwind_support.h"
+#include "src/profiling/perf/callchain_aggregator.h"
 #include "src/profiling/perf/common_types.h"
 #include "src/profiling/perf/event_config.h"
 #include "src/profiling/perf/event_reader.h"
@@ -54,13 +57,19 @@ namespace profiling {
 // summary in the mean time: three stages: (1) kernel buffer reader that parses
 // the samples -> (2) callstack unwinder -> (3) interning and serialization of
 // samples. This class handles stages (1) and (3) on the main thread. Unwinding
-// is done by |Unwinder| on a dedicated thread.
+// is done by one or more |Unwinder|s, each on a dedicated thread, with the
+// samples partitioned between them by pid.
 class PerfProducer : public Producer,
                      public ProcDescriptorDelegate,
                      public Unwinder::Delegate {
  public:
+  // The samples are unwound on |num_unwinders| threads. Every unwinder keeps
+  // its own parsed state (maps, Elf objects, kernel symbols) for the processes
+  // assigned to it, and libunwindstack's global Elf cache is disabled if there
+  // is more than one (see Unwinder::use_unwindstack_cache_).
   PerfProducer(ProcDescriptorGetter* proc_fd_getter,
-               base::TaskRunner* task_runner);
+               base::TaskRunner* task_runner,
+               size_t num_unwinders = 1);
   ~PerfProducer() override = default;
 
   PerfProducer(const PerfProducer&) = delete;
@@ -95,9 +104,13 @@ class PerfProducer : public Producer,
                       CompletedSample sample) override;
   void PostEmitUnwinderSkippedSample(DataSourceInstanceID ds_id,
                                      ParsedSample sample) override;
+  void PostEmitAggregatedSamples(DataSourceInstanceID ds_id,
+                                 AggregatedSamples samples) override;
   void PostFinishDataSourceStop(DataSourceInstanceID ds_id) override;
 
  private:
+  friend class PerfProducerTest;
+
   // State of the producer's connection to tracing service (traced).
   enum State {
     kNotStarted = 0,
@@ -119,15 +132,27 @@ class PerfProducer : public Producer,
     kRejected    // process not considered relevant for the data source
   };
 
+  // Data source's use of the queue of one of the unwinders.
+  struct UnwindQueueStats {
+    uint64_t samples_enqueued = 0;
+    // Samples skipped because the queue was full.
+    uint64_t samples_dropped = 0;
+    // Highest number of outstanding entries (of all data sources) in the
+    // queue, as observed after enqueueing this data source's samples.
+    uint64_t max_queue_depth = 0;
+  };
+
   struct DataSourceState {
     enum class Status { kActive, kShuttingDown };
 
     DataSourceState(EventConfig _event_config,
                     std::unique_ptr<TraceWriter> _trace_writer,
-                    std::vector<EventReader> _per_cpu_readers)
+                    std::vector<EventReader> _per_cpu_readers,
+                    size_t num_unwinders)
         : event_config(std::move(_event_config)),
           trace_writer(std::move(_trace_writer)),
-          per_cpu_readers(std::move(_per_cpu_readers)) {}
+          per_cpu_readers(std::move(_per_cpu_readers)),
+          unwind_queue_stats(num_unwinders) {}
 
     Status status = Status::kActive;
     const EventConfig event_config;
@@ -145,6 +170,15 @@ class PerfProducer : public Producer,
     // Command lines we have decided to unwind, up to a total of
     // additional_cmdline_count values.
     base::FlatSet<std::string> additional_cmdlines;
+
+    // Frame pointer callchains not yet handed to the unwinders. Only used if
+    // |event_config.frame_pointer_callchains()|.
+    CallchainAggregator callchain_aggregator;
+
+    // Indexed by unwinder, vector never resized.
+    std::vector<UnwindQueueStats> unwind_queue_stats;
+    // Number of unwinders that have yet to finish their part of the stop.
+    size_t pending_unwinder_stops = 0;
   };
 
   // For |EmitSkippedSample|.
@@ -172,6 +206,17 @@ class PerfProducer : public Producer,
                                 DataSourceInstanceID ds_id,
                                 DataSourceState* ds);
 
+  // Pushes |sample| into the queue of its process' unwinder, or emits it as
+  // skipped if the queue is full.
+  void EnqueueSampleForUnwinding(DataSourceInstanceID ds_id,
+                                 DataSourceState* ds,
+                                 ParsedSample sample);
+
+  // All of a process' samples and proc-fds go to the same unwinder.
+  size_t UnwinderIndexForPid(pid_t pid) const;
+  UnwinderHandle& UnwinderForPid(pid_t pid);
+  uint64_t GetEnqueuedFootprint();
+
   void InitiateDescriptorLookup(DataSourceInstanceID ds_id,
                                 pid_t pid,
                                 uint32_t timeout_ms);
@@ -181,10 +226,21 @@ class PerfProducer : public Producer,
                              uint32_t timeout_ms);
   void EvaluateDescriptorLookupTimeout(DataSourceInstanceID ds_id, pid_t pid);
 
+  // Hands the aggregated callchains of the processes with resolved proc-fds
+  // over to the unwinders for symbolization. Processes that are still
+  // resolving are kept for the next attempt, unless |final_flush| is set.
+  void FlushAggregatedCallchains(DataSourceInstanceID ds_id,
+                                 DataSourceState* ds,
+                                 bool final_flush);
+  void FlushAggregatedCallchainsPeriodic(DataSourceInstanceID ds_id);
+
   void EmitSample(DataSourceInstanceID ds_id, CompletedSample sample);
+  void EmitAggregatedSamples(DataSourceInstanceID ds_id,
+                             AggregatedSamples samples);
   void EmitRingBufferLoss(DataSourceInstanceID ds_id,
                           size_t cpu,
                           uint64_t records_lost);
+  void EmitUnwindQueueStats(DataSourceState* ds);
 
   void PostEmitSkippedSample(DataSourceInstanceID ds_id,
                              ParsedSample sample,
@@ -203,7 +259,8 @@ class PerfProducer : public Producer,
   // source at the unwinding stage.
   void InitiateReaderStop(DataSourceState* ds);
   // Destroys the state belonging to this instance, and acks the stop to the
-  // tracing service.
+  // tracing service. Called once by every unwinder, only the last call takes
+  // effect.
   void FinishDataSourceStop(DataSourceInstanceID ds_id);
   // Immediately destroys the data source state, and instructs the unwinder to
   // do the same. This is used for abrupt stops.
@@ -246,8 +303,9 @@ class PerfProducer : public Producer,
   // State associated with perf-sampling data sources.
   std::map<DataSourceInstanceID, DataSourceState> data_sources_;
 
-  // Unwinding stage, running on a dedicated thread.
-  UnwinderHandle unwinding_worker_;
+  // Unwinding stage, each unwinder running on a dedicated thread. Indexed by
+  // pid modulo the number of unwinders, vector never resized.
+  std::vector<std::unique_ptr<UnwinderHandle>> unwinding_workers_;
 
   // Used for tracepoint name -> id lookups. Initialized lazily, and in general
   // best effort - can be null if tracefs isn't accessible.
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/perf/perf_producer.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "perfetto/ext/tracing/core/commit_data_request.h"
+#include "perfetto/tracing/core/data_source_config.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/profiling/perf/unwinding.h"
+#include "src/tracing/core/trace_writer_for_testing.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/config/profiling/perf_event_config.gen.h"
+#include "protos/perfetto/trace/profiling/profile_packet.gen.h"
+#include "protos/perfetto/trace/trace_packet.gen.h"
+
+namespace perfetto {
+namespace profiling {
+
+using ::testing::Invoke;
+
+namespace {
+
+constexpr DataSourceInstanceID kDataSourceId = 1;
+constexpr size_t kNumUnwinders = 3;
+
+class MockProducerEndpoint : public TracingService::ProducerEndpoint {
+ public:
+  MOCK_METHOD1(UnregisterDataSource, void(const std::string&));
+  MOCK_METHOD1(NotifyFlushComplete, void(FlushRequestID));
+  MOCK_METHOD1(NotifyDataSourceStarted, void(DataSourceInstanceID));
+  MOCK_METHOD1(NotifyDataSourceStopped, void(DataSourceInstanceID));
+
+  MOCK_CONST_METHOD0(shared_memory, SharedMemory*());
+  MOCK_CONST_METHOD0(shared_buffer_page_size_kb, size_t());
+  MOCK_METHOD2(CreateTraceWriter,
+               std::unique_ptr<TraceWriter>(BufferID, BufferExhaustedPolicy));
+  MOCK_METHOD0(MaybeSharedMemoryArbiter, SharedMemoryArbiter*());
+  MOCK_CONST_METHOD0(IsShmemProvidedByProducer, bool());
+  MOCK_METHOD1(ActivateTriggers, void(const std::vector<std::string>&));
+
+  MOCK_METHOD1(RegisterDataSource, void(const DataSourceDescriptor&));
+  MOCK_METHOD2(CommitData, void(const CommitDataRequest&, CommitDataCallback));
+  MOCK_METHOD2(RegisterTraceWriter, void(uint32_t, uint32_t));
+  MOCK_METHOD1(UnregisterTraceWriter, void(uint32_t));
+  MOCK_METHOD1(Sync, void(std::function<void()>));
+};
+
+class FakeProcDescriptorGetter : public ProcDescriptorGetter {
+ public:
+  void GetDescriptorsForPid(pid_t) override {}
+  void SetDelegate(ProcDescriptorDelegate*) override {}
+};
+
+// Writes into a TraceWriterForTesting that outlives the data source.
+class ForwardingTraceWriter : public TraceWriter {
+ public:
+  explicit ForwardingTraceWriter(TraceWriterForTesting* writer)
+      : writer_(writer) {}
+
+  TracePacketHandle NewTracePacket() override {
+    return writer_->NewTracePacket();
+  }
+  void Flush(std::function<void()> callback = {}) override {
+    writer_->Flush(std::move(callback));
+  }
+  WriterID writer_id() const override { return writer_->writer_id(); }
+  uint64_t written() const override { return writer_->written(); }
+
+ private:
+  TraceWriterForTesting* const writer_;
+};
+
+}  // namespace
+
+class PerfProducerTest : public ::testing::Test {
+ public:
+  PerfProducerTest()
+      : producer_(&proc_fd_getter_, &task_runner_, kNumUnwinders) {
+    endpoint_ = new MockProducerEndpoint();
+    producer_.endpoint_.reset(endpoint_);
+  }
+
+ protected:
+  // Adds a data source without any perf event readers, so that stopping it
+  // only goes through the unwinders.
+  void AddDataSource(DataSourceInstanceID ds_id) {
+    DataSourceConfig ds_config;
+    ds_config.set_perf_event_config_raw(
+        protos::gen::PerfEventConfig().SerializeAsString());
+    base::Optional<EventConfig> event_config = EventConfig::Create(ds_config);
+    ASSERT_TRUE(event_config.has_value());
+    std::unique_ptr<TraceWriter> writer(new ForwardingTraceWriter(&writer_));
+    producer_.data_sources_.emplace(
+        std::piecewise_construct, std::forward_as_tuple(ds_id),
+        std::forward_as_tuple(event_config.value(), std::move(writer),
+                              std::vector<EventReader>(),
+                              producer_.unwinding_workers_.size()));
+    for (auto& unwinder : producer_.unwinding_workers_)
+      (*unwinder)->PostStartDataSource(ds_id, /*kernel_frames=*/false);
+  }
+
+  PerfProducer::DataSourceState* GetDataSource(DataSourceInstanceID ds_id) {
+    auto it = producer_.data_sources_.find(ds_id);
+    return it != producer_.data_sources_.end() ? &it->second : nullptr;
+  }
+
+  size_t UnwinderIndexForPid(pid_t pid) const {
+    return producer_.UnwinderIndexForPid(pid);
+  }
+
+  void TickDataSourceRead(DataSourceInstanceID ds_id) {
+    producer_.TickDataSourceRead(ds_id);
+  }
+
+  // Enqueues |num_samples| samples of |pid| as the reading frontend does.
+  void EnqueueSamples(DataSourceInstanceID ds_id,
+                      pid_t pid,
+                      size_t num_samples) {
+    PerfProducer::DataSourceState* ds = GetDataSource(ds_id);
+    ASSERT_NE(ds, nullptr);
+    for (size_t i = 0; i < num_samples; i++) {
+      ParsedSample sample;
+      sample.common.pid = pid;
+      sample.common.tid = pid;
+      sample.common.timestamp = i;
+      producer_.EnqueueSampleForUnwinding(ds_id, ds, std::move(sample));
+    }
+  }
+
+  // Makes the unwinder give up on the samples of |pid|, as if its proc-fds
+  // lookup timed out.
+  void ExpireProcess(DataSourceInstanceID ds_id, pid_t pid) {
+    (*producer_.unwinding_workers_[UnwinderIndexForPid(pid)])
+        ->PostRecordTimedOutProcDescriptors(ds_id, pid);
+  }
+
+  base::TestTaskRunner task_runner_;
+  FakeProcDescriptorGetter proc_fd_getter_;
+  TraceWriterForTesting writer_;
+  PerfProducer producer_;
+  MockProducerEndpoint* endpoint_ = nullptr;  // Owned by |producer_|.
+};
+
+namespace {
+
+TEST_F(PerfProducerTest, PartitionsProcessesByPid) {
+  std::set<size_t> used_unwinders;
+  for (pid_t pid = 1; pid <= 10; pid++) {
+    size_t idx = UnwinderIndexForPid(pid);
+    ASSERT_LT(idx, kNumUnwinders);
+    // All of a process' samples go to the same unwinder.
+    EXPECT_EQ(UnwinderIndexForPid(pid), idx);
+    used_unwinders.insert(idx);
+  }
+  // Consecutive pids are spread over all the unwinders.
+  EXPECT_EQ(used_unwinders.size(), kNumUnwinders);
+  EXPECT_NE(UnwinderIndexForPid(1), UnwinderIndexForPid(2));
+}
+
+TEST_F(PerfProducerTest, StopWaitsForAllUnwinders) {
+  AddDataSource(kDataSourceId);
+
+  // One process per unwinder. The queue of the last one overflows.
+  const pid_t pids[kNumUnwinders] = {3, 4, 5};
+  const size_t num_samples[kNumUnwinders] = {2, 5, kUnwindQueueCapacity + 3};
+  std::vector<uint64_t> expected_enqueued(kNumUnwinders);
+  std::vector<uint64_t> expected_dropped(kNumUnwinders);
+  std::set<size_t> used_unwinders;
+  for (size_t i = 0; i < kNumUnwinders; i++) {
+    size_t idx = UnwinderIndexForPid(pids[i]);
+    used_unwinders.insert(idx);
+    expected_enqueued[idx] = std::min<size_t>(num_samples[i],
+                                              kUnwindQueueCapacity);
+    expected_dropped[idx] = num_samples[i] - expected_enqueued[idx];
+    EnqueueSamples(kDataSourceId, pids[i], num_samples[i]);
+    ExpireProcess(kDataSourceId, pids[i]);
+  }
+  ASSERT_EQ(used_unwinders.size(), kNumUnwinders);
+
+  auto stopped = task_runner_.CreateCheckpoint("stopped");
+  EXPECT_CALL(*endpoint_, NotifyDataSourceStopped(kDataSourceId))
+      .WillOnce(Invoke([&](DataSourceInstanceID) {
+        // The source is only torn down once every unwinder is done with it.
+        EXPECT_EQ(GetDataSource(kDataSourceId), nullptr);
+        stopped();
+      }));
+  producer_.StopDataSource(kDataSourceId);
+  TickDataSourceRead(kDataSourceId);
+  auto* ds = GetDataSource(kDataSourceId);
+  ASSERT_NE(ds, nullptr);
+  EXPECT_EQ(ds->pending_unwinder_stops, kNumUnwinders);
+  task_runner_.RunUntilCheckpoint("stopped");
+
+  // The samples that didn't fit in the queue are skipped right away, the
+  // others once the unwinder gives up on their process. The queue stats of
+  // every unwinder are written once, on stop.
+  using PerfSample = protos::gen::PerfSample;
+  size_t skipped_at_enqueue = 0;
+  size_t skipped_at_unwind = 0;
+  std::vector<PerfSample::UnwinderStats> unwinder_stats;
+  for (const auto& packet : writer_.GetAllTracePackets()) {
+    const PerfSample& sample = packet.perf_sample();
+    if (sample.has_unwinder_stats())
+      unwinder_stats.push_back(sample.unwinder_stats());
+    if (sample.sample_skipped_reason() ==
+        PerfSample::PROFILER_SKIP_UNWIND_ENQUEUE) {
+      skipped_at_enqueue++;
+    }
+    if (sample.sample_skipped_reason() ==
+        PerfSample::PROFILER_SKIP_UNWIND_STAGE) {
+      skipped_at_unwind++;
+    }
+  }
+  EXPECT_EQ(skipped_at_enqueue, 3u);
+  EXPECT_EQ(skipped_at_unwind, 2u + 5u + kUnwindQueueCapacity);
+
+  ASSERT_EQ(unwinder_stats.size(), kNumUnwinders);
+  for (size_t i = 0; i < kNumUnwinders; i++) {
+    EXPECT_EQ(unwinder_stats[i].unwinder_index(), i);
+    EXPECT_EQ(unwinder_stats[i].samples_enqueued(), expected_enqueued[i]);
+    EXPECT_EQ(unwinder_stats[i].samples_dropped(), expected_dropped[i]);
+    // Nothing is consumed before the data source stops.
+    EXPECT_EQ(unwinder_stats[i].max_queue_depth(), expected_enqueued[i]);
+  }
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
@@ -15,6 +15,8 @@
  */
 
 #include "src/profiling/perf/traced_perf.h"
+#include "perfetto/ext/base/getopt.h"
+#include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/unix_task_runner.h"
 #include "perfetto/ext/tracing/ipc/default_socket.h"
 #include "src/profiling/perf/perf_producer.h"
@@ -40,7 +42,27 @@ int GetRawInheritedListeningSocket() {
 }  // namespace
 
 // TODO(rsavitski): watchdog.
-int TracedPerfMain(int, char**) {
+int TracedPerfMain(int argc, char** argv) {
+  // Number of threads the samples are unwound on, partitioned by process.
+  size_t num_unwinders = 1;
+
+  enum { kUnwinders = 256 };
+  static option long_options[] = {
+      {"unwinders", required_argument, nullptr, kUnwinders},
+      {nullptr, 0, nullptr, 0}};
+  int c;
+  while ((c = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+    switch (c) {
+      case kUnwinders: {
+        base::Optional<uint32_t> n = base::CStringToUInt32(optarg);
+        if (!n || *n == 0)
+          PERFETTO_FATAL("Invalid --unwinders value: %s", optarg);
+        num_unwinders = *n;
+        break;
+      }
+    }
+  }
+
   base::UnixTaskRunner task_runner;
 
 // TODO(rsavitski): support standalone --root or similar on android.
@@ -51,7 +73,8 @@ int TracedPerfMain(int, char**) {
   DirectDescriptorGetter proc_fd_getter;
 #endif
 
-  profiling::PerfProducer producer(&proc_fd_getter, &task_runner);
+  profiling::PerfProducer producer(&proc_fd_getter, &task_runner,
+                                   num_unwinders);
   producer.ConnectWithRetries(GetProducerSocket());
   task_runner.Run();
   return 0;
@@ -70,6 +70,15 @@ class UnwindQueue {
 
   void CommitWrite() { wr_pos_.fetch_add(1u, std::memory_order_release); }
 
+  // Number of entries that were written but not yet consumed. Writer side
+  // only, might overestimate if the reader is consuming concurrently.
+  uint64_t WriterSize() {
+    uint64_t rd = rd_pos_.load(std::memory_order_acquire);
+    uint64_t wr = wr_pos_.load(std::memory_order_relaxed);
+    PERFETTO_DCHECK(wr >= rd);
+    return wr - rd;
+  }
+
   ReadView BeginRead() {
     uint64_t wr = wr_pos_.load(std::memory_order_acquire);
     uint64_t rd = rd_pos_.load(std::memory_order_relaxed);
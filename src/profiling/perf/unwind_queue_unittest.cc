@@ -72,6 +72,7 @@ TEST(UnwindQueueTest, Wrapped) {
 
   // no more available capacity
   ASSERT_FALSE(queue.BeginWrite().valid);
+  ASSERT_EQ(queue.WriterSize(), 4u);
 
   {
     // consume 2 entries (partial read)
@@ -80,6 +81,7 @@ TEST(UnwindQueueTest, Wrapped) {
     ASSERT_EQ(v.write_pos, 4u);
     queue.CommitNewReadPosition(v.read_pos + 2);
   }
+  ASSERT_EQ(queue.WriterSize(), 2u);
 
   // write 2 more entries
   for (int i = 0; i < 2; i++) {
@@ -104,6 +106,7 @@ TEST(UnwindQueueTest, Wrapped) {
   queue.CommitNewReadPosition(v.write_pos);
 
   ASSERT_THAT(read_back, ::testing::ElementsAre(2, 3, 4, 5));
+  ASSERT_EQ(queue.WriterSize(), 0u);
 
   // writer sees an available slot
   ASSERT_TRUE(queue.BeginWrite().valid);
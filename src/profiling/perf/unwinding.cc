@@ -28,6 +28,8 @@
 namespace {
 constexpr size_t kUnwindingMaxFrames = 1000;
 constexpr uint32_t kDataSourceShutdownRetryDelayMs = 400;
+// Number of binaries whose parsed Elf objects are kept across data sources.
+constexpr size_t kElfCacheMaxEntries = 256;
 }  // namespace
 
 namespace perfetto {
@@ -35,9 +37,14 @@ namespace profiling {
 
 Unwinder::Delegate::~Delegate() = default;
 
-Unwinder::Unwinder(Delegate* delegate, base::UnixTaskRunner* task_runner)
-    : task_runner_(task_runner), delegate_(delegate) {
-  ResetAndEnableUnwindstackCache();
+Unwinder::Unwinder(Delegate* delegate,
+                   base::UnixTaskRunner* task_runner,
+                   bool use_unwindstack_cache)
+    : task_runner_(task_runner),
+      delegate_(delegate),
+      use_unwindstack_cache_(use_unwindstack_cache),
+      elf_cache_(kElfCacheMaxEntries) {
+  ResetUnwindstackCache();
   base::MaybeSetThreadName("stack-unwinding");
 }
 
@@ -112,6 +119,7 @@ void Unwinder::AdoptProcDescriptors(DataSourceInstanceID ds_id,
   proc_state.status = ProcessState::Status::kResolved;
   proc_state.unwind_state =
       UnwindingMetadata{std::move(maps_fd), std::move(mem_fd)};
+  elf_cache_.PopulateMaps(&proc_state.unwind_state->fd_maps);
 }
 
 void Unwinder::PostRecordTimedOutProcDescriptors(DataSourceInstanceID ds_id,
@@ -371,6 +379,7 @@ CompletedSample Unwinder::UnwindSample(const ParsedSample& sample,
       PERFETTO_DLOG("Reparsing maps for pid [%d]",
                     static_cast<int>(sample.common.pid));
       unwind_state->ReparseMaps();
+      elf_cache_.PopulateMaps(&unwind_state->fd_maps);
     }
     // reunwind attempt
     unwind = attempt_unwind();
@@ -378,7 +387,7 @@ CompletedSample Unwinder::UnwindSample(const ParsedSample& sample,
 
   // Symbolize kernel-unwound kernel frames (if any).
   std::vector<unwindstack::FrameData> kernel_frames =
-      SymbolizeKernelCallchain(sample);
+      SymbolizeKernelCallchain(sample.kernel_ips);
 
   // Concatenate the kernel and userspace frames.
   auto kernel_frames_size = kernel_frames.size();
@@ -390,8 +399,10 @@ CompletedSample Unwinder::UnwindSample(const ParsedSample& sample,
 
   ret.build_ids.resize(kernel_frames_size, "");
 
+  base::FlatSet<uint64_t> cached_maps;
   for (unwindstack::FrameData& frame : unwind.frames) {
     ret.build_ids.emplace_back(unwind_state->GetBuildId(frame));
+    AddToElfCache(frame, unwind_state, &cached_maps);
     ret.frames.emplace_back(std::move(frame));
   }
 
@@ -414,17 +425,34 @@ CompletedSample Unwinder::UnwindSample(const ParsedSample& sample,
   return ret;
 }
 
+void Unwinder::AddToElfCache(const unwindstack::FrameData& frame,
+                             UnwindingMetadata* unwind_state,
+                             base::FlatSet<uint64_t>* cached_maps) {
+  // Anonymous and special mappings (e.g. [vdso], [anon:dalvik-jit-code-cache])
+  // and devices have no file to key the cache on.
+  const std::string& map_name = frame.map_name;
+  if (map_name.empty() || map_name[0] == '[' ||
+      (frame.map_flags & unwindstack::MAPS_FLAGS_DEVICE_MAP)) {
+    return;
+  }
+  if (!cached_maps->insert(frame.map_start).second)
+    return;
+  unwindstack::MapInfo* map_info = unwind_state->fd_maps.Find(frame.map_start);
+  if (map_info)
+    elf_cache_.Add(map_info);
+}
+
 std::vector<unwindstack::FrameData> Unwinder::SymbolizeKernelCallchain(
-    const ParsedSample& sample) {
+    const std::vector<uint64_t>& kernel_ips) {
   std::vector<unwindstack::FrameData> ret;
-  if (sample.kernel_ips.empty())
+  if (kernel_ips.empty())
     return ret;
 
   // The list of addresses contains special context marker values (inserted by
   // the kernel's unwinding) to indicate which section of the callchain belongs
   // to the kernel/user mode (if the kernel can successfully unwind user
   // stacks). In our case, we request only the kernel frames.
-  if (sample.kernel_ips[0] != PERF_CONTEXT_KERNEL) {
+  if (kernel_ips[0] != PERF_CONTEXT_KERNEL) {
     PERFETTO_DFATAL_OR_ELOG(
         "Unexpected: 0th frame of callchain is not PERF_CONTEXT_KERNEL.");
     return ret;
@@ -432,9 +460,9 @@ std::vector<unwindstack::FrameData> Unwinder::SymbolizeKernelCallchain(
 
   auto* kernel_map = kernel_symbolizer_.GetOrCreateKernelSymbolMap();
   PERFETTO_DCHECK(kernel_map);
-  ret.reserve(sample.kernel_ips.size());
-  for (size_t i = 1; i < sample.kernel_ips.size(); i++) {
-    std::string function_name = kernel_map->Lookup(sample.kernel_ips[i]);
+  ret.reserve(kernel_ips.size());
+  for (size_t i = 1; i < kernel_ips.size(); i++) {
+    std::string function_name = kernel_map->Lookup(kernel_ips[i]);
 
     // Synthesise a partially-valid libunwindstack frame struct for the kernel
     // frame. We reuse the type for convenience. The kernel frames are marked by
@@ -447,6 +475,95 @@ std::vector<unwindstack::FrameData> Unwinder::SymbolizeKernelCallchain(
   return ret;
 }
 
+// See the comment on |PostAdoptProcDescriptors| for the use of shared_ptr.
+void Unwinder::PostSymbolizeCallchains(DataSourceInstanceID ds_id,
+                                       AggregatedSamples samples) {
+  auto shared_samples = std::make_shared<AggregatedSamples>(std::move(samples));
+  task_runner_->PostTask([this, ds_id, shared_samples] {
+    SymbolizeCallchains(ds_id, std::move(*shared_samples.get()));
+  });
+}
+
+void Unwinder::SymbolizeCallchains(DataSourceInstanceID ds_id,
+                                   AggregatedSamples samples) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  PERFETTO_METATRACE_SCOPED(TAG_PRODUCER, PROFILER_UNWIND_SAMPLE);
+
+  auto it = data_sources_.find(ds_id);
+  if (it == data_sources_.end())
+    return;
+  DataSourceState& ds = it->second;
+
+  pid_t pid = samples.pid;
+  auto proc_it = ds.process_states.find(pid);
+  if (proc_it == ds.process_states.end() ||
+      proc_it->second.status != ProcessState::Status::kResolved) {
+    PERFETTO_DFATAL_OR_ELOG("Callchains for pid [%d] without proc-fds",
+                            static_cast<int>(pid));
+    return;
+  }
+  UnwindingMetadata* unwind_state = &proc_it->second.unwind_state.value();
+
+  // The architecture of the sampled process is not known without the
+  // registers, so this assumes that it is the same as ours.
+  // Frames of 32-bit processes on 64-bit kernels are left without function
+  // names (but with valid mappings, for offline symbolization).
+  unwindstack::ArchEnum arch = unwindstack::Regs::CurrentArch();
+#if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
+  unwindstack::JitDebug* jit_debug = unwind_state->GetJitDebug(arch);
+#else
+  unwindstack::JitDebug* jit_debug = nullptr;
+#endif
+
+  auto build_frame = [&](uint64_t pc) {
+    return unwindstack::Unwinder::BuildFrameFromPcOnly(
+        pc, arch, &unwind_state->fd_maps, jit_debug, unwind_state->fd_mem,
+        /*resolve_names=*/true);
+  };
+
+  bool reparsed = false;
+  base::FlatSet<uint64_t> cached_maps;
+  for (AggregatedCallchain& callchain : samples.callchains) {
+    callchain.frames = SymbolizeKernelCallchain(callchain.kernel_ips);
+    callchain.build_ids.resize(callchain.frames.size());
+    size_t num_frames = callchain.frames.size() + callchain.user_ips.size();
+    callchain.frames.reserve(num_frames);
+    callchain.build_ids.reserve(num_frames);
+
+    for (size_t i = 0; i < callchain.user_ips.size(); i++) {
+      // All but the innermost frame are return addresses, which point past
+      // the call instruction. Look up the call itself, so that the frame is
+      // attributed to the calling line (and function, for tail calls).
+      uint64_t pc = callchain.user_ips[i];
+      if (i > 0 && pc > 0)
+        pc--;
+
+      // A pc outside of all mappings gets a frame without one. The maps might
+      // be outdated if the process loaded new code since they were parsed.
+      // Reparse at most once per batch.
+      unwindstack::FrameData frame = build_frame(pc);
+      if (frame.map_end == 0 && !reparsed) {
+        PERFETTO_METATRACE_SCOPED(TAG_PRODUCER, PROFILER_MAPS_REPARSE);
+        unwind_state->ReparseMaps();
+        elf_cache_.PopulateMaps(&unwind_state->fd_maps);
+        reparsed = true;
+        cached_maps.clear();
+        frame = build_frame(pc);
+      }
+
+      callchain.build_ids.emplace_back(unwind_state->GetBuildId(frame));
+      AddToElfCache(frame, unwind_state, &cached_maps);
+      callchain.frames.emplace_back(std::move(frame));
+    }
+    PERFETTO_CHECK(callchain.build_ids.size() == callchain.frames.size());
+
+    callchain.kernel_ips.clear();
+    callchain.user_ips.clear();
+  }
+
+  delegate_->PostEmitAggregatedSamples(ds_id, std::move(samples));
+}
+
 void Unwinder::PostInitiateDataSourceStop(DataSourceInstanceID ds_id) {
   task_runner_->PostTask([this, ds_id] { InitiateDataSourceStop(ds_id); });
 }
@@ -486,7 +603,7 @@ void Unwinder::FinishDataSourceStop(DataSourceInstanceID ds_id) {
   // Clean up state if there are no more active sources.
   if (data_sources_.empty()) {
     kernel_symbolizer_.Destroy();
-    ResetAndEnableUnwindstackCache();
+    ResetUnwindstackCache();
   }
 
   // Inform service thread that the unwinder is done with the source.
@@ -510,7 +627,7 @@ void Unwinder::PurgeDataSource(DataSourceInstanceID ds_id) {
   // Clean up state if there are no more active sources.
   if (data_sources_.empty()) {
     kernel_symbolizer_.Destroy();
-    ResetAndEnableUnwindstackCache();
+    ResetUnwindstackCache();
     // Also purge scudo on Android, which would normally be done by the service
     // thread in |FinishDataSourceStop|. This is important as most of the scudo
     // overhead comes from libunwindstack.
@@ -542,13 +659,13 @@ void Unwinder::ClearCachedStatePeriodic(DataSourceInstanceID ds_id,
   for (auto& pid_and_process : ds.process_states) {
     pid_and_process.second.unwind_state->fd_maps.Reset();
   }
-  ResetAndEnableUnwindstackCache();
+  ResetUnwindstackCache();
   base::MaybeReleaseAllocatorMemToOS();
 
   PostClearCachedStatePeriodic(ds_id, period_ms);  // repost
 }
 
-void Unwinder::ResetAndEnableUnwindstackCache() {
+void Unwinder::ResetUnwindstackCache() {
   PERFETTO_DLOG("Resetting unwindstack cache");
   // Libunwindstack uses an unsynchronized variable for setting/checking whether
   // the cache is enabled. Therefore unwinding and cache toggling should stay on
@@ -559,7 +676,8 @@ void Unwinder::ResetAndEnableUnwindstackCache() {
   static std::mutex* lock = new std::mutex{};
   std::lock_guard<std::mutex> guard{*lock};
   unwindstack::Elf::SetCachingEnabled(false);  // free any existing state
-  unwindstack::Elf::SetCachingEnabled(true);   // reallocate a fresh cache
+  if (use_unwindstack_cache_)
+    unwindstack::Elf::SetCachingEnabled(true);  // reallocate a fresh cache
 }
 
 }  // namespace profiling
@@ -36,6 +36,7 @@
 #include "src/kallsyms/lazy_kernel_symbolizer.h"
 #include "src/profiling/common/unwind_support.h"
 #include "src/profiling/perf/common_types.h"
+#include "src/profiling/perf/elf_cache.h"
 #include "src/profiling/perf/unwind_queue.h"
 
 namespace perfetto {
@@ -45,7 +46,9 @@ constexpr static uint32_t kUnwindQueueCapacity = 1024;
 
 // Unwinds callstacks based on the sampled stack and register state (see
 // |ParsedSample|). Has a single unwinding ring queue, shared across
-// all data sources.
+// all data sources. The producer can run several unwinders, in which case the
+// samples are partitioned between them by pid, so that the unwinding state of
+// a given process is only ever used by one unwinder.
 //
 // Samples cannot be unwound without having /proc/<pid>/{maps,mem} file
 // descriptors for that process. This lookup can be asynchronous (e.g. on
@@ -81,6 +84,8 @@ class Unwinder {
                                 CompletedSample sample) = 0;
     virtual void PostEmitUnwinderSkippedSample(DataSourceInstanceID ds_id,
                                                ParsedSample sample) = 0;
+    virtual void PostEmitAggregatedSamples(DataSourceInstanceID ds_id,
+                                           AggregatedSamples samples) = 0;
     virtual void PostFinishDataSourceStop(DataSourceInstanceID ds_id) = 0;
 
     virtual ~Delegate();
@@ -95,6 +100,10 @@ class Unwinder {
                                 base::ScopedFile mem_fd);
   void PostRecordTimedOutProcDescriptors(DataSourceInstanceID ds_id, pid_t pid);
   void PostProcessQueue();
+  // Symbolizes the aggregated frame pointer callchains of a process, whose
+  // proc-fds must have been handed to this unwinder already.
+  void PostSymbolizeCallchains(DataSourceInstanceID ds_id,
+                               AggregatedSamples samples);
   void PostInitiateDataSourceStop(DataSourceInstanceID ds_id);
   void PostPurgeDataSource(DataSourceInstanceID ds_id);
 
@@ -154,7 +163,9 @@ class Unwinder {
   };
 
   // Must be instantiated via the |UnwinderHandle|.
-  Unwinder(Delegate* delegate, base::UnixTaskRunner* task_runner);
+  Unwinder(Delegate* delegate,
+           base::UnixTaskRunner* task_runner,
+           bool use_unwindstack_cache);
 
   // Marks the data source as valid and active at the unwinding stage.
   // Initializes kernel address symbolization if needed.
@@ -179,9 +190,22 @@ class Unwinder {
                                UnwindingMetadata* unwind_state,
                                bool pid_unwound_before);
 
+  // Hands the Elf object of the frame's mapping to |elf_cache_|, if the
+  // mapping is backed by a file and is not in |cached_maps| (the start
+  // addresses of the mappings already handed over) yet.
+  void AddToElfCache(const unwindstack::FrameData& frame,
+                     UnwindingMetadata* unwind_state,
+                     base::FlatSet<uint64_t>* cached_maps);
+
   // Returns a list of symbolized kernel frames in the sample (if any).
   std::vector<unwindstack::FrameData> SymbolizeKernelCallchain(
-      const ParsedSample& sample);
+      const std::vector<uint64_t>& kernel_ips);
+
+  // Fills in the frames of every callchain, and hands the samples back to the
+  // producer. Unlike |UnwindSample|, there is no stack to unwind: the frames
+  // are built from the instruction pointers, with one maps lookup each.
+  void SymbolizeCallchains(DataSourceInstanceID ds_id,
+                           AggregatedSamples samples);
 
   // Marks the data source as shutting down at the unwinding stage. It is known
   // that no new samples for this source will be pushed into the queue, but we
@@ -203,7 +227,7 @@ class Unwinder {
   }
 
   // Clears the parsed maps for all previously-sampled processes, and resets the
-  // libunwindstack cache. This has the effect of deallocating the cached Elf
+  // libunwindstack cache (if used). This has the effect of deallocating the cached Elf
   // objects within libunwindstack, which take up non-trivial amounts of memory.
   //
   // There are two reasons for having this operation:
@@ -216,7 +240,9 @@ class Unwinder {
   //   on the profiling config).
   //
   // After this function completes, the next unwind for each process will
-  // therefore incur a guaranteed maps reparse.
+  // therefore incur a guaranteed maps reparse. The Elf objects of recently
+  // sampled binaries are kept alive by |elf_cache_| though, so the reparse
+  // does not have to parse them again.
   //
   // Unwinding for concurrent data sources will *not* be directly affected at
   // the time of writing, as the non-cleared parsed maps will keep the cached
@@ -232,14 +258,24 @@ class Unwinder {
   // worth having at the moment to speed up unwinds across map reparses).
   void ClearCachedStatePeriodic(DataSourceInstanceID ds_id, uint32_t period_ms);
 
-  void ResetAndEnableUnwindstackCache();
+  // Frees libunwindstack's global Elf cache, and re-enables it unless
+  // |use_unwindstack_cache_| is false.
+  void ResetUnwindstackCache();
 
   base::UnixTaskRunner* const task_runner_;
   Delegate* const delegate_;
+  // libunwindstack's Elf cache is global to the process, and resetting it
+  // while another thread is unwinding is not safe. It is therefore left
+  // disabled if there are several unwinders, which then rely on their
+  // |elf_cache_| alone.
+  const bool use_unwindstack_cache_;
   UnwindQueue<UnwindEntry, kUnwindQueueCapacity> unwind_queue_;
   QueueFootprintTracker footprint_tracker_;
   std::map<DataSourceInstanceID, DataSourceState> data_sources_;
   LazyKernelSymbolizer kernel_symbolizer_;
+  // Survives data sources, so that consecutive profiling sessions of the same
+  // binaries do not parse their unwind tables from scratch.
+  ElfCache elf_cache_;
 
   PERFETTO_THREAD_CHECKER(thread_checker_)
 };
@@ -250,7 +286,7 @@ class Unwinder {
 // owned state, and consolidate.
 class UnwinderHandle {
  public:
-  explicit UnwinderHandle(Unwinder::Delegate* delegate) {
+  UnwinderHandle(Unwinder::Delegate* delegate, bool use_unwindstack_cache) {
     std::mutex init_lock;
     std::condition_variable init_cv;
 
@@ -268,7 +304,8 @@ class UnwinderHandle {
         };
 
     thread_ = std::thread(&UnwinderHandle::RunTaskThread, this,
-                          std::move(initializer), delegate);
+                          std::move(initializer), delegate,
+                          use_unwindstack_cache);
 
     std::unique_lock<std::mutex> lock(init_lock);
     init_cv.wait(lock, [this] { return !!task_runner_ && !!unwinder_; });
@@ -290,9 +327,10 @@ class UnwinderHandle {
  private:
   void RunTaskThread(
       std::function<void(base::UnixTaskRunner*, Unwinder*)> initializer,
-      Unwinder::Delegate* delegate) {
+      Unwinder::Delegate* delegate,
+      bool use_unwindstack_cache) {
     base::UnixTaskRunner task_runner;
-    Unwinder unwinder(delegate, &task_runner);
+    Unwinder unwinder(delegate, &task_runner, use_unwindstack_cache);
     task_runner.PostTask(
         std::bind(std::move(initializer), &task_runner, &unwinder));
     task_runner.Run();
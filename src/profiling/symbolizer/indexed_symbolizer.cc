@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/symbolizer/indexed_symbolizer.h"
+
+#include "perfetto/base/build_config.h"
+
+// This translation unit is built only on Linux, MacOS and Windows. See
+// //gn/BUILD.gn.
+#if PERFETTO_BUILDFLAG(PERFETTO_LOCAL_SYMBOLIZER)
+
+#include <fcntl.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <thread>
+#include <utility>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/string_utils.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+struct IndexJob {
+  std::string build_id;
+  // Either the path of a stored index, or of the binary to parse.
+  std::string path;
+  bool from_index_dir = false;
+  uint64_t load_bias = 0;
+  std::unique_ptr<SymbolIndex> result;
+};
+
+void WriteIndex(const SymbolIndex& index, const std::string& path) {
+  std::string data = index.Serialize();
+  // Write to a temporary file first, so that concurrent runs never read a
+  // partially written index.
+  std::string tmp_path = path + ".tmp";
+  {
+    base::ScopedFile fd(
+        base::OpenFile(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    if (!fd) {
+      PERFETTO_PLOG("Failed to create %s", tmp_path.c_str());
+      return;
+    }
+    if (base::WriteAll(*fd, data.data(), data.size()) !=
+        static_cast<ssize_t>(data.size())) {
+      PERFETTO_PLOG("Failed to write %s", tmp_path.c_str());
+      fd.reset();
+      remove(tmp_path.c_str());
+      return;
+    }
+  }
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    PERFETTO_PLOG("Failed to rename %s", tmp_path.c_str());
+    remove(tmp_path.c_str());
+  }
+}
+
+void RunJob(IndexJob* job, const std::string& index_path) {
+  if (job->from_index_dir) {
+    std::string data;
+    if (!base::ReadFile(job->path, &data))
+      return;
+    base::Optional<SymbolIndex> index = SymbolIndex::Deserialize(data);
+    if (!index) {
+      PERFETTO_ELOG("Ignoring invalid symbol index %s", job->path.c_str());
+      return;
+    }
+    job->result.reset(new SymbolIndex(std::move(*index)));
+    return;
+  }
+
+  base::Optional<SymbolIndex> index = SymbolIndex::CreateFromElf(job->path);
+  if (!index) {
+    PERFETTO_ELOG("Failed to index %s", job->path.c_str());
+    return;
+  }
+  index->set_load_bias(job->load_bias);
+  PERFETTO_DLOG("Indexed %s: %zu functions, %zu line rows", job->path.c_str(),
+                index->num_functions(), index->num_lines());
+  if (!index_path.empty())
+    WriteIndex(*index, index_path);
+  job->result.reset(new SymbolIndex(std::move(*index)));
+}
+
+}  // namespace
+
+IndexedSymbolizer::IndexedSymbolizer(std::unique_ptr<BinaryFinder> finder,
+                                     std::string index_dir,
+                                     uint32_t num_threads)
+    : finder_(std::move(finder)),
+      index_dir_(std::move(index_dir)),
+      num_threads_(std::max(num_threads, 1u)) {
+  // Fails if the directory already exists, which is the common case.
+  if (!index_dir_.empty())
+    base::Mkdir(index_dir_);
+}
+
+IndexedSymbolizer::~IndexedSymbolizer() = default;
+
+std::vector<std::vector<SymbolizedFrame>> IndexedSymbolizer::Symbolize(
+    const std::string& mapping_name,
+    const std::string& build_id,
+    uint64_t load_bias,
+    const std::vector<uint64_t>& addresses) {
+  Mapping mapping;
+  mapping.name = mapping_name;
+  mapping.build_id = build_id;
+  mapping.load_bias = load_bias;
+  mapping.addresses = addresses;
+  std::vector<Mapping> mappings;
+  mappings.emplace_back(std::move(mapping));
+  return std::move(SymbolizeBatch(mappings)[0]);
+}
+
+std::vector<std::vector<std::vector<SymbolizedFrame>>>
+IndexedSymbolizer::SymbolizeBatch(const std::vector<Mapping>& mappings) {
+  LoadIndices(mappings);
+
+  std::vector<std::vector<std::vector<SymbolizedFrame>>> result(
+      mappings.size());
+  for (size_t i = 0; i < mappings.size(); ++i) {
+    const Mapping& mapping = mappings[i];
+    const SymbolIndex* index = indices_[mapping.build_id].get();
+    if (!index)
+      continue;
+    uint64_t load_bias_correction = 0;
+    if (index->load_bias() > mapping.load_bias) {
+      // See LocalSymbolizer::Symbolize.
+      load_bias_correction = index->load_bias() - mapping.load_bias;
+      PERFETTO_LOG("Correcting load bias by %" PRIu64 " for %s",
+                   load_bias_correction, mapping.name.c_str());
+    }
+    result[i].reserve(mapping.addresses.size());
+    for (uint64_t address : mapping.addresses)
+      result[i].emplace_back(index->Lookup(address + load_bias_correction));
+  }
+  return result;
+}
+
+void IndexedSymbolizer::LoadIndices(const std::vector<Mapping>& mappings) {
+  // Finding the binaries is done on this thread, as BinaryFinders are not
+  // thread safe. Only the parsing is parallel.
+  std::vector<IndexJob> jobs;
+  for (const Mapping& mapping : mappings) {
+    if (!indices_.emplace(mapping.build_id, nullptr).second)
+      continue;  // Seen before, or earlier in this batch.
+
+    IndexJob job;
+    job.build_id = mapping.build_id;
+    if (!index_dir_.empty() &&
+        base::FileExists(IndexPath(mapping.build_id))) {
+      job.path = IndexPath(mapping.build_id);
+      job.from_index_dir = true;
+    } else {
+      base::Optional<FoundBinary> binary =
+          finder_->FindBinary(mapping.name, mapping.build_id);
+      if (!binary)
+        continue;
+      job.path = binary->file_name;
+      job.load_bias = binary->load_bias;
+    }
+    jobs.emplace_back(std::move(job));
+  }
+  if (jobs.empty())
+    return;
+
+  std::atomic<size_t> next_job{0};
+  auto worker = [this, &jobs, &next_job] {
+    for (size_t i = next_job++; i < jobs.size(); i = next_job++) {
+      IndexJob& job = jobs[i];
+      RunJob(&job, index_dir_.empty() || job.from_index_dir
+                       ? std::string()
+                       : IndexPath(job.build_id));
+    }
+  };
+  size_t num_threads = std::min<size_t>(num_threads_, jobs.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i)
+    threads.emplace_back(worker);
+  worker();
+  for (std::thread& thread : threads)
+    thread.join();
+
+  for (IndexJob& job : jobs)
+    indices_[job.build_id] = std::move(job.result);
+}
+
+std::string IndexedSymbolizer::IndexPath(const std::string& build_id) const {
+  return index_dir_ + "/" + base::ToHex(build_id) + ".symidx";
+}
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_LOCAL_SYMBOLIZER)
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_SYMBOLIZER_INDEXED_SYMBOLIZER_H_
+#define SRC_PROFILING_SYMBOLIZER_INDEXED_SYMBOLIZER_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/profiling/symbolizer/local_symbolizer.h"
+#include "src/profiling/symbolizer/symbol_index.h"
+#include "src/profiling/symbolizer/symbolizer.h"
+
+namespace perfetto {
+namespace profiling {
+
+// Symbolizes in-process from a SymbolIndex of each binary, instead of going
+// through llvm-symbolizer. The binaries of a batch of mappings are parsed in
+// parallel, on up to |num_threads| threads.
+//
+// If |index_dir| is not empty, the index of every binary is stored there,
+// named after its build id. Later runs load it from there, without looking
+// for (or parsing) the binary again.
+class IndexedSymbolizer : public Symbolizer {
+ public:
+  IndexedSymbolizer(std::unique_ptr<BinaryFinder> finder,
+                    std::string index_dir,
+                    uint32_t num_threads);
+  ~IndexedSymbolizer() override;
+
+  std::vector<std::vector<SymbolizedFrame>> Symbolize(
+      const std::string& mapping_name,
+      const std::string& build_id,
+      uint64_t load_bias,
+      const std::vector<uint64_t>& address) override;
+
+  std::vector<std::vector<std::vector<SymbolizedFrame>>> SymbolizeBatch(
+      const std::vector<Mapping>& mappings) override;
+
+  bool BuildIdNeedsHexConversion() override { return true; }
+
+ private:
+  // Loads or builds the indices of the binaries of |mappings| that were not
+  // seen before.
+  void LoadIndices(const std::vector<Mapping>& mappings);
+  std::string IndexPath(const std::string& build_id) const;
+
+  std::unique_ptr<BinaryFinder> finder_;
+  const std::string index_dir_;
+  const uint32_t num_threads_;
+  // By build id. nullptr if the binary could not be found or parsed.
+  std::map<std::string, std::unique_ptr<SymbolIndex>> indices_;
+};
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_SYMBOLIZER_INDEXED_SYMBOLIZER_H_
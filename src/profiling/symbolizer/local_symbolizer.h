@@ -49,6 +49,9 @@ class BinaryFinder {
       const std::string& build_id) = 0;
 };
 
+// Finds binaries by build id anywhere under |roots|. The roots are walked on
+// the first call to FindBinary(), so that no walk is needed if the symbols of
+// all binaries can be found elsewhere (see IndexedSymbolizer).
 class LocalBinaryIndexer : public BinaryFinder {
  public:
   explicit LocalBinaryIndexer(std::vector<std::string> roots);
@@ -58,6 +61,8 @@ class LocalBinaryIndexer : public BinaryFinder {
   ~LocalBinaryIndexer() override;
 
  private:
+  std::vector<std::string> roots_;
+  bool indexed_ = false;
   std::map<std::string, FoundBinary> buildid_to_file_;
 };
 
@@ -116,9 +121,15 @@ class LocalSymbolizer : public Symbolizer {
   std::unique_ptr<BinaryFinder> finder_;
 };
 
+// |mode| selects how binaries are found: "find" (default) or "index".
+// |backend| selects how they are symbolized: "llvm" (default, through
+// llvm-symbolizer) or "builtin" (IndexedSymbolizer). |index_dir|, if not null,
+// is where the builtin backend stores the symbol index of each binary.
 std::unique_ptr<Symbolizer> LocalSymbolizerOrDie(
     std::vector<std::string> binary_path,
-    const char* mode);
+    const char* mode,
+    const char* backend,
+    const char* index_dir);
 
 }  // namespace profiling
 }  // namespace perfetto
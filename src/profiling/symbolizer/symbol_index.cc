@@ -0,0 +1,759 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/symbolizer/symbol_index.h"
+
+#include "perfetto/base/build_config.h"
+
+// This translation unit is built only on Linux, MacOS and Windows. See
+// //gn/BUILD.gn.
+#if PERFETTO_BUILDFLAG(PERFETTO_LOCAL_SYMBOLIZER)
+
+#include <string.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <memory>
+#include <utility>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/utils.h"
+#include "src/profiling/symbolizer/elf.h"
+#include "src/profiling/symbolizer/filesystem.h"
+#include "src/profiling/symbolizer/scoped_read_mmap.h"
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <cxxabi.h>
+#endif
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+// Bump when changing the serialized format.
+constexpr char kIndexMagic[] = "PERFETTO_SYMBOL_INDEX_1";
+
+// DWARF constants, see the DWARF 5 standard, section 7.22.
+constexpr uint8_t DW_LNS_copy = 1;
+constexpr uint8_t DW_LNS_advance_pc = 2;
+constexpr uint8_t DW_LNS_advance_line = 3;
+constexpr uint8_t DW_LNS_set_file = 4;
+constexpr uint8_t DW_LNS_set_column = 5;
+constexpr uint8_t DW_LNS_negate_stmt = 6;
+constexpr uint8_t DW_LNS_set_basic_block = 7;
+constexpr uint8_t DW_LNS_const_add_pc = 8;
+constexpr uint8_t DW_LNS_fixed_advance_pc = 9;
+constexpr uint8_t DW_LNS_set_prologue_end = 10;
+constexpr uint8_t DW_LNS_set_epilogue_begin = 11;
+constexpr uint8_t DW_LNS_set_isa = 12;
+constexpr uint8_t DW_LNE_end_sequence = 1;
+constexpr uint8_t DW_LNE_set_address = 2;
+constexpr uint8_t DW_LNE_define_file = 3;
+constexpr uint64_t DW_LNCT_path = 1;
+constexpr uint64_t DW_LNCT_directory_index = 2;
+constexpr uint64_t DW_FORM_data2 = 0x05;
+constexpr uint64_t DW_FORM_data4 = 0x06;
+constexpr uint64_t DW_FORM_data8 = 0x07;
+constexpr uint64_t DW_FORM_string = 0x08;
+constexpr uint64_t DW_FORM_block = 0x09;
+constexpr uint64_t DW_FORM_data1 = 0x0b;
+constexpr uint64_t DW_FORM_strp = 0x0e;
+constexpr uint64_t DW_FORM_udata = 0x0f;
+constexpr uint64_t DW_FORM_data16 = 0x1e;
+constexpr uint64_t DW_FORM_line_strp = 0x1f;
+
+// Bounds checked reader of little endian data. Once a read goes out of
+// bounds, all further reads return zero and ok() returns false.
+class ByteReader {
+ public:
+  ByteReader(const uint8_t* begin, const uint8_t* end)
+      : ptr_(begin), end_(end) {}
+
+  bool ok() const { return ok_; }
+  size_t remaining() const { return static_cast<size_t>(end_ - ptr_); }
+  const uint8_t* ptr() const { return ptr_; }
+
+  uint64_t ReadUint(size_t size) {
+    if (size > sizeof(uint64_t) || !Check(size))
+      return 0;
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++)
+      value |= static_cast<uint64_t>(ptr_[i]) << (8 * i);
+    ptr_ += size;
+    return value;
+  }
+  uint8_t ReadU8() { return static_cast<uint8_t>(ReadUint(1)); }
+  uint16_t ReadU16() { return static_cast<uint16_t>(ReadUint(2)); }
+  uint32_t ReadU32() { return static_cast<uint32_t>(ReadUint(4)); }
+  uint64_t ReadU64() { return ReadUint(8); }
+  // Offset into another section: 4 bytes, or 8 bytes in 64-bit DWARF.
+  uint64_t ReadOffset(bool dwarf64) { return ReadUint(dwarf64 ? 8 : 4); }
+
+  uint64_t ReadUleb() {
+    uint64_t value = 0;
+    for (uint32_t shift = 0; Check(1); shift += 7) {
+      uint8_t byte = *ptr_++;
+      if (shift < 64)
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return value;
+    }
+    return 0;
+  }
+
+  int64_t ReadSleb() {
+    uint64_t value = 0;
+    for (uint32_t shift = 0; Check(1);) {
+      uint8_t byte = *ptr_++;
+      if (shift < 64)
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      shift += 7;
+      if (!(byte & 0x80)) {
+        if (shift < 64 && (byte & 0x40))
+          value |= ~uint64_t(0) << shift;
+        return static_cast<int64_t>(value);
+      }
+    }
+    return 0;
+  }
+
+  std::string ReadCString() {
+    const void* nul = ok_ ? memchr(ptr_, 0, remaining()) : nullptr;
+    if (!nul) {
+      ok_ = false;
+      return "";
+    }
+    std::string str(reinterpret_cast<const char*>(ptr_),
+                    static_cast<const uint8_t*>(nul) - ptr_);
+    ptr_ = static_cast<const uint8_t*>(nul) + 1;
+    return str;
+  }
+
+  void Skip(size_t size) {
+    if (Check(size))
+      ptr_ += size;
+  }
+
+ private:
+  bool Check(size_t size) {
+    if (ok_ && size <= remaining())
+      return true;
+    ok_ = false;
+    return false;
+  }
+
+  const uint8_t* ptr_;
+  const uint8_t* end_;
+  bool ok_ = true;
+};
+
+class ByteWriter {
+ public:
+  void WriteUint(uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++)
+      data_.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+  void WriteU32(uint32_t value) { WriteUint(value, sizeof(value)); }
+  void WriteU64(uint64_t value) { WriteUint(value, sizeof(value)); }
+  void WriteString(const std::string& str) {
+    WriteU32(static_cast<uint32_t>(str.size()));
+    data_.append(str);
+  }
+
+  std::string* data() { return &data_; }
+
+ private:
+  std::string data_;
+};
+
+bool ReadSectionString(ElfSection section, uint64_t offset, std::string* out) {
+  if (offset >= section.size)
+    return false;
+  ByteReader reader(section.data + offset, section.data + section.size);
+  *out = reader.ReadCString();
+  return reader.ok();
+}
+
+// Reads one attribute of a DWARF 5 directory or file name entry. Only strings
+// and unsigned integers are returned, other values are skipped.
+bool ReadEntryAttribute(ByteReader* reader,
+                        uint64_t form,
+                        bool dwarf64,
+                        ElfSection debug_line_str,
+                        ElfSection debug_str,
+                        std::string* str_value,
+                        uint64_t* uint_value) {
+  switch (form) {
+    case DW_FORM_string:
+      *str_value = reader->ReadCString();
+      break;
+    case DW_FORM_line_strp:
+      if (!ReadSectionString(debug_line_str, reader->ReadOffset(dwarf64),
+                             str_value))
+        return false;
+      break;
+    case DW_FORM_strp:
+      if (!ReadSectionString(debug_str, reader->ReadOffset(dwarf64),
+                             str_value))
+        return false;
+      break;
+    case DW_FORM_udata:
+      *uint_value = reader->ReadUleb();
+      break;
+    case DW_FORM_data1:
+      *uint_value = reader->ReadU8();
+      break;
+    case DW_FORM_data2:
+      *uint_value = reader->ReadU16();
+      break;
+    case DW_FORM_data4:
+      *uint_value = reader->ReadU32();
+      break;
+    case DW_FORM_data8:
+      *uint_value = reader->ReadU64();
+      break;
+    case DW_FORM_data16:
+      reader->Skip(16);
+      break;
+    case DW_FORM_block:
+      reader->Skip(reader->ReadUleb());
+      break;
+    default:
+      // E.g. DW_FORM_strx, which needs .debug_str_offsets.
+      PERFETTO_DLOG("Unsupported DWARF form %" PRIu64, form);
+      return false;
+  }
+  return reader->ok();
+}
+
+// Reads the DWARF 5 directory or file name table of a line table header.
+// Returns (path, directory index) pairs.
+bool ReadEntryTable(ByteReader* reader,
+                    bool dwarf64,
+                    ElfSection debug_line_str,
+                    ElfSection debug_str,
+                    std::vector<std::pair<std::string, uint64_t>>* entries) {
+  std::vector<std::pair<uint64_t, uint64_t>> formats;  // (content type, form)
+  uint8_t format_count = reader->ReadU8();
+  for (uint8_t i = 0; i < format_count; i++) {
+    uint64_t content_type = reader->ReadUleb();
+    uint64_t form = reader->ReadUleb();
+    formats.emplace_back(content_type, form);
+  }
+  uint64_t count = reader->ReadUleb();
+  for (uint64_t i = 0; i < count && reader->ok(); i++) {
+    std::pair<std::string, uint64_t> entry;
+    for (const auto& content_type_and_form : formats) {
+      std::string str_value;
+      uint64_t uint_value = 0;
+      if (!ReadEntryAttribute(reader, content_type_and_form.second, dwarf64,
+                              debug_line_str, debug_str, &str_value,
+                              &uint_value)) {
+        return false;
+      }
+      if (content_type_and_form.first == DW_LNCT_path)
+        entry.first = std::move(str_value);
+      else if (content_type_and_form.first == DW_LNCT_directory_index)
+        entry.second = uint_value;
+    }
+    entries->emplace_back(std::move(entry));
+  }
+  return reader->ok();
+}
+
+std::string JoinPath(const std::string& dir, const std::string& name) {
+  if (dir.empty() || name.empty() || name[0] == '/')
+    return name;
+  return dir + "/" + name;
+}
+
+// Parses the header and line number program of one line table unit, whose
+// unit_length field has already been read.
+bool ParseLineUnit(ByteReader* unit,
+                   bool dwarf64,
+                   ElfSection debug_line_str,
+                   ElfSection debug_str,
+                   SymbolIndex* index) {
+  uint16_t version = unit->ReadU16();
+  if (version < 2 || version > 5) {
+    PERFETTO_DLOG("Unsupported .debug_line version %u", version);
+    return false;
+  }
+  if (version >= 5) {
+    unit->ReadU8();  // address_size
+    unit->ReadU8();  // segment_selector_size
+  }
+  uint64_t header_length = unit->ReadOffset(dwarf64);
+  if (!unit->ok() || header_length > unit->remaining())
+    return false;
+  ByteReader program(unit->ptr() + header_length,
+                     unit->ptr() + unit->remaining());
+
+  uint8_t min_inst_length = unit->ReadU8();
+  if (version >= 4)
+    unit->ReadU8();  // maximum_operations_per_instruction, for VLIW
+  unit->ReadU8();    // default_is_stmt
+  int8_t line_base = static_cast<int8_t>(unit->ReadU8());
+  uint8_t line_range = unit->ReadU8();
+  uint8_t opcode_base = unit->ReadU8();
+  if (!unit->ok() || line_range == 0 || opcode_base == 0)
+    return false;
+  std::vector<uint8_t> standard_opcode_lengths(opcode_base - 1);
+  for (uint8_t& length : standard_opcode_lengths)
+    length = unit->ReadU8();
+
+  // File names by file index, already interned in |index|. File indices are
+  // 1-based before DWARF 5.
+  std::vector<uint32_t> file_ids;
+  if (version >= 5) {
+    std::vector<std::pair<std::string, uint64_t>> dirs;
+    std::vector<std::pair<std::string, uint64_t>> files;
+    if (!ReadEntryTable(unit, dwarf64, debug_line_str, debug_str, &dirs) ||
+        !ReadEntryTable(unit, dwarf64, debug_line_str, debug_str, &files)) {
+      return false;
+    }
+    // Directory 0 is the compilation directory, the others can be relative
+    // to it.
+    const std::string comp_dir = dirs.empty() ? "" : dirs[0].first;
+    for (const auto& file : files) {
+      std::string dir =
+          file.second < dirs.size() ? dirs[file.second].first : "";
+      if (file.second != 0)
+        dir = JoinPath(comp_dir, dir);
+      file_ids.push_back(index->InternString(JoinPath(dir, file.first)));
+    }
+  } else {
+    // Directory 0 is the compilation directory, which is not in the header.
+    std::vector<std::string> dirs(1);
+    for (;;) {
+      std::string dir = unit->ReadCString();
+      if (dir.empty())
+        break;
+      dirs.emplace_back(std::move(dir));
+    }
+    file_ids.push_back(index->InternString(""));
+    for (;;) {
+      std::string name = unit->ReadCString();
+      if (name.empty())
+        break;
+      uint64_t dir_index = unit->ReadUleb();
+      unit->ReadUleb();  // modification time
+      unit->ReadUleb();  // file length
+      const std::string& dir = dir_index < dirs.size() ? dirs[dir_index] : "";
+      file_ids.push_back(index->InternString(JoinPath(dir, name)));
+    }
+  }
+  if (!unit->ok())
+    return false;
+
+  // Line number program state machine. Rows are buffered until the end of
+  // their sequence: sequences of functions that were discarded by the linker
+  // start at address 0, and would shadow the real function at that address.
+  struct Row {
+    uint64_t address;
+    uint32_t file_id;
+    uint32_t line;
+  };
+  std::vector<Row> sequence;
+  uint64_t address = 0;
+  uint64_t file = 1;
+  int64_t line = 1;
+  auto emit_row = [&] {
+    // A row without a valid file or line is kept, as it ends the range of
+    // the previous row.
+    Row row{address, 0, 0};
+    if (file < file_ids.size() && line > 0 && line <= UINT32_MAX) {
+      row.file_id = file_ids[file];
+      row.line = static_cast<uint32_t>(line);
+    }
+    sequence.push_back(row);
+  };
+
+  while (program.remaining() > 0) {
+    uint8_t opcode = program.ReadU8();
+    if (opcode >= opcode_base) {
+      // Special opcode: advance address and line, and emit a row.
+      uint8_t adjusted = static_cast<uint8_t>(opcode - opcode_base);
+      address += (adjusted / line_range) * min_inst_length;
+      line += line_base + adjusted % line_range;
+      emit_row();
+      continue;
+    }
+    switch (opcode) {
+      case 0: {  // extended opcode
+        uint64_t length = program.ReadUleb();
+        if (!program.ok() || length == 0 || length > program.remaining())
+          return false;
+        ByteReader extended(program.ptr(), program.ptr() + length);
+        program.Skip(static_cast<size_t>(length));
+        uint8_t extended_opcode = extended.ReadU8();
+        if (extended_opcode == DW_LNE_end_sequence) {
+          if (!sequence.empty() && sequence.front().address != 0) {
+            // Rows at the end address cover no instructions.
+            for (const Row& row : sequence) {
+              if (row.address < address)
+                index->AddLine(row.address, row.file_id, row.line);
+            }
+            index->AddLine(address, 0, 0);
+          }
+          sequence.clear();
+          address = 0;
+          file = 1;
+          line = 1;
+        } else if (extended_opcode == DW_LNE_set_address) {
+          address = extended.ReadUint(extended.remaining());
+        } else if (extended_opcode == DW_LNE_define_file) {
+          std::string name = extended.ReadCString();
+          file_ids.push_back(index->InternString(name));
+        }
+        // Other extended opcodes (e.g. DW_LNE_set_discriminator) do not
+        // affect the rows we keep.
+        break;
+      }
+      case DW_LNS_copy:
+        emit_row();
+        break;
+      case DW_LNS_advance_pc:
+        address += program.ReadUleb() * min_inst_length;
+        break;
+      case DW_LNS_advance_line:
+        line += program.ReadSleb();
+        break;
+      case DW_LNS_set_file:
+        file = program.ReadUleb();
+        break;
+      case DW_LNS_set_column:
+      case DW_LNS_set_isa:
+        program.ReadUleb();
+        break;
+      case DW_LNS_negate_stmt:
+      case DW_LNS_set_basic_block:
+      case DW_LNS_set_prologue_end:
+      case DW_LNS_set_epilogue_begin:
+        break;
+      case DW_LNS_const_add_pc:
+        address += ((255 - opcode_base) / line_range) * min_inst_length;
+        break;
+      case DW_LNS_fixed_advance_pc:
+        address += program.ReadU16();
+        break;
+      default:
+        // Unknown standard opcode, skip its operands.
+        for (uint8_t i = 0; i < standard_opcode_lengths[opcode - 1]; i++)
+          program.ReadUleb();
+        break;
+    }
+    if (!program.ok())
+      return false;
+  }
+  return true;
+}
+
+std::string Demangle(const char* name) {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  int ignored;
+  std::unique_ptr<char, base::FreeDeleter> demangled(
+      abi::__cxa_demangle(name, nullptr, nullptr, &ignored));
+  if (demangled)
+    return demangled.get();
+#endif
+  return name;
+}
+
+template <typename E>
+bool ReadElf(char* mem, size_t size, SymbolIndex* index) {
+  const typename E::Ehdr* ehdr = reinterpret_cast<typename E::Ehdr*>(mem);
+  if (!InRange(mem, size, ehdr, sizeof(typename E::Ehdr)) ||
+      ehdr->e_shoff > size ||
+      !InRange(mem, size, mem + ehdr->e_shoff,
+               ehdr->e_shnum * sizeof(typename E::Shdr)) ||
+      ehdr->e_shstrndx >= ehdr->e_shnum) {
+    PERFETTO_ELOG("Corrupted ELF.");
+    return false;
+  }
+  auto section_data = [mem, size](const typename E::Shdr* shdr) {
+    ElfSection section;
+    if (shdr->sh_type == SHT_NOBITS || shdr->sh_offset > size ||
+        shdr->sh_size > size - shdr->sh_offset) {
+      return section;
+    }
+    section.data = reinterpret_cast<const uint8_t*>(mem + shdr->sh_offset);
+    section.size = static_cast<size_t>(shdr->sh_size);
+    return section;
+  };
+  ElfSection shstrtab = section_data(GetShdr<E>(mem, ehdr, ehdr->e_shstrndx));
+
+  const typename E::Shdr* symtab = nullptr;
+  const typename E::Shdr* dynsym = nullptr;
+  ElfSection debug_line;
+  ElfSection debug_line_str;
+  ElfSection debug_str;
+  for (size_t i = 0; i < ehdr->e_shnum; ++i) {
+    const typename E::Shdr* shdr = GetShdr<E>(mem, ehdr, i);
+    if (shdr->sh_type == SHT_SYMTAB) {
+      symtab = shdr;
+    } else if (shdr->sh_type == SHT_DYNSYM) {
+      dynsym = shdr;
+    }
+    std::string name;
+    if (!ReadSectionString(shstrtab, shdr->sh_name, &name) ||
+        name.compare(0, 7, ".debug_") != 0) {
+      continue;
+    }
+    if (shdr->sh_flags & SHF_COMPRESSED) {
+      PERFETTO_DLOG("Skipping compressed section %s", name.c_str());
+      continue;
+    }
+    if (name == ".debug_line") {
+      debug_line = section_data(shdr);
+    } else if (name == ".debug_line_str") {
+      debug_line_str = section_data(shdr);
+    } else if (name == ".debug_str") {
+      debug_str = section_data(shdr);
+    }
+  }
+
+  // Stripped binaries only have the dynamic symbols.
+  const typename E::Shdr* syms = symtab ? symtab : dynsym;
+  if (syms && syms->sh_link < ehdr->e_shnum) {
+    ElfSection sym_data = section_data(syms);
+    ElfSection strtab = section_data(GetShdr<E>(mem, ehdr, syms->sh_link));
+    size_t num_syms = sym_data.size / sizeof(typename E::Sym);
+    for (size_t i = 0; i < num_syms; ++i) {
+      const typename E::Sym* sym =
+          reinterpret_cast<const typename E::Sym*>(sym_data.data) + i;
+      if (ElfSymType(sym->st_info) != STT_FUNC ||
+          sym->st_shndx == SHN_UNDEF || sym->st_value == 0) {
+        continue;
+      }
+      std::string name;
+      if (!ReadSectionString(strtab, sym->st_name, &name) || name.empty())
+        continue;
+      uint64_t start = sym->st_value;
+      // The lowest bit of Thumb function addresses is set.
+      if (ehdr->e_machine == EM_ARM)
+        start &= ~uint64_t(1);
+      index->AddFunction(start, sym->st_size, Demangle(name.c_str()));
+    }
+  }
+
+  if (debug_line.size > 0 &&
+      !ParseDebugLine(debug_line, debug_line_str, debug_str, index)) {
+    PERFETTO_ELOG("Failed to parse .debug_line, line numbers are incomplete.");
+  }
+  return true;
+}
+
+}  // namespace
+
+bool ParseDebugLine(ElfSection debug_line,
+                    ElfSection debug_line_str,
+                    ElfSection debug_str,
+                    SymbolIndex* index) {
+  ByteReader reader(debug_line.data, debug_line.data + debug_line.size);
+  while (reader.remaining() > 0) {
+    uint64_t unit_length = reader.ReadU32();
+    bool dwarf64 = false;
+    if (unit_length == 0xffffffff) {
+      unit_length = reader.ReadU64();
+      dwarf64 = true;
+    } else if (unit_length >= 0xfffffff0) {
+      return false;  // reserved
+    }
+    if (!reader.ok() || unit_length > reader.remaining())
+      return false;
+    ByteReader unit(reader.ptr(), reader.ptr() + unit_length);
+    reader.Skip(static_cast<size_t>(unit_length));
+    if (!ParseLineUnit(&unit, dwarf64, debug_line_str, debug_str, index))
+      return false;
+  }
+  return true;
+}
+
+// static
+base::Optional<SymbolIndex> SymbolIndex::CreateFromElf(
+    const std::string& path) {
+  size_t size = GetFileSize(path);
+  if (size <= EI_DATA)
+    return base::nullopt;
+  ScopedReadMmap map(path.c_str(), size);
+  if (!map.IsValid()) {
+    PERFETTO_PLOG("mmap %s", path.c_str());
+    return base::nullopt;
+  }
+  char* mem = static_cast<char*>(*map);
+  if (!IsElf(mem, size) || mem[EI_DATA] != ELFDATA2LSB)
+    return base::nullopt;
+
+  SymbolIndex index;
+  bool success = false;
+  switch (mem[EI_CLASS]) {
+    case ELFCLASS32:
+      success = ReadElf<Elf32>(mem, size, &index);
+      break;
+    case ELFCLASS64:
+      success = ReadElf<Elf64>(mem, size, &index);
+      break;
+  }
+  if (!success)
+    return base::nullopt;
+  index.Finalize();
+  return base::make_optional(std::move(index));
+}
+
+// static
+base::Optional<SymbolIndex> SymbolIndex::Deserialize(const std::string& data) {
+  const uint8_t* begin = reinterpret_cast<const uint8_t*>(data.data());
+  ByteReader reader(begin, begin + data.size());
+  if (reader.ReadCString() != kIndexMagic)
+    return base::nullopt;
+
+  SymbolIndex index;
+  index.load_bias_ = reader.ReadU64();
+  uint32_t num_strings = reader.ReadU32();
+  for (uint32_t i = 0; i < num_strings && reader.ok(); i++) {
+    uint32_t size = reader.ReadU32();
+    if (!reader.ok() || size > reader.remaining())
+      return base::nullopt;
+    index.strings_.emplace_back(reinterpret_cast<const char*>(reader.ptr()),
+                                size);
+    reader.Skip(size);
+  }
+  uint32_t num_functions = reader.ReadU32();
+  for (uint32_t i = 0; i < num_functions && reader.ok(); i++) {
+    Function function;
+    function.start = reader.ReadU64();
+    function.size = reader.ReadU64();
+    function.name_id = reader.ReadU32();
+    if (function.name_id >= index.strings_.size())
+      return base::nullopt;
+    index.functions_.push_back(function);
+  }
+  uint32_t num_lines = reader.ReadU32();
+  for (uint32_t i = 0; i < num_lines && reader.ok(); i++) {
+    LineRow row;
+    row.address = reader.ReadU64();
+    row.file_id = reader.ReadU32();
+    row.line = reader.ReadU32();
+    if (row.file_id >= index.strings_.size() && row.line != 0)
+      return base::nullopt;
+    index.lines_.push_back(row);
+  }
+  if (!reader.ok() || reader.remaining() != 0)
+    return base::nullopt;
+  return base::make_optional(std::move(index));
+}
+
+std::string SymbolIndex::Serialize() const {
+  ByteWriter writer;
+  writer.data()->append(kIndexMagic, sizeof(kIndexMagic));
+  writer.WriteU64(load_bias_);
+  writer.WriteU32(static_cast<uint32_t>(strings_.size()));
+  for (const std::string& str : strings_)
+    writer.WriteString(str);
+  writer.WriteU32(static_cast<uint32_t>(functions_.size()));
+  for (const Function& function : functions_) {
+    writer.WriteU64(function.start);
+    writer.WriteU64(function.size);
+    writer.WriteU32(function.name_id);
+  }
+  writer.WriteU32(static_cast<uint32_t>(lines_.size()));
+  for (const LineRow& row : lines_) {
+    writer.WriteU64(row.address);
+    writer.WriteU32(row.file_id);
+    writer.WriteU32(row.line);
+  }
+  return std::move(*writer.data());
+}
+
+std::vector<SymbolizedFrame> SymbolIndex::Lookup(uint64_t address) const {
+  auto fn_it = std::upper_bound(
+      functions_.begin(), functions_.end(), address,
+      [](uint64_t addr, const Function& fn) { return addr < fn.start; });
+  if (fn_it == functions_.begin())
+    return {};
+  --fn_it;
+  if (address - fn_it->start >= fn_it->size)
+    return {};
+
+  SymbolizedFrame frame;
+  frame.function_name = strings_[fn_it->name_id];
+  auto line_it = std::upper_bound(
+      lines_.begin(), lines_.end(), address,
+      [](uint64_t addr, const LineRow& row) { return addr < row.address; });
+  if (line_it != lines_.begin()) {
+    --line_it;
+    if (line_it->line != 0) {
+      frame.file_name = strings_[line_it->file_id];
+      frame.line = line_it->line;
+    }
+  }
+  return {std::move(frame)};
+}
+
+uint32_t SymbolIndex::InternString(const std::string& str) {
+  auto it_and_inserted =
+      string_ids_.emplace(str, static_cast<uint32_t>(strings_.size()));
+  if (it_and_inserted.second)
+    strings_.push_back(str);
+  return it_and_inserted.first->second;
+}
+
+void SymbolIndex::AddFunction(uint64_t start,
+                              uint64_t size,
+                              const std::string& name) {
+  functions_.push_back(Function{start, size, InternString(name)});
+}
+
+void SymbolIndex::AddLine(uint64_t address, uint32_t file_id, uint32_t line) {
+  lines_.push_back(LineRow{address, file_id, line});
+}
+
+void SymbolIndex::Finalize() {
+  // Of the symbols at the same address (aliases), keep the largest. Symbols
+  // without a size (e.g. from assembly) extend to the next symbol.
+  std::sort(functions_.begin(), functions_.end(),
+            [](const Function& a, const Function& b) {
+              return a.start < b.start ||
+                     (a.start == b.start && a.size > b.size);
+            });
+  functions_.erase(
+      std::unique(functions_.begin(), functions_.end(),
+                  [](const Function& a, const Function& b) {
+                    return a.start == b.start;
+                  }),
+      functions_.end());
+  for (size_t i = 0; i + 1 < functions_.size(); ++i) {
+    if (functions_[i].size == 0)
+      functions_[i].size = functions_[i + 1].start - functions_[i].start;
+  }
+
+  // At the same address, the end of a sequence goes before the rows of the
+  // next sequence, and the rows of a sequence keep their order (the last one
+  // is the one that applies).
+  std::stable_sort(lines_.begin(), lines_.end(),
+                   [](const LineRow& a, const LineRow& b) {
+                     return a.address < b.address ||
+                            (a.address == b.address && a.line == 0 &&
+                             b.line != 0);
+                   });
+  string_ids_.clear();
+}
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_LOCAL_SYMBOLIZER)
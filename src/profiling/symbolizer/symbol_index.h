@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_SYMBOLIZER_SYMBOL_INDEX_H_
+#define SRC_PROFILING_SYMBOLIZER_SYMBOL_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/optional.h"
+#include "src/profiling/symbolizer/symbolizer.h"
+
+namespace perfetto {
+namespace profiling {
+
+// Address to function and source line lookup table of one binary, built
+// in-process from its ELF symbol table and DWARF line table (.debug_line).
+// Can be serialized, so that a binary only needs to be parsed once per build
+// id.
+//
+// Does not read .debug_info, so inlined frames are not reported and function
+// names come from the symbol table. Compressed debug sections are not
+// supported.
+class SymbolIndex {
+ public:
+  // Parses the ELF file at |path|. Returns nullopt if it is not a (little
+  // endian) ELF file.
+  static base::Optional<SymbolIndex> CreateFromElf(const std::string& path);
+  static base::Optional<SymbolIndex> Deserialize(const std::string& data);
+
+  std::string Serialize() const;
+
+  // |address| is an ELF virtual address. Returns an empty vector if no
+  // function contains |address|.
+  std::vector<SymbolizedFrame> Lookup(uint64_t address) const;
+
+  // Building blocks of CreateFromElf. Finalize() must be called after
+  // adding entries, before calling Lookup().
+  uint32_t InternString(const std::string& str);
+  void AddFunction(uint64_t start, uint64_t size, const std::string& name);
+  // A |line| of 0 marks the end of a sequence of rows (i.e. that |address|
+  // and the following ones have no line information).
+  void AddLine(uint64_t address, uint32_t file_id, uint32_t line);
+  void Finalize();
+
+  // Load bias of the indexed binary (see FoundBinary).
+  uint64_t load_bias() const { return load_bias_; }
+  void set_load_bias(uint64_t load_bias) { load_bias_ = load_bias; }
+
+  size_t num_functions() const { return functions_.size(); }
+  size_t num_lines() const { return lines_.size(); }
+
+ private:
+  struct Function {
+    uint64_t start;
+    uint64_t size;
+    uint32_t name_id;
+  };
+  struct LineRow {
+    uint64_t address;
+    uint32_t file_id;
+    uint32_t line;
+  };
+
+  uint64_t load_bias_ = 0;
+  std::vector<std::string> strings_;
+  // Only used while building.
+  std::map<std::string, uint32_t> string_ids_;
+  // Sorted by start address once finalized.
+  std::vector<Function> functions_;
+  // Sorted by address once finalized.
+  std::vector<LineRow> lines_;
+};
+
+struct ElfSection {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+};
+
+// Adds the rows of a DWARF (version 2 to 5) .debug_line section to |index|.
+// |debug_line_str| and |debug_str| are used to resolve DWARF 5 file names,
+// and can be empty. Returns false if the section is malformed, in which case
+// the rows of the units before the malformed one are kept.
+bool ParseDebugLine(ElfSection debug_line,
+                    ElfSection debug_line_str,
+                    ElfSection debug_str,
+                    SymbolIndex* index);
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_SYMBOLIZER_SYMBOL_INDEX_H_
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/build_config.h"
+#include "test/gtest_and_gmock.h"
+
+// This translation unit is built only on Linux, MacOS and Windows. See
+// //gn/BUILD.gn.
+#if PERFETTO_BUILDFLAG(PERFETTO_LOCAL_SYMBOLIZER)
+
+#include "src/profiling/symbolizer/symbol_index.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+void ExpectFrame(const SymbolIndex& index,
+                 uint64_t address,
+                 const std::string& function_name,
+                 const std::string& file_name,
+                 uint32_t line) {
+  std::vector<SymbolizedFrame> frames = index.Lookup(address);
+  ASSERT_EQ(frames.size(), 1u) << address;
+  EXPECT_EQ(frames[0].function_name, function_name) << address;
+  EXPECT_EQ(frames[0].file_name, file_name) << address;
+  EXPECT_EQ(frames[0].line, line) << address;
+}
+
+SymbolIndex MakeIndex() {
+  SymbolIndex index;
+  index.set_load_bias(0x1000);
+  index.AddFunction(0x2000, 0x10, "second");
+  index.AddFunction(0x1000, 0x20, "first");
+  index.AddFunction(0x1000, 0x8, "first_alias");
+  index.AddFunction(0x3000, 0, "no_size");
+  index.AddFunction(0x3100, 0x10, "last");
+  uint32_t file = index.InternString("foo.cc");
+  index.AddLine(0x1000, file, 10);
+  index.AddLine(0x1008, file, 11);
+  index.AddLine(0x1010, 0, 0);
+  index.Finalize();
+  return index;
+}
+
+TEST(SymbolIndexTest, Lookup) {
+  SymbolIndex index = MakeIndex();
+  EXPECT_EQ(index.num_functions(), 4u);
+
+  ExpectFrame(index, 0x1000, "first", "foo.cc", 10);
+  ExpectFrame(index, 0x1007, "first", "foo.cc", 10);
+  ExpectFrame(index, 0x1008, "first", "foo.cc", 11);
+  // Past the end of the line table sequence.
+  ExpectFrame(index, 0x1010, "first", "", 0);
+  ExpectFrame(index, 0x200f, "second", "", 0);
+  // Sizeless symbols extend to the next one.
+  ExpectFrame(index, 0x30ff, "no_size", "", 0);
+
+  EXPECT_TRUE(index.Lookup(0xfff).empty());
+  EXPECT_TRUE(index.Lookup(0x1020).empty());
+  EXPECT_TRUE(index.Lookup(0x2010).empty());
+  EXPECT_TRUE(index.Lookup(0x3110).empty());
+}
+
+TEST(SymbolIndexTest, SerializeRoundTrip) {
+  base::Optional<SymbolIndex> index =
+      SymbolIndex::Deserialize(MakeIndex().Serialize());
+  ASSERT_TRUE(index);
+  EXPECT_EQ(index->load_bias(), 0x1000u);
+  EXPECT_EQ(index->num_functions(), 4u);
+  EXPECT_EQ(index->num_lines(), 3u);
+  ExpectFrame(*index, 0x1008, "first", "foo.cc", 11);
+  ExpectFrame(*index, 0x3100, "last", "", 0);
+
+  std::string truncated = MakeIndex().Serialize();
+  truncated.resize(truncated.size() - 1);
+  EXPECT_FALSE(SymbolIndex::Deserialize(truncated));
+  EXPECT_FALSE(SymbolIndex::Deserialize("not an index"));
+}
+
+class DebugLineBuilder {
+ public:
+  void U8(uint8_t value) { data_.push_back(value); }
+  void Uint(uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++)
+      U8(static_cast<uint8_t>(value >> (8 * i)));
+  }
+  void Str(const char* str) {
+    data_.insert(data_.end(), str, str + strlen(str) + 1);
+  }
+  void SetAddress(uint64_t address) {
+    U8(0);
+    U8(9);
+    U8(2);
+    Uint(address, 8);
+  }
+  void EndSequence() {
+    U8(0);
+    U8(1);
+    U8(1);
+  }
+  size_t size() const { return data_.size(); }
+  // Overwrites the 4 bytes at |offset|.
+  void Patch(size_t offset, uint32_t value) {
+    for (size_t i = 0; i < 4; i++)
+      data_[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+  ElfSection section() const {
+    ElfSection section;
+    section.data = data_.data();
+    section.size = data_.size();
+    return section;
+  }
+
+ private:
+  std::vector<uint8_t> data_;
+};
+
+TEST(SymbolIndexTest, ParseDebugLineV4) {
+  constexpr uint8_t kOpcodeBase = 13;
+  constexpr int8_t kLineBase = -5;
+  constexpr uint8_t kLineRange = 14;
+
+  DebugLineBuilder b;
+  b.Uint(0, 4);  // unit_length, patched below
+  b.Uint(4, 2);  // version
+  b.Uint(0, 4);  // header_length, patched below
+  size_t header_start = b.size();
+  b.U8(1);  // minimum_instruction_length
+  b.U8(1);  // maximum_operations_per_instruction
+  b.U8(1);  // default_is_stmt
+  b.U8(static_cast<uint8_t>(kLineBase));
+  b.U8(kLineRange);
+  b.U8(kOpcodeBase);
+  for (uint8_t length : {0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1})
+    b.U8(length);
+  b.Str("src");  // include_directories
+  b.Str("");
+  b.Str("foo.cc");  // file_names
+  b.U8(1);          // directory index
+  b.U8(0);          // modification time
+  b.U8(0);          // length
+  b.Str("");
+  size_t program_start = b.size();
+
+  b.SetAddress(0x1000);
+  b.U8(3);  // DW_LNS_advance_line
+  b.U8(9);
+  b.U8(1);  // DW_LNS_copy
+  // Special opcode: address += 4, line += 1.
+  b.U8(static_cast<uint8_t>(4 * kLineRange + (1 - kLineBase) + kOpcodeBase));
+  b.U8(2);  // DW_LNS_advance_pc
+  b.U8(4);
+  b.EndSequence();
+
+  // A sequence of code discarded by the linker, at address 0.
+  b.SetAddress(0);
+  b.U8(1);  // DW_LNS_copy
+  b.U8(2);  // DW_LNS_advance_pc
+  b.U8(4);
+  b.EndSequence();
+
+  b.Patch(0, static_cast<uint32_t>(b.size() - 4));
+  b.Patch(6, static_cast<uint32_t>(program_start - header_start));
+
+  SymbolIndex index;
+  index.AddFunction(0, 0x10, "discarded");
+  index.AddFunction(0x1000, 0x10, "fn");
+  ASSERT_TRUE(ParseDebugLine(b.section(), ElfSection(), ElfSection(), &index));
+  index.Finalize();
+
+  ExpectFrame(index, 0x1000, "fn", "src/foo.cc", 10);
+  ExpectFrame(index, 0x1003, "fn", "src/foo.cc", 10);
+  ExpectFrame(index, 0x1004, "fn", "src/foo.cc", 11);
+  ExpectFrame(index, 0x1008, "fn", "", 0);
+  ExpectFrame(index, 0x0, "discarded", "", 0);
+
+  // Truncated input.
+  ElfSection truncated = b.section();
+  truncated.size -= 5;
+  SymbolIndex truncated_index;
+  EXPECT_FALSE(ParseDebugLine(truncated, ElfSection(), ElfSection(),
+                              &truncated_index));
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif
@@ -42,6 +42,10 @@ constexpr const char* kQueryUnsymbolized =
     "on spf.mapping = spm.id "
     "where spm.build_id != '' and spf.symbol_set_id IS NULL";
 
+// Mappings handed to the symbolizer at once. Bounds the number of
+// symbolization results held in memory.
+constexpr size_t kMappingsPerBatch = 256;
+
 using NameAndBuildIdPair = std::pair<std::string, std::string>;
 
 struct UnsymbolizedMapping {
@@ -114,32 +118,45 @@ void SymbolizeDatabase(trace_processor::TraceProcessor* tp,
   PERFETTO_CHECK(symbolizer);
   auto unsymbolized =
       GetUnsymbolizedFrames(tp, symbolizer->BuildIdNeedsHexConversion());
-  for (auto it = unsymbolized.cbegin(); it != unsymbolized.cend(); ++it) {
-    const auto& unsymbolized_mapping = it->first;
-    const std::vector<uint64_t>& rel_pcs = it->second;
-    auto res = symbolizer->Symbolize(unsymbolized_mapping.name,
-                                     unsymbolized_mapping.build_id,
-                                     unsymbolized_mapping.load_bias, rel_pcs);
-    if (res.empty())
-      continue;
-
-    protozero::HeapBuffered<perfetto::protos::pbzero::Trace> trace;
-    auto* packet = trace->add_packet();
-    auto* module_symbols = packet->set_module_symbols();
-    module_symbols->set_path(unsymbolized_mapping.name);
-    module_symbols->set_build_id(unsymbolized_mapping.build_id);
-    PERFETTO_DCHECK(res.size() == rel_pcs.size());
-    for (size_t i = 0; i < res.size(); ++i) {
-      auto* address_symbols = module_symbols->add_address_symbols();
-      address_symbols->set_address(rel_pcs[i]);
-      for (const SymbolizedFrame& frame : res[i]) {
-        auto* line = address_symbols->add_lines();
-        line->set_function_name(frame.function_name);
-        line->set_source_file_name(frame.file_name);
-        line->set_line_number(frame.line);
+  auto it = unsymbolized.begin();
+  while (it != unsymbolized.end()) {
+    std::vector<Symbolizer::Mapping> batch;
+    for (; it != unsymbolized.end() && batch.size() < kMappingsPerBatch;
+         ++it) {
+      Symbolizer::Mapping mapping;
+      mapping.name = it->first.name;
+      mapping.build_id = it->first.build_id;
+      mapping.load_bias = it->first.load_bias;
+      mapping.addresses = std::move(it->second);
+      batch.emplace_back(std::move(mapping));
+    }
+    auto batch_res = symbolizer->SymbolizeBatch(batch);
+    PERFETTO_DCHECK(batch_res.size() == batch.size());
+
+    for (size_t m = 0; m < batch.size(); ++m) {
+      const Symbolizer::Mapping& mapping = batch[m];
+      const auto& res = batch_res[m];
+      if (res.empty())
+        continue;
+
+      protozero::HeapBuffered<perfetto::protos::pbzero::Trace> trace;
+      auto* packet = trace->add_packet();
+      auto* module_symbols = packet->set_module_symbols();
+      module_symbols->set_path(mapping.name);
+      module_symbols->set_build_id(mapping.build_id);
+      PERFETTO_DCHECK(res.size() == mapping.addresses.size());
+      for (size_t i = 0; i < res.size(); ++i) {
+        auto* address_symbols = module_symbols->add_address_symbols();
+        address_symbols->set_address(mapping.addresses[i]);
+        for (const SymbolizedFrame& frame : res[i]) {
+          auto* line = address_symbols->add_lines();
+          line->set_function_name(frame.function_name);
+          line->set_source_file_name(frame.file_name);
+          line->set_line_number(frame.line);
+        }
       }
+      callback(trace.SerializeAsString());
     }
-    callback(trace.SerializeAsString());
   }
 }
 
@@ -21,5 +21,16 @@ namespace profiling {
 
 Symbolizer::~Symbolizer() = default;
 
+std::vector<std::vector<std::vector<SymbolizedFrame>>>
+Symbolizer::SymbolizeBatch(const std::vector<Mapping>& mappings) {
+  std::vector<std::vector<std::vector<SymbolizedFrame>>> result;
+  result.reserve(mappings.size());
+  for (const Mapping& mapping : mappings) {
+    result.emplace_back(Symbolize(mapping.name, mapping.build_id,
+                                  mapping.load_bias, mapping.addresses));
+  }
+  return result;
+}
+
 }  // namespace profiling
 }  // namespace perfetto
@@ -32,6 +32,13 @@ struct SymbolizedFrame {
 
 class Symbolizer {
  public:
+  struct Mapping {
+    std::string name;
+    std::string build_id;
+    uint64_t load_bias = 0;
+    std::vector<uint64_t> addresses;
+  };
+
   // For each address in the input vector, output a vector of SymbolizedFrame
   // representing the functions corresponding to that address. When inlining
   // occurs, this can be more than one function for a single address.
@@ -44,6 +51,12 @@ class Symbolizer {
       const std::vector<uint64_t>& address) = 0;
   virtual ~Symbolizer();
 
+  // Same as calling Symbolize() for each of |mappings|, but gives the
+  // implementation the chance to work on several mappings in parallel. Returns
+  // one element per mapping, each as returned by Symbolize().
+  virtual std::vector<std::vector<std::vector<SymbolizedFrame>>>
+  SymbolizeBatch(const std::vector<Mapping>& mappings);
+
   // LocalSymbolizer uses a specific conversion of a symbol file's |build_id| to
   // bytes, but BreakpadSymbolizer requires the |build_id| as given. Return true
   // if the |build_id| passed to Symbolize() requires the conversion to bytes
@@ -42,6 +42,9 @@ namespace protozero {
 // See comments around |word_| below for the structure of the word vector.
 class FilterBytecodeParser {
  public:
+  // The |nested_msg_index| of QueryResult for simple fields.
+  static constexpr uint32_t kSimpleField = 0x7fffffff;
+
   // Result of a Query() operation
   struct QueryResult {
     bool allowed;  // Whether the field is allowed at all or no.
@@ -67,12 +70,20 @@ class FilterBytecodeParser {
   QueryResult Query(uint32_t msg_index, uint32_t field_id);
 
   void Reset();
+
+  // Number of messages in the loaded filter. Valid message indexes for Query()
+  // are [0, num_messages()).
+  uint32_t num_messages() const {
+    return message_offset_.empty()
+               ? 0
+               : static_cast<uint32_t>(message_offset_.size() - 1);
+  }
+
   void set_suppress_logs_for_fuzzer(bool x) { suppress_logs_for_fuzzer_ = x; }
 
  private:
   static constexpr uint32_t kDirectlyIndexLimit = 128;
   static constexpr uint32_t kAllowed = 1u << 31u;
-  static constexpr uint32_t kSimpleField = 0x7fffffff;
 
   bool LoadInternal(const uint8_t* filter_data, size_t len);
 
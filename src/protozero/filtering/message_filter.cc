@@ -16,6 +16,10 @@
 
 #include "src/protozero/filtering/message_filter.h"
 
+#include <string.h>
+
+#include <algorithm>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/protozero/proto_utils.h"
 
@@ -68,7 +72,7 @@ inline std::pair<uint8_t*, uint32_t> AppendLenDelim(uint32_t field_id,
 }
 }  // namespace
 
-MessageFilter::MessageFilter() {
+MessageFilter::MessageFilter() : simple_fields_bitmap_(1) {
   // Push a state on the stack for the implicit root message.
   stack_.emplace_back();
 }
@@ -76,7 +80,22 @@ MessageFilter::MessageFilter() {
 MessageFilter::~MessageFilter() = default;
 
 bool MessageFilter::LoadFilterBytecode(const void* filter_data, size_t len) {
-  return filter_.Load(filter_data, len);
+  // The root message is always looked up, even with an empty filter.
+  root_msg_index_ = 0;
+  simple_fields_bitmap_.assign(1, 0);
+  if (!filter_.Load(filter_data, len))
+    return false;
+  simple_fields_bitmap_.resize(std::max(filter_.num_messages(), 1u));
+  for (uint32_t msg_index = 0; msg_index < filter_.num_messages();
+       ++msg_index) {
+    uint64_t& bitmap = simple_fields_bitmap_[msg_index];
+    for (uint32_t field_id = 1; field_id < 64; ++field_id) {
+      auto res = filter_.Query(msg_index, field_id);
+      if (res.allowed && res.simple_field())
+        bitmap |= 1ull << field_id;
+    }
+  }
+  return true;
 }
 
 bool MessageFilter::SetFilterRoot(const uint32_t* field_ids,
@@ -105,6 +124,76 @@ MessageFilter::FilteredMessage MessageFilter::FilterMessageFragments(
   out_ = out_buf_.get();
   out_end_ = out_ + total_len;
 
+  BeginMessage(total_len);
+  for (size_t i = 0; i < num_slices; ++i) {
+    FilterFragment(static_cast<const uint8_t*>(slices[i].data),
+                   slices[i].len);
+  }
+  bool success = EndMessage(total_len);
+
+  // Construct the output object.
+  auto used_size = static_cast<size_t>(out_ - out_buf_.get());
+  FilteredMessage res{std::move(out_buf_), used_size};
+  res.error = !success;
+  return res;
+}
+
+bool MessageFilter::FilterMessageInto(const void* data,
+                                      size_t len,
+                                      uint8_t* out,
+                                      size_t* out_size) {
+  // As above, the filtered message cannot be > the original message.
+  const auto total_len = static_cast<uint32_t>(len);
+  out_ = out;
+  out_end_ = out + total_len;
+
+  BeginMessage(total_len);
+  FilterFragment(static_cast<const uint8_t*>(data), total_len);
+  bool success = EndMessage(total_len);
+  *out_size = static_cast<size_t>(out_ - out);
+  return success;
+}
+
+MessageFilter::FilteredBatch MessageFilter::FilterMessageBatch(
+    const InputSlice* slices,
+    const size_t* num_slices_per_message,
+    size_t num_messages) {
+  size_t num_slices = 0;
+  for (size_t i = 0; i < num_messages; ++i)
+    num_slices += num_slices_per_message[i];
+  size_t total_len = 0;
+  for (size_t i = 0; i < num_slices; ++i)
+    total_len += slices[i].len;
+  PERFETTO_CHECK(total_len <= UINT32_MAX);
+  out_buf_.reset(new uint8_t[total_len]);
+  out_ = out_buf_.get();
+  out_end_ = out_ + total_len;
+
+  FilteredBatch res;
+  res.messages.reserve(num_messages);
+  const InputSlice* slice = slices;
+  for (size_t msg = 0; msg < num_messages; ++msg) {
+    const InputSlice* const msg_end = slice + num_slices_per_message[msg];
+    uint32_t msg_len = 0;
+    for (const InputSlice* it = slice; it != msg_end; ++it)
+      msg_len += static_cast<uint32_t>(it->len);
+    BeginMessage(msg_len);
+    for (; slice != msg_end; ++slice)
+      FilterFragment(static_cast<const uint8_t*>(slice->data), slice->len);
+    bool success = EndMessage(msg_len);
+    const uint32_t offset =
+        static_cast<uint32_t>(out_msg_start_ - out_buf_.get());
+    res.messages.push_back({offset, out_written() - offset, !success});
+  }
+
+  res.size = static_cast<size_t>(out_ - out_buf_.get());
+  res.data = std::move(out_buf_);
+  return res;
+}
+
+void MessageFilter::BeginMessage(uint32_t total_len) {
+  out_msg_start_ = out_;
+
   // Reset the parser state.
   tokenizer_ = MessageTokenizer();
   error_ = false;
@@ -118,25 +207,41 @@ MessageFilter::FilteredMessage MessageFilter::FilterMessageFragments(
   // stack_[1] is the actual root message.
   stack_[1].in_bytes_limit = total_len;
   stack_[1].msg_index = root_msg_index_;
+  stack_[1].out_bytes_written_at_start = out_written();
+}
 
-  // Process the input data and write the output.
-  for (size_t slice_idx = 0; slice_idx < num_slices; ++slice_idx) {
-    const InputSlice& slice = slices[slice_idx];
-    const uint8_t* data = static_cast<const uint8_t*>(slice.data);
-    for (size_t i = 0; i < slice.len; ++i)
-      FilterOneByte(data[i]);
+void MessageFilter::FilterFragment(const uint8_t* data, size_t len) {
+  const uint8_t* const end = data + len;
+  while (data < end) {
+    StackState* state = &stack_.back();
+    if (state->eat_next_bytes == 0) {
+      FilterOneByte(*(data++));
+      continue;
+    }
+    // This is the case where the previous tokenizer_.Push() call returned a
+    // length delimited message which is NOT a submessage (a string or a bytes
+    // field). We just want to consume it, and pass it through in output
+    // if the field was allowed. This is done in bulk, rather than byte by
+    // byte, as strings are a good portion of the trace.
+    const uint32_t eat_bytes = static_cast<uint32_t>(
+        std::min(static_cast<size_t>(state->eat_next_bytes),
+                 static_cast<size_t>(end - data)));
+    if (state->passthrough_eaten_bytes) {
+      memcpy(out_, data, eat_bytes);
+      out_ += eat_bytes;
+    }
+    data += eat_bytes;
+    state->eat_next_bytes -= eat_bytes;
+    state->in_bytes += eat_bytes;
+    if (state->in_bytes >= state->in_bytes_limit)
+      PopCompletedMessages();
   }
+}
 
-  // Construct the output object.
-  PERFETTO_CHECK(out_ >= out_buf_.get() && out_ <= out_end_);
-  auto used_size = static_cast<size_t>(out_ - out_buf_.get());
-  FilteredMessage res{std::move(out_buf_), used_size};
-  res.error = error_;
-  if (stack_.size() != 1 || !tokenizer_.idle() ||
-      stack_[0].in_bytes != total_len) {
-    res.error = true;
-  }
-  return res;
+bool MessageFilter::EndMessage(uint32_t total_len) {
+  PERFETTO_CHECK(out_ >= out_msg_start_ && out_ <= out_end_);
+  return !error_ && stack_.size() == 1 && tokenizer_.idle() &&
+         stack_[0].in_bytes == total_len;
 }
 
 void MessageFilter::FilterOneByte(uint8_t octet) {
@@ -146,95 +251,110 @@ void MessageFilter::FilterOneByte(uint8_t octet) {
   StackState next_state{};
   bool push_next_state = false;
 
-  if (state->eat_next_bytes > 0) {
-    // This is the case where the previous tokenizer_.Push() call returned a
-    // length delimited message which is NOT a submessage (a string or a bytes
-    // field). We just want to consume it, and pass it through in output
-    // if the field was allowed.
-    --state->eat_next_bytes;
-    if (state->passthrough_eaten_bytes)
-      *(out_++) = octet;
-  } else {
-    MessageTokenizer::Token token = tokenizer_.Push(octet);
-    // |token| will not be valid() in most cases and this is WAI. When pushing
-    // a varint field, only the last byte yields a token, all the other bytes
-    // return an invalid token, they just update the internal tokenizer state.
-    if (token.valid()) {
-      auto filter = filter_.Query(state->msg_index, token.field_id);
-      switch (token.type) {
-        case proto_utils::ProtoWireType::kVarInt:
-          if (filter.allowed && filter.simple_field())
-            AppendVarInt(token.field_id, token.value, &out_);
-          break;
-        case proto_utils::ProtoWireType::kFixed32:
-          if (filter.allowed && filter.simple_field())
-            AppendFixed(token.field_id, static_cast<uint32_t>(token.value),
-                        &out_);
-          break;
-        case proto_utils::ProtoWireType::kFixed64:
-          if (filter.allowed && filter.simple_field())
-            AppendFixed(token.field_id, static_cast<uint64_t>(token.value),
-                        &out_);
-          break;
-        case proto_utils::ProtoWireType::kLengthDelimited:
-          // Here we have two cases:
-          // A. A simple string/bytes field: we just want to consume the next
-          //    bytes (the string payload), optionally passing them through in
-          //    output if the field is allowed.
-          // B. This is a nested submessage. In this case we want to recurse and
-          //    push a new state on the stack.
-          // Note that we can't tell the difference between a
-          // "non-allowed string" and a "non-allowed submessage". But it doesn't
-          // matter because in both cases we just want to skip the next N bytes.
-          const auto submessage_len = static_cast<uint32_t>(token.value);
-          auto in_bytes_left = state->in_bytes_limit - state->in_bytes - 1;
-          if (PERFETTO_UNLIKELY(submessage_len > in_bytes_left)) {
-            // This is a malicious / malformed string/bytes/submessage that
-            // claims to be larger than the outer message that contains it.
-            return SetUnrecoverableErrorState();
-          }
-
-          if (filter.allowed && !filter.simple_field() && submessage_len > 0) {
-            // submessage_len == 0 is the edge case of a message with a 0-len
-            // (but present) submessage. In this case, if allowed, we don't want
-            // to push any further state (doing so would desync the FSM) but we
-            // still want to emit it.
-            // At this point |submessage_len| is only an upper bound. The
-            // final message written in output can be <= the one in input,
-            // only some of its fields might be allowed (also remember that
-            // this class implicitly removes redundancy varint encoding of
-            // len-delimited field lengths). The final length varint (the
-            // return value of AppendLenDelim()) will be filled when popping
-            // from |stack_|.
-            auto size_field =
-                AppendLenDelim(token.field_id, submessage_len, &out_);
-            push_next_state = true;
-            next_state.field_id = token.field_id;
-            next_state.msg_index = filter.nested_msg_index;
-            next_state.in_bytes_limit = submessage_len;
-            next_state.size_field = size_field.first;
-            next_state.size_field_len = size_field.second;
-            next_state.out_bytes_written_at_start = out_written();
-          } else {
-            // A string or bytes field, or a 0 length submessage.
-            state->eat_next_bytes = submessage_len;
-            state->passthrough_eaten_bytes = filter.allowed;
-            if (filter.allowed)
+  // The payload of string and bytes fields is consumed by FilterFragment().
+  PERFETTO_DCHECK(state->eat_next_bytes == 0);
+
+  MessageTokenizer::Token token = tokenizer_.Push(octet);
+  // |token| will not be valid() in most cases and this is WAI. When pushing
+  // a varint field, only the last byte yields a token, all the other bytes
+  // return an invalid token, they just update the internal tokenizer state.
+  if (token.valid()) {
+    FilterBytecodeParser::QueryResult filter;
+    if (token.field_id < 64 &&
+        ((simple_fields_bitmap_[state->msg_index] >> token.field_id) & 1)) {
+      filter.allowed = true;
+      filter.nested_msg_index = FilterBytecodeParser::kSimpleField;
+    } else {
+      filter = filter_.Query(state->msg_index, token.field_id);
+    }
+    switch (token.type) {
+      case proto_utils::ProtoWireType::kVarInt:
+        if (filter.allowed && filter.simple_field())
+          AppendVarInt(token.field_id, token.value, &out_);
+        break;
+      case proto_utils::ProtoWireType::kFixed32:
+        if (filter.allowed && filter.simple_field())
+          AppendFixed(token.field_id, static_cast<uint32_t>(token.value),
+                      &out_);
+        break;
+      case proto_utils::ProtoWireType::kFixed64:
+        if (filter.allowed && filter.simple_field())
+          AppendFixed(token.field_id, static_cast<uint64_t>(token.value),
+                      &out_);
+        break;
+      case proto_utils::ProtoWireType::kLengthDelimited:
+        // Here we have two cases:
+        // A. A simple string/bytes field: we just want to consume the next
+        //    bytes (the string payload), optionally passing them through in
+        //    output if the field is allowed.
+        // B. This is a nested submessage. In this case we want to recurse and
+        //    push a new state on the stack.
+        // Note that we can't tell the difference between a
+        // "non-allowed string" and a "non-allowed submessage". But it doesn't
+        // matter because in both cases we just want to skip the next N bytes.
+        const auto submessage_len = static_cast<uint32_t>(token.value);
+        auto in_bytes_left = state->in_bytes_limit - state->in_bytes - 1;
+        if (PERFETTO_UNLIKELY(submessage_len > in_bytes_left)) {
+          // This is a malicious / malformed string/bytes/submessage that
+          // claims to be larger than the outer message that contains it.
+          return SetUnrecoverableErrorState();
+        }
+
+        if (filter.allowed && !filter.simple_field() && submessage_len > 0) {
+          // submessage_len == 0 is the edge case of a message with a 0-len
+          // (but present) submessage. In this case, if allowed, we don't want
+          // to push any further state (doing so would desync the FSM) but we
+          // still want to emit it.
+          // At this point |submessage_len| is only an upper bound. The
+          // final message written in output can be <= the one in input,
+          // only some of its fields might be allowed (also remember that
+          // this class implicitly removes redundancy varint encoding of
+          // len-delimited field lengths). The final length varint (the
+          // return value of AppendLenDelim()) will be filled when popping
+          // from |stack_|.
+          auto size_field =
               AppendLenDelim(token.field_id, submessage_len, &out_);
-          }
-          break;
-      }  // switch(type)
-
-      if (PERFETTO_UNLIKELY(track_field_usage_)) {
-        IncrementCurrentFieldUsage(token.field_id, filter.allowed);
-      }
-    }  // if (token.valid)
-  }    // if (eat_next_bytes == 0)
+          push_next_state = true;
+          next_state.field_id = token.field_id;
+          next_state.msg_index = filter.nested_msg_index;
+          next_state.in_bytes_limit = submessage_len;
+          next_state.size_field = size_field.first;
+          next_state.size_field_len = size_field.second;
+          next_state.out_bytes_written_at_start = out_written();
+        } else {
+          // A string or bytes field, or a 0 length submessage.
+          state->eat_next_bytes = submessage_len;
+          state->passthrough_eaten_bytes = filter.allowed;
+          if (filter.allowed)
+            AppendLenDelim(token.field_id, submessage_len, &out_);
+        }
+        break;
+    }  // switch(type)
+
+    if (PERFETTO_UNLIKELY(track_field_usage_)) {
+      IncrementCurrentFieldUsage(token.field_id, filter.allowed);
+    }
+  }  // if (token.valid)
 
   ++state->in_bytes;
+  if (state->in_bytes >= state->in_bytes_limit) {
+    // A message can't start on the last byte of its parent. This would have
+    // been caught by the |in_bytes_left| check above.
+    PERFETTO_DCHECK(!push_next_state);
+    PopCompletedMessages();
+    return;
+  }
+
+  if (push_next_state) {
+    PERFETTO_DCHECK(tokenizer_.idle());
+    stack_.emplace_back(std::move(next_state));
+  }
+}
+
+bool MessageFilter::PopCompletedMessages() {
+  auto* state = &stack_.back();
   while (state->in_bytes >= state->in_bytes_limit) {
     PERFETTO_DCHECK(state->in_bytes == state->in_bytes_limit);
-    push_next_state = false;
 
     // We can't possibly write more than we read.
     const uint32_t msg_bytes_written = static_cast<uint32_t>(
@@ -254,15 +374,11 @@ void MessageFilter::FilterOneByte(uint8_t octet) {
       // If we hit this case, it means that we got to the end of a submessage
       // while decoding a field. We can't recover from this and we don't want to
       // propagate a broken sub-message.
-      return SetUnrecoverableErrorState();
+      SetUnrecoverableErrorState();
+      return false;
     }
   }
-
-  if (push_next_state) {
-    PERFETTO_DCHECK(tokenizer_.idle());
-    stack_.emplace_back(std::move(next_state));
-    state = &stack_.back();
-  }
+  return true;
 }
 
 void MessageFilter::SetUnrecoverableErrorState() {
@@ -273,7 +389,7 @@ void MessageFilter::SetUnrecoverableErrorState() {
   state.eat_next_bytes = UINT32_MAX;
   state.in_bytes_limit = UINT32_MAX;
   state.passthrough_eaten_bytes = false;
-  out_ = out_buf_.get();  // Reset the write pointer.
+  out_ = out_msg_start_;  // Reset the write pointer.
 }
 
 void MessageFilter::IncrementCurrentFieldUsage(uint32_t field_id,
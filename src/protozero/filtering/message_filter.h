@@ -22,6 +22,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "src/protozero/filtering/filter_bytecode_parser.h"
 #include "src/protozero/filtering/message_tokenizer.h"
@@ -68,6 +69,19 @@ class MessageFilter {
     bool error = false;
   };
 
+  // The result of FilterMessageBatch(). The filtered messages are stored back
+  // to back in |data|, in the same order of the input.
+  struct FilteredBatch {
+    struct Message {
+      uint32_t offset;  // Offset of the filtered message in |data|.
+      uint32_t size;    // 0 if the message was filtered out entirely.
+      bool error;       // Same as FilteredMessage.error.
+    };
+    std::unique_ptr<uint8_t[]> data;
+    size_t size = 0;  // The used bytes in |data|.
+    std::vector<Message> messages;
+  };
+
   // Loads the filter bytecode that will be used to filter any subsequent
   // message. Must be called before the first call to FilterMessage*().
   // |filter_data| must point to a byte buffer for a proto-encoded ProtoFilter
@@ -92,6 +106,27 @@ class MessageFilter {
   // filtered message in output.
   FilteredMessage FilterMessageFragments(const InputSlice*, size_t num_slices);
 
+  // Filters a run of |num_messages| messages in one pass, writing all of them
+  // in a single output buffer. This is faster than calling
+  // FilterMessageFragments() for each message, as it makes only one
+  // allocation. |slices| contains the fragments of all the messages, one
+  // message after the other. The i-th message consists of the next
+  // |num_slices_per_message[i]| slices. An error in one message doesn't affect
+  // the others.
+  FilteredBatch FilterMessageBatch(const InputSlice* slices,
+                                   const size_t* num_slices_per_message,
+                                   size_t num_messages);
+
+  // Filters a contiguous message into |out|, which must have room for at least
+  // |len| bytes, rather than into a newly allocated buffer. Meant for callers
+  // that filter many messages and can reuse the same output buffer. Returns
+  // false if the message is malformed. Otherwise sets |*out_size| to the size
+  // of the filtered message.
+  bool FilterMessageInto(const void* data,
+                         size_t len,
+                         uint8_t* out,
+                         size_t* out_size);
+
   // Helper for tests, where the input is a contiguous buffer.
   FilteredMessage FilterMessage(const void* data, size_t len) {
     InputSlice slice{data, len};
@@ -123,6 +158,21 @@ class MessageFilter {
   // It gives a 20-25% speedup (265ms vs 215ms for a 25MB trace).
   void FilterOneByte(uint8_t octet) PERFETTO_ALWAYS_INLINE;
 
+  // Resets the parser state before filtering a message of |total_len| bytes,
+  // which will be written at |out_|.
+  void BeginMessage(uint32_t total_len);
+
+  // Feeds the next fragment of the current message to the filter.
+  void FilterFragment(const uint8_t* data, size_t len);
+
+  // Finalizes the current message. Returns false if it was malformed.
+  bool EndMessage(uint32_t total_len);
+
+  // Pops all the messages in |stack_| whose input has been fully consumed.
+  // Returns false, after entering the error state, if a message ends in the
+  // middle of a field.
+  bool PopCompletedMessages() PERFETTO_ALWAYS_INLINE;
+
   // No-inline because this is a slowpath (only when usage tracking is enabled).
   void IncrementCurrentFieldUsage(uint32_t field_id,
                                   bool allowed) PERFETTO_NO_INLINE;
@@ -190,11 +240,18 @@ class MessageFilter {
   uint32_t out_written() { return static_cast<uint32_t>(out_ - &out_buf_[0]); }
 
   std::unique_ptr<uint8_t[]> out_buf_;
+  uint8_t* out_msg_start_ = nullptr;  // Where the current message starts.
   uint8_t* out_ = nullptr;
   uint8_t* out_end_ = nullptr;
   uint32_t root_msg_index_ = 0;
 
   FilterBytecodeParser filter_;
+
+  // One word per message in |filter_|. Bit N is set if the field id N of the
+  // message is an allowed simple field. This saves a Query() for most of the
+  // scalar and string fields, which are the majority of the fields in a trace.
+  std::vector<uint64_t> simple_fields_bitmap_;
+
   MessageTokenizer tokenizer_;
   std::vector<StackState> stack_;
 
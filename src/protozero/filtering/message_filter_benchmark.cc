@@ -18,9 +18,58 @@
 #include <string>
 
 #include "perfetto/ext/base/file_utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "src/base/test/utils.h"
+#include "src/protozero/filtering/filter_bytecode_generator.h"
 #include "src/protozero/filtering/message_filter.h"
 
+namespace {
+
+constexpr size_t kNumPackets = 1000;
+
+// Returns a filter for the packets returned by MakePackets(), which allows
+// most of their fields, and strips some.
+std::string MakeFilter() {
+  protozero::FilterBytecodeGenerator gen;
+  // Packet.
+  gen.AddSimpleField(1);      // timestamp
+  gen.AddNestedField(3, 1);   // bundle
+  gen.EndMessage();
+  // Bundle.
+  gen.AddSimpleField(1);      // cpu
+  gen.AddNestedField(2, 2);   // event
+  gen.EndMessage();
+  // Event.
+  gen.AddSimpleFieldRange(1, 3);  // timestamp, pid, comm
+  gen.AddSimpleField(5);          // prio
+  gen.EndMessage();
+  return gen.Serialize();
+}
+
+// Returns a sequence of packets that resemble ftrace bundles.
+std::vector<std::string> MakePackets() {
+  std::vector<std::string> packets;
+  for (size_t i = 0; i < kNumPackets; i++) {
+    protozero::HeapBuffered<protozero::Message> packet;
+    packet->AppendVarInt(1, 1000000000ull + i);
+    packet->AppendString(2, "stripped trusted_uid");
+    auto* bundle = packet->BeginNestedMessage<protozero::Message>(3);
+    bundle->AppendVarInt(1, i % 8);
+    for (uint32_t j = 0; j < 50; j++) {
+      auto* event = bundle->BeginNestedMessage<protozero::Message>(2);
+      event->AppendVarInt(1, 1000000000ull + i * 1000 + j);
+      event->AppendVarInt(2, 1000 + j);
+      event->AppendString(3, "surfaceflinger");
+      event->AppendString(4, "stripped string");
+      event->AppendFixed(5, static_cast<uint64_t>(j));
+    }
+    packets.emplace_back(packet.SerializeAsString());
+  }
+  return packets;
+}
+
+}  // namespace
+
 static void BM_ProtozeroMessageFilter(benchmark::State& state) {
   std::string trace_data;
   static const char kTestTrace[] = "test/data/example_android_trace_30s.pb";
@@ -46,3 +95,48 @@ static void BM_ProtozeroMessageFilter(benchmark::State& state) {
 }
 
 BENCHMARK(BM_ProtozeroMessageFilter);
+
+static void BM_ProtozeroMessageFilter_Packets(benchmark::State& state) {
+  std::string filter = MakeFilter();
+  std::vector<std::string> packets = MakePackets();
+  protozero::MessageFilter filt;
+  PERFETTO_CHECK(filt.LoadFilterBytecode(filter.data(), filter.size()));
+
+  size_t bytes = 0;
+  for (const std::string& packet : packets)
+    bytes += packet.size();
+  for (auto _ : state) {
+    for (const std::string& packet : packets) {
+      auto res = filt.FilterMessage(packet.data(), packet.size());
+      benchmark::DoNotOptimize(res);
+    }
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+}
+
+BENCHMARK(BM_ProtozeroMessageFilter_Packets);
+
+static void BM_ProtozeroMessageFilter_Batch(benchmark::State& state) {
+  std::string filter = MakeFilter();
+  std::vector<std::string> packets = MakePackets();
+  protozero::MessageFilter filt;
+  PERFETTO_CHECK(filt.LoadFilterBytecode(filter.data(), filter.size()));
+
+  size_t bytes = 0;
+  std::vector<protozero::MessageFilter::InputSlice> slices;
+  for (const std::string& packet : packets) {
+    slices.push_back({packet.data(), packet.size()});
+    bytes += packet.size();
+  }
+  std::vector<size_t> num_slices_per_message(packets.size(), 1);
+  for (auto _ : state) {
+    auto res = filt.FilterMessageBatch(
+        slices.data(), num_slices_per_message.data(), packets.size());
+    benchmark::DoNotOptimize(res);
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+}
+
+BENCHMARK(BM_ProtozeroMessageFilter_Batch);
@@ -25,6 +25,7 @@
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "protos/perfetto/trace/trace.pb.h"
+#include "src/protozero/filtering/filter_bytecode_generator.h"
 #include "src/protozero/filtering/filter_util.h"
 #include "src/protozero/filtering/message_filter.h"
 
@@ -273,6 +274,120 @@ TEST(MessageFilterTest, MalformedInput) {
   }
 }
 
+TEST(MessageFilterTest, FilterMessageBatch) {
+  FilterBytecodeGenerator gen;
+  gen.AddSimpleField(1);
+  gen.AddNestedField(3, 1);
+  gen.EndMessage();
+  gen.AddSimpleField(2);
+  gen.EndMessage();
+  std::string bytecode = gen.Serialize();
+
+  MessageFilter flt;
+  ASSERT_TRUE(flt.LoadFilterBytecode(bytecode.data(), bytecode.size()));
+
+  std::vector<std::string> messages;
+  for (int i = 0; i < 4; i++) {
+    HeapBuffered<Message> msg;
+    msg->AppendVarInt(/*field_id=*/1, i);
+    msg->AppendString(/*field_id=*/2, "stripped");
+    auto* nested = msg->BeginNestedMessage<Message>(/*field_id=*/3);
+    nested->AppendVarInt(/*field_id=*/1, 42);
+    nested->AppendString(/*field_id=*/2, std::string(200, 'a' + i));
+    messages.emplace_back(msg.SerializeAsString());
+  }
+  // A message that is stripped entirely.
+  messages.emplace_back("\x12\x01x");
+  // A truncated message.
+  messages.emplace_back(messages[0].substr(0, messages[0].size() - 1));
+
+  // Split each message in one to three slices.
+  std::vector<MessageFilter::InputSlice> slices;
+  std::vector<size_t> num_slices;
+  for (size_t i = 0; i < messages.size(); i++) {
+    const std::string& msg = messages[i];
+    size_t split1 = i % 3 > 0 ? msg.size() / 3 : msg.size();
+    size_t split2 = i % 3 > 1 ? msg.size() / 2 : msg.size();
+    slices.push_back({msg.data(), split1});
+    if (i % 3 > 0)
+      slices.push_back({msg.data() + split1, split2 - split1});
+    if (i % 3 > 1)
+      slices.push_back({msg.data() + split2, msg.size() - split2});
+    num_slices.push_back(1 + i % 3);
+  }
+
+  auto batch = flt.FilterMessageBatch(slices.data(), num_slices.data(),
+                                      messages.size());
+  ASSERT_EQ(batch.messages.size(), messages.size());
+  // The messages are stored back to back and match the ones filtered one by
+  // one.
+  uint32_t offset = 0;
+  for (size_t i = 0; i < messages.size(); i++) {
+    auto expected = flt.FilterMessage(messages[i].data(), messages[i].size());
+    const auto& actual = batch.messages[i];
+    EXPECT_EQ(actual.offset, offset) << i;
+    offset += actual.size;
+    EXPECT_EQ(actual.error, expected.error) << i;
+    if (expected.error)
+      continue;
+    ASSERT_EQ(actual.size, expected.size) << i;
+    EXPECT_EQ(memcmp(batch.data.get() + actual.offset, expected.data.get(),
+                     expected.size),
+              0)
+        << i;
+  }
+  EXPECT_EQ(batch.size, offset);
+  EXPECT_TRUE(batch.messages[5].error);
+  EXPECT_EQ(batch.messages[4].size, 0u);
+
+  // Check the contents of one of the messages.
+  ProtoDecoder dec(batch.data.get() + batch.messages[1].offset,
+                   batch.messages[1].size);
+  EXPECT_EQ(dec.FindField(1).as_int32(), 1);
+  EXPECT_FALSE(dec.FindField(2));
+  ProtoDecoder nested_dec(dec.FindField(3).as_bytes());
+  EXPECT_FALSE(nested_dec.FindField(1));
+  EXPECT_EQ(nested_dec.FindField(2).as_std_string(), std::string(200, 'b'));
+}
+
+TEST(MessageFilterTest, FilterMessageInto) {
+  FilterBytecodeGenerator gen;
+  gen.AddSimpleField(1);
+  gen.EndMessage();
+  std::string bytecode = gen.Serialize();
+
+  MessageFilter flt;
+  ASSERT_TRUE(flt.LoadFilterBytecode(bytecode.data(), bytecode.size()));
+
+  // The same output buffer is reused across messages.
+  std::vector<uint8_t> out(256);
+  for (int i = 0; i < 3; i++) {
+    HeapBuffered<Message> msg;
+    msg->AppendVarInt(/*field_id=*/1, i);
+    msg->AppendString(/*field_id=*/2, std::string(100, 'x'));
+    std::string input = msg.SerializeAsString();
+    ASSERT_LE(input.size(), out.size());
+
+    auto expected = flt.FilterMessage(input.data(), input.size());
+    ASSERT_FALSE(expected.error);
+    size_t out_size = 0;
+    ASSERT_TRUE(
+        flt.FilterMessageInto(input.data(), input.size(), out.data(), &out_size));
+    ASSERT_EQ(out_size, expected.size);
+    EXPECT_EQ(memcmp(out.data(), expected.data.get(), out_size), 0);
+
+    ProtoDecoder dec(out.data(), out_size);
+    EXPECT_EQ(dec.FindField(1).as_int32(), i);
+    EXPECT_FALSE(dec.FindField(2));
+  }
+
+  // A truncated message.
+  static const char kTruncated[] = "\x12\x05xy";
+  size_t out_size = 0;
+  EXPECT_FALSE(flt.FilterMessageInto(kTruncated, sizeof(kTruncated) - 1,
+                                     out.data(), &out_size));
+}
+
 // It processes a real test trace with a real filter. The filter has been
 // obtained from the full upstream perfetto proto (+ re-adding the for_testing
 // field which got removed after adding most test traces). This covers the most
@@ -197,10 +197,17 @@ void TypedProtoDecoderBase::ParseAllFields() {
     PERFETTO_DCHECK(res.parse_res == ParseFieldResult::kOk);
     PERFETTO_DCHECK(res.field.valid());
     auto field_id = res.field.id();
-    if (PERFETTO_UNLIKELY(field_id >= num_fields_))
+    if (PERFETTO_UNLIKELY(field_id >= num_field_ids_))
       continue;
 
-    Field* fld = &fields_[field_id];
+    uint32_t slot = field_id;
+    if (field_slots_) {
+      slot = field_slots_[field_id];
+      if (slot == 0)
+        continue;  // Not stored by this decoder.
+    }
+
+    Field* fld = &fields_[slot];
     if (PERFETTO_LIKELY(!fld->valid())) {
       // This is the first time we see this field.
       *fld = std::move(res.field);
@@ -217,7 +224,7 @@ void TypedProtoDecoderBase::ParseAllFields() {
       if (PERFETTO_UNLIKELY(size_ >= capacity_)) {
         ExpandHeapStorage();
         // ExpandHeapStorage moves fields_ so we need to update the ptr to fld:
-        fld = &fields_[field_id];
+        fld = &fields_[slot];
         PERFETTO_DCHECK(size_ < capacity_);
       }
       fields_[size_++] = *fld;
@@ -591,5 +591,60 @@ TEST(ProtoDecoderTest, OneBigFieldIdOnly) {
   ASSERT_FALSE(field.valid());
 }
 
+TEST(ProtoDecoderTest, DenseFieldSlots) {
+  HeapBuffered<Message> message;
+  message->AppendVarInt(/*field_id=*/2, 20);
+  message->AppendVarInt(/*field_id=*/100, 1000);
+  message->AppendVarInt(/*field_id=*/3, 30);
+  message->AppendVarInt(/*field_id=*/100, 1001);
+  auto data = message.SerializeAsArray();
+
+  // Only fields 2 and 100 are stored, field 3 is unknown to the decoder.
+  uint16_t slots[101] = {};
+  slots[2] = 1;
+  slots[100] = 2;
+  using Decoder = TypedProtoDecoder</*MAX_FIELD_ID=*/100,
+                                    /*HAS_NONPACKED_REPEATED_FIELDS=*/true,
+                                    /*NUM_STORED_FIELDS=*/2>;
+  Decoder tpd(data.data(), data.size(), slots);
+  EXPECT_EQ(tpd.at<2>().as_int32(), 20);
+  EXPECT_FALSE(tpd.at<3>().valid());
+  EXPECT_FALSE(tpd.Get(3).valid());
+  EXPECT_FALSE(tpd.Get(101).valid());
+  EXPECT_EQ(tpd.Get(100).as_int32(), 1001);
+
+  auto it = tpd.GetRepeated<int32_t>(100);
+  EXPECT_EQ(*it++, 1000);
+  EXPECT_EQ(*it++, 1001);
+  EXPECT_FALSE(it);
+}
+
+TEST(ProtoDecoderTest, FieldSubset) {
+  HeapBuffered<Message> message;
+  for (uint32_t id = 1; id <= 20; id++)
+    message->AppendVarInt(id, id * 10);
+  message->AppendVarInt(/*field_id=*/7, 71);
+  message->AppendVarInt(/*field_id=*/8, 81);
+  auto data = message.SerializeAsArray();
+
+  using Decoder = TypedProtoDecoder<20, true>;
+  Decoder tpd(data.data(), data.size(), FieldSubset<7, 15>());
+  EXPECT_EQ(tpd.at<7>().as_int32(), 71);
+  EXPECT_EQ(tpd.Get(15).as_int32(), 150);
+  EXPECT_FALSE(tpd.at<8>().valid());
+  EXPECT_FALSE(tpd.Get(1).valid());
+  EXPECT_FALSE(tpd.GetRepeated<int32_t>(8));
+
+  auto it = tpd.GetRepeated<int32_t>(7);
+  EXPECT_EQ(*it++, 70);
+  EXPECT_EQ(*it++, 71);
+  EXPECT_FALSE(it);
+
+  // Decoders using the same subset share the slot table.
+  Decoder tpd2(data.data(), data.size(), FieldSubset<7, 15>());
+  EXPECT_EQ(tpd2.at<7>().as_int32(), 71);
+  EXPECT_EQ(tpd2.Get(15).as_int32(), 150);
+}
+
 }  // namespace
 }  // namespace protozero
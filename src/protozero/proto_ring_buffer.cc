@@ -16,6 +16,10 @@
 
 #include "src/protozero/proto_ring_buffer.h"
 
+#include <string.h>
+
+#include <algorithm>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/paged_memory.h"
 #include "perfetto/protozero/proto_utils.h"
@@ -31,11 +35,14 @@ inline ProtoRingBuffer::Message FramingError() {
   return msg;
 }
 
-// Tries to decode a length-delimited proto field from |start|.
-// Returns a valid boundary if the preamble is valid and the length is within
-// |end|, or an invalid message otherwise.
-ProtoRingBuffer::Message TryReadMessage(const uint8_t* start,
-                                        const uint8_t* end) {
+// Tries to decode the preamble of a length-delimited proto field at |start|.
+// Returns an invalid message if [start, end) doesn't contain the whole
+// preamble, or if the preamble is invalid (with |fatal_framing_error| set).
+// Otherwise returns the boundaries of the payload, which can extend beyond
+// |end|.
+ProtoRingBuffer::Message ReadPreamble(const uint8_t* start,
+                                      const uint8_t* end,
+                                      bool log_errors) {
   namespace proto_utils = protozero::proto_utils;
   uint64_t field_tag = 0;
   auto* start_of_len = proto_utils::ParseVarInt(start, end, &field_tag);
@@ -45,7 +52,8 @@ ProtoRingBuffer::Message TryReadMessage(const uint8_t* start,
   const uint32_t tag = field_tag & 0x07;
   if (tag !=
       static_cast<uint32_t>(proto_utils::ProtoWireType::kLengthDelimited)) {
-    PERFETTO_ELOG("RPC framing error, unexpected msg tag 0x%xu", tag);
+    if (log_errors)
+      PERFETTO_ELOG("RPC framing error, unexpected msg tag 0x%xu", tag);
     return FramingError();
   }
 
@@ -55,14 +63,13 @@ ProtoRingBuffer::Message TryReadMessage(const uint8_t* start,
     return ProtoRingBuffer::Message{};  // Not enough data.
 
   if (msg_len > ProtoRingBuffer::kMaxMsgSize) {
-    PERFETTO_ELOG("RPC framing error, message too large (%" PRIu64 " > %zu)",
-                  msg_len, ProtoRingBuffer::kMaxMsgSize);
+    if (log_errors) {
+      PERFETTO_ELOG("RPC framing error, message too large (%" PRIu64 " > %zu)",
+                    msg_len, ProtoRingBuffer::kMaxMsgSize);
+    }
     return FramingError();
   }
 
-  if (start_of_msg + msg_len > end)
-    return ProtoRingBuffer::Message{};  // Not enough data.
-
   ProtoRingBuffer::Message msg{};
   msg.start = start_of_msg;
   msg.len = static_cast<uint32_t>(msg_len);
@@ -70,6 +77,43 @@ ProtoRingBuffer::Message TryReadMessage(const uint8_t* start,
   return msg;
 }
 
+// Tries to decode a length-delimited proto field from |start|.
+// Returns a valid boundary if the preamble is valid and the length is within
+// |end|, or an invalid message otherwise.
+ProtoRingBuffer::Message TryReadMessage(const uint8_t* start,
+                                        const uint8_t* end) {
+  ProtoRingBuffer::Message msg = ReadPreamble(start, end, /*log_errors=*/true);
+  if (msg.valid() && msg.len > static_cast<size_t>(end - msg.start))
+    return ProtoRingBuffer::Message{};  // Not enough data.
+  return msg;
+}
+
+// Returns the end of the sequence of complete messages at the beginning of
+// [start, end). Stops at the first incomplete or invalid message. This is the
+// same parsing as TryReadMessage(), without building the Message.
+const uint8_t* FindEndOfCompleteMessages(const uint8_t* start,
+                                         const uint8_t* end) {
+  namespace proto_utils = protozero::proto_utils;
+  for (;;) {
+    uint64_t field_tag = 0;
+    auto* start_of_len = proto_utils::ParseVarInt(start, end, &field_tag);
+    if (start_of_len == start ||
+        (field_tag & 0x07) !=
+            static_cast<uint64_t>(
+                proto_utils::ProtoWireType::kLengthDelimited)) {
+      return start;
+    }
+    uint64_t msg_len = 0;
+    auto* start_of_msg = proto_utils::ParseVarInt(start_of_len, end, &msg_len);
+    if (start_of_msg == start_of_len ||
+        msg_len > ProtoRingBuffer::kMaxMsgSize ||
+        msg_len > static_cast<uint64_t>(end - start_of_msg)) {
+      return start;
+    }
+    start = start_of_msg + msg_len;
+  }
+}
+
 }  // namespace
 
 ProtoRingBuffer::ProtoRingBuffer()
@@ -83,27 +127,67 @@ void ProtoRingBuffer::Append(const void* data_void, size_t data_len) {
   PERFETTO_DCHECK(wr_ <= buf_.size());
   PERFETTO_DCHECK(wr_ >= rd_);
 
+  // The caller is expected to issue ReadMessage() calls after each Append()
+  // until no more messages can be read. The messages of the previous Append()
+  // that haven't been read point into the caller's data, which might not be
+  // valid anymore.
+  PERFETTO_CHECK(inplace_rd_ == inplace_end_);
+
   // If the last call to ReadMessage() consumed all the data in the buffer and
   // there are no incomplete messages pending, restart from the beginning rather
   // than keep ringing. This is the most common case.
   if (rd_ == wr_)
     rd_ = wr_ = 0;
 
-  // The caller is expected to always issue a ReadMessage() after each Append().
-  PERFETTO_CHECK(!fastpath_.valid());
-  if (rd_ == wr_) {
-    auto msg = TryReadMessage(data, data + data_len);
-    if (msg.valid() && msg.end() == (data + data_len)) {
-      // Fastpath: in many cases, the underlying stream will effectively
-      // preserve the atomicity of messages for most small messages.
-      // In this case we can avoid the extra buf_ roundtrip and just pass a
-      // pointer to |data| + (proto preamble len).
-      // The next call to ReadMessage)= will return |fastpath_|.
-      fastpath_ = std::move(msg);
+  // Complete the message that straddles the previous Append() and this one,
+  // by copying only the bytes of |data| that belong to it.
+  // |pending| is the offset from |rd_| of the incomplete message in |buf_|.
+  size_t pending = static_cast<size_t>(
+      FindEndOfCompleteMessages(&buf()[rd_], &buf()[wr_]) - &buf()[rd_]);
+  while (pending < wr_ - rd_ && data_len > 0) {
+    const uint8_t* msg_begin = &buf()[rd_ + pending];
+    Message msg = ReadPreamble(msg_begin, &buf()[wr_], /*log_errors=*/false);
+    if (msg.fatal_framing_error) {
+      // ReadMessage() will report the error.
+      AppendToBuffer(data, data_len);
       return;
     }
+    // If the preamble itself is incomplete, copy it one byte at a time. It's
+    // at most 15 bytes long.
+    size_t copy_len = 1;
+    if (msg.valid()) {
+      size_t have = wr_ - rd_ - pending;
+      size_t msg_outer_len =
+          static_cast<size_t>(msg.start - msg_begin) + msg.len;
+      copy_len = std::min(msg_outer_len - have, data_len);
+    }
+    AppendToBuffer(data, copy_len);
+    data += copy_len;
+    data_len -= copy_len;
+    if (msg.valid() || failed_)
+      break;
   }
+  if (failed_)
+    return;
+
+  // The complete messages in the rest of |data| are returned by ReadMessage()
+  // straight from |data|, without copying them. Only a trailing incomplete
+  // message (or the bytes from a framing error onwards) is copied, to be
+  // completed by the next Append().
+  const uint8_t* data_end = data + data_len;
+  const uint8_t* complete_end = FindEndOfCompleteMessages(data, data_end);
+  const size_t tail_len = static_cast<size_t>(data_end - complete_end);
+  AppendToBuffer(complete_end, tail_len);
+  if (failed_)
+    return;
+  inplace_rd_ = data;
+  inplace_end_ = complete_end;
+  inplace_offset_ = wr_ - tail_len;
+}
 
+void ProtoRingBuffer::AppendToBuffer(const uint8_t* data, size_t data_len) {
+  if (data_len == 0)
+    return;
   size_t avail = buf_.size() - wr_;
   if (data_len > avail) {
     // This whole section should be hit extremely rarely.
@@ -117,8 +201,7 @@ void ProtoRingBuffer::Append(const void* data_void, size_t data_len) {
     // After recompaction:
     // buf_: [msg1 incomplete]
     //       ^rd_             ^wr_
-    uint8_t* buf = static_cast<uint8_t*>(buf_.Get());
-    memmove(&buf[0], &buf[rd_], wr_ - rd_);
+    memmove(&buf()[0], &buf()[rd_], wr_ - rd_);
     avail += rd_;
     wr_ -= rd_;
     rd_ = 0;
@@ -145,8 +228,7 @@ void ProtoRingBuffer::Append(const void* data_void, size_t data_len) {
   }
 
   // Append the received data at the end of the ring buffer.
-  uint8_t* buf = static_cast<uint8_t*>(buf_.Get());
-  memcpy(&buf[wr_], data, data_len);
+  memcpy(&buf()[wr_], data, data_len);
   wr_ += data_len;
 }
 
@@ -154,21 +236,24 @@ ProtoRingBuffer::Message ProtoRingBuffer::ReadMessage() {
   if (failed_)
     return FramingError();
 
-  if (fastpath_.valid()) {
-    // The fastpath can only be hit when the buffer is empty.
-    PERFETTO_CHECK(rd_ == wr_);
-    auto msg = std::move(fastpath_);
-    fastpath_ = Message{};
+  const bool has_inplace_msgs = inplace_rd_ != inplace_end_;
+  if (has_inplace_msgs && rd_ >= inplace_offset_) {
+    // All the messages in |buf_| that precede the in-place ones have been
+    // read. Append() has checked that the in-place messages are complete.
+    auto msg = TryReadMessage(inplace_rd_, inplace_end_);
+    PERFETTO_CHECK(msg.valid());
+    inplace_rd_ = msg.end();
     return msg;
   }
 
-  uint8_t* buf = static_cast<uint8_t*>(buf_.Get());
+  uint8_t* buf = this->buf();
+  const size_t end = has_inplace_msgs ? inplace_offset_ : wr_;
 
-  PERFETTO_DCHECK(rd_ <= wr_);
-  if (rd_ >= wr_)
+  PERFETTO_DCHECK(rd_ <= end);
+  if (rd_ >= end)
     return Message{};  // Completely empty.
 
-  auto msg = TryReadMessage(&buf[rd_], &buf[wr_]);
+  auto msg = TryReadMessage(&buf[rd_], &buf[end]);
   if (!msg.valid()) {
     failed_ = failed_ || msg.fatal_framing_error;
     return msg;  // Return |msg| because it could be a framing error.
@@ -177,7 +262,7 @@ ProtoRingBuffer::Message ProtoRingBuffer::ReadMessage() {
   // Note: msg.start is > buf[rd_], because it skips the proto preamble.
   PERFETTO_DCHECK(msg.start > &buf[rd_]);
   const uint8_t* msg_end = msg.start + msg.len;
-  PERFETTO_CHECK(msg_end > &buf[rd_] && msg_end <= &buf[wr_]);
+  PERFETTO_CHECK(msg_end > &buf[rd_] && msg_end <= &buf[end]);
   auto msg_outer_len = static_cast<size_t>(msg_end - &buf[rd_]);
   rd_ += msg_outer_len;
   return msg;
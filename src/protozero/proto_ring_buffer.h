@@ -93,6 +93,14 @@ namespace protozero {
 // 2. If still there isn't enough space, we expand the buffer.
 // Given that each message is expected to be at most kMaxMsgSize (64 MB), the
 // expansion is bound at 2 * kMaxMsgSize.
+//
+// The buffer above only ever holds the messages that straddle two Append()
+// calls. The complete messages inside the data passed to Append() are not
+// copied: ReadMessage() returns them as pointers into that data. In the example
+// above, Append("ll2be4f") copies only "ll" into the buffer, to complete
+// "4will". ReadMessage() then returns "will" from the buffer and "be" from the
+// appended data, and "4f" is copied into the buffer, to be completed by the
+// next Append().
 class ProtoRingBuffer {
  public:
   static constexpr size_t kMaxMsgSize = 64 * 1024 * 1024;
@@ -111,14 +119,17 @@ class ProtoRingBuffer {
   ProtoRingBuffer& operator=(const ProtoRingBuffer&) = delete;
 
   // Appends data into the ring buffer, recompacting or resizing it if needed.
-  // Will invaildate the pointers previously handed out.
+  // Will invaildate the pointers previously handed out. |data| must stay valid
+  // until ReadMessage() has returned all the messages that can be read, as
+  // they can point into it.
   void Append(const void* data, size_t len);
 
   // If a protobuf message can be read, it returns the boundaries of the message
   // (without including the preamble) and advances the read cursor.
   // If no message is avaiable, returns a null range.
   // The returned pointer is only valid until the next call to Append(), as
-  // that can recompact or resize the underlying buffer.
+  // that can recompact or resize the underlying buffer, and as long as the data
+  // passed to the last Append() is valid.
   Message ReadMessage();
 
   // Exposed for testing.
@@ -126,11 +137,22 @@ class ProtoRingBuffer {
   size_t avail() const { return buf_.size() - (wr_ - rd_); }
 
  private:
+  // Copies |data| at the write cursor of |buf_|.
+  void AppendToBuffer(const uint8_t* data, size_t data_len);
+
+  uint8_t* buf() { return static_cast<uint8_t*>(buf_.Get()); }
+
   perfetto::base::PagedMemory buf_;
-  Message fastpath_{};
   bool failed_ = false;  // Set in case of an unrecoverable framing faiulre.
   size_t rd_ = 0;        // Offset of the read cursor in |buf_|.
   size_t wr_ = 0;        // Offset of the write cursor in |buf_|.
+
+  // The complete messages of the data passed to the last Append(), which are
+  // read in place. They come after the messages in |buf_| that precede
+  // |inplace_offset_|.
+  const uint8_t* inplace_rd_ = nullptr;
+  const uint8_t* inplace_end_ = nullptr;
+  size_t inplace_offset_ = 0;
 };
 
 }  // namespace protozero
@@ -0,0 +1,106 @@
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "src/protozero/proto_ring_buffer.h"
+
+namespace {
+
+// Size of the stream of messages tokenized in each benchmark iteration.
+constexpr size_t kStreamSize = 16 * 1024 * 1024;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+// Arguments: {chunk size, average message size}.
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Args({4096, 512});
+  } else {
+    for (int chunk_size : {4096, 64 * 1024, 1024 * 1024}) {
+      for (int avg_msg_size : {64, 512, 4096})
+        b->Args({chunk_size, avg_msg_size});
+    }
+  }
+}
+
+// Returns a stream of length-delimited fields, like a trace file or the
+// TraceProcessorRpcStream. The sizes of the messages are random in
+// [1, 2 * avg_msg_size].
+std::vector<uint8_t> MakeStream(size_t avg_msg_size) {
+  namespace proto_utils = protozero::proto_utils;
+  std::minstd_rand0 rnd(0);
+  std::vector<uint8_t> stream;
+  stream.reserve(kStreamSize + 2 * avg_msg_size + 16);
+  while (stream.size() < kStreamSize) {
+    uint32_t len = static_cast<uint32_t>(1 + rnd() % (2 * avg_msg_size));
+    uint8_t preamble[16];
+    uint8_t* wptr = preamble;
+    wptr = proto_utils::WriteVarInt(proto_utils::MakeTagLengthDelimited(1),
+                                    wptr);
+    wptr = proto_utils::WriteVarInt(len, wptr);
+    stream.insert(stream.end(), preamble, wptr);
+    stream.resize(stream.size() + len, static_cast<uint8_t>(len));
+  }
+  return stream;
+}
+
+}  // namespace
+
+// Feeds the stream to the ring buffer in chunks of a fixed size, as the RPC
+// receives it from the socket, and reads all the messages.
+static void BM_ProtoRingBuffer_ReadMessages(benchmark::State& state) {
+  const size_t chunk_size = static_cast<size_t>(state.range(0));
+  const std::vector<uint8_t> stream =
+      MakeStream(static_cast<size_t>(state.range(1)));
+  std::vector<uint8_t> rx_buf(chunk_size);
+  protozero::ProtoRingBuffer ring_buffer;
+
+  uint64_t checksum = 0;
+  for (auto _ : state) {
+    for (size_t offset = 0; offset < stream.size(); offset += chunk_size) {
+      // Stands for the recv() into the socket buffer.
+      size_t len = std::min(chunk_size, stream.size() - offset);
+      memcpy(rx_buf.data(), &stream[offset], len);
+      ring_buffer.Append(rx_buf.data(), len);
+      for (;;) {
+        auto msg = ring_buffer.ReadMessage();
+        if (!msg.valid())
+          break;
+        // Touch each cache line of the payload, as the caller would decode
+        // it.
+        for (uint32_t i = 0; i < msg.len; i += 64)
+          checksum += msg.start[i];
+      }
+    }
+    benchmark::DoNotOptimize(checksum);
+  }
+  PERFETTO_CHECK(checksum > 0);
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(stream.size()));
+}
+
+BENCHMARK(BM_ProtoRingBuffer_ReadMessages)->Apply(BenchmarkArgs);
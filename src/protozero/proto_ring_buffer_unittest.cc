@@ -127,6 +127,60 @@ TEST_F(ProtoRingBufferTest, Fastpath) {
   }
 }
 
+// Test that only the messages that straddle two Append() calls are copied.
+TEST_F(ProtoRingBufferTest, ReadsCompleteMessagesInPlace) {
+  ProtoRingBuffer buf;
+  last_msg_.reserve(1024);
+  auto msg1 = MakeProtoMessage(1, 10, /*append=*/true);
+  auto msg2 = MakeProtoMessage(2, 20, /*append=*/true);
+  auto msg3 = MakeProtoMessage(3, 30, /*append=*/true);
+  auto msg4 = MakeProtoMessage(4, 40, /*append=*/true);
+
+  // Append msg1, msg2 and the first half of msg3.
+  size_t msg3_half = static_cast<size_t>(msg3.start - last_msg_.data()) + 15;
+  buf.Append(last_msg_.data(), msg3_half);
+  const size_t msg3_copied = msg3_half - static_cast<size_t>(msg2.end() -
+                                                             last_msg_.data());
+  EXPECT_EQ(buf.avail(), buf.capacity() - msg3_copied);
+  auto actual = buf.ReadMessage();
+  EXPECT_EQ(actual.start, msg1.start);
+  EXPECT_EQ(actual, msg1);
+  actual = buf.ReadMessage();
+  EXPECT_EQ(actual.start, msg2.start);
+  EXPECT_EQ(actual, msg2);
+  EXPECT_FALSE(buf.ReadMessage().valid());
+
+  // Append the rest: msg3 is completed in the buffer, msg4 is read in place.
+  buf.Append(last_msg_.data() + msg3_half, last_msg_.size() - msg3_half);
+  actual = buf.ReadMessage();
+  EXPECT_NE(actual.start, msg3.start);
+  EXPECT_EQ(actual, msg3);
+  actual = buf.ReadMessage();
+  EXPECT_EQ(actual.start, msg4.start);
+  EXPECT_EQ(actual, msg4);
+  EXPECT_FALSE(buf.ReadMessage().valid());
+  EXPECT_EQ(buf.avail(), buf.capacity());
+}
+
+// Test a message whose preamble is split across several Append() calls.
+TEST_F(ProtoRingBufferTest, SplitPreamble) {
+  ProtoRingBuffer buf;
+  last_msg_.reserve(1024);
+  auto msg1 = MakeProtoMessage(/*field_id=*/100000, 300, /*append=*/true);
+  auto msg2 = MakeProtoMessage(1, 5, /*append=*/true);
+  const size_t preamble_len = static_cast<size_t>(msg1.start - &last_msg_[0]);
+  for (size_t i = 0; i < preamble_len; i++) {
+    buf.Append(&last_msg_[i], 1);
+    EXPECT_FALSE(buf.ReadMessage().valid());
+  }
+  buf.Append(&last_msg_[preamble_len], last_msg_.size() - preamble_len);
+  EXPECT_EQ(buf.ReadMessage(), msg1);
+  auto actual = buf.ReadMessage();
+  EXPECT_EQ(actual.start, msg2.start);
+  EXPECT_EQ(actual, msg2);
+  EXPECT_FALSE(buf.ReadMessage().valid());
+}
+
 TEST_F(ProtoRingBufferTest, CoalescingStream) {
   ProtoRingBuffer buf;
   last_msg_.reserve(1024);
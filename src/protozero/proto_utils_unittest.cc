@@ -194,6 +194,23 @@ TEST(ProtoUtilsTest, VarIntDecoding) {
   }
 }
 
+// As above, but with other data after the varint, as is the case when
+// decoding a message. This exercises the short varint fast paths.
+TEST(ProtoUtilsTest, VarIntDecodingWithTrailingBytes) {
+  for (uint8_t trailing_byte : {0x00, 0x80, 0xff}) {
+    for (size_t i = 0; i < ArraySize(kVarIntExpectations); ++i) {
+      const VarIntExpectation& exp = kVarIntExpectations[i];
+      uint8_t buf[16];
+      memset(buf, trailing_byte, sizeof(buf));
+      memcpy(buf, exp.encoded, exp.encoded_size);
+      uint64_t value = std::numeric_limits<uint64_t>::max();
+      const uint8_t* res = ParseVarInt(buf, buf + sizeof(buf), &value);
+      ASSERT_EQ(&buf[exp.encoded_size], res);
+      ASSERT_EQ(exp.int_value, value);
+    }
+  }
+}
+
 // ParseVarInt() must fail gracefully if we hit the |end| without seeing the
 // MSB == 0 (i.e. end-of-sequence).
 TEST(ProtoUtilsTest, VarIntDecodingOutOfBounds) {
@@ -74,6 +74,9 @@ class CppObjGenerator : public ::google::protobuf::compiler::CodeGenerator {
   void GenEnumAliases(const EnumDescriptor*, Printer*) const;
   void GenClassDecl(const Descriptor*, Printer*) const;
   void GenClassDef(const Descriptor*, Printer*) const;
+  void GenFieldsReset(const Descriptor*,
+                      bool keep_repeated_messages,
+                      Printer*) const;
 
   std::vector<std::string> GetNamespaces(const FileDescriptor* file) const {
     std::string pkg = file->package() + wrapper_namespace_;
@@ -576,9 +579,15 @@ void CppObjGenerator::GenClassDecl(const Descriptor* msg, Printer* p) const {
 
   std::string proto_type = GetFullName(msg, true);
   p->Print("bool ParseFromArray(const void*, size_t) override;\n");
+  p->Print(
+      "// Like ParseFromArray(), but doesn't clear the fields first: scalar\n"
+      "// fields are overwritten, repeated fields appended to and message\n"
+      "// fields merged.\n");
+  p->Print("bool MergeFromArray(const void*, size_t);\n");
   p->Print("std::string SerializeAsString() const override;\n");
   p->Print("std::vector<uint8_t> SerializeAsArray() const override;\n");
   p->Print("void Serialize(::protozero::Message*) const;\n");
+  p->Print("void Clear();\n");
 
   // Generate accessors.
   for (int i = 0; i < msg->field_count(); i++) {
@@ -648,6 +657,7 @@ void CppObjGenerator::GenClassDecl(const Descriptor* msg, Printer* p) const {
   p->Outdent();
   p->Print("\n private:\n");
   p->Indent();
+  p->Print("bool DecodeFields(const void*, size_t, bool merge);\n\n");
 
   // Generate fields.
   int max_field_id = 1;
@@ -727,17 +737,54 @@ void CppObjGenerator::GenClassDef(const Descriptor* msg, Printer* p) const {
 
   std::string proto_type = GetFullName(msg, true);
 
-  // Generate the ParseFromArray() method definition.
+  // Generate the Clear() method definition. It keeps the memory allocated for
+  // strings and repeated fields, so that the message can be reused.
+  p->Print("void $f$::Clear() {\n", "f", full_name);
+  p->Indent();
+  GenFieldsReset(msg, /*keep_repeated_messages=*/false, p);
+  p->Outdent();
+  p->Print("}\n\n");
+
+  // Generate the ParseFromArray() and MergeFromArray() method definitions.
   p->Print("bool $f$::ParseFromArray(const void* raw, size_t size) {\n", "f",
            full_name);
   p->Indent();
+  GenFieldsReset(msg, /*keep_repeated_messages=*/true, p);
+  p->Print("return DecodeFields(raw, size, /*merge=*/false);\n");
+  p->Outdent();
+  p->Print("}\n\n");
+
+  p->Print("bool $f$::MergeFromArray(const void* raw, size_t size) {\n", "f",
+           full_name);
+  p->Print("  return DecodeFields(raw, size, /*merge=*/true);\n");
+  p->Print("}\n\n");
+
+  // Generate the DecodeFields() method definition. Unless |merge|, repeated
+  // message fields are parsed into the existing elements, if any, so that
+  // their strings and repeated fields are reused when parsing many messages
+  // into the same object (e.g. in the IPC layer). |num_xxx| counts the
+  // elements of each message field.
+  p->Print(
+      "bool $f$::DecodeFields(const void* raw, size_t size, bool merge) {\n",
+      "f", full_name);
+  p->Indent();
+  bool has_message_fields = false;
   for (int i = 0; i < msg->field_count(); i++) {
     const FieldDescriptor* field = msg->field(i);
-    if (field->is_repeated())
-      p->Print("$n$_.clear();\n", "n", field->lowercase_name());
+    if (field->type() != TYPE_MESSAGE || field->options().lazy())
+      continue;
+    has_message_fields = true;
+    if (field->is_repeated()) {
+      p->Print("size_t num_$n$ = merge ? $n$_.size() : 0;\n", "n",
+               field->lowercase_name());
+    } else {
+      p->Print("size_t num_$n$ = merge ? 1 : 0;\n", "n",
+               field->lowercase_name());
+    }
   }
-  p->Print("unknown_fields_.clear();\n");
-  p->Print("bool packed_error = false;\n");
+  if (!has_message_fields)
+    p->Print("(void)merge;\n");
+  p->Print("bool parse_error = false;\n");
   p->Print("\n");
   p->Print("::protozero::ProtoDecoder dec(raw, size);\n");
   p->Print("for (auto field = dec.ReadField(); field.valid(); ");
@@ -754,11 +801,17 @@ void CppObjGenerator::GenClassDef(const Descriptor* msg, Printer* p) const {
              "n", field->lowercase_name());
     p->Indent();
     if (field->options().lazy()) {
-      p->Print("$n$_ = field.as_std_string();\n", "n", field->lowercase_name());
+      // Concatenating the serialized occurrences merges them.
+      p->Print(
+          "$n$_.append(reinterpret_cast<const char*>(field.data()), "
+          "field.size());\n",
+          "n", field->lowercase_name());
     } else {
       std::string statement;
       if (field->type() == TYPE_MESSAGE) {
-        statement = "$rval$.ParseFromArray(field.data(), field.size());\n";
+        statement =
+            "if (!$rval$.ParseFromArray(field.data(), field.size()))\n"
+            "  parse_error = true;\n";
       } else {
         if (field->type() == TYPE_SINT32 || field->type() == TYPE_SINT64) {
           // sint32/64 fields are special and need to be zig-zag-decoded.
@@ -774,17 +827,35 @@ void CppObjGenerator::GenClassDef(const Descriptor* msg, Printer* p) const {
         }
         p->Print(
             "for (::protozero::PackedRepeatedFieldIterator<$w$, $c$> "
-            "rep(field.data(), field.size(), &packed_error); rep; ++rep) {\n",
+            "rep(field.data(), field.size(), &parse_error); rep; ++rep) {\n",
             "w", GetPackedWireType(field), "c", GetCppType(field, false));
         p->Print("  $n$_.emplace_back(*rep);\n", "n", field->lowercase_name());
         p->Print("}\n");
+      } else if (field->is_repeated() && field->type() == TYPE_MESSAGE) {
+        p->Print("if (num_$n$ == $n$_.size())\n", "n",
+                 field->lowercase_name());
+        p->Print("  $n$_.emplace_back();\n", "n", field->lowercase_name());
+        p->Print(statement.c_str(), "rval",
+                 field->lowercase_name() + "_[num_" + field->lowercase_name() +
+                     "++]");
       } else if (field->is_repeated()) {
         p->Print("$n$_.emplace_back();\n", "n", field->lowercase_name());
         p->Print(statement.c_str(), "rval",
                  field->lowercase_name() + "_.back()");
       } else if (field->type() == TYPE_MESSAGE) {
+        // A non-repeated message field that occurs more than once (or that is
+        // already set, when merging) must be merged, as per the proto
+        // semantics.
+        p->Print("if (num_$n$++ == 0) {\n", "n", field->lowercase_name());
+        p->Indent();
         p->Print(statement.c_str(), "rval",
                  "(*" + field->lowercase_name() + "_)");
+        p->Outdent();
+        p->Print(
+            "} else if (!$n$_->MergeFromArray(field.data(), field.size())) {\n",
+            "n", field->lowercase_name());
+        p->Print("  parse_error = true;\n");
+        p->Print("}\n");
       } else {
         p->Print(statement.c_str(), "rval", field->lowercase_name() + "_");
       }
@@ -798,8 +869,13 @@ void CppObjGenerator::GenClassDef(const Descriptor* msg, Printer* p) const {
   p->Outdent();
   p->Print("}\n");  // switch(field.id)
   p->Outdent();
-  p->Print("}\n");                                           // for(field)
-  p->Print("return !packed_error && !dec.bytes_left();\n");  // for(field)
+  p->Print("}\n");  // for(field)
+  for (int i = 0; i < msg->field_count(); i++) {
+    const FieldDescriptor* field = msg->field(i);
+    if (field->is_repeated() && field->type() == TYPE_MESSAGE)
+      p->Print("$n$_.resize(num_$n$);\n", "n", field->lowercase_name());
+  }
+  p->Print("return !parse_error && !dec.bytes_left();\n");
   p->Outdent();
   p->Print("}\n\n");
 
@@ -877,6 +953,33 @@ void CppObjGenerator::GenClassDef(const Descriptor* msg, Printer* p) const {
   p->Print("}\n\n");
 }
 
+// Resets all the fields to their default value, without releasing the memory
+// of strings and repeated fields. If |keep_repeated_messages| is true, the
+// elements of repeated message fields are left untouched.
+void CppObjGenerator::GenFieldsReset(const Descriptor* msg,
+                                     bool keep_repeated_messages,
+                                     Printer* p) const {
+  for (int i = 0; i < msg->field_count(); i++) {
+    const FieldDescriptor* field = msg->field(i);
+    const std::string name = field->lowercase_name();
+    if (field->options().lazy()) {
+      p->Print("$n$_.clear();\n", "n", name);
+    } else if (field->is_repeated()) {
+      if (field->type() != TYPE_MESSAGE || !keep_repeated_messages)
+        p->Print("$n$_.clear();\n", "n", name);
+    } else if (field->type() == TYPE_MESSAGE) {
+      p->Print("$n$_->Clear();\n", "n", name);
+    } else if (field->type() == FieldDescriptor::TYPE_STRING ||
+               field->type() == FieldDescriptor::TYPE_BYTES) {
+      p->Print("$n$_.clear();\n", "n", name);
+    } else {
+      p->Print("$n$_ = {};\n", "n", name);
+    }
+  }
+  p->Print("unknown_fields_.clear();\n");
+  p->Print("_has_field_.reset();\n");
+}
+
 }  // namespace
 }  // namespace protozero
 
@@ -21,6 +21,7 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include <google/protobuf/compiler/code_generator.h>
 #include <google/protobuf/compiler/plugin.h>
@@ -54,6 +55,12 @@ using perfetto::base::Uppercase;
 // Not worth an extra dependency.
 constexpr int kMaxDecoderFieldId = 999;
 
+// Decoders for messages with at least this many unused field ids below the
+// highest one store their fields densely, through a field id -> slot table,
+// rather than in an array indexed by field id (e.g. TracePacket, whose highest
+// field id is 900, has less than 100 fields).
+constexpr int kMinUnusedFieldIdsForDenseDecoder = 32;
+
 void Assert(bool condition) {
   if (!condition)
     abort();
@@ -619,37 +626,65 @@ class GeneratorJob {
 
   void GenerateDecoder(const Descriptor* message) {
     int max_field_id = 0;
+    int num_fields = 0;
     bool has_nonpacked_repeated_fields = false;
     for (int i = 0; i < message->field_count(); ++i) {
       const FieldDescriptor* field = message->field(i);
       if (field->number() > kMaxDecoderFieldId)
         continue;
       max_field_id = std::max(max_field_id, field->number());
+      num_fields++;
       if (field->is_repeated() && !field->is_packed())
         has_nonpacked_repeated_fields = true;
     }
+    const bool dense =
+        max_field_id - num_fields >= kMinUnusedFieldIdsForDenseDecoder;
 
     std::string class_name = GetCppClassName(message) + "_Decoder";
-    stub_h_->Print(
-        "class $name$ : public "
-        "::protozero::TypedProtoDecoder</*MAX_FIELD_ID=*/$max$, "
-        "/*HAS_NONPACKED_REPEATED_FIELDS=*/$rep$> {\n",
-        "name", class_name, "max", std::to_string(max_field_id), "rep",
-        has_nonpacked_repeated_fields ? "true" : "false");
+    if (dense) {
+      stub_h_->Print(
+          "class $name$ : public "
+          "::protozero::TypedProtoDecoder</*MAX_FIELD_ID=*/$max$, "
+          "/*HAS_NONPACKED_REPEATED_FIELDS=*/$rep$, "
+          "/*NUM_STORED_FIELDS=*/$num$> {\n",
+          "name", class_name, "max", std::to_string(max_field_id), "rep",
+          has_nonpacked_repeated_fields ? "true" : "false", "num",
+          std::to_string(num_fields));
+    } else {
+      stub_h_->Print(
+          "class $name$ : public "
+          "::protozero::TypedProtoDecoder</*MAX_FIELD_ID=*/$max$, "
+          "/*HAS_NONPACKED_REPEATED_FIELDS=*/$rep$> {\n",
+          "name", class_name, "max", std::to_string(max_field_id), "rep",
+          has_nonpacked_repeated_fields ? "true" : "false");
+    }
     stub_h_->Print(" public:\n");
     stub_h_->Indent();
+    const char* slots_arg = dense ? ", FieldSlots()" : "";
     stub_h_->Print(
         "$name$(const uint8_t* data, size_t len) "
-        ": TypedProtoDecoder(data, len) {}\n",
-        "name", class_name);
+        ": TypedProtoDecoder(data, len$slots$) {}\n",
+        "name", class_name, "slots", slots_arg);
     stub_h_->Print(
         "explicit $name$(const std::string& raw) : "
         "TypedProtoDecoder(reinterpret_cast<const uint8_t*>(raw.data()), "
-        "raw.size()) {}\n",
-        "name", class_name);
+        "raw.size()$slots$) {}\n",
+        "name", class_name, "slots", slots_arg);
     stub_h_->Print(
         "explicit $name$(const ::protozero::ConstBytes& raw) : "
-        "TypedProtoDecoder(raw.data, raw.size) {}\n",
+        "TypedProtoDecoder(raw.data, raw.size$slots$) {}\n",
+        "name", class_name, "slots", slots_arg);
+    stub_h_->Print(
+        "template <uint32_t... FIELD_IDS>\n"
+        "$name$(const uint8_t* data, size_t len, "
+        "::protozero::FieldSubset<FIELD_IDS...> subset) : "
+        "TypedProtoDecoder(data, len, subset) {}\n",
+        "name", class_name);
+    stub_h_->Print(
+        "template <uint32_t... FIELD_IDS>\n"
+        "$name$(const ::protozero::ConstBytes& raw, "
+        "::protozero::FieldSubset<FIELD_IDS...> subset) : "
+        "TypedProtoDecoder(raw.data, raw.size, subset) {}\n",
         "name", class_name);
 
     for (int i = 0; i < message->field_count(); ++i) {
@@ -742,10 +777,51 @@ class GeneratorJob {
             getter);
       }
     }
+
+    if (dense)
+      GenerateDecoderFieldSlots(message, max_field_id);
+
     stub_h_->Outdent();
     stub_h_->Print("};\n\n");
   }
 
+  // Emits the field id -> slot table of a dense decoder. Slots are assigned in
+  // increasing field id order, starting from 1 (0 is the invalid field).
+  void GenerateDecoderFieldSlots(const Descriptor* message, int max_field_id) {
+    std::vector<int> slots(static_cast<size_t>(max_field_id) + 1);
+    for (int i = 0; i < message->field_count(); ++i) {
+      const FieldDescriptor* field = message->field(i);
+      if (field->number() <= max_field_id)
+        slots[static_cast<size_t>(field->number())] = 1;
+    }
+    int next_slot = 1;
+    for (int& slot : slots) {
+      if (slot)
+        slot = next_slot++;
+    }
+
+    stub_h_->Outdent();
+    stub_h_->Print("\n private:\n");
+    stub_h_->Indent();
+    stub_h_->Print("static const uint16_t* FieldSlots() {\n");
+    stub_h_->Indent();
+    stub_h_->Print("static constexpr uint16_t kFieldSlots[] = {\n");
+    stub_h_->Indent();
+    constexpr size_t kSlotsPerLine = 16;
+    for (size_t i = 0; i < slots.size(); i += kSlotsPerLine) {
+      std::string line;
+      for (size_t j = i; j < std::min(i + kSlotsPerLine, slots.size()); j++)
+        line += std::to_string(slots[j]) + ", ";
+      line.pop_back();
+      stub_h_->Print("$line$\n", "line", line);
+    }
+    stub_h_->Outdent();
+    stub_h_->Print("};\n");
+    stub_h_->Print("return kFieldSlots;\n");
+    stub_h_->Outdent();
+    stub_h_->Print("}\n");
+  }
+
   void GenerateConstantsForMessageFields(const Descriptor* message) {
     const bool has_fields = (message->field_count() > 0);
 
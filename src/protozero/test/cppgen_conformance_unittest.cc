@@ -142,6 +142,108 @@ TEST(ProtoCppConformanceTest, NestedMessages) {
   EXPECT_EQ(1000, gold_msg_a.super_nested().value_c());
 }
 
+// Tests that a non-repeated message field that occurs more than once is merged,
+// rather than replaced.
+TEST(ProtoCppConformanceTest, MergeNestedMessageOccurrences) {
+  pbtest::NestedA::NestedB msg_b;
+  msg_b.mutable_value_b()->set_value_c(1);
+  std::string serialized = msg_b.SerializeAsString();
+  pbtest::NestedA::NestedB empty_msg_b;
+  empty_msg_b.mutable_value_b();
+  serialized += empty_msg_b.SerializeAsString();
+
+  pbtest::NestedA::NestedB dec;
+  ASSERT_TRUE(dec.ParseFromString(serialized));
+  EXPECT_TRUE(dec.value_b().has_value_c());
+  EXPECT_EQ(dec.value_b().value_c(), 1);
+
+  pbgold::NestedA::NestedB gold_dec;
+  ASSERT_TRUE(gold_dec.ParseFromString(serialized));
+  EXPECT_EQ(gold_dec.value_b().value_c(), 1);
+}
+
+// Tests that a malformed occurrence of a non-repeated message field, which is
+// merged into the previous ones, fails the parsing.
+TEST(ProtoCppConformanceTest, MergeNestedMessageParseError) {
+  pbtest::NestedA::NestedB msg_b;
+  msg_b.mutable_value_b()->set_value_c(1);
+  std::string serialized = msg_b.SerializeAsString();
+  // value_b: {value_c: <truncated varint>}.
+  serialized += std::string("\x0a\x02\x08\x80", 4);
+
+  pbtest::NestedA::NestedB dec;
+  EXPECT_FALSE(dec.ParseFromString(serialized));
+}
+
+TEST(ProtoCppConformanceTest, MergeFromArray) {
+  pbtest::EveryField msg;
+  msg.set_field_int32(1);
+  msg.add_repeated_int32(1);
+  msg.add_field_nested()->set_field_int32(1);
+  std::string first = msg.SerializeAsString();
+
+  msg.Clear();
+  msg.set_field_string("x");
+  msg.add_repeated_int32(2);
+  msg.add_field_nested()->set_field_int32(2);
+  std::string second = msg.SerializeAsString();
+
+  pbtest::EveryField dec;
+  ASSERT_TRUE(dec.ParseFromString(first));
+  ASSERT_TRUE(dec.MergeFromArray(second.data(), second.size()));
+  EXPECT_EQ(dec.field_int32(), 1);
+  EXPECT_EQ(dec.field_string(), "x");
+  EXPECT_THAT(dec.repeated_int32(), ElementsAreArray({1, 2}));
+  ASSERT_EQ(dec.field_nested_size(), 2);
+  EXPECT_EQ(dec.field_nested()[0].field_int32(), 1);
+  EXPECT_EQ(dec.field_nested()[1].field_int32(), 2);
+
+  pbgold::EveryField gold_merged;
+  ASSERT_TRUE(gold_merged.ParseFromString(first + second));
+  pbgold::EveryField gold_dec;
+  ASSERT_TRUE(gold_dec.ParseFromString(dec.SerializeAsString()));
+  EXPECT_EQ(gold_dec.SerializeAsString(), gold_merged.SerializeAsString());
+}
+
+// Tests that decoding into an already populated message replaces its contents,
+// as if it was decoded into a new one.
+TEST(ProtoCppConformanceTest, ReuseMessage) {
+  pbtest::NestedA msg_a;
+  msg_a.add_repeated_a()->mutable_value_b()->set_value_c(1);
+  msg_a.add_repeated_a()->mutable_value_b()->set_value_c(2);
+  msg_a.mutable_super_nested()->set_value_c(3);
+  std::string first = msg_a.SerializeAsString();
+
+  msg_a.Clear();
+  EXPECT_EQ(msg_a.repeated_a_size(), 0);
+  EXPECT_FALSE(msg_a.has_super_nested());
+  EXPECT_EQ(msg_a.SerializeAsString(), "");
+
+  msg_a.add_repeated_a();
+  std::string second = msg_a.SerializeAsString();
+
+  pbtest::NestedA dec;
+  ASSERT_TRUE(dec.ParseFromString(first));
+  ASSERT_EQ(dec.repeated_a_size(), 2);
+  EXPECT_EQ(dec.repeated_a()[1].value_b().value_c(), 2);
+  EXPECT_EQ(dec.super_nested().value_c(), 3);
+
+  ASSERT_TRUE(dec.ParseFromString(second));
+  ASSERT_EQ(dec.repeated_a_size(), 1);
+  EXPECT_FALSE(dec.repeated_a()[0].has_value_b());
+  EXPECT_FALSE(dec.has_super_nested());
+  EXPECT_EQ(dec.SerializeAsString(), second);
+
+  pbtest::EveryField every_field;
+  SetTestingFields(&every_field);
+  ASSERT_TRUE(every_field.ParseFromString(""));
+  EXPECT_FALSE(every_field.has_field_int32());
+  EXPECT_EQ(every_field.field_int32(), 0);
+  EXPECT_FALSE(every_field.has_field_string());
+  EXPECT_EQ(every_field.field_string(), "");
+  EXPECT_EQ(every_field.repeated_int32_size(), 0);
+}
+
 // Tests that unknown fields are preserved when re-serializing. This test uses
 // the messages NestedA and NestedA_V2, where NestedA_V2 mimics a future
 // extension of NestedA. It starts filling the V2 version, than decodes it with
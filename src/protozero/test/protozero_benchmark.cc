@@ -17,6 +17,7 @@
 // See /docs/design-docs/protozero.md for rationale and results.
 
 #include <memory>
+#include <random>
 #include <vector>
 
 #include <unistd.h>
@@ -24,7 +25,14 @@
 #include <benchmark/benchmark.h>
 
 #include "perfetto/base/compiler.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/protozero/static_buffer.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/ftrace/sched.pbzero.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
 
 // Autogenerated headers in out/*/gen/
 #include "src/protozero/test/example_proto/library.pbzero.h"
@@ -128,6 +136,100 @@ PERFETTO_ALWAYS_INLINE void Clobber(benchmark::State& state) {
   benchmark::ClobberMemory();
 }
 
+// A bundle of sched_switch events similar to what traced_probes writes (with
+// compact_sched disabled): ~1k events of ~50 bytes with 1 to 8 byte varints.
+std::vector<uint8_t> MakeSchedSwitchBundle() {
+  std::minstd_rand rnd(42);
+  protozero::HeapBuffered<perfetto::protos::pbzero::FtraceEventBundle> bundle;
+  bundle->set_cpu(3);
+  uint64_t ts = 1000000000000ull;
+  for (int i = 0; i < 1000; i++) {
+    ts += rnd() % 100000;
+    auto* event = bundle->add_event();
+    event->set_timestamp(ts);
+    event->set_pid(rnd() % 32768);
+    auto* sched_switch = event->set_sched_switch();
+    sched_switch->set_prev_comm("surfaceflinger");
+    sched_switch->set_prev_pid(static_cast<int32_t>(rnd() % 32768));
+    sched_switch->set_prev_prio(120);
+    sched_switch->set_prev_state(rnd() % 2 ? 0 : 1);
+    sched_switch->set_next_comm("RenderThread");
+    sched_switch->set_next_pid(static_cast<int32_t>(rnd() % 32768));
+    sched_switch->set_next_prio(static_cast<int32_t>(rnd() % 140));
+  }
+  return bundle.SerializeAsArray();
+}
+
+// The compact_sched encoding of ~1k sched_switch events: packed repeated
+// varints, mostly of 1 to 3 bytes.
+std::vector<uint8_t> MakeCompactSchedBundle() {
+  std::minstd_rand rnd(42);
+  protozero::PackedVarInt timestamps;
+  protozero::PackedVarInt prev_states;
+  protozero::PackedVarInt next_pids;
+  protozero::PackedVarInt next_prios;
+  protozero::PackedVarInt next_comm_indexes;
+  for (int i = 0; i < 1000; i++) {
+    timestamps.Append(rnd() % 100000);
+    prev_states.Append(rnd() % 2);
+    next_pids.Append(rnd() % 32768);
+    next_prios.Append(rnd() % 140);
+    next_comm_indexes.Append(rnd() % 64);
+  }
+  protozero::HeapBuffered<perfetto::protos::pbzero::FtraceEventBundle> bundle;
+  bundle->set_cpu(3);
+  auto* compact_sched = bundle->set_compact_sched();
+  compact_sched->set_switch_timestamp(timestamps);
+  compact_sched->set_switch_prev_state(prev_states);
+  compact_sched->set_switch_next_pid(next_pids);
+  compact_sched->set_switch_next_prio(next_prios);
+  compact_sched->set_switch_next_comm_index(next_comm_indexes);
+  return bundle.SerializeAsArray();
+}
+
+// A trace of ~1k small packets, each with a timestamp, a sequence id and a
+// payload, the fields that the trace processor tokenizer looks at first.
+std::vector<uint8_t> MakeTrace() {
+  std::minstd_rand rnd(42);
+  protozero::HeapBuffered<perfetto::protos::pbzero::Trace> trace;
+  uint64_t ts = 1000000000000ull;
+  for (int i = 0; i < 1000; i++) {
+    ts += rnd() % 100000;
+    auto* packet = trace->add_packet();
+    packet->set_timestamp(ts);
+    packet->set_trusted_packet_sequence_id(1 + rnd() % 8);
+    packet->set_sequence_flags(2);
+    auto* bundle = packet->set_ftrace_events();
+    bundle->set_cpu(rnd() % 8);
+  }
+  return trace.SerializeAsArray();
+}
+
+template <typename FtraceEventDecoderFactory>
+void DecodeSchedSwitchBundle(benchmark::State& state,
+                             FtraceEventDecoderFactory make_event_decoder) {
+  using perfetto::protos::pbzero::FtraceEventBundle;
+  using perfetto::protos::pbzero::SchedSwitchFtraceEvent;
+  std::vector<uint8_t> data = MakeSchedSwitchBundle();
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    FtraceEventBundle::Decoder bundle(data.data(), data.size());
+    for (auto it = bundle.event(); it; ++it) {
+      auto event = make_event_decoder(*it);
+      sum += event.timestamp() + event.pid();
+      SchedSwitchFtraceEvent::Decoder sched_switch(event.sched_switch());
+      sum += static_cast<uint64_t>(sched_switch.prev_pid()) +
+             static_cast<uint64_t>(sched_switch.prev_state()) +
+             static_cast<uint64_t>(sched_switch.next_pid()) +
+             static_cast<uint64_t>(sched_switch.next_prio()) +
+             sched_switch.prev_comm().size + sched_switch.next_comm().size;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(data.size()));
+}
+
 }  // namespace
 
 static void BM_Protozero_Simple_Libprotobuf(benchmark::State& state) {
@@ -191,6 +293,68 @@ static void BM_Protozero_Nested_SpeedOfLight(benchmark::State& state) {
   }
 }
 
+static void BM_Protozero_Decode_SchedSwitch(benchmark::State& state) {
+  using perfetto::protos::pbzero::FtraceEvent;
+  DecodeSchedSwitchBundle(state, [](protozero::ConstBytes bytes) {
+    return FtraceEvent::Decoder(bytes);
+  });
+}
+
+static void BM_Protozero_Decode_SchedSwitch_FieldSubset(
+    benchmark::State& state) {
+  using perfetto::protos::pbzero::FtraceEvent;
+  DecodeSchedSwitchBundle(state, [](protozero::ConstBytes bytes) {
+    return FtraceEvent::Decoder(
+        bytes, protozero::FieldSubset<FtraceEvent::kTimestampFieldNumber,
+                                      FtraceEvent::kPidFieldNumber,
+                                      FtraceEvent::kSchedSwitchFieldNumber>());
+  });
+}
+
+static void BM_Protozero_Decode_CompactSched(benchmark::State& state) {
+  using perfetto::protos::pbzero::FtraceEventBundle;
+  std::vector<uint8_t> data = MakeCompactSchedBundle();
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    bool parse_error = false;
+    FtraceEventBundle::Decoder bundle(data.data(), data.size());
+    FtraceEventBundle::CompactSched::Decoder compact_sched(
+        bundle.compact_sched());
+    for (auto it = compact_sched.switch_timestamp(&parse_error); it; ++it)
+      sum += *it;
+    for (auto it = compact_sched.switch_prev_state(&parse_error); it; ++it)
+      sum += static_cast<uint64_t>(*it);
+    for (auto it = compact_sched.switch_next_pid(&parse_error); it; ++it)
+      sum += static_cast<uint64_t>(*it);
+    for (auto it = compact_sched.switch_next_prio(&parse_error); it; ++it)
+      sum += static_cast<uint64_t>(*it);
+    for (auto it = compact_sched.switch_next_comm_index(&parse_error); it; ++it)
+      sum += *it;
+    PERFETTO_CHECK(!parse_error);
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(data.size()));
+}
+
+static void BM_Protozero_Decode_TracePacket(benchmark::State& state) {
+  using perfetto::protos::pbzero::Trace;
+  using perfetto::protos::pbzero::TracePacket;
+  std::vector<uint8_t> data = MakeTrace();
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    Trace::Decoder trace(data.data(), data.size());
+    for (auto it = trace.packet(); it; ++it) {
+      TracePacket::Decoder packet(*it);
+      sum += packet.timestamp() + packet.trusted_packet_sequence_id() +
+             packet.sequence_flags() + packet.ftrace_events().size;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(data.size()));
+}
+
 BENCHMARK(BM_Protozero_Simple_Libprotobuf);
 BENCHMARK(BM_Protozero_Simple_Protozero);
 BENCHMARK(BM_Protozero_Simple_SpeedOfLight);
@@ -198,3 +362,8 @@ BENCHMARK(BM_Protozero_Simple_SpeedOfLight);
 BENCHMARK(BM_Protozero_Nested_Libprotobuf);
 BENCHMARK(BM_Protozero_Nested_Protozero);
 BENCHMARK(BM_Protozero_Nested_SpeedOfLight);
+
+BENCHMARK(BM_Protozero_Decode_SchedSwitch);
+BENCHMARK(BM_Protozero_Decode_SchedSwitch_FieldSubset);
+BENCHMARK(BM_Protozero_Decode_TracePacket);
+BENCHMARK(BM_Protozero_Decode_CompactSched);
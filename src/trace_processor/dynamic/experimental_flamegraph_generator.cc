@@ -28,6 +28,9 @@ namespace trace_processor {
 
 namespace {
 
+// The UI queries the same flamegraph again whenever the focus changes.
+constexpr size_t kMaxCachedFlamegraphs = 4;
+
 ExperimentalFlamegraphGenerator::InputValues GetFlamegraphInputValues(
     const std::vector<Constraint>& cs) {
   using T = tables::ExperimentalFlamegraphNodesTable;
@@ -138,15 +141,18 @@ struct CumulativeCounts {
   int64_t alloc_size;
   int64_t alloc_count;
 };
+// Returns a copy of |in| with only the nodes matching |focus_str|, their
+// ancestors and their descendants. All nodes are kept if |focus_str| is empty.
 std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> FocusTable(
     TraceStorage* storage,
-    std::unique_ptr<ExperimentalFlamegraphNodesTable> in,
+    const ExperimentalFlamegraphNodesTable& table,
     const std::string& focus_str) {
-  if (in->row_count() == 0 || focus_str.empty()) {
-    return in;
-  }
+  const ExperimentalFlamegraphNodesTable* in = &table;
   std::vector<FocusedState> focused_state =
-      ComputeFocusedState(*in, Matcher(focus_str));
+      focus_str.empty()
+          ? std::vector<FocusedState>(in->row_count(),
+                                      FocusedState::kFocusedPropagating)
+          : ComputeFocusedState(*in, Matcher(focus_str));
   std::unique_ptr<ExperimentalFlamegraphNodesTable> tbl(
       new tables::ExperimentalFlamegraphNodesTable(
           storage->mutable_string_pool(), nullptr));
@@ -201,6 +207,8 @@ std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> FocusTable(
     alloc_row.size = in->size()[i];
     alloc_row.alloc_count = in->alloc_count()[i];
     alloc_row.alloc_size = in->alloc_size()[i];
+    alloc_row.source_file = in->source_file()[i];
+    alloc_row.line_number = in->line_number()[i];
 
     const auto& cumulative = node_to_cumulatives[i];
     alloc_row.cumulative_count = cumulative.count;
@@ -255,20 +263,16 @@ std::unique_ptr<Table> ExperimentalFlamegraphGenerator::ComputeTable(
   // Get the input column values and compute the flamegraph using them.
   auto values = GetFlamegraphInputValues(cs);
 
-  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> table;
-  if (values.profile_type == "graph") {
-    auto* tracker = HeapGraphTracker::GetOrCreate(context_);
-    table = tracker->BuildFlamegraph(values.ts, values.upid);
-  } else if (values.profile_type == "native") {
-    table = BuildNativeHeapProfileFlamegraph(context_->storage.get(),
-                                             values.upid, values.ts);
-  } else if (values.profile_type == "callstack") {
-    table = BuildNativeCallStackSamplingFlamegraph(context_->storage.get(),
-                                                   values.upid, values.ts);
-  }
+  const tables::ExperimentalFlamegraphNodesTable* flamegraph =
+      GetOrBuildFlamegraph(values);
+  if (!flamegraph)
+    return nullptr;
+
+  // The cached flamegraph is never handed out, as the returned table can
+  // outlive the cache entry.
+  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> table =
+      FocusTable(context_->storage.get(), *flamegraph, values.focus_str);
   if (!values.focus_str.empty()) {
-    table =
-        FocusTable(context_->storage.get(), std::move(table), values.focus_str);
     // The pseudocolumns must be populated because as far as SQLite is
     // concerned these are equality constraints.
     auto focus_id =
@@ -282,6 +286,67 @@ std::unique_ptr<Table> ExperimentalFlamegraphGenerator::ComputeTable(
   return std::move(table);
 }
 
+const tables::ExperimentalFlamegraphNodesTable*
+ExperimentalFlamegraphGenerator::GetOrBuildFlamegraph(
+    const InputValues& values) {
+  const uint64_t data_generation =
+      context_->storage->profile_data_generation();
+  std::vector<uint32_t> source_row_counts = SourceRowCounts();
+  for (auto it = cache_.begin(); it != cache_.end(); ++it) {
+    if (it->ts != values.ts || it->upid != values.upid ||
+        it->profile_type != values.profile_type) {
+      continue;
+    }
+    if (it->data_generation != data_generation ||
+        it->source_row_counts != source_row_counts) {
+      // The data was changed or more was imported since this was built.
+      cache_.erase(it);
+      break;
+    }
+    // Move to the back, which holds the most recently used flamegraph.
+    std::rotate(it, it + 1, cache_.end());
+    return cache_.back().table.get();
+  }
+
+  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> table;
+  if (values.profile_type == "graph") {
+    auto* tracker = HeapGraphTracker::GetOrCreate(context_);
+    table = tracker->BuildFlamegraph(values.ts, values.upid);
+  } else if (values.profile_type == "native") {
+    table = BuildNativeHeapProfileFlamegraph(context_->storage.get(),
+                                             values.upid, values.ts);
+  } else if (values.profile_type == "callstack") {
+    table = BuildNativeCallStackSamplingFlamegraph(context_->storage.get(),
+                                                   values.upid, values.ts);
+  }
+  if (!table)
+    return nullptr;
+
+  if (cache_.size() == kMaxCachedFlamegraphs)
+    cache_.erase(cache_.begin());
+  CachedFlamegraph entry;
+  entry.ts = values.ts;
+  entry.upid = values.upid;
+  entry.profile_type = values.profile_type;
+  entry.data_generation = data_generation;
+  entry.source_row_counts = std::move(source_row_counts);
+  entry.table = std::move(table);
+  cache_.emplace_back(std::move(entry));
+  return cache_.back().table.get();
+}
+
+std::vector<uint32_t> ExperimentalFlamegraphGenerator::SourceRowCounts()
+    const {
+  const TraceStorage& storage = *context_->storage;
+  return {storage.heap_profile_allocation_table().row_count(),
+          storage.perf_sample_table().row_count(),
+          storage.stack_profile_callsite_table().row_count(),
+          storage.stack_profile_frame_table().row_count(),
+          storage.stack_profile_mapping_table().row_count(),
+          storage.symbol_table().row_count(),
+          storage.heap_graph_object_table().row_count()};
+}
+
 Table::Schema ExperimentalFlamegraphGenerator::CreateSchema() {
   return tables::ExperimentalFlamegraphNodesTable::Schema();
 }
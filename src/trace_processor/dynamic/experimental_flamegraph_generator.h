@@ -17,6 +17,10 @@
 #ifndef SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_FLAMEGRAPH_GENERATOR_H_
 #define SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_FLAMEGRAPH_GENERATOR_H_
 
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "src/trace_processor/sqlite/db_sqlite_table.h"
 
 #include "src/trace_processor/storage/trace_storage.h"
@@ -47,7 +51,27 @@ class ExperimentalFlamegraphGenerator
                                       const std::vector<Order>& ob) override;
 
  private:
+  // An unfocused flamegraph, built for the given input values.
+  struct CachedFlamegraph {
+    int64_t ts;
+    UniquePid upid;
+    std::string profile_type;
+    // TraceStorage::profile_data_generation() and the row counts of the tables
+    // flamegraphs are built from at the time this one was, to notice when the
+    // data was changed (e.g. deobfuscated) or more was imported since.
+    uint64_t data_generation;
+    std::vector<uint32_t> source_row_counts;
+    std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> table;
+  };
+
+  // Returns nullptr if there is no such flamegraph.
+  const tables::ExperimentalFlamegraphNodesTable* GetOrBuildFlamegraph(
+      const InputValues& values);
+  std::vector<uint32_t> SourceRowCounts() const;
+
   TraceProcessorContext* context_ = nullptr;
+  // Least recently used first.
+  std::vector<CachedFlamegraph> cache_;
 };
 
 }  // namespace trace_processor
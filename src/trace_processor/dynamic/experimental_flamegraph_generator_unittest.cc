@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_flamegraph_generator.h"
+
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+
+constexpr UniquePid kUpid = 1;
+constexpr int64_t kTimestamp = 10;
+
+class ExperimentalFlamegraphGeneratorTest : public ::testing::Test {
+ public:
+  ExperimentalFlamegraphGeneratorTest() : generator_(&context_) {
+    context_.storage.reset(new TraceStorage());
+    TraceStorage* storage = context_.storage.get();
+
+    //   main
+    //    |
+    //    a
+    StringId mapping_name = storage->InternString("libfoo.so");
+    auto mapping_id = storage->mutable_stack_profile_mapping_table()
+                          ->Insert({{}, 0, 0, 0, 0, 0, mapping_name})
+                          .id;
+    auto* frames = storage->mutable_stack_profile_frame_table();
+    auto main_frame = frames->Insert({storage->InternString("main"),
+                                      mapping_id, 0, base::nullopt,
+                                      base::nullopt})
+                          .id;
+    a_frame_ = frames->Insert({storage->InternString("a"), mapping_id, 1,
+                               base::nullopt, base::nullopt})
+                   .id;
+
+    auto* callsites = storage->mutable_stack_profile_callsite_table();
+    auto main_cs = callsites->Insert({0, base::nullopt, main_frame}).id;
+    a_callsite_ = callsites->Insert({1, main_cs, a_frame_}).id;
+    AddAllocation(16);
+  }
+
+  void AddAllocation(int64_t size) {
+    context_.storage->mutable_heap_profile_allocation_table()->Insert(
+        {kTimestamp, kUpid, context_.storage->InternString("malloc"),
+         a_callsite_, 1, size});
+  }
+
+  // Returns the names of the nodes of the native heap profile flamegraph and
+  // the cumulative size of its root.
+  std::pair<std::vector<std::string>, int64_t> QueryFlamegraph() {
+    using T = tables::ExperimentalFlamegraphNodesTable;
+    std::vector<Constraint> cs = {
+        {static_cast<uint32_t>(T::ColumnIndex::ts), FilterOp::kEq,
+         SqlValue::Long(kTimestamp)},
+        {static_cast<uint32_t>(T::ColumnIndex::upid), FilterOp::kEq,
+         SqlValue::Long(kUpid)},
+        {static_cast<uint32_t>(T::ColumnIndex::profile_type), FilterOp::kEq,
+         SqlValue::String("native")},
+    };
+    std::unique_ptr<Table> table = generator_.ComputeTable(cs, {});
+    std::vector<std::string> names;
+    if (!table || table->row_count() == 0)
+      return {names, 0};
+    const Column* name_column = table->GetColumnByName("name");
+    for (uint32_t i = 0; i < table->row_count(); ++i)
+      names.push_back(name_column->Get(i).string_value);
+    return {names,
+            table->GetColumnByName("cumulative_size")->Get(0).long_value};
+  }
+
+ protected:
+  TraceProcessorContext context_;
+  ExperimentalFlamegraphGenerator generator_;
+  FrameId a_frame_{0};
+  CallsiteId a_callsite_{0};
+};
+
+TEST_F(ExperimentalFlamegraphGeneratorTest, RebuiltAfterDeobfuscation) {
+  auto flamegraph = QueryFlamegraph();
+  EXPECT_THAT(flamegraph.first, ElementsAre("main", "a"));
+
+  // Deobfuscation renames the frames in place, without adding any rows.
+  TraceStorage* storage = context_.storage.get();
+  auto* frames = storage->mutable_stack_profile_frame_table();
+  frames->mutable_deobfuscated_name()->Set(
+      *frames->id().IndexOf(a_frame_), storage->InternString("deobfuscated"));
+  storage->IncrementProfileDataGeneration();
+
+  flamegraph = QueryFlamegraph();
+  EXPECT_THAT(flamegraph.first, ElementsAre("main", "deobfuscated"));
+}
+
+TEST_F(ExperimentalFlamegraphGeneratorTest, RebuiltAfterImport) {
+  EXPECT_EQ(QueryFlamegraph().second, 16);
+  AddAllocation(32);
+  EXPECT_EQ(QueryFlamegraph().second, 48);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -16,10 +16,77 @@
 
 #include "flamegraph_construction_algorithms.h"
 
+#include <algorithm>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/compiler.h"
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+#include <thread>
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 
 namespace {
+
+// Below this many allocations per thread, aggregating them on more threads is
+// slower than doing it serially.
+constexpr size_t kMinAllocationsPerThread = 16 * 1024;
+constexpr uint32_t kMaxAggregationThreads = 8;
+
+struct NodeTotals {
+  int64_t size = 0;
+  int64_t count = 0;
+  int64_t alloc_size = 0;
+  int64_t alloc_count = 0;
+};
+
+uint32_t NumAggregationThreads(size_t allocation_count) {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  base::ignore_result(allocation_count);
+  return 1;
+#else
+  size_t max_useful = allocation_count / kMinAllocationsPerThread;
+  uint32_t hardware = std::max(std::thread::hardware_concurrency(), 1u);
+  return static_cast<uint32_t>(std::max<size_t>(
+      std::min<size_t>({max_useful, hardware, kMaxAggregationThreads}), 1));
+#endif
+}
+
+// Adds the allocations in |rows| of the allocation table to |totals|, which
+// is indexed by flamegraph node.
+void AggregateAllocations(
+    const TraceStorage& storage,
+    const std::vector<uint32_t>& callsite_to_merged_callsite,
+    const uint32_t* rows,
+    size_t row_count,
+    std::vector<NodeTotals>* totals) {
+  const tables::HeapProfileAllocationTable& allocation_tbl =
+      storage.heap_profile_allocation_table();
+  const tables::StackProfileCallsiteTable& callsites_tbl =
+      storage.stack_profile_callsite_table();
+  for (size_t i = 0; i < row_count; ++i) {
+    uint32_t row = rows[i];
+    int64_t size = allocation_tbl.size()[row];
+    int64_t count = allocation_tbl.count()[row];
+    PERFETTO_CHECK((size <= 0 && count <= 0) || (size >= 0 && count >= 0));
+    uint32_t callsite_idx =
+        *callsites_tbl.id().IndexOf(allocation_tbl.callsite_id()[row]);
+    uint32_t merged_idx = callsite_to_merged_callsite[callsite_idx];
+    NodeTotals& node = (*totals)[merged_idx];
+    // On old heapprofd producers, the count field is incorrectly set and we
+    // zero it in proto_trace_parser.cc.
+    // As such, we cannot depend on count == 0 to imply size == 0, so we check
+    // for both of them separately.
+    if (size > 0)
+      node.alloc_size += size;
+    if (count > 0)
+      node.alloc_count += count;
+    node.size += size;
+    node.count += count;
+  }
+}
 struct MergedCallsite {
   StringId frame_name;
   StringId mapping_name;
@@ -88,7 +155,7 @@ static FlamegraphTableAndMergedCallsites BuildFlamegraphTableTreeStructure(
     UniquePid upid,
     int64_t timestamp,
     StringId profile_type,
-    const Table& filtered) {
+    uint32_t sample_count) {
   const tables::StackProfileCallsiteTable& callsites_tbl =
       storage->stack_profile_callsite_table();
 
@@ -170,7 +237,7 @@ static FlamegraphTableAndMergedCallsites BuildFlamegraphTableTreeStructure(
     callsite_to_merged_callsite[i] = *parent_idx;
   }
 
-  return {filtered.row_count() == 0 ? nullptr : std::move(tbl),
+  return {sample_count == 0 ? nullptr : std::move(tbl),
           callsite_to_merged_callsite};
 }
 
@@ -179,44 +246,52 @@ BuildFlamegraphTableSizeAndCount(
     std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> tbl,
     const std::vector<uint32_t>& callsite_to_merged_callsite,
     TraceStorage* storage,
-    const Table& filtered) {
-  const tables::StackProfileCallsiteTable& callsites_tbl =
-      storage->stack_profile_callsite_table();
-
-  for (auto it = filtered.IterateRows(); it; it.Next()) {
-    int64_t size =
-        it.Get(static_cast<uint32_t>(
-                   tables::HeapProfileAllocationTable::ColumnIndex::size))
-            .long_value;
-    int64_t count =
-        it.Get(static_cast<uint32_t>(
-                   tables::HeapProfileAllocationTable::ColumnIndex::count))
-            .long_value;
-    int64_t callsite_id =
-        it
-            .Get(static_cast<uint32_t>(
-                tables::HeapProfileAllocationTable::ColumnIndex::callsite_id))
-            .long_value;
+    const RowMap& allocation_rows) {
+  std::vector<uint32_t> rows;
+  rows.reserve(allocation_rows.size());
+  for (auto it = allocation_rows.IterateRows(); it; it.Next())
+    rows.push_back(it.row());
 
-    PERFETTO_CHECK((size <= 0 && count <= 0) || (size >= 0 && count >= 0));
-    uint32_t merged_idx =
-        callsite_to_merged_callsite[*callsites_tbl.id().IndexOf(
-            CallsiteId(static_cast<uint32_t>(callsite_id)))];
-    // On old heapprofd producers, the count field is incorrectly set and we
-    // zero it in proto_trace_parser.cc.
-    // As such, we cannot depend on count == 0 to imply size == 0, so we check
-    // for both of them separately.
-    if (size > 0) {
-      tbl->mutable_alloc_size()->Set(merged_idx,
-                                     tbl->alloc_size()[merged_idx] + size);
-    }
-    if (count > 0) {
-      tbl->mutable_alloc_count()->Set(merged_idx,
-                                      tbl->alloc_count()[merged_idx] + count);
+  // PASS OVER ALLOCATIONS:
+  // Aggregate allocations into the newly built tree. Every thread aggregates
+  // a contiguous slice of the allocations into its own per-node totals, which
+  // are then merged. The table is only written once per node.
+  uint32_t num_threads = NumAggregationThreads(rows.size());
+  std::vector<std::vector<NodeTotals>> partial_totals(
+      num_threads, std::vector<NodeTotals>(tbl->row_count()));
+  size_t rows_per_thread = (rows.size() + num_threads - 1) / num_threads;
+  auto aggregate_slice = [storage, &callsite_to_merged_callsite, &rows,
+                          &partial_totals, rows_per_thread](uint32_t i) {
+    size_t begin = std::min(rows.size(), i * rows_per_thread);
+    size_t end = std::min(rows.size(), begin + rows_per_thread);
+    AggregateAllocations(*storage, callsite_to_merged_callsite,
+                         rows.data() + begin, end - begin, &partial_totals[i]);
+  };
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  aggregate_slice(0);
+#else
+  std::vector<std::thread> threads;
+  for (uint32_t i = 1; i < num_threads; ++i)
+    threads.emplace_back(aggregate_slice, i);
+  aggregate_slice(0);
+  for (std::thread& thread : threads)
+    thread.join();
+#endif
+
+  std::vector<NodeTotals>& totals = partial_totals[0];
+  for (uint32_t i = 1; i < num_threads; ++i) {
+    for (size_t idx = 0; idx < totals.size(); ++idx) {
+      totals[idx].size += partial_totals[i][idx].size;
+      totals[idx].count += partial_totals[i][idx].count;
+      totals[idx].alloc_size += partial_totals[i][idx].alloc_size;
+      totals[idx].alloc_count += partial_totals[i][idx].alloc_count;
     }
-
-    tbl->mutable_size()->Set(merged_idx, tbl->size()[merged_idx] + size);
-    tbl->mutable_count()->Set(merged_idx, tbl->count()[merged_idx] + count);
+  }
+  for (uint32_t idx = 0; idx < totals.size(); ++idx) {
+    tbl->mutable_size()->Set(idx, totals[idx].size);
+    tbl->mutable_count()->Set(idx, totals[idx].count);
+    tbl->mutable_alloc_size()->Set(idx, totals[idx].alloc_size);
+    tbl->mutable_alloc_count()->Set(idx, totals[idx].alloc_count);
   }
 
   // BACKWARD PASS:
@@ -263,17 +338,18 @@ BuildNativeHeapProfileFlamegraph(TraceStorage* storage,
                                  int64_t timestamp) {
   const tables::HeapProfileAllocationTable& allocation_tbl =
       storage->heap_profile_allocation_table();
-  // PASS OVER ALLOCATIONS:
-  // Aggregate allocations into the newly built tree.
-  auto filtered = allocation_tbl.Filter(
+  RowMap allocation_rows = allocation_tbl.FilterToRowMap(
       {allocation_tbl.ts().le(timestamp), allocation_tbl.upid().eq(upid)});
   StringId profile_type = storage->InternString("native");
   FlamegraphTableAndMergedCallsites table_and_callsites =
       BuildFlamegraphTableTreeStructure(storage, upid, timestamp, profile_type,
-                                        filtered);
+                                        allocation_rows.size());
+  if (!table_and_callsites.tbl)
+    return nullptr;
   return BuildFlamegraphTableSizeAndCount(
       std::move(table_and_callsites.tbl),
-      table_and_callsites.callsite_to_merged_callsite, storage, filtered);
+      table_and_callsites.callsite_to_merged_callsite, storage,
+      allocation_rows);
 }
 
 std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
@@ -308,7 +384,8 @@ BuildNativeCallStackSamplingFlamegraph(TraceStorage* storage,
 
   StringId profile_type = storage->InternString("callstack");
   return BuildFlamegraphTableTreeStructure(storage, upid, timestamp,
-                                           profile_type, filtered_fully)
+                                           profile_type,
+                                           filtered_fully.row_count())
       .tbl;
 }
 
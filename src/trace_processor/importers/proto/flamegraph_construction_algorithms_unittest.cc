@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/proto/flamegraph_construction_algorithms.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+TEST(FlamegraphConstructionAlgorithmsTest, NativeHeapProfile) {
+  //   main
+  //   /  \
+  //  a    b
+  //
+  // There are two callsites for main -> a, with different frames of the same
+  // name, which are merged.
+  constexpr UniquePid kUpid = 1;
+  constexpr int64_t kTimestamp = 10;
+  // Enough allocations for them to be aggregated on several threads.
+  constexpr int64_t kIterations = 40000;
+
+  TraceStorage storage;
+  StringId mapping_name = storage.InternString("libfoo.so");
+  auto mapping_id = storage.mutable_stack_profile_mapping_table()
+                        ->Insert({{}, 0, 0, 0, 0, 0, mapping_name})
+                        .id;
+  auto* frames = storage.mutable_stack_profile_frame_table();
+  auto main_frame = frames->Insert({storage.InternString("main"), mapping_id,
+                                    0, base::nullopt, base::nullopt})
+                        .id;
+  auto a_frame = frames->Insert({storage.InternString("a"), mapping_id, 1,
+                                 base::nullopt, base::nullopt})
+                     .id;
+  auto other_a_frame = frames->Insert({storage.InternString("a"), mapping_id,
+                                       2, base::nullopt, base::nullopt})
+                           .id;
+  auto b_frame = frames->Insert({storage.InternString("b"), mapping_id, 3,
+                                 base::nullopt, base::nullopt})
+                     .id;
+
+  auto* callsites = storage.mutable_stack_profile_callsite_table();
+  auto main_cs = callsites->Insert({0, base::nullopt, main_frame}).id;
+  auto a_cs = callsites->Insert({1, main_cs, a_frame}).id;
+  auto b_cs = callsites->Insert({1, main_cs, b_frame}).id;
+  auto other_a_cs = callsites->Insert({1, main_cs, other_a_frame}).id;
+
+  StringId heap_name = storage.InternString("malloc");
+  auto* allocations = storage.mutable_heap_profile_allocation_table();
+  for (int64_t i = 0; i < kIterations; ++i) {
+    allocations->Insert({kTimestamp, kUpid, heap_name, a_cs, 1, 16});
+    allocations->Insert({kTimestamp, kUpid, heap_name, b_cs, -1, -4});
+    allocations->Insert({kTimestamp, kUpid, heap_name, other_a_cs, 2, 8});
+  }
+  // Neither of these are part of the flamegraph.
+  allocations->Insert({kTimestamp + 1, kUpid, heap_name, a_cs, 1, 1000});
+  allocations->Insert({kTimestamp, kUpid + 1, heap_name, a_cs, 1, 1000});
+
+  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> tbl =
+      BuildNativeHeapProfileFlamegraph(&storage, kUpid, kTimestamp);
+  ASSERT_NE(tbl, nullptr);
+  ASSERT_EQ(tbl->row_count(), 3u);
+
+  ASSERT_EQ(storage.GetString(tbl->name()[0]), "main");
+  EXPECT_EQ(tbl->size()[0], 0);
+  EXPECT_EQ(tbl->cumulative_size()[0], 20 * kIterations);
+  EXPECT_EQ(tbl->cumulative_count()[0], 2 * kIterations);
+  EXPECT_EQ(tbl->cumulative_alloc_size()[0], 24 * kIterations);
+  EXPECT_EQ(tbl->cumulative_alloc_count()[0], 3 * kIterations);
+
+  ASSERT_EQ(storage.GetString(tbl->name()[1]), "a");
+  EXPECT_EQ(tbl->size()[1], 24 * kIterations);
+  EXPECT_EQ(tbl->count()[1], 3 * kIterations);
+  EXPECT_EQ(tbl->alloc_size()[1], 24 * kIterations);
+  EXPECT_EQ(tbl->alloc_count()[1], 3 * kIterations);
+  EXPECT_EQ(tbl->cumulative_size()[1], 24 * kIterations);
+
+  ASSERT_EQ(storage.GetString(tbl->name()[2]), "b");
+  EXPECT_EQ(tbl->size()[2], -4 * kIterations);
+  EXPECT_EQ(tbl->count()[2], -kIterations);
+  EXPECT_EQ(tbl->alloc_size()[2], 0);
+  EXPECT_EQ(tbl->alloc_count()[2], 0);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -299,6 +299,7 @@ void HeapGraphModule::DeobfuscateClass(
       context_->storage->mutable_heap_graph_class_table()
           ->mutable_deobfuscated_name()
           ->Set(row, deobfuscated_type_name_id);
+      context_->storage->IncrementProfileDataGeneration();
     }
   } else {
     PERFETTO_DLOG("Class %s not found",
@@ -22,6 +22,9 @@
 #include "src/trace_processor/importers/proto/profiler_util.h"
 #include "src/trace_processor/tables/profiler_tables.h"
 
+#include <algorithm>
+#include <limits>
+#include <numeric>
 #include <set>
 #include <utility>
 
@@ -183,48 +186,243 @@ BuildSuperclassMap(UniquePid upid, int64_t ts, TraceStorage* storage) {
   return superclass_map;
 }
 
-}  // namespace
+// The object graph of one heap dump, in compressed sparse row form: the
+// children of node i are targets[offsets[i]] to targets[offsets[i + 1] - 1].
+// Node i is the object in row first_row + i of heap_graph_object.
+struct ObjectGraph {
+  uint32_t first_row = 0;
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> targets;
+
+  uint32_t size() const { return static_cast<uint32_t>(offsets.size() - 1); }
+};
 
-void MarkRoot(TraceStorage* storage,
-              tables::HeapGraphObjectTable::Id id,
-              StringPool::Id type) {
-  uint32_t row = *storage->heap_graph_object_table().id().IndexOf(id);
-  storage->mutable_heap_graph_object_table()->mutable_root_type()->Set(row,
-                                                                       type);
-
-  // Calculate shortest distance to a GC root.
-  std::deque<std::pair<int32_t, tables::HeapGraphObjectTable::Id>>
-      reachable_nodes{{0, id}};
-  while (!reachable_nodes.empty()) {
-    tables::HeapGraphObjectTable::Id cur_node;
-    int32_t distance;
-    std::tie(distance, cur_node) = reachable_nodes.front();
-    reachable_nodes.pop_front();
-    uint32_t cur_row =
-        *storage->heap_graph_object_table().id().IndexOf(cur_node);
-    int32_t cur_distance =
-        storage->heap_graph_object_table().root_distance()[cur_row];
-    if (cur_distance == -1 || cur_distance > distance) {
-      if (cur_distance == -1) {
-        storage->mutable_heap_graph_object_table()->mutable_reachable()->Set(
-            cur_row, 1);
+// Builds the graph of the rows from |first_row| to the end of
+// heap_graph_object. The rows are visited in table order, and the children of
+// each one are its strong references in the order of the reference rows of its
+// reference set. Rows of other dumps interleaved in that range get their
+// references too, but are never reached from the roots of this dump.
+ObjectGraph BuildObjectGraph(const TraceStorage& storage, uint32_t first_row) {
+  const auto& objects = storage.heap_graph_object_table();
+  const auto& classes = storage.heap_graph_class_table();
+  const auto& references = storage.heap_graph_reference_table();
+
+  // Do not follow weak / soft / finalizer / phantom references.
+  std::vector<StringPool::Id> weak_kinds;
+  for (const char* kind :
+       {"KIND_WEAK_REFERENCE", "KIND_SOFT_REFERENCE",
+        "KIND_FINALIZER_REFERENCE", "KIND_PHANTOM_REFERENCE"}) {
+    base::Optional<StringPool::Id> kind_id = storage.string_pool().GetId(kind);
+    if (kind_id)
+      weak_kinds.push_back(*kind_id);
+  }
+
+  ObjectGraph graph;
+  graph.first_row = first_row;
+  uint32_t end_row = objects.row_count();
+  graph.offsets.reserve(end_row - first_row + 1);
+  graph.offsets.push_back(0);
+  for (uint32_t row = first_row; row < end_row; ++row) {
+    base::Optional<uint32_t> reference_set_id =
+        objects.reference_set_id()[row];
+    uint32_t cls_row = *classes.id().IndexOf(objects.type_id()[row]);
+    StringPool::Id kind = classes.kind()[cls_row];
+    if (reference_set_id && std::find(weak_kinds.begin(), weak_kinds.end(),
+                                      kind) == weak_kinds.end()) {
+      for (uint32_t reference_row = *reference_set_id;
+           reference_row < references.row_count() &&
+           references.reference_set_id()[reference_row] == *reference_set_id;
+           ++reference_row) {
+        base::Optional<tables::HeapGraphObjectTable::Id> owned =
+            references.owned_id()[reference_row];
+        if (!owned)
+          continue;
+        uint32_t owned_row = *objects.id().IndexOf(*owned);
+        // Objects are only ever referred to from within their dump.
+        if (owned_row < first_row)
+          continue;
+        graph.targets.push_back(owned_row - first_row);
       }
-      storage->mutable_heap_graph_object_table()->mutable_root_distance()->Set(
-          cur_row, distance);
-
-      for (tables::HeapGraphObjectTable::Id child_node :
-           GetChildren(*storage, cur_node)) {
-        uint32_t child_row =
-            *storage->heap_graph_object_table().id().IndexOf(child_node);
-        int32_t child_distance =
-            storage->heap_graph_object_table().root_distance()[child_row];
-        if (child_distance == -1 || child_distance > distance + 1)
-          reachable_nodes.emplace_back(distance + 1, child_node);
+    }
+    graph.offsets.push_back(static_cast<uint32_t>(graph.targets.size()));
+  }
+  return graph;
+}
+
+// Marks the objects reachable from |roots| and sets their shortest distance
+// to a root.
+void MarkReachable(TraceStorage* storage,
+                   const ObjectGraph& graph,
+                   const std::vector<uint32_t>& roots) {
+  std::vector<int32_t> distance(graph.size(), -1);
+  std::vector<uint32_t> queue;
+  for (uint32_t root : roots) {
+    if (distance[root] == -1) {
+      distance[root] = 0;
+      queue.push_back(root);
+    }
+  }
+  for (size_t i = 0; i < queue.size(); ++i) {
+    uint32_t node = queue[i];
+    for (uint32_t edge = graph.offsets[node]; edge < graph.offsets[node + 1];
+         ++edge) {
+      uint32_t child = graph.targets[edge];
+      if (distance[child] == -1) {
+        distance[child] = distance[node] + 1;
+        queue.push_back(child);
+      }
+    }
+  }
+
+  auto* objects = storage->mutable_heap_graph_object_table();
+  for (uint32_t node : queue) {
+    uint32_t row = graph.first_row + node;
+    objects->mutable_reachable()->Set(row, 1);
+    objects->mutable_root_distance()->Set(row, distance[node]);
+  }
+}
+
+// Computes the dominator tree of the objects reachable from |roots|, using the
+// Lengauer-Tarjan algorithm, and sets the dominator_id and retained_size of
+// those objects. All state is kept in flat vectors indexed by DFS number, with
+// number 0 being a virtual node that has all roots as its children.
+void ComputeDominators(TraceStorage* storage,
+                       const ObjectGraph& graph,
+                       const std::vector<uint32_t>& roots) {
+  constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+  // Iterative DFS, as there are very long reference chains (e.g. from
+  // LinkedList).
+  std::vector<uint32_t> number(graph.size(), kNone);
+  std::vector<uint32_t> node_for_number{kNone};
+  std::vector<uint32_t> parent{0};
+  std::vector<std::pair<uint32_t, uint32_t>> stack;  // (number, next edge).
+  for (uint32_t root : roots) {
+    if (number[root] != kNone)
+      continue;
+    number[root] = static_cast<uint32_t>(node_for_number.size());
+    node_for_number.push_back(root);
+    parent.push_back(0);
+    stack.emplace_back(number[root], graph.offsets[root]);
+    while (!stack.empty()) {
+      uint32_t cur = stack.back().first;
+      uint32_t node = node_for_number[cur];
+      if (stack.back().second == graph.offsets[node + 1]) {
+        stack.pop_back();
+        continue;
+      }
+      uint32_t child = graph.targets[stack.back().second++];
+      if (number[child] != kNone)
+        continue;
+      number[child] = static_cast<uint32_t>(node_for_number.size());
+      node_for_number.push_back(child);
+      parent.push_back(cur);
+      stack.emplace_back(number[child], graph.offsets[child]);
+    }
+  }
+  uint32_t count = static_cast<uint32_t>(node_for_number.size());
+
+  // Predecessors of the reached nodes, by DFS number.
+  std::vector<uint32_t> pred_offsets(count + 1, 0);
+  for (uint32_t v = 1; v < count; ++v) {
+    uint32_t node = node_for_number[v];
+    for (uint32_t edge = graph.offsets[node]; edge < graph.offsets[node + 1];
+         ++edge) {
+      pred_offsets[number[graph.targets[edge]] + 1]++;
+    }
+  }
+  for (uint32_t root : roots)
+    pred_offsets[number[root] + 1]++;
+  std::partial_sum(pred_offsets.begin(), pred_offsets.end(),
+                   pred_offsets.begin());
+  std::vector<uint32_t> preds(pred_offsets[count]);
+  {
+    std::vector<uint32_t> next(pred_offsets.begin(), pred_offsets.end() - 1);
+    for (uint32_t v = 1; v < count; ++v) {
+      uint32_t node = node_for_number[v];
+      for (uint32_t edge = graph.offsets[node]; edge < graph.offsets[node + 1];
+           ++edge) {
+        preds[next[number[graph.targets[edge]]]++] = v;
       }
     }
+    for (uint32_t root : roots)
+      preds[next[number[root]]++] = 0;
+  }
+
+  std::vector<uint32_t> semi(count);
+  std::iota(semi.begin(), semi.end(), 0);
+  std::vector<uint32_t> label = semi;
+  std::vector<uint32_t> ancestor(count, kNone);
+  std::vector<uint32_t> idom(count, 0);
+  // Singly linked lists of the nodes with a given semidominator.
+  std::vector<uint32_t> bucket_head(count, kNone);
+  std::vector<uint32_t> bucket_next(count, kNone);
+  std::vector<uint32_t> path;
+
+  auto eval = [&ancestor, &label, &semi, &path](uint32_t v) {
+    if (ancestor[v] == kNone)
+      return v;
+    // Path compression, without recursion.
+    path.clear();
+    for (uint32_t x = v; ancestor[ancestor[x]] != kNone; x = ancestor[x])
+      path.push_back(x);
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+      uint32_t x = *it;
+      uint32_t a = ancestor[x];
+      if (semi[label[a]] < semi[label[x]])
+        label[x] = label[a];
+      ancestor[x] = ancestor[a];
+    }
+    return label[v];
+  };
+
+  for (uint32_t w = count - 1; w > 0; --w) {
+    for (uint32_t i = pred_offsets[w]; i < pred_offsets[w + 1]; ++i) {
+      uint32_t u = eval(preds[i]);
+      if (semi[u] < semi[w])
+        semi[w] = semi[u];
+    }
+    bucket_next[w] = bucket_head[semi[w]];
+    bucket_head[semi[w]] = w;
+    uint32_t p = parent[w];
+    ancestor[w] = p;
+    for (uint32_t v = bucket_head[p]; v != kNone; v = bucket_next[v]) {
+      uint32_t u = eval(v);
+      idom[v] = semi[u] < semi[v] ? u : p;
+    }
+    bucket_head[p] = kNone;
+  }
+  for (uint32_t w = 1; w < count; ++w) {
+    if (idom[w] != semi[w])
+      idom[w] = idom[idom[w]];
+  }
+
+  // Dominators precede the nodes they dominate in DFS order, so a single
+  // backwards pass accumulates the retained sizes.
+  auto* objects = storage->mutable_heap_graph_object_table();
+  std::vector<int64_t> retained(count, 0);
+  for (uint32_t w = 1; w < count; ++w) {
+    // Objects that were referred to but never sent have a size of -1.
+    retained[w] =
+        std::max<int64_t>(objects->self_size()[graph.first_row +
+                                               node_for_number[w]],
+                          0);
+  }
+  for (uint32_t w = count - 1; w > 0; --w)
+    retained[idom[w]] += retained[w];
+
+  for (uint32_t w = 1; w < count; ++w) {
+    uint32_t row = graph.first_row + node_for_number[w];
+    if (idom[w] != 0) {
+      objects->mutable_dominator_id()->Set(
+          row, objects->id()[graph.first_row + node_for_number[idom[w]]]);
+    }
+    objects->mutable_retained_size()->Set(row, retained[w]);
   }
 }
 
+}  // namespace
+
 base::Optional<base::StringView> GetStaticClassTypeName(base::StringView type) {
   static const base::StringView kJavaClassTemplate("java.lang.Class<");
   if (!type.empty() && type.at(type.size() - 1) == '>' &&
@@ -314,6 +512,8 @@ tables::HeapGraphObjectTable::Id HeapGraphTracker::GetOrInsertObject(
              {},
              /*root_type=*/base::nullopt,
              /*root_distance*/ -1});
+    if (!sequence_state->first_object_row)
+      sequence_state->first_object_row = id_and_row.row;
     bool inserted;
     std::tie(it, inserted) =
         sequence_state->object_id_to_db_id.emplace(object_id, id_and_row.id);
@@ -359,7 +559,7 @@ void HeapGraphTracker::AddObject(uint32_t seq_id,
   hgo->mutable_type_id()->Set(row, type_id);
 
   if (obj.self_size == 0)
-    sequence_state.deferred_size_objects_for_type_[type_id].push_back(owner_id);
+    sequence_state.deferred_size_object_rows.push_back(row);
 
   uint32_t reference_set_id =
       context_->storage->heap_graph_reference_table().row_count();
@@ -381,21 +581,15 @@ void HeapGraphTracker::AddObject(uint32_t seq_id,
              {},
              /*deobfuscated_field_name=*/base::nullopt});
     if (!obj.field_name_ids.empty()) {
-      sequence_state.references_for_field_name_id[obj.field_name_ids[i]]
-          .push_back(ref_id_and_row.id);
+      sequence_state.pending_field_references.push_back(
+          PendingFieldReference{obj.field_name_ids[i], ref_id_and_row.row});
     }
     any_references = true;
   }
   if (any_references) {
-    uint32_t owner_row =
-        *context_->storage->heap_graph_object_table().id().IndexOf(owner_id);
-    context_->storage->mutable_heap_graph_object_table()
-        ->mutable_reference_set_id()
-        ->Set(owner_row, reference_set_id);
-    if (obj.field_name_ids.empty()) {
-      sequence_state.deferred_reference_objects_for_type_[type_id].push_back(
-          owner_id);
-    }
+    hgo->mutable_reference_set_id()->Set(row, reference_set_id);
+    if (obj.field_name_ids.empty())
+      sequence_state.deferred_reference_object_rows.push_back(row);
   }
 }
 
@@ -454,18 +648,6 @@ void HeapGraphTracker::AddInternedFieldName(uint32_t seq_id,
 
   sequence_state.interned_fields.emplace(intern_id,
                                          InternedField{field_name, type_name});
-
-  auto it = sequence_state.references_for_field_name_id.find(intern_id);
-  if (it != sequence_state.references_for_field_name_id.end()) {
-    auto hgr = context_->storage->mutable_heap_graph_reference_table();
-    for (const tables::HeapGraphReferenceTable::Id reference_id : it->second) {
-      uint32_t row = *hgr->id().IndexOf(reference_id);
-      hgr->mutable_field_name()->Set(row, field_name);
-      hgr->mutable_field_type_name()->Set(row, type_name);
-
-      field_to_rows_[field_name].emplace_back(row);
-    }
-  }
 }
 
 void HeapGraphTracker::SetPacketIndex(uint32_t seq_id, uint64_t index) {
@@ -539,66 +721,6 @@ void HeapGraphTracker::FinalizeProfile(uint32_t seq_id) {
     tables::HeapGraphClassTable::Id type_id =
         GetOrInsertType(&sequence_state, id);
 
-    auto sz_obj_it =
-        sequence_state.deferred_size_objects_for_type_.find(type_id);
-    if (sz_obj_it != sequence_state.deferred_size_objects_for_type_.end()) {
-      for (tables::HeapGraphObjectTable::Id obj_id : sz_obj_it->second) {
-        auto* hgo = context_->storage->mutable_heap_graph_object_table();
-        uint32_t row = *hgo->id().IndexOf(obj_id);
-        hgo->mutable_self_size()->Set(
-            row, static_cast<int64_t>(interned_type.object_size));
-      }
-      sequence_state.deferred_size_objects_for_type_.erase(sz_obj_it);
-    }
-
-    auto ref_obj_it =
-        sequence_state.deferred_reference_objects_for_type_.find(type_id);
-    if (ref_obj_it !=
-        sequence_state.deferred_reference_objects_for_type_.end()) {
-      for (tables::HeapGraphObjectTable::Id obj_id : ref_obj_it->second) {
-        const InternedType* current_type = &interned_type;
-        if (interned_type.no_fields) {
-          continue;
-        }
-        size_t field_offset_in_cls = 0;
-        ForReferenceSet(
-            *context_->storage, obj_id,
-            [this, &current_type, &sequence_state,
-             &field_offset_in_cls](uint32_t reference_row) {
-              while (current_type && field_offset_in_cls >=
-                                         current_type->field_name_ids.size()) {
-                size_t prev_type_size = current_type->field_name_ids.size();
-                current_type = GetSuperClass(&sequence_state, current_type);
-                field_offset_in_cls -= prev_type_size;
-              }
-
-              if (!current_type) {
-                return false;
-              }
-
-              uint64_t field_id =
-                  current_type->field_name_ids[field_offset_in_cls++];
-              auto it = sequence_state.interned_fields.find(field_id);
-              if (it == sequence_state.interned_fields.end()) {
-                PERFETTO_DLOG("Invalid field id.");
-                context_->storage->IncrementIndexedStats(
-                    stats::heap_graph_malformed_packet,
-                    static_cast<int>(sequence_state.current_upid));
-                return true;
-              }
-              const InternedField& field = it->second;
-              auto hgr =
-                  context_->storage->mutable_heap_graph_reference_table();
-              hgr->mutable_field_name()->Set(reference_row, field.name);
-              hgr->mutable_field_type_name()->Set(reference_row,
-                                                  field.type_name);
-              field_to_rows_[field.name].emplace_back(reference_row);
-              return true;
-            });
-      }
-      sequence_state.deferred_reference_objects_for_type_.erase(ref_obj_it);
-    }
-
     auto* hgc = context_->storage->mutable_heap_graph_class_table();
     uint32_t row = *hgc->id().IndexOf(type_id);
     hgc->mutable_name()->Set(row, interned_type.name);
@@ -649,18 +771,10 @@ void HeapGraphTracker::FinalizeProfile(uint32_t seq_id) {
     }
   }
 
-  if (!sequence_state.deferred_size_objects_for_type_.empty()) {
-    context_->storage->IncrementIndexedStats(
-        stats::heap_graph_malformed_packet,
-        static_cast<int>(sequence_state.current_upid));
-  }
-
-  if (!sequence_state.deferred_reference_objects_for_type_.empty()) {
-    context_->storage->IncrementIndexedStats(
-        stats::heap_graph_malformed_packet,
-        static_cast<int>(sequence_state.current_upid));
-  }
+  ResolveDeferredObjects(&sequence_state);
 
+  auto* hgo = context_->storage->mutable_heap_graph_object_table();
+  std::vector<uint32_t> root_nodes;
   for (const SourceRoot& root : sequence_state.current_roots) {
     for (uint64_t obj_id : root.object_ids) {
       auto it = sequence_state.object_id_to_db_id.find(obj_id);
@@ -673,15 +787,117 @@ void HeapGraphTracker::FinalizeProfile(uint32_t seq_id) {
       auto it_and_success = roots_[std::make_pair(sequence_state.current_upid,
                                                   sequence_state.current_ts)]
                                 .emplace(db_id);
-      if (it_and_success.second)
-        MarkRoot(context_->storage.get(), db_id, root.root_type);
+      if (!it_and_success.second)
+        continue;
+      uint32_t row = *hgo->id().IndexOf(db_id);
+      hgo->mutable_root_type()->Set(row, root.root_type);
+      root_nodes.push_back(row - *sequence_state.first_object_row);
     }
   }
+  if (!root_nodes.empty()) {
+    ObjectGraph graph = BuildObjectGraph(*context_->storage,
+                                         *sequence_state.first_object_row);
+    MarkReachable(context_->storage.get(), graph, root_nodes);
+    ComputeDominators(context_->storage.get(), graph, root_nodes);
+  }
 
   PopulateSuperClasses(sequence_state);
   sequence_state_.erase(seq_id);
 }
 
+void HeapGraphTracker::ResolveDeferredObjects(SequenceState* sequence_state) {
+  auto* hgr = context_->storage->mutable_heap_graph_reference_table();
+  for (const PendingFieldReference& reference :
+       sequence_state->pending_field_references) {
+    auto it = sequence_state->interned_fields.find(reference.field_name_id);
+    if (it == sequence_state->interned_fields.end())
+      continue;
+    const InternedField& field = it->second;
+    hgr->mutable_field_name()->Set(reference.reference_row, field.name);
+    hgr->mutable_field_type_name()->Set(reference.reference_row,
+                                        field.type_name);
+    field_to_rows_[field.name].emplace_back(reference.reference_row);
+  }
+
+  std::unordered_map<uint32_t, const InternedType*> type_for_class_id;
+  for (const auto& p : sequence_state->interned_types) {
+    type_for_class_id[GetOrInsertType(sequence_state, p.first).value] =
+        &p.second;
+  }
+
+  auto* hgo = context_->storage->mutable_heap_graph_object_table();
+  bool missing_size_type = false;
+  for (uint32_t row : sequence_state->deferred_size_object_rows) {
+    auto it = type_for_class_id.find(hgo->type_id()[row].value);
+    if (it == type_for_class_id.end()) {
+      missing_size_type = true;
+      continue;
+    }
+    hgo->mutable_self_size()->Set(row,
+                                  static_cast<int64_t>(it->second->object_size));
+  }
+  if (missing_size_type) {
+    context_->storage->IncrementIndexedStats(
+        stats::heap_graph_malformed_packet,
+        static_cast<int>(sequence_state->current_upid));
+  }
+
+  bool missing_reference_type = false;
+  for (uint32_t row : sequence_state->deferred_reference_object_rows) {
+    auto it = type_for_class_id.find(hgo->type_id()[row].value);
+    if (it == type_for_class_id.end()) {
+      missing_reference_type = true;
+      continue;
+    }
+    if (!it->second->no_fields)
+      SetFieldNamesFromType(sequence_state, *it->second, row);
+  }
+  if (missing_reference_type) {
+    context_->storage->IncrementIndexedStats(
+        stats::heap_graph_malformed_packet,
+        static_cast<int>(sequence_state->current_upid));
+  }
+}
+
+void HeapGraphTracker::SetFieldNamesFromType(SequenceState* sequence_state,
+                                             const InternedType& type,
+                                             uint32_t object_row) {
+  const InternedType* current_type = &type;
+  size_t field_offset_in_cls = 0;
+  ForReferenceSet(
+      *context_->storage,
+      context_->storage->heap_graph_object_table().id()[object_row],
+      [this, &current_type, sequence_state,
+       &field_offset_in_cls](uint32_t reference_row) {
+        while (current_type &&
+               field_offset_in_cls >= current_type->field_name_ids.size()) {
+          size_t prev_type_size = current_type->field_name_ids.size();
+          current_type = GetSuperClass(sequence_state, current_type);
+          field_offset_in_cls -= prev_type_size;
+        }
+
+        if (!current_type) {
+          return false;
+        }
+
+        uint64_t field_id = current_type->field_name_ids[field_offset_in_cls++];
+        auto it = sequence_state->interned_fields.find(field_id);
+        if (it == sequence_state->interned_fields.end()) {
+          PERFETTO_DLOG("Invalid field id.");
+          context_->storage->IncrementIndexedStats(
+              stats::heap_graph_malformed_packet,
+              static_cast<int>(sequence_state->current_upid));
+          return true;
+        }
+        const InternedField& field = it->second;
+        auto hgr = context_->storage->mutable_heap_graph_reference_table();
+        hgr->mutable_field_name()->Set(reference_row, field.name);
+        hgr->mutable_field_type_name()->Set(reference_row, field.type_name);
+        field_to_rows_[field.name].emplace_back(reference_row);
+        return true;
+      });
+}
+
 // TODO(fmayer): For Android S+ traces, use the superclass_id from the trace.
 void HeapGraphTracker::PopulateSuperClasses(const SequenceState& seq) {
   // Maps from normalized class name and location, to superclass.
@@ -19,6 +19,7 @@
 
 #include <map>
 #include <set>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -55,9 +56,6 @@ struct PathFromRoot {
   std::set<tables::HeapGraphObjectTable::Id> visited;
 };
 
-void MarkRoot(TraceStorage* s,
-              tables::HeapGraphObjectTable::Id id,
-              StringPool::Id type);
 void FindPathFromRoot(TraceStorage* storage,
                       tables::HeapGraphObjectTable::Id id,
                       PathFromRoot* path);
@@ -159,29 +157,40 @@ class HeapGraphTracker : public Destructible {
     uint64_t classloader_id;
     StringPool::Id kind;
   };
+  // A reference whose field name is resolved in FinalizeProfile, once all
+  // the interned field names of the dump have been seen.
+  struct PendingFieldReference {
+    uint64_t field_name_id;
+    uint32_t reference_row;
+  };
+  // Rows and references are inserted into the tables as the objects arrive.
+  // Everything kept here until FinalizeProfile is either per type or a few
+  // bytes per object, so the memory needed on top of the tables stays small
+  // even for large dumps.
   struct SequenceState {
     UniquePid current_upid = 0;
     int64_t current_ts = 0;
     uint64_t last_object_id = 0;
+    // Row of the first object of this dump in heap_graph_object. All the
+    // objects of the dump are at or after this row.
+    base::Optional<uint32_t> first_object_row;
     std::vector<SourceRoot> current_roots;
     std::map<uint64_t, InternedType> interned_types;
     std::map<uint64_t, StringPool::Id> interned_location_names;
-    std::map<uint64_t, tables::HeapGraphObjectTable::Id> object_id_to_db_id;
+    std::unordered_map<uint64_t, tables::HeapGraphObjectTable::Id>
+        object_id_to_db_id;
     std::map<uint64_t, tables::HeapGraphClassTable::Id> type_id_to_db_id;
-    std::map<uint64_t, std::vector<tables::HeapGraphReferenceTable::Id>>
-        references_for_field_name_id;
+    std::vector<PendingFieldReference> pending_field_references;
     std::map<uint64_t, InternedField> interned_fields;
-    std::map<tables::HeapGraphClassTable::Id,
-             std::vector<tables::HeapGraphObjectTable::Id>>
-        deferred_reference_objects_for_type_;
+    // Rows of objects whose references are named after the fields of their
+    // type, resolved in FinalizeProfile.
+    std::vector<uint32_t> deferred_reference_object_rows;
     base::Optional<uint64_t> prev_index;
     // For most objects, we need not store the size in the object's message
     // itself, because all instances of the type have the same type. In this
     // case, we defer setting self_size in the table until we process the class
     // message in FinalizeProfile.
-    std::map<tables::HeapGraphClassTable::Id,
-             std::vector<tables::HeapGraphObjectTable::Id>>
-        deferred_size_objects_for_type_;
+    std::vector<uint32_t> deferred_size_object_rows;
     bool truncated = false;
   };
 
@@ -193,6 +202,10 @@ class HeapGraphTracker : public Destructible {
                                                   uint64_t type_id);
   bool SetPidAndTimestamp(SequenceState* seq, UniquePid upid, int64_t ts);
   void PopulateSuperClasses(const SequenceState& seq);
+  void ResolveDeferredObjects(SequenceState* sequence_state);
+  void SetFieldNamesFromType(SequenceState* sequence_state,
+                             const InternedType& type,
+                             uint32_t object_row);
   InternedType* GetSuperClass(SequenceState* sequence_state,
                               const InternedType* current_type);
   bool IsTruncated(UniquePid upid, int64_t ts);
@@ -25,6 +25,7 @@ namespace perfetto {
 namespace trace_processor {
 namespace {
 
+using ::testing::Pair;
 using ::testing::UnorderedElementsAre;
 
 TEST(HeapGraphTrackerTest, PackageFromLocationApp) {
@@ -187,6 +188,90 @@ TEST(HeapGraphTrackerTest, BuildFlamegraph) {
   EXPECT_THAT(counts, UnorderedElementsAre(1, 2, 1, 1, 1));
 }
 
+TEST(HeapGraphTrackerTest, Dominators) {
+  //    R ---> X      (R and X are roots, U is unreachable)
+  //   / \     |
+  //  A   B    |
+  //   \ /     |
+  //    C <----+
+  //    |
+  //    D          U
+
+  constexpr uint64_t kSeqId = 1;
+  constexpr UniquePid kPid = 1;
+  constexpr int64_t kTimestamp = 1;
+  constexpr uint64_t kField = 1;
+  constexpr uint64_t kType = 1;
+
+  TraceProcessorContext context;
+  context.storage.reset(new TraceStorage());
+
+  HeapGraphTracker tracker(&context);
+  tracker.AddInternedFieldName(kSeqId, kField, base::StringView("foo"));
+  tracker.AddInternedType(kSeqId, kType, context.storage->InternString("T"),
+                          /*location_id=*/base::nullopt, /*object_size=*/0,
+                          /*field_name_ids=*/{}, /*superclass_id=*/0,
+                          /*classloader_id=*/0, /*no_fields=*/false,
+                          context.storage->InternString("KIND_NORMAL"));
+
+  // Object ids are also used as self sizes, to identify the rows below.
+  constexpr uint64_t kR = 1;
+  constexpr uint64_t kA = 2;
+  constexpr uint64_t kB = 3;
+  constexpr uint64_t kC = 4;
+  constexpr uint64_t kD = 5;
+  constexpr uint64_t kU = 7;
+  constexpr uint64_t kX = 10;
+  auto add_object = [&](uint64_t id, std::vector<uint64_t> referred) {
+    HeapGraphTracker::SourceObject obj;
+    obj.object_id = id;
+    obj.self_size = id;
+    obj.type_id = kType;
+    obj.field_name_ids.assign(referred.size(), kField);
+    obj.referred_objects = std::move(referred);
+    tracker.AddObject(kSeqId, kPid, kTimestamp, std::move(obj));
+  };
+  add_object(kR, {kA, kB, kX});
+  add_object(kA, {kC});
+  add_object(kB, {kC});
+  add_object(kC, {kD});
+  add_object(kD, {});
+  add_object(kU, {kD});
+  add_object(kX, {kC});
+
+  HeapGraphTracker::SourceRoot root;
+  root.root_type = context.storage->InternString("ROOT");
+  root.object_ids = {kX, kR};
+  tracker.AddRoot(kSeqId, kPid, kTimestamp, root);
+  tracker.FinalizeProfile(kSeqId);
+
+  const auto& objects = context.storage->heap_graph_object_table();
+  std::map<uint64_t, uint64_t> retained_size;
+  std::map<uint64_t, uint64_t> dominator;
+  for (uint32_t row = 0; row < objects.row_count(); ++row) {
+    auto self_size = static_cast<uint64_t>(objects.self_size()[row]);
+    if (objects.retained_size()[row]) {
+      retained_size[self_size] =
+          static_cast<uint64_t>(*objects.retained_size()[row]);
+    }
+    base::Optional<tables::HeapGraphObjectTable::Id> dominator_id =
+        objects.dominator_id()[row];
+    if (dominator_id) {
+      uint32_t dominator_row = *objects.id().IndexOf(*dominator_id);
+      dominator[self_size] =
+          static_cast<uint64_t>(objects.self_size()[dominator_row]);
+    }
+  }
+
+  EXPECT_THAT(retained_size,
+              UnorderedElementsAre(Pair(kR, kR + kA + kB), Pair(kA, kA),
+                                   Pair(kB, kB), Pair(kC, kC + kD),
+                                   Pair(kD, kD), Pair(kX, kX)));
+  // C is reachable through both roots, so is dominated by neither.
+  EXPECT_THAT(dominator, UnorderedElementsAre(Pair(kA, kR), Pair(kB, kR),
+                                              Pair(kD, kC)));
+}
+
 static const char kArray[] = "X[]";
 static const char kDoubleArray[] = "X[][]";
 static const char kNoArray[] = "X";
@@ -243,6 +243,35 @@ void ProfileModule::ParsePerfSample(
     return;
   }
 
+  // Not a sample, but the producer's accounting of one of its unwinding queues.
+  if (sample.has_unwinder_stats()) {
+    PerfSample::UnwinderStats::Decoder unwinder_stats(sample.unwinder_stats());
+    int unwinder_index = static_cast<int>(unwinder_stats.unwinder_index());
+    context_->storage->IncrementIndexedStats(
+        stats::perf_unwinder_samples_dropped, unwinder_index,
+        static_cast<int64_t>(unwinder_stats.samples_dropped()));
+    const auto& max_depth_stats =
+        context_->storage->stats()[stats::perf_unwinder_max_queue_depth];
+    auto it = max_depth_stats.indexed_values.find(unwinder_index);
+    int64_t max_queue_depth =
+        static_cast<int64_t>(unwinder_stats.max_queue_depth());
+    if (it == max_depth_stats.indexed_values.end() ||
+        it->second < max_queue_depth) {
+      context_->storage->SetIndexedStats(stats::perf_unwinder_max_queue_depth,
+                                         unwinder_index, max_queue_depth);
+    }
+    return;
+  }
+
+  // Callchains aggregated by the producer over a period ending at |ts|, each
+  // with the number of samples that had it. They go to the
+  // |perf_aggregated_sample| table, one row per callchain, attributed to the
+  // main thread of the process.
+  if (sample.has_aggregated_callstack_iid()) {
+    ParseAggregatedPerfSamples(ts, sequence_state, sampling_stream, sample);
+    return;
+  }
+
   // Proper sample, populate the |perf_sample| table with everything except the
   // recorded counter values, which go to |counter|.
   context_->event_tracker->PushCounter(
@@ -282,6 +311,43 @@ void ProfileModule::ParsePerfSample(
   context_->storage->mutable_perf_sample_table()->Insert(sample_row);
 }
 
+void ProfileModule::ParseAggregatedPerfSamples(
+    int64_t ts,
+    PacketSequenceStateGeneration* sequence_state,
+    const PerfSampleTracker::SamplingStreamInfo& sampling_stream,
+    const protos::pbzero::PerfSample::Decoder& sample) {
+  TraceStorage* storage = context_->storage.get();
+  SequenceStackProfileTracker& stack_tracker =
+      sequence_state->state()->sequence_stack_profile_tracker();
+  ProfilePacketInternLookup intern_lookup(sequence_state);
+
+  UniqueTid utid =
+      context_->process_tracker->UpdateThread(sample.pid(), sample.pid());
+
+  bool parse_error = false;
+  auto count_it = sample.aggregated_count(&parse_error);
+  for (auto callstack_it = sample.aggregated_callstack_iid(&parse_error);
+       callstack_it; ++callstack_it, ++count_it) {
+    if (!count_it) {
+      storage->IncrementStats(stats::stackprofile_parser_error);
+      PERFETTO_ELOG("PerfSample has less aggregated counts than callstacks!");
+      break;
+    }
+    base::Optional<CallsiteId> cs_id =
+        stack_tracker.FindOrInsertCallstack(*callstack_it, &intern_lookup);
+    if (!cs_id) {
+      storage->IncrementStats(stats::stackprofile_parser_error);
+      continue;
+    }
+    tables::PerfAggregatedSampleTable::Row sample_row(
+        ts, utid, *cs_id, static_cast<int64_t>(*count_it),
+        sampling_stream.perf_session_id);
+    storage->mutable_perf_aggregated_sample_table()->Insert(sample_row);
+  }
+  if (parse_error)
+    storage->IncrementStats(stats::stackprofile_parser_error);
+}
+
 void ProfileModule::ParseProfilePacket(
     int64_t ts,
     PacketSequenceStateGeneration* sequence_state,
@@ -467,6 +533,7 @@ void ProfileModule::ParseModuleSymbols(ConstBytes blob) {
         auto* frames = context_->storage->mutable_stack_profile_frame_table();
         uint32_t frame_row = *frames->id().IndexOf(frame_id);
         frames->mutable_symbol_set_id()->Set(frame_row, symbol_set_id);
+        context_->storage->IncrementProfileDataGeneration();
         frame_found = true;
       }
     }
@@ -534,6 +601,7 @@ void ProfileModule::ParseDeobfuscationMapping(int64_t,
             *frames_tbl->id().IndexOf(frame_id),
             context_->storage->InternString(
                 base::StringView(merged_deobfuscated)));
+        context_->storage->IncrementProfileDataGeneration();
       }
     }
   }
@@ -18,9 +18,11 @@
 #define SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_PROFILE_MODULE_H_
 
 #include "perfetto/protozero/field.h"
+#include "src/trace_processor/importers/proto/perf_sample_tracker.h"
 #include "src/trace_processor/importers/proto/proto_importer_module.h"
 #include "src/trace_processor/importers/proto/proto_incremental_state.h"
 
+#include "protos/perfetto/trace/profiling/profile_packet.pbzero.h"
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
 
 namespace perfetto {
@@ -59,6 +61,11 @@ class ProfileModule : public ProtoImporterModule {
   void ParsePerfSample(int64_t ts,
                        PacketSequenceStateGeneration* sequence_state,
                        const protos::pbzero::TracePacket::Decoder& decoder);
+  void ParseAggregatedPerfSamples(
+      int64_t ts,
+      PacketSequenceStateGeneration* sequence_state,
+      const PerfSampleTracker::SamplingStreamInfo& sampling_stream,
+      const protos::pbzero::PerfSample::Decoder& sample);
 
   // heap profiling:
   void ParseProfilePacket(int64_t ts,
@@ -18,6 +18,7 @@
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "src/trace_processor/importers/additional_modules.h"
 #include "src/trace_processor/importers/common/args_tracker.h"
@@ -30,6 +31,7 @@
 #include "src/trace_processor/importers/default_modules.h"
 #include "src/trace_processor/importers/ftrace/sched_event_tracker.h"
 #include "src/trace_processor/importers/proto/metadata_tracker.h"
+#include "src/trace_processor/importers/proto/perf_sample_tracker.h"
 #include "src/trace_processor/importers/proto/proto_trace_parser.h"
 #include "src/trace_processor/importers/proto/stack_profile_tracker.h"
 #include "src/trace_processor/storage/metadata.h"
@@ -254,6 +256,7 @@ class ProtoTraceParserTest : public ::testing::Test {
     context_.flow_tracker.reset(flow_);
     clock_ = new ClockTracker(&context_);
     context_.clock_tracker.reset(clock_);
+    context_.perf_sample_tracker.reset(new PerfSampleTracker(&context_));
     context_.sorter.reset(new TraceSorter(CreateParser(), 0 /*window size*/));
     context_.descriptor_pool_.reset(new DescriptorPool());
 
@@ -2962,6 +2965,73 @@ TEST_F(ProtoTraceParserTest, CPUProfileSamplesTimestampsAreClockMonotonic) {
   EXPECT_EQ(samples.utid()[0], 1u);
 }
 
+TEST_F(ProtoTraceParserTest, ParseAggregatedPerfSamplesIntoTable) {
+  {
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_incremental_state_cleared(true);
+
+    auto* interned_data = packet->set_interned_data();
+
+    auto mapping = interned_data->add_mappings();
+    mapping->set_iid(1);
+
+    auto frame = interned_data->add_frames();
+    frame->set_iid(1);
+    frame->set_rel_pc(0x42);
+    frame->set_mapping_id(1);
+
+    auto frame2 = interned_data->add_frames();
+    frame2->set_iid(2);
+    frame2->set_rel_pc(0x4242);
+    frame2->set_mapping_id(1);
+
+    auto callstack = interned_data->add_callstacks();
+    callstack->set_iid(1);
+    callstack->add_frame_ids(1);
+
+    auto callstack2 = interned_data->add_callstacks();
+    callstack2->set_iid(42);
+    callstack2->add_frame_ids(1);
+    callstack2->add_frame_ids(2);
+  }
+
+  {
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_timestamp(1000);
+
+    auto* sample = packet->set_perf_sample();
+    sample->set_pid(15);
+    protozero::PackedVarInt callstack_iids;
+    callstack_iids.Append(1u);
+    callstack_iids.Append(42u);
+    sample->set_aggregated_callstack_iid(callstack_iids);
+    protozero::PackedVarInt counts;
+    counts.Append(3u);
+    counts.Append(1000000u);
+    sample->set_aggregated_count(counts);
+  }
+
+  EXPECT_CALL(*process_, UpdateThread(15, 15)).WillRepeatedly(Return(1));
+
+  Tokenize();
+
+  // One row per callchain, however many samples it stands for.
+  EXPECT_EQ(storage_->perf_sample_table().row_count(), 0u);
+  const auto& samples = storage_->perf_aggregated_sample_table();
+  ASSERT_EQ(samples.row_count(), 2u);
+  for (uint32_t i = 0; i < samples.row_count(); i++) {
+    EXPECT_EQ(samples.ts()[i], 1000);
+    EXPECT_EQ(samples.utid()[i], 1u);
+  }
+  EXPECT_NE(samples.callsite_id()[0], samples.callsite_id()[1]);
+  EXPECT_EQ(samples.count()[0], 3);
+  EXPECT_EQ(samples.count()[1], 1000000);
+
+  EXPECT_EQ(storage_->stats()[stats::stackprofile_parser_error].value, 0);
+}
+
 TEST_F(ProtoTraceParserTest, ConfigUuid) {
   auto* config = trace_->add_packet()->set_trace_config();
   config->set_trace_uuid_lsb(1);
@@ -214,8 +214,11 @@ util::Status DecompressTrace(const uint8_t* data,
   if (size > 0 && !decoder.packet()) {
     return util::ErrStatus("Trace does not contain valid packets");
   }
+  using protos::pbzero::TracePacket;
   for (auto it = decoder.packet(); it; ++it) {
-    protos::pbzero::TracePacket::Decoder packet(*it);
+    TracePacket::Decoder packet(
+        *it,
+        protozero::FieldSubset<TracePacket::kCompressedPacketsFieldNumber>());
     if (!packet.has_compressed_packets()) {
       it->SerializeAndAppendTo(output);
       continue;
@@ -185,7 +185,13 @@ namespace stats {
       "the tracing service. This happens if the ftrace buffers were not "      \
       "cleared properly. These packets are silently dropped by trace "         \
       "processor."),                                                           \
-  F(perf_guardrail_stop_ts,             kIndexed, kDataLoss, kTrace,    "")
+  F(perf_guardrail_stop_ts,             kIndexed, kDataLoss, kTrace,    ""),   \
+  F(perf_unwinder_samples_dropped,      kIndexed, kDataLoss, kTrace,           \
+      "Samples skipped by traced_perf because the queue of the unwinder "      \
+      "(index) was full."),                                                    \
+  F(perf_unwinder_max_queue_depth,      kIndexed, kInfo,     kTrace,           \
+      "Highest number of samples outstanding in the queue of traced_perf's "   \
+      "unwinder (index).")
 // clang-format on
 
 enum Type {
@@ -136,6 +136,8 @@ std::pair<int64_t, int64_t> TraceStorage::GetTraceTimestampBoundsNs() const {
   DbTableMaybeUpdateMinMax(heap_graph_object_table_.graph_sample_ts(),
                            &start_ns, &end_ns);
   DbTableMaybeUpdateMinMax(perf_sample_table_.ts(), &start_ns, &end_ns);
+  DbTableMaybeUpdateMinMax(perf_aggregated_sample_table_.ts(), &start_ns,
+                           &end_ns);
 
   if (start_ns == std::numeric_limits<int64_t>::max()) {
     return std::make_pair(0, 0);
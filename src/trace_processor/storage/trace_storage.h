@@ -506,6 +506,12 @@ class TraceStorage {
 
   const StatsMap& stats() const { return stats_; }
 
+  // Incremented whenever profiling data that was already imported is changed
+  // in place (e.g. when frames or classes are deobfuscated), so that data
+  // derived from it can be recomputed.
+  uint64_t profile_data_generation() const { return profile_data_generation_; }
+  void IncrementProfileDataGeneration() { profile_data_generation_++; }
+
   const tables::MetadataTable& metadata_table() const {
     return metadata_table_;
   }
@@ -596,6 +602,14 @@ class TraceStorage {
     return &perf_sample_table_;
   }
 
+  const tables::PerfAggregatedSampleTable& perf_aggregated_sample_table()
+      const {
+    return perf_aggregated_sample_table_;
+  }
+  tables::PerfAggregatedSampleTable* mutable_perf_aggregated_sample_table() {
+    return &perf_aggregated_sample_table_;
+  }
+
   const tables::SymbolTable& symbol_table() const { return symbol_table_; }
 
   tables::SymbolTable* mutable_symbol_table() { return &symbol_table_; }
@@ -790,6 +804,9 @@ class TraceStorage {
   // Stats about parsing the trace.
   StatsMap stats_{};
 
+  // See profile_data_generation().
+  uint64_t profile_data_generation_ = 0;
+
   // Extra data extracted from the trace. Includes:
   // * metadata from chrome and benchmarking infrastructure
   // * descriptions of android packages
@@ -902,6 +919,8 @@ class TraceStorage {
   tables::CpuProfileStackSampleTable cpu_profile_stack_sample_table_{
       &string_pool_, &stack_sample_table_};
   tables::PerfSampleTable perf_sample_table_{&string_pool_, nullptr};
+  tables::PerfAggregatedSampleTable perf_aggregated_sample_table_{
+      &string_pool_, nullptr};
   tables::PackageListTable package_list_table_{&string_pool_, nullptr};
   tables::ProfilerSmapsTable profiler_smaps_table_{&string_pool_, nullptr};
 
@@ -202,6 +202,28 @@ PERFETTO_TP_TABLE(PERFETTO_TP_CPU_PROFILE_STACK_SAMPLE_DEF);
 
 PERFETTO_TP_TABLE(PERFETTO_TP_PERF_SAMPLE_DEF);
 
+// Callchains aggregated by the traced_perf perf sampler, across all the threads
+// of a process and all cores. Each row stands for |count| samples with the
+// same callchain since the previous aggregation of the process.
+// @param ts timestamp of the latest of the aggregated samples.
+// @param utid main thread of the sampled process. {@joinable thread.utid}.
+// @param callsite_id callchain of the samples.
+// @param count number of samples with this callchain over the period.
+// @param perf_session_id distinguishes samples from different profiling
+//        streams (i.e. multiple data sources).
+//        {@joinable perf_counter_track.perf_session_id}
+// @tablegroup Callstack profilers
+#define PERFETTO_TP_PERF_AGGREGATED_SAMPLE_DEF(NAME, PARENT, C) \
+  NAME(PerfAggregatedSampleTable, "perf_aggregated_sample")     \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                             \
+  C(int64_t, ts, Column::Flag::kSorted)                         \
+  C(uint32_t, utid)                                             \
+  C(StackProfileCallsiteTable::Id, callsite_id)                 \
+  C(int64_t, count)                                             \
+  C(uint32_t, perf_session_id)
+
+PERFETTO_TP_TABLE(PERFETTO_TP_PERF_AGGREGATED_SAMPLE_DEF);
+
 // Symbolization data for a frame. Rows with the same symbol_set_id describe
 // one callframe, with the most-inlined symbol having id == symbol_set_id.
 //
@@ -328,6 +350,12 @@ PERFETTO_TP_TABLE(PERFETTO_TP_HEAP_GRAPH_CLASS_DEF);
 // false, this object is uncollected garbage.
 // @param type_id class this object is an instance of.
 // @param root_type if not NULL, this object is a GC root.
+// @param dominator_id immediate dominator of this object, i.e. the closest
+// object all paths from the GC roots to this object go through. NULL for
+// roots and unreachable objects.
+// @param retained_size self_size of this object and of all objects it
+// dominates, i.e. the memory that would be freed if this object was
+// collected. NULL for unreachable objects.
 // @tablegroup ART Heap Graphs
 #define PERFETTO_TP_HEAP_GRAPH_OBJECT_DEF(NAME, PARENT, C)            \
   NAME(HeapGraphObjectTable, "heap_graph_object")                     \
@@ -339,7 +367,9 @@ PERFETTO_TP_TABLE(PERFETTO_TP_HEAP_GRAPH_CLASS_DEF);
   C(int32_t, reachable)                                               \
   C(HeapGraphClassTable::Id, type_id)                                 \
   C(base::Optional<StringPool::Id>, root_type)                        \
-  C(int32_t, root_distance, Column::Flag::kHidden)
+  C(int32_t, root_distance, Column::Flag::kHidden)                    \
+  C(base::Optional<HeapGraphObjectTable::Id>, dominator_id)           \
+  C(base::Optional<int64_t>, retained_size)
 
 PERFETTO_TP_TABLE(PERFETTO_TP_HEAP_GRAPH_OBJECT_DEF);
 
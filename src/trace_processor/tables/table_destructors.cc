@@ -56,6 +56,7 @@ StackProfileCallsiteTable::~StackProfileCallsiteTable() = default;
 StackSampleTable::~StackSampleTable() = default;
 CpuProfileStackSampleTable::~CpuProfileStackSampleTable() = default;
 PerfSampleTable::~PerfSampleTable() = default;
+PerfAggregatedSampleTable::~PerfAggregatedSampleTable() = default;
 SymbolTable::~SymbolTable() = default;
 HeapProfileAllocationTable::~HeapProfileAllocationTable() = default;
 ExperimentalFlamegraphNodesTable::~ExperimentalFlamegraphNodesTable() = default;
@@ -944,7 +944,9 @@ util::Status LoadTrace(const std::string& trace_file_path, double* size_mb) {
 
   std::unique_ptr<profiling::Symbolizer> symbolizer =
       profiling::LocalSymbolizerOrDie(profiling::GetPerfettoBinaryPath(),
-                                      getenv("PERFETTO_SYMBOLIZER_MODE"));
+                                      getenv("PERFETTO_SYMBOLIZER_MODE"),
+                                      getenv("PERFETTO_SYMBOLIZER_BACKEND"),
+                                      getenv("PERFETTO_SYMBOL_INDEX_DIR"));
 
   if (symbolizer) {
     profiling::SymbolizeDatabase(
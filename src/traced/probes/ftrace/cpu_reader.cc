@@ -143,13 +143,16 @@ using protos::pbzero::GenericFtraceEvent;
 CpuReader::CpuReader(size_t cpu,
                      const ProtoTranslationTable* table,
                      LazyKernelSymbolizer* symbolizer,
-                     base::ScopedFile trace_fd)
+                     base::ScopedFile trace_fd,
+                     bool use_splice)
     : cpu_(cpu),
       table_(table),
       symbolizer_(symbolizer),
       trace_fd_(std::move(trace_fd)) {
   PERFETTO_CHECK(trace_fd_);
   PERFETTO_CHECK(SetBlocking(*trace_fd_, false));
+  if (use_splice)
+    staging_pipe_ = base::Pipe::Create(base::Pipe::kBothNonBlock);
 }
 
 CpuReader::~CpuReader() = default;
@@ -158,7 +161,7 @@ size_t CpuReader::ReadCycle(
     uint8_t* parsing_buf,
     size_t parsing_buf_size_pages,
     size_t max_pages,
-    const std::set<FtraceDataSource*>& started_data_sources) {
+    const std::vector<ParsingTarget>& targets) {
   PERFETTO_DCHECK(max_pages > 0 && parsing_buf_size_pages > 0);
   metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                              metatrace::FTRACE_CPU_READ_CYCLE);
@@ -167,8 +170,8 @@ size_t CpuReader::ReadCycle(
   size_t batch_pages = std::min(parsing_buf_size_pages, max_pages);
   size_t total_pages_read = 0;
   for (bool is_first_batch = true;; is_first_batch = false) {
-    size_t pages_read = ReadAndProcessBatch(
-        parsing_buf, batch_pages, is_first_batch, started_data_sources);
+    size_t pages_read =
+        ReadAndProcessBatch(parsing_buf, batch_pages, is_first_batch, targets);
 
     PERFETTO_DCHECK(pages_read <= batch_pages);
     total_pages_read += pages_read;
@@ -194,12 +197,23 @@ size_t CpuReader::ReadAndProcessBatch(
     uint8_t* parsing_buf,
     size_t max_pages,
     bool first_batch_in_cycle,
-    const std::set<FtraceDataSource*>& started_data_sources) {
+    const std::vector<ParsingTarget>& targets) {
   size_t pages_read = 0;
   {
     metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                                metatrace::FTRACE_CPU_READ_BATCH);
     for (; pages_read < max_pages;) {
+      // splice() moves only the pages that the kernel has finished writing.
+      // Splice until there are none left (EAGAIN), then read() the partially
+      // written head page. If the writer has filled it in the meantime, the
+      // read() returns a full page and we go back to splicing.
+      if (staging_pipe_.rd) {
+        pages_read +=
+            SpliceFullPages(parsing_buf + (pages_read * base::kPageSize),
+                            max_pages - pages_read);
+        if (pages_read == max_pages)
+          break;
+      }
       uint8_t* curr_page = parsing_buf + (pages_read * base::kPageSize);
       ssize_t res =
           PERFETTO_EINTR(read(*trace_fd_, curr_page, base::kPageSize));
@@ -267,11 +281,10 @@ size_t CpuReader::ReadAndProcessBatch(
   if (pages_read == 0)
     return pages_read;
 
-  for (FtraceDataSource* data_source : started_data_sources) {
+  for (const ParsingTarget& target : targets) {
     bool pages_parsed_ok = ProcessPagesForDataSource(
-        data_source->trace_writer(), data_source->mutable_metadata(), cpu_,
-        data_source->parsing_config(), parsing_buf, pages_read, table_,
-        symbolizer_, ftrace_clock_);
+        target.trace_writer, target.metadata, cpu_, target.parsing_config,
+        parsing_buf, pages_read, table_, symbolizer_, ftrace_clock_);
     // If this CHECK fires, it means that we did not know how to parse the
     // kernel binary format. This is a bug in either perfetto or the kernel, and
     // must be investigated. Hence we CHECK instead of recording a bit
@@ -282,6 +295,47 @@ size_t CpuReader::ReadAndProcessBatch(
   return pages_read;
 }
 
+size_t CpuReader::SpliceFullPages(uint8_t* parsing_buf, size_t max_pages) {
+  size_t pages_spliced = 0;
+  while (pages_spliced < max_pages) {
+    // The staging pipe might not be big enough to hold |max_pages|, in which
+    // case the kernel will splice fewer pages. Move them out and repeat.
+    size_t max_bytes = (max_pages - pages_spliced) * base::kPageSize;
+    ssize_t res = PERFETTO_EINTR(splice(*trace_fd_, nullptr, *staging_pipe_.wr,
+                                        nullptr, max_bytes,
+                                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+    if (res < 0 && errno == EINVAL) {
+      // The fd doesn't support splice(). Use read() from now on.
+      PERFETTO_ELOG("[cpu%zu]: splice() not supported, using read()", cpu_);
+      staging_pipe_ = base::Pipe();
+      break;
+    }
+    if (res <= 0) {
+      // EAGAIN means that there are no full pages left to splice. For the
+      // other expected errors, see the comment in ReadAndProcessBatch().
+      if (res < 0 && errno != EAGAIN && errno != ENOMEM && errno != EBUSY &&
+          errno != ENODEV) {
+        PERFETTO_PLOG("Unexpected error on raw ftrace splice");
+      }
+      break;
+    }
+    // The kernel splices whole pages only.
+    PERFETTO_CHECK(res % static_cast<ssize_t>(base::kPageSize) == 0);
+
+    // Drain the pipe. The data is already in it, so the reads can't block or
+    // come up short (other than being split into several reads).
+    uint8_t* dst = parsing_buf + pages_spliced * base::kPageSize;
+    for (size_t rd_total = 0; rd_total < static_cast<size_t>(res);) {
+      ssize_t rd = PERFETTO_EINTR(read(*staging_pipe_.rd, dst + rd_total,
+                                       static_cast<size_t>(res) - rd_total));
+      PERFETTO_CHECK(rd > 0);
+      rd_total += static_cast<size_t>(rd);
+    }
+    pages_spliced += static_cast<size_t>(res) / base::kPageSize;
+  }
+  return pages_spliced;
+}
+
 // static
 bool CpuReader::ProcessPagesForDataSource(
     TraceWriter* trace_writer,
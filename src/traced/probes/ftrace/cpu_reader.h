@@ -23,8 +23,8 @@
 #include <array>
 #include <atomic>
 #include <memory>
-#include <set>
 #include <thread>
+#include <vector>
 
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/paged_memory.h"
@@ -41,7 +41,6 @@
 
 namespace perfetto {
 
-class FtraceDataSource;
 class LazyKernelSymbolizer;
 class ProtoTranslationTable;
 struct FtraceDataSourceConfig;
@@ -65,18 +64,34 @@ class CpuReader {
     bool lost_events;
   };
 
+  // Where the events parsed for one data source are written. Normally these
+  // are the data source's own writer and metadata. When parsing on worker
+  // threads, each worker has its own (see FtraceController::ReaderWorker).
+  struct ParsingTarget {
+    TraceWriter* trace_writer;
+    FtraceMetadata* metadata;
+    const FtraceDataSourceConfig* parsing_config;
+  };
+
+  // If |use_splice| is true, fully written pages are moved out of the kernel
+  // buffer with splice() through a staging pipe, in batches, rather than with
+  // one read() per page. read() is still used for the partially written page
+  // at the head of the buffer, as splice() only hands over full pages.
   CpuReader(size_t cpu,
             const ProtoTranslationTable* table,
             LazyKernelSymbolizer* symbolizer,
-            base::ScopedFile trace_fd);
+            base::ScopedFile trace_fd,
+            bool use_splice);
   ~CpuReader();
 
   // Reads and parses all ftrace data for this cpu (in batches), until we catch
   // up to the writer, or hit |max_pages|. Returns number of pages read.
+  // Different CpuReader instances can be used concurrently from different
+  // threads, as long as the |targets| are not shared.
   size_t ReadCycle(uint8_t* parsing_buf,
                    size_t parsing_buf_size_pages,
                    size_t max_pages,
-                   const std::set<FtraceDataSource*>& started_data_sources);
+                   const std::vector<ParsingTarget>& targets);
 
   template <typename T>
   static bool ReadAndAdvance(const uint8_t** ptr, const uint8_t* end, T* out) {
@@ -247,6 +262,8 @@ class CpuReader {
     ftrace_clock_ = clock;
   }
 
+  bool uses_splice_for_testing() const { return !!staging_pipe_.rd; }
+
  private:
   CpuReader(const CpuReader&) = delete;
   CpuReader& operator=(const CpuReader&) = delete;
@@ -255,16 +272,21 @@ class CpuReader {
   // into |started_data_sources|. Returns number of pages read.
   // See comment on ftrace_controller.cc:kMaxParsingWorkingSetPages for
   // rationale behind the batching.
-  size_t ReadAndProcessBatch(
-      uint8_t* parsing_buf,
-      size_t max_pages,
-      bool first_batch_in_cycle,
-      const std::set<FtraceDataSource*>& started_data_sources);
+  size_t ReadAndProcessBatch(uint8_t* parsing_buf,
+                             size_t max_pages,
+                             bool first_batch_in_cycle,
+                             const std::vector<ParsingTarget>& targets);
+
+  // Moves full pages into |parsing_buf| via |staging_pipe_| until there are
+  // none left (EAGAIN) or it got |max_pages|. Returns the number of pages
+  // moved. If the fd doesn't support splice(), switches to read() for good.
+  size_t SpliceFullPages(uint8_t* parsing_buf, size_t max_pages);
 
   const size_t cpu_;
   const ProtoTranslationTable* const table_;
   LazyKernelSymbolizer* const symbolizer_;
   base::ScopedFile trace_fd_;
+  base::Pipe staging_pipe_;  // Only valid if splice() is used.
   protos::pbzero::FtraceClock ftrace_clock_{};
 };
 
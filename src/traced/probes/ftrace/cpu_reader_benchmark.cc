@@ -14,6 +14,13 @@
 
 #include <benchmark/benchmark.h>
 
+#include <unistd.h>
+
+#include <mutex>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/root_message.h"
 #include "perfetto/protozero/scattered_stream_null_delegate.h"
@@ -23,6 +30,7 @@
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
 #include "src/traced/probes/ftrace/proto_translation_table.h"
 #include "src/traced/probes/ftrace/test/cpu_reader_support.h"
+#include "src/tracing/core/null_trace_writer.h"
 
 namespace {
 
@@ -344,3 +352,70 @@ static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
   }
 }
 BENCHMARK(BM_ParsePageFullOfSchedSwitch);
+
+// End-to-end throughput of draining a per-cpu buffer: reading the pages from
+// the fd (one read() per page, or splice() in batches), parsing them and
+// writing the bundles into a TraceWriter. The per-cpu buffer is emulated with
+// a file full of sched_switch pages. Each benchmark thread has its own reader,
+// as FtraceController's reader workers do, so ->ThreadRange() shows how the
+// throughput scales when the cpus are drained in parallel.
+static void BM_ReadCycle(benchmark::State& state) {
+  constexpr size_t kNumPages = 256;  // kMaxPagesPerCpuPerReadTick.
+  constexpr size_t kParsingBufferSizePages = 32;
+  const bool use_splice = state.range(0) != 0;
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+
+  // GetTable() lazily populates a global cache, and this runs on several
+  // threads at once.
+  static std::mutex table_mutex;
+  ProtoTranslationTable* table = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(table_mutex);
+    table = GetTable(test_case->name);
+  }
+  auto page = PageFromXxd(test_case->data);
+
+  perfetto::base::TempFile trace_file =
+      perfetto::base::TempFile::CreateUnlinked();
+  for (size_t i = 0; i < kNumPages; i++) {
+    perfetto::base::WriteAll(trace_file.fd(), page.get(),
+                             perfetto::base::kPageSize);
+  }
+
+  FtraceDataSourceConfig ds_config{EventFilter{},
+                                   DisabledCompactSchedConfigForTesting(),
+                                   {},
+                                   {},
+                                   false /*symbolize_ksyms*/};
+  ds_config.event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  perfetto::NullTraceWriter trace_writer;
+  FtraceMetadata metadata{};
+  std::vector<CpuReader::ParsingTarget> targets;
+  targets.push_back({&trace_writer, &metadata, &ds_config});
+
+  // The reader owns a dup() of the fd, sharing the file offset with
+  // |trace_file|, so that it can be rewound on each iteration.
+  CpuReader reader(0, table, /*symbolizer=*/nullptr,
+                   perfetto::base::ScopedFile(dup(trace_file.fd())),
+                   use_splice);
+  auto parsing_buf = std::unique_ptr<uint8_t[]>(
+      new uint8_t[perfetto::base::kPageSize * kParsingBufferSizePages]);
+
+  size_t pages_read = 0;
+  while (state.KeepRunning()) {
+    lseek(trace_file.fd(), 0, SEEK_SET);
+    pages_read += reader.ReadCycle(parsing_buf.get(), kParsingBufferSizePages,
+                                   kNumPages, targets);
+    metadata.Clear();
+  }
+  state.SetBytesProcessed(
+      static_cast<int64_t>(pages_read * perfetto::base::kPageSize));
+}
+BENCHMARK(BM_ReadCycle)
+    ->ArgNames({"splice"})
+    ->Arg(0)
+    ->Arg(1)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
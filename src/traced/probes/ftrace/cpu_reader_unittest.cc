@@ -16,10 +16,14 @@
 
 #include "src/traced/probes/ftrace/cpu_reader.h"
 
+#include <fcntl.h>
 #include <string.h>
 #include <sys/stat.h>
 
 #include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
@@ -1202,6 +1206,91 @@ TEST(CpuReaderTest, NewPacketOnLostEvents) {
   EXPECT_EQ(4u, packets[2].ftrace_events().event().size());
 }
 
+// Returns an fd to a file holding |num_pages| copies of |page|, standing in
+// for trace_pipe_raw. Unlike the kernel, the file lets splice() move pages
+// that are only partially filled, which tells the splice() and read() paths
+// apart.
+base::ScopedFile OpenTempFileWithPages(const uint8_t* page, size_t num_pages) {
+  base::TempFile tmp = base::TempFile::Create();
+  for (size_t i = 0; i < num_pages; i++)
+    PERFETTO_CHECK(base::WriteAll(tmp.fd(), page, base::kPageSize) ==
+                   static_cast<ssize_t>(base::kPageSize));
+  return base::OpenFile(tmp.path(), O_RDONLY);
+}
+
+TEST(CpuReaderTest, ReadCycleSplicesPages) {
+  auto page = PageFromXxd(g_switch_page);
+  ProtoTranslationTable* table = GetTable("synthetic");
+  FtraceMetadata metadata{};
+  FtraceDataSourceConfig ds_config = EmptyConfig();
+  ds_config.event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+  TraceWriterForTesting trace_writer;
+
+  CpuReader reader(/*cpu=*/0, table, /*symbolizer=*/nullptr,
+                   OpenTempFileWithPages(page.get(), 8), /*use_splice=*/true);
+  ASSERT_TRUE(reader.uses_splice_for_testing());
+
+  // splice() doesn't look at the page headers, so all the pages are read even
+  // though none of them is full.
+  static constexpr size_t kParsingBufPages = 4;
+  std::unique_ptr<uint8_t[]> parsing_buf(
+      new uint8_t[kParsingBufPages * base::kPageSize]);
+  EXPECT_EQ(reader.ReadCycle(parsing_buf.get(), kParsingBufPages,
+                             /*max_pages=*/100,
+                             {{&trace_writer, &metadata, &ds_config}}),
+            8u);
+  EXPECT_TRUE(reader.uses_splice_for_testing());
+
+  size_t num_events = 0;
+  for (const auto& packet : trace_writer.GetAllTracePackets())
+    num_events += packet.ftrace_events().event().size();
+  EXPECT_EQ(num_events, 8u);
+}
+
+TEST(CpuReaderTest, ReadCycleReadsPages) {
+  auto page = PageFromXxd(g_switch_page);
+  ProtoTranslationTable* table = GetTable("synthetic");
+  FtraceMetadata metadata{};
+  FtraceDataSourceConfig ds_config = EmptyConfig();
+  TraceWriterForTesting trace_writer;
+
+  CpuReader reader(/*cpu=*/0, table, /*symbolizer=*/nullptr,
+                   OpenTempFileWithPages(page.get(), 8), /*use_splice=*/false);
+  ASSERT_FALSE(reader.uses_splice_for_testing());
+
+  // The first page of a cycle can be partial, the second partial one means
+  // that the reader caught up with the writer.
+  static constexpr size_t kParsingBufPages = 4;
+  std::unique_ptr<uint8_t[]> parsing_buf(
+      new uint8_t[kParsingBufPages * base::kPageSize]);
+  EXPECT_EQ(reader.ReadCycle(parsing_buf.get(), kParsingBufPages,
+                             /*max_pages=*/100,
+                             {{&trace_writer, &metadata, &ds_config}}),
+            2u);
+}
+
+TEST(CpuReaderTest, ReadCycleFallsBackToReadIfSpliceUnsupported) {
+  ProtoTranslationTable* table = GetTable("synthetic");
+  FtraceMetadata metadata{};
+  FtraceDataSourceConfig ds_config = EmptyConfig();
+  TraceWriterForTesting trace_writer;
+
+  // /dev/null doesn't support splice().
+  CpuReader reader(/*cpu=*/0, table, /*symbolizer=*/nullptr,
+                   base::OpenFile("/dev/null", O_RDONLY), /*use_splice=*/true);
+  ASSERT_TRUE(reader.uses_splice_for_testing());
+
+  static constexpr size_t kParsingBufPages = 4;
+  std::unique_ptr<uint8_t[]> parsing_buf(
+      new uint8_t[kParsingBufPages * base::kPageSize]);
+  EXPECT_EQ(reader.ReadCycle(parsing_buf.get(), kParsingBufPages,
+                             /*max_pages=*/100,
+                             {{&trace_writer, &metadata, &ds_config}}),
+            0u);
+  EXPECT_FALSE(reader.uses_splice_for_testing());
+}
+
 // Page containing an absolute timestamp (RINGBUF_TYPE_TIME_STAMP).
 static char g_abs_timestamp[] =
     R"(
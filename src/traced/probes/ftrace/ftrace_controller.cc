@@ -34,6 +34,7 @@
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/metatrace.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/waitable_event.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "src/kallsyms/kernel_symbol_map.h"
 #include "src/kallsyms/lazy_kernel_symbolizer.h"
@@ -161,6 +162,7 @@ FtraceController::FtraceController(std::unique_ptr<FtraceProcfs> ftrace_procfs,
       weak_factory_(this) {}
 
 FtraceController::~FtraceController() {
+  WaitForWorkersIdle();
   for (const auto* data_source : data_sources_)
     ftrace_config_muxer_->RemoveConfig(data_source->config_id());
   data_sources_.clear();
@@ -172,10 +174,10 @@ uint64_t FtraceController::NowMs() const {
   return static_cast<uint64_t>(base::GetWallTimeMs().count());
 }
 
-void FtraceController::StartIfNeeded() {
+void FtraceController::StartIfNeeded(FtraceDataSource* started) {
   if (started_data_sources_.size() > 1)
     return;
-  PERFETTO_DCHECK(!started_data_sources_.empty());
+  PERFETTO_DCHECK(started_data_sources_.count(started) > 0);
   PERFETTO_DCHECK(per_cpu_.empty());
 
   // Lazily allocate the memory used for reading & parsing ftrace.
@@ -184,16 +186,36 @@ void FtraceController::StartIfNeeded() {
         base::PagedMemory::Allocate(base::kPageSize * kParsingBufferSizePages);
   }
 
+  // The data source that started first decides whether the cpus are read on
+  // worker threads, for as long as any data source is active.
+  const size_t num_cpus = ftrace_procfs_->NumberOfCpus();
+  const size_t num_workers = std::min(
+      static_cast<size_t>(started->config().cpu_reader_threads()), num_cpus);
+
   per_cpu_.clear();
-  per_cpu_.reserve(ftrace_procfs_->NumberOfCpus());
+  per_cpu_.reserve(num_cpus);
   size_t period_page_quota = ftrace_config_muxer_->GetPerCpuBufferSizePages();
-  for (size_t cpu = 0; cpu < ftrace_procfs_->NumberOfCpus(); cpu++) {
-    auto reader = std::unique_ptr<CpuReader>(
-        new CpuReader(cpu, table_.get(), symbolizer_.get(),
-                      ftrace_procfs_->OpenPipeForCpu(cpu)));
+  for (size_t cpu = 0; cpu < num_cpus; cpu++) {
+    auto reader = std::unique_ptr<CpuReader>(new CpuReader(
+        cpu, table_.get(), symbolizer_.get(),
+        ftrace_procfs_->OpenPipeForCpu(cpu), /*use_splice=*/num_workers > 0));
     per_cpu_.emplace_back(std::move(reader), period_page_quota);
   }
 
+  // Split the cpus in contiguous groups, one per worker.
+  PERFETTO_DCHECK(workers_.empty());
+  for (size_t i = 0, next_cpu = 0; i < num_workers; i++) {
+    std::unique_ptr<ReaderWorker> worker(new ReaderWorker());
+    worker->thread.reset(new base::ThreadTaskRunner(
+        base::ThreadTaskRunner::CreateAndStart("ftrace_rd")));
+    worker->first_cpu = next_cpu;
+    worker->num_cpus = num_cpus / num_workers + (i < num_cpus % num_workers);
+    worker->parsing_mem =
+        base::PagedMemory::Allocate(base::kPageSize * kParsingBufferSizePages);
+    next_cpu += worker->num_cpus;
+    workers_.emplace_back(std::move(worker));
+  }
+
   // Start the repeating read tasks.
   auto generation = ++generation_;
   auto drain_period_ms = GetDrainPeriodMs();
@@ -229,6 +251,12 @@ void FtraceController::StartIfNeeded() {
 // drain period. Therefore we introduce |per_cpu_.period_page_quota|. If the
 // consumer wants to handle a high bandwidth of ftrace events, they should set
 // the config values appropriately.
+//
+// With many cpus, a single thread can't keep up with the kernel. If the config
+// sets cpu_reader_threads, the cpus are split in groups, each read by a
+// |ReaderWorker| on its own thread. ReadTick() then only fans the reads out to
+// the workers, and the scheduling and quota logic above runs once all of them
+// are done. The main thread isn't blocked in the meantime.
 void FtraceController::ReadTick(int generation) {
   metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                              metatrace::FTRACE_READ_TICK);
@@ -246,20 +274,79 @@ void FtraceController::ReadTick(int generation) {
   }
 #endif
 
+  auto on_cpus_read = [this, generation](bool all_cpus_done) {
+    observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
+
+    // More work to do in this period.
+    auto weak_this = weak_factory_.GetWeakPtr();
+    if (!all_cpus_done) {
+      PERFETTO_DLOG("Reposting immediate ReadTick as there's more work.");
+      task_runner_->PostTask([weak_this, generation] {
+        if (weak_this)
+          weak_this->ReadTick(generation);
+      });
+    } else {
+      // Done until next drain period.
+      size_t period_page_quota =
+          ftrace_config_muxer_->GetPerCpuBufferSizePages();
+      for (auto& per_cpu : per_cpu_)
+        per_cpu.period_page_quota = period_page_quota;
+
+      auto drain_period_ms = GetDrainPeriodMs();
+      task_runner_->PostDelayedTask(
+          [weak_this, generation] {
+            if (weak_this)
+              weak_this->ReadTick(generation);
+          },
+          drain_period_ms - (NowMs() % drain_period_ms));
+    }
+  };
+
   // Read all cpu buffers with remaining per-period quota.
-  bool all_cpus_done = true;
-  uint8_t* parsing_buf = reinterpret_cast<uint8_t*>(parsing_mem_.Get());
   const auto ftrace_clock = ftrace_config_muxer_->ftrace_clock();
-  for (size_t i = 0; i < per_cpu_.size(); i++) {
+  if (workers_.empty()) {
+    for (auto& per_cpu : per_cpu_)
+      per_cpu.reader->set_ftrace_clock(ftrace_clock);
+    uint8_t* parsing_buf = reinterpret_cast<uint8_t*>(parsing_mem_.Get());
+    on_cpus_read(
+        ReadCpus(0, per_cpu_.size(), parsing_buf, GetParsingTargets()));
+  } else {
+    RunOnWorkers(
+        [this, ftrace_clock](ReaderWorker* worker) {
+          for (size_t i = worker->first_cpu;
+               i < worker->first_cpu + worker->num_cpus; i++) {
+            per_cpu_[i].reader->set_ftrace_clock(ftrace_clock);
+          }
+          worker->all_cpus_done = ReadCpus(
+              worker->first_cpu, worker->num_cpus,
+              reinterpret_cast<uint8_t*>(worker->parsing_mem.Get()),
+              worker->targets);
+        },
+        [this, on_cpus_read] {
+          bool all_cpus_done = true;
+          for (const auto& worker : workers_)
+            all_cpus_done &= worker->all_cpus_done;
+          MergeWorkerMetadata();
+          on_cpus_read(all_cpus_done);
+        });
+  }
+}
+
+bool FtraceController::ReadCpus(
+    size_t first_cpu,
+    size_t num_cpus,
+    uint8_t* parsing_buf,
+    const std::vector<CpuReader::ParsingTarget>& targets) {
+  bool all_cpus_done = true;
+  for (size_t i = first_cpu; i < first_cpu + num_cpus; i++) {
     size_t orig_quota = per_cpu_[i].period_page_quota;
     if (orig_quota == 0)
       continue;
 
     size_t max_pages = std::min(orig_quota, kMaxPagesPerCpuPerReadTick);
     CpuReader& cpu_reader = *per_cpu_[i].reader;
-    cpu_reader.set_ftrace_clock(ftrace_clock);
     size_t pages_read = cpu_reader.ReadCycle(
-        parsing_buf, kParsingBufferSizePages, max_pages, started_data_sources_);
+        parsing_buf, kParsingBufferSizePages, max_pages, targets);
 
     size_t new_quota = (pages_read >= orig_quota) ? 0 : orig_quota - pages_read;
     per_cpu_[i].period_page_quota = new_quota;
@@ -275,29 +362,110 @@ void FtraceController::ReadTick(int generation) {
     if (pages_read == max_pages && new_quota > 0)
       all_cpus_done = false;
   }
-  observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
+  return all_cpus_done;
+}
+
+std::vector<CpuReader::ParsingTarget> FtraceController::GetParsingTargets() {
+  std::vector<CpuReader::ParsingTarget> targets;
+  targets.reserve(started_data_sources_.size());
+  for (FtraceDataSource* data_source : started_data_sources_) {
+    targets.push_back({data_source->trace_writer(),
+                       data_source->mutable_metadata(),
+                       data_source->parsing_config()});
+  }
+  return targets;
+}
 
-  // More work to do in this period.
+void FtraceController::RunOnWorkers(std::function<void(ReaderWorker*)> fn,
+                                    std::function<void()> on_done) {
+  worker_passes_.push_back({std::move(fn), std::move(on_done)});
+  if (worker_passes_.size() == 1 && busy_workers_ == 0)
+    StartWorkerPass();
+}
+
+void FtraceController::StartWorkerPass() {
+  bool symbolize_ksyms = false;
+  for (auto& worker : workers_) {
+    worker->targets.clear();
+    for (FtraceDataSource* data_source : started_data_sources_) {
+      symbolize_ksyms |= data_source->parsing_config()->symbolize_ksyms;
+      std::unique_ptr<ReaderWorker::Sink>& sink = worker->sinks[data_source];
+      if (!sink) {
+        sink.reset(new ReaderWorker::Sink());
+        sink->writer = data_source->CreateWorkerTraceWriter();
+      }
+      if (!sink->writer) {
+        PERFETTO_DFATAL_OR_ELOG("No TraceWriter for ftrace worker");
+        continue;
+      }
+      worker->targets.push_back({sink->writer.get(), &sink->metadata,
+                                 data_source->parsing_config()});
+    }
+  }
+
+  // The symbol map can only be created on this thread. Once created, the
+  // workers can share it.
+  if (symbolize_ksyms)
+    symbolizer_->GetOrCreateKernelSymbolMap();
+
+  const std::function<void(ReaderWorker*)>& fn = worker_passes_.front().fn;
+  const uint64_t pass_id = ++worker_pass_id_;
+  busy_workers_ = workers_.size();
+  base::TaskRunner* task_runner = task_runner_;
   auto weak_this = weak_factory_.GetWeakPtr();
-  if (!all_cpus_done) {
-    PERFETTO_DLOG("Reposting immediate ReadTick as there's more work.");
-    task_runner_->PostTask([weak_this, generation] {
-      if (weak_this)
-        weak_this->ReadTick(generation);
+  for (auto& worker : workers_) {
+    ReaderWorker* worker_ptr = worker.get();
+    worker->thread->PostTask([fn, worker_ptr, task_runner, weak_this, pass_id] {
+      fn(worker_ptr);
+      task_runner->PostTask([weak_this, pass_id] {
+        if (weak_this)
+          weak_this->OnWorkerPassDone(pass_id);
+      });
     });
-  } else {
-    // Done until next drain period.
-    size_t period_page_quota = ftrace_config_muxer_->GetPerCpuBufferSizePages();
-    for (auto& per_cpu : per_cpu_)
-      per_cpu.period_page_quota = period_page_quota;
+  }
+}
 
-    auto drain_period_ms = GetDrainPeriodMs();
-    task_runner_->PostDelayedTask(
-        [weak_this, generation] {
-          if (weak_this)
-            weak_this->ReadTick(generation);
-        },
-        drain_period_ms - (NowMs() % drain_period_ms));
+void FtraceController::OnWorkerPassDone(uint64_t pass_id) {
+  // The pass is stale if the workers were stopped in the meantime.
+  if (pass_id != worker_pass_id_ || --busy_workers_ > 0)
+    return;
+  std::function<void()> on_done = std::move(worker_passes_.front().on_done);
+  worker_passes_.pop_front();
+  on_done();
+  if (!worker_passes_.empty() && busy_workers_ == 0)
+    StartWorkerPass();
+}
+
+void FtraceController::WaitForWorkersIdle() {
+  if (busy_workers_ == 0)
+    return;
+  // The tasks of each worker run in order, so the pass is done once these run.
+  std::vector<std::unique_ptr<base::WaitableEvent>> idle;
+  for (auto& worker : workers_) {
+    idle.emplace_back(new base::WaitableEvent());
+    base::WaitableEvent* evt = idle.back().get();
+    worker->thread->PostTask([evt] { evt->Notify(); });
+  }
+  for (auto& evt : idle)
+    evt->Wait();
+}
+
+void FtraceController::MergeWorkerMetadata() {
+  for (auto& worker : workers_) {
+    for (auto& it : worker->sinks) {
+      FtraceMetadata* dst = it.first->mutable_metadata();
+      FtraceMetadata& src = it.second->metadata;
+      for (const auto& inode_and_device : src.inode_and_device)
+        dst->inode_and_device.insert(inode_and_device);
+      for (int32_t pid : src.rename_pids)
+        dst->AddRenamePid(pid);
+      for (int32_t pid : src.pids)
+        dst->AddPid(pid);
+      // The kernel symbols are interned on the worker's own packet sequence
+      // and must not be merged. Clearing them here (as ProbesProducer does for
+      // the data source's metadata) restarts the interning on the next tick.
+      src.Clear();
+    }
   }
 }
 
@@ -333,16 +501,44 @@ void FtraceController::Flush(FlushRequestID flush_id) {
   // events.
   size_t per_cpu_buf_size_pages =
       ftrace_config_muxer_->GetPerCpuBufferSizePages();
-  uint8_t* parsing_buf = reinterpret_cast<uint8_t*>(parsing_mem_.Get());
-  for (size_t i = 0; i < per_cpu_.size(); i++) {
-    per_cpu_[i].reader->ReadCycle(parsing_buf, kParsingBufferSizePages,
-                                  per_cpu_buf_size_pages,
-                                  started_data_sources_);
+  auto on_cpus_read = [this, flush_id] {
+    observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
+    for (FtraceDataSource* data_source : started_data_sources_)
+      data_source->OnFtraceFlushComplete(flush_id);
+  };
+
+  if (workers_.empty()) {
+    uint8_t* parsing_buf = reinterpret_cast<uint8_t*>(parsing_mem_.Get());
+    auto targets = GetParsingTargets();
+    for (size_t i = 0; i < per_cpu_.size(); i++) {
+      per_cpu_[i].reader->ReadCycle(parsing_buf, kParsingBufferSizePages,
+                                    per_cpu_buf_size_pages, targets);
+    }
+    on_cpus_read();
+  } else {
+    RunOnWorkers(
+        [this, per_cpu_buf_size_pages](ReaderWorker* worker) {
+          uint8_t* parsing_buf =
+              reinterpret_cast<uint8_t*>(worker->parsing_mem.Get());
+          for (size_t i = worker->first_cpu;
+               i < worker->first_cpu + worker->num_cpus; i++) {
+            per_cpu_[i].reader->ReadCycle(parsing_buf, kParsingBufferSizePages,
+                                          per_cpu_buf_size_pages,
+                                          worker->targets);
+          }
+        },
+        [this, on_cpus_read] {
+          MergeWorkerMetadata();
+          // The data sources flush their own writer once notified below.
+          for (auto& worker : workers_) {
+            for (auto& it : worker->sinks) {
+              if (it.second->writer)
+                it.second->writer->Flush();
+            }
+          }
+          on_cpus_read();
+        });
   }
-  observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
-
-  for (FtraceDataSource* data_source : started_data_sources_)
-    data_source->OnFtraceFlushComplete(flush_id);
 }
 
 void FtraceController::StopIfNeeded() {
@@ -353,6 +549,11 @@ void FtraceController::StopIfNeeded() {
   // ask for an explicit flush before stopping, unless it needs to perform a
   // non-graceful stop.
 
+  workers_.clear();  // Joins the worker threads.
+  // There are no data sources left to complete the passes for.
+  worker_passes_.clear();
+  busy_workers_ = 0;
+  worker_pass_id_++;
   per_cpu_.clear();
   symbolizer_->Destroy();
 
@@ -387,7 +588,7 @@ bool FtraceController::StartDataSource(FtraceDataSource* data_source) {
     return false;
 
   started_data_sources_.insert(data_source);
-  StartIfNeeded();
+  StartIfNeeded(data_source);
 
   // If the config is requesting to symbolize kernel addresses, create the
   // symbolizer and parse /proc/kallsyms (it will take 200-300 ms). This is not
@@ -409,7 +610,10 @@ bool FtraceController::StartDataSource(FtraceDataSource* data_source) {
 }
 
 void FtraceController::RemoveDataSource(FtraceDataSource* data_source) {
+  WaitForWorkersIdle();
   started_data_sources_.erase(data_source);
+  for (auto& worker : workers_)
+    worker->sinks.erase(data_source);
   size_t removed = data_sources_.erase(data_source);
   if (!removed)
     return;  // Can happen if AddDataSource failed (e.g. too many sessions).
@@ -21,19 +21,23 @@
 #include <unistd.h>
 
 #include <bitset>
+#include <deque>
 #include <functional>
 #include <map>
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "perfetto/base/task_runner.h"
 #include "perfetto/ext/base/paged_memory.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/base/weak_ptr.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "src/traced/probes/ftrace/cpu_reader.h"
 #include "src/traced/probes/ftrace/ftrace_config_utils.h"
+#include "src/traced/probes/ftrace/ftrace_metadata.h"
 
 namespace perfetto {
 
@@ -70,7 +74,8 @@ class FtraceController {
   void RemoveDataSource(FtraceDataSource*);
 
   // Force a read of the ftrace buffers. Will call OnFtraceFlushComplete() on
-  // all |started_data_sources_|.
+  // all |started_data_sources_|, asynchronously if the cpus are read on worker
+  // threads.
   void Flush(FlushRequestID);
 
   void DumpFtraceStats(FtraceStats*);
@@ -100,15 +105,77 @@ class FtraceController {
     size_t period_page_quota = 0;
   };
 
+  // Drains and parses a contiguous group of cpus on a dedicated thread, when
+  // FtraceConfig.cpu_reader_threads is set. Each worker writes into its own
+  // TraceWriter (and FtraceMetadata) per data source, as neither is
+  // thread-safe. The main thread only touches a worker while it's idle, i.e.
+  // outside of a worker pass (see RunOnWorkers()).
+  struct ReaderWorker {
+    struct Sink {
+      std::unique_ptr<TraceWriter> writer;
+      FtraceMetadata metadata;
+    };
+
+    std::unique_ptr<base::ThreadTaskRunner> thread;
+    size_t first_cpu = 0;
+    size_t num_cpus = 0;
+    base::PagedMemory parsing_mem;
+    std::map<FtraceDataSource*, std::unique_ptr<Sink>> sinks;
+    std::vector<CpuReader::ParsingTarget> targets;
+    bool all_cpus_done = true;  // Result of the last ReadCpus().
+  };
+
   FtraceController(const FtraceController&) = delete;
   FtraceController& operator=(const FtraceController&) = delete;
 
   // Periodic task that reads all per-cpu ftrace buffers.
   void ReadTick(int generation);
 
+  // Reads the cpus [first_cpu, first_cpu + num_cpus) up to their remaining
+  // |period_page_quota|. Returns false if at least one of them stopped because
+  // of kMaxPagesPerCpuPerReadTick and can still read more in this period.
+  bool ReadCpus(size_t first_cpu,
+                size_t num_cpus,
+                uint8_t* parsing_buf,
+                const std::vector<CpuReader::ParsingTarget>& targets);
+
+  std::vector<CpuReader::ParsingTarget> GetParsingTargets();
+
+  // A ReadTick() or Flush() fanned out to the workers.
+  struct WorkerPass {
+    std::function<void(ReaderWorker*)> fn;
+    std::function<void()> on_done;
+  };
+
+  // Runs |fn| on all the |workers_| without blocking, then |on_done| on this
+  // thread once all of them are done. The passes don't overlap: if one is in
+  // progress, this one starts once it's done.
+  void RunOnWorkers(std::function<void(ReaderWorker*)> fn,
+                    std::function<void()> on_done);
+
+  // Creates the per-worker sinks for the data sources started since the last
+  // pass, and posts the front of |worker_passes_| to all the workers.
+  void StartWorkerPass();
+
+  // Called on this thread each time a worker is done with pass |pass_id|.
+  void OnWorkerPassDone(uint64_t pass_id);
+
+  // Blocks until the workers are done with the current pass, if any, so that
+  // the data sources and cpu readers they use can be changed or destroyed.
+  // The |on_done| of the pass still runs later, as a task.
+  void WaitForWorkersIdle();
+
+  // Moves the pids, inodes etc. seen by the workers into the data sources'
+  // metadata, so the main thread can act on them as in the single thread
+  // case.
+  void MergeWorkerMetadata();
+
   uint32_t GetDrainPeriodMs();
 
-  void StartIfNeeded();
+  // Starts reading the cpus when |started| is the only started data source.
+  // Its config decides whether they are read on worker threads, for as long
+  // as any data source is active.
+  void StartIfNeeded(FtraceDataSource* started);
   void StopIfNeeded();
 
   base::TaskRunner* const task_runner_;
@@ -121,6 +188,10 @@ class FtraceController {
   int generation_ = 0;
   bool atrace_running_ = false;
   std::vector<PerCpuState> per_cpu_;  // empty if tracing isn't active
+  std::vector<std::unique_ptr<ReaderWorker>> workers_;  // empty if not used
+  std::deque<WorkerPass> worker_passes_;  // The front() one is in progress.
+  size_t busy_workers_ = 0;  // Number of workers yet to finish the front().
+  uint64_t worker_pass_id_ = 0;
   std::set<FtraceDataSource*> data_sources_;
   std::set<FtraceDataSource*> started_data_sources_;
   base::WeakPtrFactory<FtraceController> weak_factory_;  // Keep last.
@@ -20,6 +20,10 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
 #include "perfetto/ext/base/file_utils.h"
 #include "src/traced/probes/ftrace/compact_sched.h"
 #include "src/traced/probes/ftrace/cpu_reader.h"
@@ -192,9 +196,12 @@ class TestFtraceController : public FtraceController,
     return data_source;
   }
 
-  void OnFtraceDataWrittenIntoDataSourceBuffers() override {}
+  void OnFtraceDataWrittenIntoDataSourceBuffers() override {
+    num_data_written++;
+  }
 
   uint64_t now_ms = 0;
+  size_t num_data_written = 0;
 
  private:
   TestFtraceController(const TestFtraceController&) = delete;
@@ -472,6 +479,97 @@ TEST(FtraceControllerTest, PeriodicDrainConfig) {
   }
 }
 
+TEST(FtraceControllerTest, ReaderWorkers) {
+  auto controller = CreateTestController(true /* nice procfs */,
+                                         4 /* num cpus */);
+
+  // The workers post their completion back to the main thread.
+  std::mutex mutex;
+  std::condition_variable posted_cv;
+  std::deque<std::function<void()>> posted_tasks;
+  ON_CALL(*controller->runner(), PostTask(_))
+      .WillByDefault(Invoke([&](std::function<void()> task) {
+        std::lock_guard<std::mutex> lock(mutex);
+        posted_tasks.emplace_back(std::move(task));
+        posted_cv.notify_one();
+      }));
+  auto run_posted_tasks = [&](size_t num_tasks) {
+    for (size_t i = 0; i < num_tasks; i++) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        posted_cv.wait(lock, [&] { return !posted_tasks.empty(); });
+        task = std::move(posted_tasks.front());
+        posted_tasks.pop_front();
+      }
+      task();
+    }
+  };
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_cpu_reader_threads(2);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(data_source);
+  size_t num_writers_created = 0;
+  data_source->set_worker_trace_writer_factory([&num_writers_created] {
+    num_writers_created++;
+    return std::unique_ptr<TraceWriter>(new TraceWriterForTesting());
+  });
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+
+  // Each worker gets its own writer, created on the first read. Flush()
+  // doesn't wait for the workers: the flush completes once both of them have
+  // posted back.
+  EXPECT_EQ(0u, num_writers_created);
+  controller->Flush(1);
+  EXPECT_EQ(2u, num_writers_created);
+  EXPECT_EQ(0u, controller->num_data_written);
+  run_posted_tasks(2);
+  EXPECT_EQ(1u, controller->num_data_written);
+
+  // A flush requested while the workers are busy starts after the current one.
+  controller->Flush(2);
+  controller->Flush(3);
+  run_posted_tasks(2);
+  EXPECT_EQ(2u, controller->num_data_written);
+  run_posted_tasks(2);
+  EXPECT_EQ(3u, controller->num_data_written);
+  EXPECT_EQ(2u, num_writers_created);
+
+  // Removing the data source waits for the workers. The completion of their
+  // last pass is then ignored, as they've been stopped.
+  controller->Flush(4);
+  data_source.reset();
+  run_posted_tasks(2);
+  EXPECT_EQ(3u, controller->num_data_written);
+}
+
+TEST(FtraceControllerTest, ReaderWorkersDecidedByFirstDataSource) {
+  auto controller = CreateTestController(true /* nice procfs */,
+                                         4 /* num cpus */);
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  auto first_data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(first_data_source);
+  ASSERT_TRUE(controller->StartDataSource(first_data_source.get()));
+
+  // The cpus are already read on the main thread: the workers requested by a
+  // data source started later are not created.
+  config.set_cpu_reader_threads(2);
+  auto second_data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(second_data_source);
+  size_t num_writers_created = 0;
+  second_data_source->set_worker_trace_writer_factory([&num_writers_created] {
+    num_writers_created++;
+    return std::unique_ptr<TraceWriter>(new TraceWriterForTesting());
+  });
+  ASSERT_TRUE(controller->StartDataSource(second_data_source.get()));
+
+  controller->Flush(1);
+  EXPECT_EQ(1u, controller->num_data_written);
+  EXPECT_EQ(0u, num_writers_created);
+}
+
 TEST(FtraceMetadataTest, Clear) {
   FtraceMetadata metadata;
   metadata.inode_and_device.insert(std::make_pair(1, 1));
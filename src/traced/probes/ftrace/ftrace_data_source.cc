@@ -64,6 +64,12 @@ void FtraceDataSource::Start() {
   DumpFtraceStats(&stats_before_);
 }
 
+std::unique_ptr<TraceWriter> FtraceDataSource::CreateWorkerTraceWriter() {
+  if (!worker_trace_writer_factory_)
+    return nullptr;
+  return worker_trace_writer_factory_();
+}
+
 void FtraceDataSource::DumpFtraceStats(FtraceStats* stats) {
   if (controller_weak_)
     controller_weak_->DumpFtraceStats(stats);
@@ -83,6 +83,16 @@ class FtraceDataSource : public ProbesDataSource {
   FtraceMetadata* mutable_metadata() { return &metadata_; }
   TraceWriter* trace_writer() { return writer_.get(); }
 
+  // Creates an additional TraceWriter for the same target buffer as
+  // trace_writer(). Used by FtraceController when parsing on worker threads,
+  // as each worker needs its own packet sequence. Returns nullptr if no
+  // factory was set.
+  std::unique_ptr<TraceWriter> CreateWorkerTraceWriter();
+  void set_worker_trace_writer_factory(
+      std::function<std::unique_ptr<TraceWriter>()> factory) {
+    worker_trace_writer_factory_ = std::move(factory);
+  }
+
  private:
   // Hands out internal pointers to callbacks.
   FtraceDataSource(const FtraceDataSource&) = delete;
@@ -97,6 +107,7 @@ class FtraceDataSource : public ProbesDataSource {
   FtraceMetadata metadata_;
   FtraceStats stats_before_ = {};
   std::map<FlushRequestID, std::function<void()>> pending_flushes_;
+  std::function<std::unique_ptr<TraceWriter>()> worker_trace_writer_factory_;
 
   // -- Fields initialized by the Initialize() call:
   FtraceConfigId config_id_ = 0;
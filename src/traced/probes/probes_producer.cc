@@ -245,6 +245,12 @@ std::unique_ptr<ProbesDataSource> ProbesProducer::CreateFtraceDataSource(
   std::unique_ptr<FtraceDataSource> data_source(new FtraceDataSource(
       ftrace_->GetWeakPtr(), session_id, std::move(ftrace_config),
       endpoint_->CreateTraceWriter(buffer_id)));
+  data_source->set_worker_trace_writer_factory(
+      [this, buffer_id]() -> std::unique_ptr<TraceWriter> {
+        if (!endpoint_)
+          return nullptr;
+        return endpoint_->CreateTraceWriter(buffer_id);
+      });
   if (!ftrace_->AddDataSource(data_source.get())) {
     PERFETTO_ELOG("Failed to setup ftrace");
     return nullptr;
@@ -16,6 +16,8 @@
 
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 
+#include <inttypes.h>
+
 #include <algorithm>
 #include <limits>
 #include <utility>
@@ -25,6 +27,8 @@
 #include "perfetto/base/time.h"
 #include "perfetto/ext/tracing/core/commit_data_request.h"
 #include "perfetto/ext/tracing/core/shared_memory.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "src/protozero/filtering/message_filter.h"
 #include "src/tracing/core/null_trace_writer.h"
 #include "src/tracing/core/trace_writer_impl.h"
 
@@ -55,6 +59,12 @@ SharedMemoryABI::PageLayout SharedMemoryArbiterImpl::default_page_layout =
 // static
 constexpr BufferID SharedMemoryArbiterImpl::kInvalidBufferId;
 
+// static
+constexpr uint32_t SharedMemoryArbiterImpl::kDefaultAdaptiveMaxBatchDurationMs;
+
+// static
+constexpr uint32_t SharedMemoryArbiterImpl::kMinAdaptiveBatchDurationMs;
+
 // static
 std::unique_ptr<SharedMemoryArbiter> SharedMemoryArbiter::CreateInstance(
     SharedMemory* shared_memory,
@@ -258,17 +268,22 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
 
     if (!commit_data_req_) {
       commit_data_req_.reset(new CommitDataRequest());
+      if (adaptive_batching_enabled_)
+        batch_start_ms_ = base::GetWallTimeMs().count();
 
       // Flushing the commit is only supported while we're |fully_bound_|. If we
       // aren't, we'll flush when |fully_bound_| is updated.
       if (fully_bound_ && !delayed_flush_scheduled_) {
         weak_this = weak_ptr_factory_.GetWeakPtr();
         task_runner_to_post_delayed_callback_on = task_runner_;
-        flush_delay_ms = batch_commits_duration_ms_;
+        flush_delay_ms = GetBatchCommitsDurationLocked();
+        batching_stats_.last_batch_duration_ms = flush_delay_ms;
         delayed_flush_scheduled_ = true;
       }
     }
 
+    const size_t bytes_pending_before = bytes_pending_commit_;
+
     // If a valid chunk is specified, return it and attach it to the request.
     if (chunk.is_valid()) {
       PERFETTO_DCHECK(chunk.writer_id() == writer_id);
@@ -356,8 +371,11 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
     // accumulate the patch and a crash occurs before the patch is sent, the
     // service will not know of the patch and won't be able to reconstruct the
     // trace.
-    if (fully_bound_ &&
-        (last_patch_req || bytes_pending_commit_ >= shmem_abi_.size() / 2)) {
+    const size_t watermark = GetCommitFlushWatermarkLocked();
+    bool over_watermark = bytes_pending_commit_ >= watermark;
+    if (fully_bound_ && (last_patch_req || over_watermark)) {
+      if (over_watermark && bytes_pending_before < watermark)
+        batching_stats_.watermark_flushes++;
       weak_this = weak_ptr_factory_.GetWeakPtr();
       task_runner_to_post_delayed_callback_on = task_runner_;
       flush_delay_ms = 0;
@@ -460,6 +478,62 @@ void SharedMemoryArbiterImpl::SetBatchCommitsDuration(
   batch_commits_duration_ms_ = batch_commits_duration_ms;
 }
 
+void SharedMemoryArbiterImpl::SetAdaptiveBatchCommits(bool enabled) {
+  std::lock_guard<std::mutex> scoped_lock(lock_);
+  adaptive_batching_enabled_ = enabled;
+  commit_bytes_per_ms_ = 0;
+  if (enabled && commit_data_req_)
+    batch_start_ms_ = base::GetWallTimeMs().count();
+}
+
+void SharedMemoryArbiterImpl::SetTraceFilterForBuffer(
+    BufferID target_buffer,
+    const std::string& bytecode) {
+  std::lock_guard<std::mutex> scoped_lock(lock_);
+  if (bytecode.empty()) {
+    trace_filters_.erase(target_buffer);
+  } else {
+    trace_filters_[target_buffer] = bytecode;
+  }
+}
+
+SharedMemoryArbiterImpl::CommitBatchingStats
+SharedMemoryArbiterImpl::GetCommitBatchingStats() {
+  std::lock_guard<std::mutex> scoped_lock(lock_);
+  return batching_stats_;
+}
+
+size_t SharedMemoryArbiterImpl::GetCommitFlushWatermarkLocked() const {
+  // In adaptive mode batches can be much longer than the default (zero)
+  // period. Flush earlier, so that the chunks held back by the producer never
+  // prevent its writers from finding free chunks while the service catches up.
+  return adaptive_batching_enabled_ ? shmem_abi_.size() / 4
+                                    : shmem_abi_.size() / 2;
+}
+
+uint32_t SharedMemoryArbiterImpl::GetBatchCommitsDurationLocked() const {
+  if (!adaptive_batching_enabled_)
+    return batch_commits_duration_ms_;
+
+  const uint32_t max_duration_ms = batch_commits_duration_ms_
+                                       ? batch_commits_duration_ms_
+                                       : kDefaultAdaptiveMaxBatchDurationMs;
+
+  // Nothing observed yet (or the producer has been idle): batch for the whole
+  // period, the watermark will cut it short if a burst comes in.
+  if (commit_bytes_per_ms_ == 0)
+    return max_duration_ms;
+
+  // Otherwise aim at ending the period around the time the batch is expected
+  // to reach the flush watermark at the current commit rate.
+  uint64_t ms_to_watermark =
+      GetCommitFlushWatermarkLocked() / commit_bytes_per_ms_;
+  return static_cast<uint32_t>(
+      std::max(static_cast<uint64_t>(kMinAdaptiveBatchDurationMs),
+               std::min(static_cast<uint64_t>(max_duration_ms),
+                        ms_to_watermark)));
+}
+
 bool SharedMemoryArbiterImpl::EnableDirectSMBPatching() {
   std::lock_guard<std::mutex> scoped_lock(lock_);
   if (!direct_patching_supported_by_service_) {
@@ -545,6 +619,31 @@ void SharedMemoryArbiterImpl::FlushPendingCommitDataRequests(
         shmem_abi_.ReleaseChunkAsComplete(std::move(chunk));
       }
 
+      if (adaptive_batching_enabled_) {
+        // Fold the rate observed over this batch into an exponential moving
+        // average (alpha = 1/2), so that the next period adapts quickly to
+        // bursts while still smoothing out single outliers.
+        int64_t elapsed_ms = base::GetWallTimeMs().count() - batch_start_ms_;
+        uint64_t rate = bytes_pending_commit_ /
+                        static_cast<uint64_t>(std::max<int64_t>(elapsed_ms, 1));
+        commit_bytes_per_ms_ = (commit_bytes_per_ms_ + rate) / 2;
+      }
+      // Requests that only carry patches or a flush reply don't count.
+      if (commit_data_req_->chunks_to_move_size() > 0) {
+        batching_stats_.commit_requests++;
+        batching_stats_.chunks_committed +=
+            static_cast<uint64_t>(commit_data_req_->chunks_to_move_size());
+      }
+      // Let the service report the counters in its TraceStats.
+      if (adaptive_batching_enabled_ || batch_commits_duration_ms_) {
+        auto* stats = commit_data_req_->mutable_batching_stats();
+        stats->set_commit_requests(batching_stats_.commit_requests);
+        stats->set_chunks_committed(batching_stats_.chunks_committed);
+        stats->set_watermark_flushes(batching_stats_.watermark_flushes);
+        stats->set_last_batch_duration_ms(
+            batching_stats_.last_batch_duration_ms);
+      }
+
       req = std::move(commit_data_req_);
       bytes_pending_commit_ = 0;
     }
@@ -759,6 +858,8 @@ void SharedMemoryArbiterImpl::NotifyFlushComplete(FlushRequestID req_id) {
     // FlushPendingCommitDataRequests() task.
     if (!commit_data_req_) {
       commit_data_req_.reset(new CommitDataRequest());
+      if (adaptive_batching_enabled_)
+        batch_start_ms_ = base::GetWallTimeMs().count();
 
       // Flushing the commit is only supported while we're |fully_bound_|. If we
       // aren't, we'll flush when |fully_bound_| is updated.
@@ -788,6 +889,7 @@ std::unique_ptr<TraceWriter> SharedMemoryArbiterImpl::CreateTraceWriterInternal(
     BufferExhaustedPolicy buffer_exhausted_policy) {
   WriterID id;
   base::TaskRunner* task_runner_to_register_on = nullptr;
+  std::string filter_bytecode;
 
   {
     std::lock_guard<std::mutex> scoped_lock(lock_);
@@ -822,6 +924,9 @@ std::unique_ptr<TraceWriter> SharedMemoryArbiterImpl::CreateTraceWriterInternal(
       // Trace writer is bound, so arbiter should be bound to an endpoint, too.
       PERFETTO_CHECK(producer_endpoint_ && task_runner_);
       task_runner_to_register_on = task_runner_;
+      auto filter_it = trace_filters_.find(static_cast<BufferID>(target_buffer));
+      if (filter_it != trace_filters_.end())
+        filter_bytecode = filter_it->second;
     }
   }  // scoped_lock
 
@@ -835,8 +940,28 @@ std::unique_ptr<TraceWriter> SharedMemoryArbiterImpl::CreateTraceWriterInternal(
     });
   }
 
-  return std::unique_ptr<TraceWriter>(
+  std::unique_ptr<TraceWriterImpl> writer(
       new TraceWriterImpl(this, id, target_buffer, buffer_exhausted_policy));
+
+  // The filter is parsed outside of the lock. Each writer gets its own
+  // instance, as MessageFilter keeps state while filtering.
+  if (!filter_bytecode.empty()) {
+    std::unique_ptr<protozero::MessageFilter> filter(
+        new protozero::MessageFilter());
+    // Like in the service, the bytecode is rooted at perfetto.protos.Trace but
+    // writers deal with perfetto.protos.TracePacket(s), one level down.
+    uint32_t packet_field_id = TracePacket::kPacketFieldNumber;
+    if (filter->LoadFilterBytecode(filter_bytecode.data(),
+                                   filter_bytecode.size()) &&
+        filter->SetFilterRoot(&packet_field_id, 1)) {
+      writer->SetPacketFilter(std::move(filter));
+    } else {
+      PERFETTO_ELOG("Invalid trace filter for buffer %" PRIu32
+                    ", not filtering in the producer",
+                    static_cast<uint32_t>(target_buffer));
+    }
+  }
+  return std::unique_ptr<TraceWriter>(std::move(writer));
 }
 
 void SharedMemoryArbiterImpl::ReleaseWriterID(WriterID id) {
@@ -23,6 +23,7 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
 #include "perfetto/ext/base/weak_ptr.h"
@@ -91,6 +92,23 @@ class TaskRunner;
 //           ----
 class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
  public:
+  // Counters about how completed chunks have been coalesced into CommitData()
+  // IPCs. See GetCommitBatchingStats().
+  struct CommitBatchingStats {
+    // Number of CommitDataRequest sent to the service that moved chunks.
+    uint64_t commit_requests = 0;
+
+    // Number of chunks moved by the above requests.
+    uint64_t chunks_committed = 0;
+
+    // Number of batching periods that were cut short because the amount of
+    // completed-but-uncommitted chunks crossed the flush watermark.
+    uint64_t watermark_flushes = 0;
+
+    // Length of the most recently scheduled batching period.
+    uint32_t last_batch_duration_ms = 0;
+  };
+
   // See SharedMemoryArbiter::CreateInstance(). |start|, |size| define the
   // boundaries of the shared memory buffer. ProducerEndpoint and TaskRunner may
   // be |nullptr| if created unbound, see
@@ -150,6 +168,11 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
 
   void SetBatchCommitsDuration(uint32_t batch_commits_duration_ms) override;
 
+  void SetAdaptiveBatchCommits(bool enabled) override;
+
+  void SetTraceFilterForBuffer(BufferID target_buffer,
+                               const std::string& bytecode) override;
+
   bool EnableDirectSMBPatching() override;
 
   void SetDirectSMBPatchingSupportedByService() override;
@@ -158,6 +181,8 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
       std::function<void()> callback = {}) override;
   bool TryShutdown() override;
 
+  CommitBatchingStats GetCommitBatchingStats();
+
   base::TaskRunner* task_runner() const { return task_runner_; }
   size_t page_size() const { return shmem_abi_.page_size(); }
   size_t num_pages() const { return shmem_abi_.num_pages(); }
@@ -180,6 +205,14 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // reservation ID in |target_buffer_reservations_|.
   static constexpr BufferID kInvalidBufferId = 0;
 
+  // Upper bound for the batching period in adaptive mode, used when no
+  // explicit duration has been set via SetBatchCommitsDuration().
+  static constexpr uint32_t kDefaultAdaptiveMaxBatchDurationMs = 100;
+
+  // Lower bound for the batching period in adaptive mode. Below this, the
+  // flush watermark is a better trigger than the timer.
+  static constexpr uint32_t kMinAdaptiveBatchDurationMs = 1;
+
   static SharedMemoryABI::PageLayout default_page_layout;
 
   SharedMemoryArbiterImpl(const SharedMemoryArbiterImpl&) = delete;
@@ -202,6 +235,15 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   bool TryDirectPatchLocked(WriterID writer_id,
                             const Patch& patch,
                             bool chunk_needs_more_patching);
+
+  // Returns the amount of completed-but-uncommitted bytes above which pending
+  // commits are flushed immediately, regardless of the batching period.
+  size_t GetCommitFlushWatermarkLocked() const;
+
+  // Returns the length of the batching period to schedule for the next batch.
+  // This is |batch_commits_duration_ms_| unless adaptive batching is enabled.
+  uint32_t GetBatchCommitsDurationLocked() const;
+
   std::unique_ptr<TraceWriter> CreateTraceWriterInternal(
       MaybeUnboundBufferID target_buffer,
       BufferExhaustedPolicy);
@@ -262,6 +304,19 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // See SharedMemoryArbiter::SetBatchCommitsDuration.
   uint32_t batch_commits_duration_ms_ = 0;
 
+  // See SharedMemoryArbiter::SetAdaptiveBatchCommits.
+  bool adaptive_batching_enabled_ = false;
+
+  // Wall time at which the first commit of the current batch was enqueued in
+  // |commit_data_req_|. Used to estimate the commit rate in adaptive mode.
+  int64_t batch_start_ms_ = 0;
+
+  // Moving average of the observed commit rate, in bytes per millisecond.
+  // Only updated when adaptive batching is enabled.
+  uint64_t commit_bytes_per_ms_ = 0;
+
+  CommitBatchingStats batching_stats_;
+
   // See SharedMemoryArbiter::EnableDirectSMBPatching.
   bool direct_patching_enabled_ = false;
 
@@ -288,6 +343,10 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   std::map<MaybeUnboundBufferID, TargetBufferReservation>
       target_buffer_reservations_;
 
+  // Filter bytecode set via SetTraceFilterForBuffer(), keyed by target buffer.
+  // Only the buffers that have a filter have an entry.
+  std::map<BufferID, std::string> trace_filters_;
+
   // --- End lock-protected members ---
 
   // Keep at the end.
@@ -224,6 +224,66 @@ TEST_P(SharedMemoryArbiterImplTest, BatchCommits) {
   arbiter_->FlushPendingCommitDataRequests();
 }
 
+TEST_P(SharedMemoryArbiterImplTest, AdaptiveBatchCommits) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv1);
+
+  // As in the BatchCommits test, a very large upper bound stands for the end of
+  // the batching period never being reached within the test.
+  arbiter_->SetBatchCommitsDuration(UINT32_MAX);
+  arbiter_->SetAdaptiveBatchCommits(true);
+
+  // With one chunk per page, the adaptive watermark (1/4 of the SMB, i.e. 3.5
+  // pages) is crossed by the 4th chunk. The first three must stay batched.
+  PatchList ignored;
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _)).Times(0);
+  for (uint32_t i = 0; i < 3; i++) {
+    SharedMemoryABI::Chunk chunk =
+        arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDefault);
+    ASSERT_TRUE(chunk.is_valid());
+    arbiter_->ReturnCompletedChunk(std::move(chunk), 1, &ignored);
+    task_runner_->RunUntilIdle();
+  }
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+  EXPECT_EQ(0u, arbiter_->GetCommitBatchingStats().commit_requests);
+
+  // The 4th chunk cuts the batching period short and all four chunks are sent
+  // in a single request.
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([](const CommitDataRequest& req,
+                          MockProducerEndpoint::CommitDataCallback) {
+        ASSERT_EQ(4, req.chunks_to_move_size());
+        // The counters are reported to the service along with the commit.
+        ASSERT_TRUE(req.has_batching_stats());
+        EXPECT_EQ(1u, req.batching_stats().commit_requests());
+        EXPECT_EQ(4u, req.batching_stats().chunks_committed());
+        EXPECT_EQ(1u, req.batching_stats().watermark_flushes());
+      }));
+  SharedMemoryABI::Chunk chunk =
+      arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDefault);
+  ASSERT_TRUE(chunk.is_valid());
+  arbiter_->ReturnCompletedChunk(std::move(chunk), 1, &ignored);
+  task_runner_->RunUntilIdle();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+
+  // A request that only replies to a flush doesn't count.
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([](const CommitDataRequest& req,
+                          MockProducerEndpoint::CommitDataCallback) {
+        ASSERT_EQ(0, req.chunks_to_move_size());
+        EXPECT_EQ(1u, req.batching_stats().commit_requests());
+      }));
+  arbiter_->NotifyFlushComplete(42);
+  task_runner_->RunUntilIdle();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+
+  auto stats = arbiter_->GetCommitBatchingStats();
+  EXPECT_EQ(1u, stats.commit_requests);
+  EXPECT_EQ(4u, stats.chunks_committed);
+  EXPECT_EQ(1u, stats.watermark_flushes);
+  EXPECT_EQ(UINT32_MAX, stats.last_batch_duration_ms);
+}
+
 // Helper for verifying trace writer id allocations.
 class TraceWriterIdChecker : public FakeProducerEndpoint {
  public:
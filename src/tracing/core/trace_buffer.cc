@@ -66,14 +66,16 @@ constexpr size_t TraceBuffer::InlineChunkHeaderSize = sizeof(ChunkRecord);
 
 // static
 std::unique_ptr<TraceBuffer> TraceBuffer::Create(size_t size_in_bytes,
-                                                 OverwritePolicy pol) {
-  std::unique_ptr<TraceBuffer> trace_buffer(new TraceBuffer(pol));
+                                                 OverwritePolicy pol,
+                                                 int memory_flags) {
+  std::unique_ptr<TraceBuffer> trace_buffer(new TraceBuffer(pol, memory_flags));
   if (!trace_buffer->Initialize(size_in_bytes))
     return nullptr;
   return trace_buffer;
 }
 
-TraceBuffer::TraceBuffer(OverwritePolicy pol) : overwrite_policy_(pol) {
+TraceBuffer::TraceBuffer(OverwritePolicy pol, int memory_flags)
+    : overwrite_policy_(pol), memory_flags_(memory_flags) {
   // See comments in ChunkRecord for the rationale of this.
   static_assert(sizeof(ChunkRecord) == sizeof(SharedMemoryABI::PageHeader) +
                                            sizeof(SharedMemoryABI::ChunkHeader),
@@ -87,13 +89,15 @@ bool TraceBuffer::Initialize(size_t size) {
       SharedMemoryABI::kMinPageSize % sizeof(ChunkRecord) == 0,
       "sizeof(ChunkRecord) must be an integer divider of a page size");
   data_ = base::PagedMemory::Allocate(
-      size, base::PagedMemory::kMayFail | base::PagedMemory::kDontCommit);
+      size, base::PagedMemory::kMayFail | base::PagedMemory::kDontCommit |
+                memory_flags_);
   if (!data_.IsValid()) {
     PERFETTO_ELOG("Trace buffer allocation failed (size: %zu)", size);
     return false;
   }
   size_ = size;
   stats_.set_buffer_size(size);
+  SetBackingStats();
   max_chunk_size_ = std::min(size, ChunkRecord::kMaxSize);
   wptr_ = begin();
   index_.clear();
@@ -102,6 +106,24 @@ bool TraceBuffer::Initialize(size_t size) {
   return true;
 }
 
+void TraceBuffer::SetBackingStats() {
+  using BufferStats = TraceStats::BufferStats;
+  switch (data_.backing()) {
+    case base::PagedMemory::Backing::kRegularPages:
+      stats_.set_page_backing(BufferStats::PAGE_BACKING_REGULAR);
+      break;
+    case base::PagedMemory::Backing::kTransparentHugePages:
+      stats_.set_page_backing(
+          BufferStats::PAGE_BACKING_TRANSPARENT_HUGE_PAGES);
+      break;
+    case base::PagedMemory::Backing::kExplicitHugePages:
+      stats_.set_page_backing(BufferStats::PAGE_BACKING_EXPLICIT_HUGE_PAGES);
+      break;
+  }
+  if (data_.numa_node() >= 0)
+    stats_.set_numa_node(data_.numa_node());
+}
+
 // Note: |src| points to a shmem region that is shared with the producer. Assume
 // that the producer is malicious and will change the content of |src|
 // while we execute here. Don't do any processing on it other than memcpy().
@@ -114,6 +136,7 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
                                      bool chunk_complete,
                                      const uint8_t* src,
                                      size_t size) {
+  PERFETTO_DCHECK(!read_only_);
   // |record_size| = |size| + sizeof(ChunkRecord), rounded up to avoid to end
   // up in a fragmented state where size_to_end() < sizeof(ChunkRecord).
   const size_t record_size =
@@ -415,6 +438,7 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
                                         const Patch* patches,
                                         size_t patches_size,
                                         bool other_patches_pending) {
+  PERFETTO_DCHECK(!read_only_);
   ChunkMeta::Key key(producer_id, writer_id, chunk_id);
   auto it = index_.find(key);
   if (it == index_.end()) {
@@ -466,6 +490,41 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
   return true;
 }
 
+std::unique_ptr<TraceBuffer> TraceBuffer::CloneReadOnly() const {
+  std::unique_ptr<TraceBuffer> clone(
+      new TraceBuffer(overwrite_policy_, memory_flags_));
+  if (!clone->Initialize(size_))
+    return nullptr;
+
+  // The index and the read iterator point into |data_|, hence the copy of the
+  // buffer contents must be followed by a rebase of all the ChunkRecord
+  // pointers onto the new buffer.
+  clone->data_.EnsureCommitted(used_size_);
+  memcpy(clone->begin(), begin(), used_size_);
+  clone->used_size_ = used_size_;
+  clone->wptr_ = clone->begin() + (wptr_ - begin());
+  clone->discard_writes_ = discard_writes_;
+  clone->last_chunk_id_written_ = last_chunk_id_written_;
+  clone->stats_ = stats_;
+  clone->SetBackingStats();
+  clone->read_only_ = true;
+
+  for (const auto& kv : index_) {
+    const ChunkMeta& meta = kv.second;
+    size_t offset = static_cast<size_t>(
+        reinterpret_cast<const uint8_t*>(meta.chunk_record) - begin());
+    ChunkMeta clone_meta(clone->GetChunkRecordAt(clone->begin() + offset),
+                         meta.num_fragments, meta.is_complete(), meta.flags,
+                         meta.trusted_uid);
+    clone_meta.index_flags = meta.index_flags;
+    clone_meta.num_fragments_read = meta.num_fragments_read;
+    clone_meta.cur_fragment_offset = meta.cur_fragment_offset;
+    clone->index_.emplace_hint(clone->index_.end(), kv.first, clone_meta);
+  }
+  clone->read_iter_ = clone->GetReadIterForSequence(clone->index_.end());
+  return clone;
+}
+
 void TraceBuffer::BeginRead() {
   read_iter_ = GetReadIterForSequence(index_.begin());
 #if PERFETTO_DCHECK_IS_ON()
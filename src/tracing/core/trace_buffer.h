@@ -20,9 +20,11 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <algorithm>
 #include <array>
 #include <limits>
 #include <map>
+#include <memory>
 #include <tuple>
 
 #include "perfetto/base/logging.h"
@@ -161,9 +163,12 @@ class TraceBuffer {
     WriterID writer_id;
   };
 
-  // Can return nullptr if the memory allocation fails.
+  // Can return nullptr if the memory allocation fails. |memory_flags| is a
+  // bitmask of base::PagedMemory::AllocationFlags which selects the backing of
+  // the buffer (huge pages, NUMA node), in addition to the ones always used.
   static std::unique_ptr<TraceBuffer> Create(size_t size_in_bytes,
-                                             OverwritePolicy = kOverwrite);
+                                             OverwritePolicy = kOverwrite,
+                                             int memory_flags = 0);
 
   ~TraceBuffer();
 
@@ -259,8 +264,18 @@ class TraceBuffer {
                            PacketSequenceProperties* sequence_properties,
                            bool* previous_packet_on_sequence_dropped);
 
+  // Creates a read-only copy of the buffer, including the read state of each
+  // sequence (i.e. packets already read from this buffer won't be returned
+  // again by the copy). Only the portion of the buffer that has been written at
+  // least once is copied, so cloning a mostly empty buffer is cheap and doesn't
+  // commit memory for its untouched pages. The returned buffer can be read via
+  // BeginRead()/ReadNextTracePacket() but must not be written into. Returns
+  // nullptr if the memory allocation fails.
+  std::unique_ptr<TraceBuffer> CloneReadOnly() const;
+
   const TraceStats::BufferStats& stats() const { return stats_; }
   size_t size() const { return size_; }
+  bool read_only() const { return read_only_; }
 
  private:
   friend class TraceBufferTest;
@@ -497,12 +512,15 @@ class TraceBuffer {
     kFailedEmptyPacket,
   };
 
-  explicit TraceBuffer(OverwritePolicy);
+  TraceBuffer(OverwritePolicy, int memory_flags);
   TraceBuffer(const TraceBuffer&) = delete;
   TraceBuffer& operator=(const TraceBuffer&) = delete;
 
   bool Initialize(size_t size);
 
+  // Reports the backing of |data_| in |stats_|.
+  void SetBackingStats();
+
   // Returns an object that allows to iterate over chunks in the |index_| that
   // have the same {ProducerID, WriterID} of
   // |seq_begin.first.{producer,writer}_id|. |seq_begin| must be an iterator to
@@ -612,6 +630,8 @@ class TraceBuffer {
     }
     const size_t rounding_size = record.size - sizeof(record) - size;
     memset(wptr + sizeof(record) + size, 0, rounding_size);
+    used_size_ = std::max(used_size_,
+                          static_cast<size_t>(wptr - begin()) + record.size);
   }
 
   uint8_t* begin() const { return reinterpret_cast<uint8_t*>(data_.Get()); }
@@ -623,6 +643,10 @@ class TraceBuffer {
   size_t max_chunk_size_ = 0;  // Max size in bytes allowed for a chunk.
   uint8_t* wptr_ = nullptr;    // Write pointer.
 
+  // High watermark of the bytes of |data_| ever written, starting from the
+  // beginning. Everything past it is guaranteed to be zero-filled.
+  size_t used_size_ = 0;
+
   // An index that keeps track of the positions and metadata of each
   // ChunkRecord.
   ChunkMap index_;
@@ -634,10 +658,16 @@ class TraceBuffer {
   // See comments at the top of the file.
   OverwritePolicy overwrite_policy_ = kOverwrite;
 
+  // The extra base::PagedMemory::AllocationFlags passed to Create().
+  int memory_flags_ = 0;
+
   // Only used when |overwrite_policy_ == kDiscard|. This is set the first time
   // a write fails because it would overwrite unread chunks.
   bool discard_writes_ = false;
 
+  // Set on buffers created by CloneReadOnly().
+  bool read_only_ = false;
+
   // Keeps track of the highest ChunkID written for a given sequence, taking
   // into account a potential overflow of ChunkIDs. In the case of overflow,
   // stores the highest ChunkID written since the overflow.
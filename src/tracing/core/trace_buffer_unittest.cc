@@ -21,6 +21,8 @@
 #include <sstream>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/paged_memory.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/shared_memory_abi.h"
@@ -136,6 +138,12 @@ class TraceBufferTest : public testing::Test {
     return keys;
   }
 
+  // Swaps the buffer under test with |other|, so that the helpers above
+  // (e.g. ReadPacket()) can be used on a different buffer.
+  void SwapBuffer(std::unique_ptr<TraceBuffer>* other) {
+    trace_buffer_.swap(*other);
+  }
+
   TraceBuffer* trace_buffer() { return trace_buffer_.get(); }
   size_t size_to_end() { return trace_buffer_->size_to_end(); }
 
@@ -1833,6 +1841,96 @@ TEST_F(TraceBufferTest, MissingPacketsOnSequence) {
   ASSERT_TRUE(previous_packet_dropped);
 }
 
+TEST_F(TraceBufferTest, Clone_ReadsSnapshot) {
+  ResetBuffer(4096);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(10, 'a')
+      .AddPacket(20, 'b', kContOnNextChunk)
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(30, 'c')
+      .CopyIntoTraceBuffer();
+
+  // Packets that have been already read before cloning are not read again.
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'a')));
+
+  std::unique_ptr<TraceBuffer> clone = trace_buffer()->CloneReadOnly();
+  ASSERT_TRUE(clone);
+  EXPECT_TRUE(clone->read_only());
+  EXPECT_FALSE(trace_buffer()->read_only());
+  EXPECT_EQ(trace_buffer()->stats().chunks_written(),
+            clone->stats().chunks_written());
+  EXPECT_EQ(trace_buffer()->stats().bytes_written(),
+            clone->stats().bytes_written());
+
+  // The original buffer is still writable and the clone doesn't see the
+  // chunks written after the snapshot.
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(1))
+      .AddPacket(20, 'd', kContFromPrevChunk)
+      .CopyIntoTraceBuffer();
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(20, 'b'),
+                                        FakePacketFragment(20, 'd')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(30, 'c')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  SwapBuffer(&clone);
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(30, 'c')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, Clone_AfterWrapping) {
+  ResetBuffer(4096);
+  for (ChunkID chunk_id = 0; chunk_id < 10; chunk_id++) {
+    char seed = static_cast<char>('a' + chunk_id);
+    CreateChunk(ProducerID(1), WriterID(1 + chunk_id % 2), chunk_id)
+        .AddPacket(900, seed)
+        .CopyIntoTraceBuffer();
+  }
+  std::unique_ptr<TraceBuffer> clone = trace_buffer()->CloneReadOnly();
+  ASSERT_TRUE(clone);
+
+  std::vector<std::vector<FakePacketFragment>> original_packets;
+  trace_buffer()->BeginRead();
+  for (auto packet = ReadPacket(); !packet.empty(); packet = ReadPacket())
+    original_packets.push_back(std::move(packet));
+  ASSERT_FALSE(original_packets.empty());
+
+  SwapBuffer(&clone);
+  trace_buffer()->BeginRead();
+  for (const auto& packet : original_packets)
+    ASSERT_EQ(packet, ReadPacket());
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, PageBackingStats) {
+  using BufferStats = TraceStats::BufferStats;
+  ResetBuffer(4096);
+  EXPECT_EQ(BufferStats::PAGE_BACKING_REGULAR,
+            trace_buffer()->stats().page_backing());
+  EXPECT_FALSE(trace_buffer()->stats().has_numa_node());
+
+  // Huge pages are best effort: the buffer is always created, with either
+  // huge pages or regular pages.
+  const int flags = base::PagedMemory::kExplicitHugePages |
+                    base::PagedMemory::kLocalNumaNode;
+  std::unique_ptr<TraceBuffer> buf =
+      TraceBuffer::Create(4096, TraceBuffer::kOverwrite, flags);
+  ASSERT_TRUE(buf);
+  std::unique_ptr<TraceBuffer> clone = buf->CloneReadOnly();
+  ASSERT_TRUE(clone);
+  EXPECT_EQ(buf->stats().has_numa_node(), clone->stats().has_numa_node());
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) && \
+    !PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  EXPECT_EQ(BufferStats::PAGE_BACKING_REGULAR, buf->stats().page_backing());
+  EXPECT_EQ(BufferStats::PAGE_BACKING_REGULAR, clone->stats().page_backing());
+  EXPECT_FALSE(buf->stats().has_numa_node());
+#endif
+}
+
 // TODO(primiano): test stats().
 // TODO(primiano): test multiple streams interleaved.
 // TODO(primiano): more testing on packet merging.
@@ -27,6 +27,7 @@
 #include "perfetto/protozero/message.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/protozero/root_message.h"
+#include "src/protozero/filtering/message_filter.h"
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
@@ -71,10 +72,20 @@ TraceWriterImpl::~TraceWriterImpl() {
   shmem_arbiter_->ReleaseWriterID(id_);
 }
 
+// static
+constexpr size_t TraceWriterImpl::kMinPacketSizeToFilter;
+
+void TraceWriterImpl::SetPacketFilter(
+    std::unique_ptr<protozero::MessageFilter> filter) {
+  PERFETTO_DCHECK(!cur_chunk_.is_valid());
+  packet_filter_ = std::move(filter);
+}
+
 void TraceWriterImpl::Flush(std::function<void()> callback) {
   // Flush() cannot be called in the middle of a TracePacket.
   PERFETTO_CHECK(cur_packet_->is_finalized());
 
+  MaybeFilterLastPacket();
   if (cur_chunk_.is_valid()) {
     shmem_arbiter_->ReturnCompletedChunk(std::move(cur_chunk_), target_buffer_,
                                          &patch_list_);
@@ -108,6 +119,10 @@ TraceWriterImpl::TracePacketHandle TraceWriterImpl::NewTracePacket() {
 
   fragmenting_packet_ = false;
 
+  // The previous packet is complete now. Filter it before checking how much
+  // space is left in the chunk, as filtering can only shrink it.
+  MaybeFilterLastPacket();
+
   // Reserve space for the size of the message. Note: this call might re-enter
   // into this class invoking GetNewBuffer() if there isn't enough space or if
   // this is the very first call to NewTracePacket().
@@ -139,6 +154,8 @@ TraceWriterImpl::TracePacketHandle TraceWriterImpl::NewTracePacket() {
   memset(header, 0, kPacketHeaderSize);
   cur_packet_->set_size_field(header);
   last_packet_size_field_ = header;
+  if (packet_filter_ && !drop_packets_)
+    filterable_packet_size_field_ = header;
 
   TracePacketHandle handle(cur_packet_.get());
   cur_fragment_start_ = protobuf_stream_writer_.write_ptr();
@@ -169,6 +186,10 @@ TraceWriterImpl::TracePacketHandle TraceWriterImpl::NewTracePacket() {
 // In this case |fragmenting_packet_| == false and we just want a new chunk
 // without creating any fragments.
 protozero::ContiguousMemoryRange TraceWriterImpl::GetNewBuffer() {
+  // A packet that spans across chunks can't be filtered in place anymore.
+  if (fragmenting_packet_)
+    filterable_packet_size_field_ = nullptr;
+
   if (fragmenting_packet_ && drop_packets_) {
     // We can't write the remaining data of the fragmenting packet to a new
     // chunk, because we have already lost some of its data in the garbage
@@ -365,6 +386,36 @@ protozero::ContiguousMemoryRange TraceWriterImpl::GetNewBuffer() {
   return protozero::ContiguousMemoryRange{payload_begin, cur_chunk_.end()};
 }
 
+void TraceWriterImpl::MaybeFilterLastPacket() {
+  uint8_t* const size_field = filterable_packet_size_field_;
+  filterable_packet_size_field_ = nullptr;
+  if (!size_field)
+    return;
+
+  PERFETTO_DCHECK(cur_packet_->is_finalized());
+  PERFETTO_DCHECK(cur_chunk_.is_valid());
+  uint8_t* const payload = size_field + kPacketHeaderSize;
+  uint8_t* const end = protobuf_stream_writer_.write_ptr();
+  PERFETTO_DCHECK(payload <= end && end <= cur_chunk_.end());
+  const size_t size = static_cast<size_t>(end - payload);
+  if (size < kMinPacketSizeToFilter)
+    return;
+
+  // If the packet can't be parsed, leave it as-is and let the service deal
+  // with it, as it would happen without producer-side filtering.
+  if (filter_buf_.size() < size)
+    filter_buf_.resize(size);
+  size_t filtered_size = 0;
+  if (!packet_filter_->FilterMessageInto(payload, size, filter_buf_.data(),
+                                         &filtered_size) ||
+      filtered_size >= size) {
+    return;
+  }
+  memcpy(payload, filter_buf_.data(), filtered_size);
+  WriteRedundantVarInt(static_cast<uint32_t>(filtered_size), size_field);
+  protobuf_stream_writer_.Rewind(size - filtered_size);
+}
+
 WriterID TraceWriterImpl::writer_id() const {
   return id_;
 }
@@ -17,6 +17,9 @@
 #ifndef SRC_TRACING_CORE_TRACE_WRITER_IMPL_H_
 #define SRC_TRACING_CORE_TRACE_WRITER_IMPL_H_
 
+#include <memory>
+#include <vector>
+
 #include "perfetto/base/proc_utils.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/shared_memory_abi.h"
@@ -29,6 +32,10 @@
 #include "perfetto/tracing/buffer_exhausted_policy.h"
 #include "src/tracing/core/patch_list.h"
 
+namespace protozero {
+class MessageFilter;
+}  // namespace protozero
+
 namespace perfetto {
 
 class SharedMemoryArbiterImpl;
@@ -52,7 +59,22 @@ class TraceWriterImpl : public TraceWriter,
     return protobuf_stream_writer_.written();
   }
 
-  void ResetChunkForTesting() { cur_chunk_ = SharedMemoryABI::Chunk(); }
+  // Makes the writer strip, from each packet that fits entirely in a chunk,
+  // the fields that are not allowed by |filter| before the chunk is returned
+  // to the arbiter. Packets smaller than kMinPacketSizeToFilter and packets
+  // fragmented across chunks are left untouched (the service filters them
+  // anyways at readout time). Must be called before the first packet is
+  // written. See SharedMemoryArbiter::SetTraceFilterForBuffer().
+  void SetPacketFilter(std::unique_ptr<protozero::MessageFilter> filter);
+
+  // Filtering a packet requires a copy of it, into |filter_buf_|. Below this
+  // size the savings in SMB space don't pay off.
+  static constexpr size_t kMinPacketSizeToFilter = 128;
+
+  void ResetChunkForTesting() {
+    cur_chunk_ = SharedMemoryABI::Chunk();
+    filterable_packet_size_field_ = nullptr;
+  }
   bool drop_packets_for_testing() const { return drop_packets_; }
 
  private:
@@ -62,6 +84,10 @@ class TraceWriterImpl : public TraceWriter,
   // ScatteredStreamWriter::Delegate implementation.
   protozero::ContiguousMemoryRange GetNewBuffer() override;
 
+  // Applies |packet_filter_| in place to the last packet written, if it
+  // is still filterable (see |filterable_packet_size_field_|).
+  void MaybeFilterLastPacket();
+
   // The per-producer arbiter that coordinates access to the shared memory
   // buffer from several threads.
   SharedMemoryArbiterImpl* const shmem_arbiter_;
@@ -132,6 +158,18 @@ class TraceWriterImpl : public TraceWriter,
   // chunks, if they are still around.
   PatchList patch_list_;
 
+  // Set via SetPacketFilter(). When null, packets are not filtered.
+  std::unique_ptr<protozero::MessageFilter> packet_filter_;
+
+  // Scratch buffer the packets are filtered into, before being copied back
+  // into the chunk. Grows up to the size of the largest packet filtered.
+  std::vector<uint8_t> filter_buf_;
+
+  // Points to the size field of the last packet written, as long as that
+  // packet is entirely contained in |cur_chunk_| and hasn't been filtered yet.
+  // Reset to |nullptr| as soon as the packet fragments into another chunk.
+  uint8_t* filterable_packet_size_field_ = nullptr;
+
   // PID of the process that created the trace writer. Used for a DCHECK that
   // aims to detect unsupported process forks while tracing.
   const base::PlatformProcessId process_id_;
@@ -20,8 +20,10 @@
 #include "perfetto/ext/tracing/core/commit_data_request.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "perfetto/ext/tracing/core/tracing_service.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "src/base/test/gtest_test_suite.h"
 #include "src/base/test/test_task_runner.h"
+#include "src/protozero/filtering/filter_bytecode_generator.h"
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 #include "src/tracing/test/aligned_buffer_test.h"
 #include "src/tracing/test/fake_producer_endpoint.h"
@@ -497,6 +499,65 @@ TEST_P(TraceWriterImplTest, FlushAfterFragmentingPacketWhileBufferExhausted) {
   writer->Flush();
 }
 
+TEST_P(TraceWriterImplTest, ProducerSideFilter) {
+  const BufferID kBufId = 42;
+
+  // Trace -> TracePacket -> TestEvent, allowing only TestEvent.seq_value.
+  protozero::FilterBytecodeGenerator filter;
+  filter.AddNestedField(1 /* Trace.packet */, 1);
+  filter.EndMessage();
+  filter.AddNestedField(900 /* TracePacket.for_testing */, 2);
+  filter.EndMessage();
+  filter.AddSimpleField(2 /* TestEvent.seq_value */);
+  filter.EndMessage();
+  arbiter_->SetTraceFilterForBuffer(kBufId, filter.Serialize());
+
+  std::unique_ptr<TraceWriter> writer = arbiter_->CreateTraceWriter(kBufId);
+  std::string large_str(TraceWriterImpl::kMinPacketSizeToFilter, 'x');
+  {
+    auto packet = writer->NewTracePacket();
+    auto* event = packet->set_for_testing();
+    event->set_str(large_str);
+    event->set_seq_value(1);
+  }
+  {
+    // Packets smaller than kMinPacketSizeToFilter are left to the service.
+    auto packet = writer->NewTracePacket();
+    auto* event = packet->set_for_testing();
+    event->set_str("small");
+    event->set_seq_value(2);
+  }
+  writer->Flush();
+
+  SharedMemoryABI* abi = arbiter_->shmem_abi_for_testing();
+  auto chunk = abi->TryAcquireChunkForReading(0, 0);
+  ASSERT_TRUE(chunk.is_valid());
+  ASSERT_EQ(2u, chunk.header()->packets.load().count);
+
+  const uint8_t* ptr = chunk.payload_begin();
+  const uint8_t* end = chunk.end();
+  std::vector<std::string> packets;
+  for (int i = 0; i < 2; i++) {
+    uint64_t packet_size = 0;
+    ptr = protozero::proto_utils::ParseVarInt(ptr, end, &packet_size);
+    ASSERT_LE(ptr + packet_size, end);
+    packets.emplace_back(reinterpret_cast<const char*>(ptr),
+                         static_cast<size_t>(packet_size));
+    ptr += packet_size;
+  }
+
+  protos::pbzero::TracePacket::Decoder filtered(packets[0]);
+  protos::pbzero::TestEvent::Decoder filtered_event(filtered.for_testing());
+  EXPECT_FALSE(filtered_event.has_str());
+  EXPECT_EQ(1u, filtered_event.seq_value());
+
+  protos::pbzero::TracePacket::Decoder unfiltered(packets[1]);
+  protos::pbzero::TestEvent::Decoder unfiltered_event(
+      unfiltered.for_testing());
+  EXPECT_EQ("small", unfiltered_event.str().ToStdString());
+  EXPECT_EQ(2u, unfiltered_event.seq_value());
+}
+
 // TODO(primiano): add multi-writer test.
 // TODO(primiano): add Flush() test.
 
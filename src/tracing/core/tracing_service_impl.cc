@@ -56,6 +56,7 @@
 #include "perfetto/base/task_runner.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/metatrace.h"
+#include "perfetto/ext/base/paged_memory.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/base/utils.h"
@@ -152,6 +153,111 @@ ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) ||
         // PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
 
+// Bump allocator for the small trusted-field slices that ReadBuffers() appends
+// to each packet, to avoid one heap allocation per packet read. The memory is
+// released when the arena goes out of scope, at the end of ReadBuffers(). This
+// is the same lifetime of the other (non-owned) slices of the packets, which
+// point straight into the TraceBuffer.
+class SliceArena {
+ public:
+  uint8_t* Allocate(size_t size) {
+    PERFETTO_DCHECK(size <= kBlockSize);
+    if (block_used_ + size > kBlockSize) {
+      blocks_.emplace_back(new uint8_t[kBlockSize]);
+      block_used_ = 0;
+    }
+    uint8_t* ptr = &blocks_.back()[block_used_];
+    block_used_ += size;
+    return ptr;
+  }
+
+ private:
+  static constexpr size_t kBlockSize = 32 * 1024;
+
+  std::vector<std::unique_ptr<uint8_t[]>> blocks_;
+  size_t block_used_ = kBlockSize;
+};
+
+// Builds the scatter-gather list used to drain a batch of packets into a file
+// with writev(). Large slices are referenced in place (they typically point
+// into the TraceBuffer). Small slices (the proto preambles and the trusted
+// fields appended by the service) are copied into a scratch buffer, so that the
+// trusted fields of a packet and the preamble of the next one end up in a
+// single iovec. Entries that are contiguous in memory are merged. This roughly
+// halves the number of iovecs (and hence of writev() calls) per packet.
+class IovecBuilder {
+ public:
+  // Slices up to this size are copied rather than referenced.
+  static constexpr size_t kMaxCopiedSliceSize = 32;
+
+  // |max_iovecs| and |scratch_size| are upper bounds computed by the caller.
+  // The scratch buffer is never reallocated, as the iovecs point into it.
+  IovecBuilder(size_t max_iovecs, size_t scratch_size)
+      : iovecs_(new struct iovec[max_iovecs]),
+        max_iovecs_(max_iovecs),
+        scratch_(new char[scratch_size]),
+        scratch_size_(scratch_size) {}
+
+  // Snapshot of the builder state, to drop a partially appended packet.
+  struct Mark {
+    size_t num_iovecs;
+    size_t last_iovec_len;
+    size_t scratch_used;
+  };
+
+  void Append(const void* data, size_t size) {
+    if (size == 0)
+      return;
+    if (size <= kMaxCopiedSliceSize) {
+      PERFETTO_CHECK(scratch_used_ + size <= scratch_size_);
+      char* dst = &scratch_[scratch_used_];
+      memcpy(dst, data, size);
+      scratch_used_ += size;
+      AppendIovec(dst, size);
+      return;
+    }
+    // writev() doesn't change the passed pointer. However, struct iovec takes
+    // a non-const ptr because it's the same struct used by readv(). Hence the
+    // const_cast here.
+    AppendIovec(static_cast<char*>(const_cast<void*>(data)), size);
+  }
+
+  Mark GetMark() const {
+    return {num_iovecs_, num_iovecs_ ? iovecs_[num_iovecs_ - 1].iov_len : 0,
+            scratch_used_};
+  }
+
+  void RewindTo(const Mark& mark) {
+    num_iovecs_ = mark.num_iovecs;
+    if (num_iovecs_)
+      iovecs_[num_iovecs_ - 1].iov_len = mark.last_iovec_len;
+    scratch_used_ = mark.scratch_used;
+  }
+
+  struct iovec* iovecs() { return iovecs_.get(); }
+  size_t num_iovecs() const { return num_iovecs_; }
+
+ private:
+  void AppendIovec(char* start, size_t size) {
+    if (num_iovecs_) {
+      struct iovec& last = iovecs_[num_iovecs_ - 1];
+      if (static_cast<char*>(last.iov_base) + last.iov_len == start) {
+        last.iov_len += size;
+        return;
+      }
+    }
+    PERFETTO_CHECK(num_iovecs_ < max_iovecs_);
+    iovecs_[num_iovecs_++] = {start, size};
+  }
+
+  std::unique_ptr<struct iovec[]> iovecs_;
+  const size_t max_iovecs_;
+  size_t num_iovecs_ = 0;
+  std::unique_ptr<char[]> scratch_;
+  const size_t scratch_size_;
+  size_t scratch_used_ = 0;
+};
+
 // Partially encodes a CommitDataRequest in an int32 for the purposes of
 // metatracing. Note that it encodes only the bottom 10 bits of the producer id
 // (which is technically 16 bits wide).
@@ -838,8 +944,21 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
         buffer_cfg.fill_policy() == TraceConfig::BufferConfig::DISCARD
             ? TraceBuffer::kDiscard
             : TraceBuffer::kOverwrite;
+    int memory_flags = 0;
+    switch (buffer_cfg.page_backing()) {
+      case TraceConfig::BufferConfig::PAGE_BACKING_UNSPECIFIED:
+        break;
+      case TraceConfig::BufferConfig::PAGE_BACKING_TRANSPARENT_HUGE_PAGES:
+        memory_flags |= base::PagedMemory::kTransparentHugePages;
+        break;
+      case TraceConfig::BufferConfig::PAGE_BACKING_EXPLICIT_HUGE_PAGES:
+        memory_flags |= base::PagedMemory::kExplicitHugePages;
+        break;
+    }
+    if (buffer_cfg.numa_local())
+      memory_flags |= base::PagedMemory::kLocalNumaNode;
     auto it_and_inserted = buffers_.emplace(
-        global_id, TraceBuffer::Create(buf_size_bytes, policy));
+        global_id, TraceBuffer::Create(buf_size_bytes, policy, memory_flags));
     PERFETTO_DCHECK(it_and_inserted.second);  // buffers_.count(global_id) == 0.
     std::unique_ptr<TraceBuffer>& trace_buffer = it_and_inserted.first->second;
     if (!trace_buffer) {
@@ -1973,6 +2092,11 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
   std::vector<TracePacket> packets;
   packets.reserve(1024);  // Just an educated guess to avoid trivial expansions.
 
+  // Backs the trusted-field slices appended to each packet below. |packets|
+  // only hold non-owned slices into it, so it must not be destroyed before the
+  // packets have been written out or passed to the consumer.
+  SliceArena trusted_slices_arena;
+
   // If a bugreport request happened and the trace was stolen for that, give
   // an empty trace with a clear signal to the consumer. This deals only with
   // the case of readback-from-IPC. A similar code-path deals with the
@@ -2078,9 +2202,10 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
       // truncated packets are also rejected, so the producer can't give us a
       // partial packet (e.g., a truncated string) which only becomes valid when
       // the trusted data is appended here.
-      Slice slice = Slice::Allocate(32);
+      static constexpr size_t kTrustedSliceSize = 32;
+      uint8_t* trusted_buf = trusted_slices_arena.Allocate(kTrustedSliceSize);
       protozero::StaticBuffered<protos::pbzero::TracePacket> trusted_packet(
-          slice.own_data(), slice.size);
+          trusted_buf, kTrustedSliceSize);
       trusted_packet->set_trusted_uid(
           static_cast<int32_t>(sequence_properties.producer_uid_trusted));
       trusted_packet->set_trusted_packet_sequence_id(
@@ -2089,8 +2214,7 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
               sequence_properties.writer_id));
       if (previous_packet_dropped)
         trusted_packet->set_previous_packet_dropped(previous_packet_dropped);
-      slice.size = trusted_packet.Finalize();
-      packet.AddSlice(std::move(slice));
+      packet.AddSlice(trusted_buf, trusted_packet.Finalize());
 
       // Append the packet (inclusive of the trusted uid) to |packets|.
       packets_bytes += packet.size();
@@ -2142,37 +2266,69 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
   // entire packet is filtered out, we emit a zero-sized TracePacket proto. That
   // makes debugging and reasoning about the trace stats easier.
   // This place swaps the contents of each |packets| entry in place.
+  // When writing into a file, the packets don't outlive this function, so
+  // they are all filtered in one batch and point directly into
+  // |filtered_batch|. Otherwise the consumer takes ownership of the packets,
+  // so each one is filtered into its own buffer, which is handed over as is.
+  protozero::MessageFilter::FilteredBatch filtered_batch;
   if (tracing_session->trace_filter) {
     auto& trace_filter = *tracing_session->trace_filter;
     // The filter root shoud be reset from protos.Trace to protos.TracePacket
     // by the earlier call to SetFilterRoot() in EnableTracing().
     PERFETTO_DCHECK(trace_filter.root_msg_index() != 0);
     std::vector<protozero::MessageFilter::InputSlice> filter_input;
-    for (auto it = packets.begin(); it != packets.end(); ++it) {
-      const auto& packet_slices = it->slices();
-      filter_input.clear();
-      filter_input.resize(packet_slices.size());
+    filter_input.reserve(total_slices);
+    std::vector<size_t> filter_input_num_slices;
+    filter_input_num_slices.reserve(packets.size());
+    for (const TracePacket& packet : packets) {
       ++tracing_session->filter_input_packets;
-      tracing_session->filter_input_bytes += it->size();
-      for (size_t i = 0; i < packet_slices.size(); ++i)
-        filter_input[i] = {packet_slices[i].start, packet_slices[i].size};
-      auto filtered_packet = trace_filter.FilterMessageFragments(
-          &filter_input[0], filter_input.size());
-
-      // Replace the packet in-place with the filtered one (unless failed).
-      *it = TracePacket();
-      if (filtered_packet.error) {
-        ++tracing_session->filter_errors;
-        PERFETTO_DLOG("Trace packet filtering failed @ packet %" PRIu64,
-                      tracing_session->filter_input_packets);
-        continue;
-      }
-      tracing_session->filter_output_bytes += filtered_packet.size;
-      it->AddSlice(Slice::TakeOwnership(std::move(filtered_packet.data),
-                                        filtered_packet.size));
-
-    }  // for (packet)
-  }    // if (trace_filter)
+      tracing_session->filter_input_bytes += packet.size();
+      for (const Slice& slice : packet.slices())
+        filter_input.push_back({slice.start, slice.size});
+      filter_input_num_slices.push_back(packet.slices().size());
+    }
+    const uint64_t first_packet_index =
+        tracing_session->filter_input_packets - packets.size() + 1;
+    auto on_filter_error = [tracing_session, first_packet_index](size_t i) {
+      ++tracing_session->filter_errors;
+      PERFETTO_DLOG("Trace packet filtering failed @ packet %" PRIu64,
+                    first_packet_index + i);
+      base::ignore_result(first_packet_index, i);
+    };
+
+    // Replace the packets in-place with the filtered ones (unless failed).
+    if (tracing_session->write_into_file) {
+      filtered_batch = trace_filter.FilterMessageBatch(
+          filter_input.data(), filter_input_num_slices.data(), packets.size());
+      for (size_t i = 0; i < packets.size(); ++i) {
+        const auto& filtered_packet = filtered_batch.messages[i];
+        packets[i] = TracePacket();
+        if (filtered_packet.error) {
+          on_filter_error(i);
+          continue;
+        }
+        tracing_session->filter_output_bytes += filtered_packet.size;
+        packets[i].AddSlice(filtered_batch.data.get() + filtered_packet.offset,
+                            filtered_packet.size);
+      }  // for (packet)
+    } else {
+      const protozero::MessageFilter::InputSlice* packet_input =
+          filter_input.data();
+      for (size_t i = 0; i < packets.size(); ++i) {
+        auto filtered_packet = trace_filter.FilterMessageFragments(
+            packet_input, filter_input_num_slices[i]);
+        packet_input += filter_input_num_slices[i];
+        packets[i] = TracePacket();
+        if (filtered_packet.error) {
+          on_filter_error(i);
+          continue;
+        }
+        tracing_session->filter_output_bytes += filtered_packet.size;
+        packets[i].AddSlice(Slice::TakeOwnership(
+            std::move(filtered_packet.data), filtered_packet.size));
+      }  // for (packet)
+    }
+  }  // if (trace_filter)
 
   // If the caller asked us to write into a file by setting
   // |write_into_file| == true in the trace config, drain the packets read
@@ -2186,37 +2342,38 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
     // message. Each packet should be prepended with a proto preamble stating
     // its field id (within trace.proto) and size. Hence the addition below.
     const size_t max_iovecs = total_slices + packets.size();
+    size_t scratch_size = packets.size() * TracePacket::kMaxPreambleBytes;
+    for (const TracePacket& packet : packets) {
+      for (const Slice& slice : packet.slices()) {
+        if (slice.size <= IovecBuilder::kMaxCopiedSliceSize)
+          scratch_size += slice.size;
+      }
+    }
 
-    size_t num_iovecs = 0;
     bool stop_writing_into_file = tracing_session->write_period_ms == 0;
-    std::unique_ptr<struct iovec[]> iovecs(new struct iovec[max_iovecs]);
-    size_t num_iovecs_at_last_packet = 0;
+    IovecBuilder iovecs(max_iovecs, scratch_size);
     uint64_t bytes_about_to_be_written = 0;
     for (TracePacket& packet : packets) {
-      std::tie(iovecs[num_iovecs].iov_base, iovecs[num_iovecs].iov_len) =
-          packet.GetProtoPreamble();
-      bytes_about_to_be_written += iovecs[num_iovecs].iov_len;
-      num_iovecs++;
+      IovecBuilder::Mark mark = iovecs.GetMark();
+      char* preamble;
+      size_t preamble_size;
+      std::tie(preamble, preamble_size) = packet.GetProtoPreamble();
+      iovecs.Append(preamble, preamble_size);
+      bytes_about_to_be_written += preamble_size;
       for (const Slice& slice : packet.slices()) {
-        // writev() doesn't change the passed pointer. However, struct iovec
-        // take a non-const ptr because it's the same struct used by readv().
-        // Hence the const_cast here.
-        char* start = static_cast<char*>(const_cast<void*>(slice.start));
+        iovecs.Append(slice.start, slice.size);
         bytes_about_to_be_written += slice.size;
-        iovecs[num_iovecs++] = {start, slice.size};
       }
 
       if (tracing_session->bytes_written_into_file +
               bytes_about_to_be_written >=
           max_size) {
         stop_writing_into_file = true;
-        num_iovecs = num_iovecs_at_last_packet;
+        iovecs.RewindTo(mark);
         break;
       }
-
-      num_iovecs_at_last_packet = num_iovecs;
     }
-    PERFETTO_DCHECK(num_iovecs <= max_iovecs);
+    const size_t num_iovecs = iovecs.num_iovecs();
     int fd = *tracing_session->write_into_file;
 
     uint64_t total_wr_size = 0;
@@ -2225,7 +2382,8 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
     constexpr size_t kIOVMax = IOV_MAX;
     for (size_t i = 0; i < num_iovecs; i += kIOVMax) {
       int iov_batch_size = static_cast<int>(std::min(num_iovecs - i, kIOVMax));
-      ssize_t wr_size = PERFETTO_EINTR(writev(fd, &iovecs[i], iov_batch_size));
+      ssize_t wr_size =
+          PERFETTO_EINTR(writev(fd, &iovecs.iovecs()[i], iov_batch_size));
       if (wr_size <= 0) {
         PERFETTO_PLOG("writev() failed");
         stop_writing_into_file = true;
@@ -2322,6 +2480,145 @@ void TracingServiceImpl::FreeBuffers(TracingSessionID tsid) {
 #endif
 }
 
+void TracingServiceImpl::CloneSession(
+    ConsumerEndpointImpl* consumer,
+    const std::string& unique_session_name,
+    ConsumerEndpoint::CloneSessionCallback callback) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  PERFETTO_DLOG("CloneSession(%s) from consumer with uid %d",
+                unique_session_name.c_str(), static_cast<int>(consumer->uid_));
+
+  if (consumer->tracing_session_id_) {
+    callback(false, "The consumer already owns a tracing session");
+    return;
+  }
+  TracingSession* src = nullptr;
+  if (!unique_session_name.empty()) {
+    for (auto& kv : tracing_sessions_) {
+      if (kv.second.config.unique_session_name() == unique_session_name) {
+        src = &kv.second;
+        break;
+      }
+    }
+  }
+  if (!src) {
+    callback(false, "No tracing session with unique_session_name \"" +
+                        unique_session_name + "\"");
+    return;
+  }
+  if (src->consumer_uid != consumer->uid_) {
+    callback(false, "Cannot clone a tracing session owned by another uid");
+    return;
+  }
+
+  // Flush the data sources first, so that the snapshot contains all the data
+  // emitted up to now. The snapshot is taken even if the flush times out, as
+  // it would happen when stopping the session.
+  auto weak_this = weak_ptr_factory_.GetWeakPtr();
+  auto weak_consumer = consumer->weak_ptr_factory_.GetWeakPtr();
+  TracingSessionID src_tsid = src->id;
+  Flush(src_tsid, 0,
+        [weak_this, weak_consumer, src_tsid, callback](bool flush_success) {
+          if (!weak_this)
+            return;
+          if (!weak_consumer) {
+            callback(false, "The consumer disconnected while cloning");
+            return;
+          }
+          if (!flush_success)
+            PERFETTO_ELOG("Flush failed while cloning session %" PRIu64,
+                          src_tsid);
+          base::Status status =
+              weak_this->FinishCloneSession(weak_consumer.get(), src_tsid);
+          callback(status.ok(), status.message());
+        });
+}
+
+base::Status TracingServiceImpl::FinishCloneSession(
+    ConsumerEndpointImpl* consumer,
+    TracingSessionID src_tsid) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  TracingSession* src = GetTracingSession(src_tsid);
+  if (!src)
+    return PERFETTO_SVC_ERR("The tracing session ended while cloning it");
+  if (consumer->tracing_session_id_)
+    return PERFETTO_SVC_ERR("The consumer already owns a tracing session");
+  if (tracing_sessions_.size() >= kMaxConcurrentTracingSessions) {
+    return PERFETTO_SVC_ERR("Too many concurrent tracing sesions (%zu)",
+                            tracing_sessions_.size());
+  }
+
+  // The clone is never started and never streamed into a file: it only exists
+  // to be read back and freed by |consumer|. Strip the fields that would make
+  // it eligible for the logic that targets running sessions.
+  TraceConfig cfg = src->config;
+  cfg.set_unique_session_name("");
+  cfg.set_write_into_file(false);
+  cfg.set_output_path("");
+  cfg.set_bugreport_score(0);
+  cfg.set_notify_traceur(false);
+
+  std::unique_ptr<protozero::MessageFilter> trace_filter;
+  if (src->trace_filter) {
+    const std::string& bytecode = cfg.trace_filter().bytecode();
+    trace_filter.reset(new protozero::MessageFilter());
+    uint32_t packet_field_id = TracePacket::kPacketFieldNumber;
+    if (!trace_filter->LoadFilterBytecode(bytecode.data(), bytecode.size()) ||
+        !trace_filter->SetFilterRoot(&packet_field_id, 1)) {
+      return PERFETTO_SVC_ERR("Failed to clone the trace filter");
+    }
+  }
+
+  // Snapshot the buffers before creating the session, so that failures don't
+  // leave a half-initialized session behind.
+  std::vector<std::unique_ptr<TraceBuffer>> cloned_buffers;
+  cloned_buffers.reserve(src->num_buffers());
+  for (BufferID src_buf_id : src->buffers_index) {
+    TraceBuffer* src_buf = GetBufferByID(src_buf_id);
+    std::unique_ptr<TraceBuffer> buf =
+        src_buf ? src_buf->CloneReadOnly() : nullptr;
+    if (!buf)
+      return PERFETTO_SVC_ERR("Failed to clone the tracing buffers (OOM)");
+    cloned_buffers.emplace_back(std::move(buf));
+  }
+
+  const TracingSessionID tsid = ++last_tracing_session_id_;
+  TracingSession* clone =
+      &tracing_sessions_
+           .emplace(std::piecewise_construct, std::forward_as_tuple(tsid),
+                    std::forward_as_tuple(tsid, consumer, cfg, task_runner_))
+           .first->second;
+  clone->trace_filter = std::move(trace_filter);
+  clone->received_triggers = src->received_triggers;
+  clone->packet_sequence_ids = src->packet_sequence_ids;
+  clone->last_packet_sequence_id = src->last_packet_sequence_id;
+  clone->initial_clock_snapshot = src->initial_clock_snapshot;
+  clone->should_emit_stats = true;
+  clone->state = TracingSession::DISABLED;
+
+  clone->buffers_index.reserve(cloned_buffers.size());
+  for (auto& buf : cloned_buffers) {
+    BufferID global_id = buffer_ids_.Allocate();
+    if (!global_id) {
+      for (BufferID id : clone->buffers_index) {
+        buffer_ids_.Free(id);
+        buffers_.erase(id);
+      }
+      tracing_sessions_.erase(tsid);
+      return PERFETTO_SVC_ERR("Failed to clone the tracing buffers (no IDs)");
+    }
+    clone->buffers_index.push_back(global_id);
+    buffers_.emplace(global_id, std::move(buf));
+  }
+  UpdateMemoryGuardrail();
+
+  consumer->tracing_session_id_ = tsid;
+  PERFETTO_LOG("Cloned tracing session %" PRIu64 " into %" PRIu64
+               ", total sessions:%zu",
+               src_tsid, tsid, tracing_sessions_.size());
+  return base::OkStatus();
+}
+
 void TracingServiceImpl::RegisterDataSource(ProducerID producer_id,
                                             const DataSourceDescriptor& desc) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
@@ -2529,6 +2826,14 @@ TracingServiceImpl::DataSourceInstance* TracingServiceImpl::SetupDataSource(
   PERFETTO_DCHECK(global_id);
   ds_config.set_target_buffer(global_id);
 
+  // Only the bytecode that the service has validated is passed through.
+  const auto& trace_filter = tracing_session->config.trace_filter();
+  if (tracing_session->trace_filter && trace_filter.filter_in_producers()) {
+    ds_config.set_trace_filter_bytecode(trace_filter.bytecode());
+  } else if (ds_config.has_trace_filter_bytecode()) {
+    ds_config.set_trace_filter_bytecode("");
+  }
+
   PERFETTO_DLOG("Setting up data source %s with target buffer %" PRIu16,
                 ds_config.name().c_str(), global_id);
   if (!producer->shared_memory()) {
@@ -3033,6 +3338,28 @@ TraceStats TracingServiceImpl::GetTraceStats(TracingSession* tracing_session) {
     filt_stats->set_errors(tracing_session->filter_errors);
   }
 
+  TraceStats::CommitBatchingStats* batching_stats = nullptr;
+  for (const auto& id_to_producer : producers_) {
+    const auto& producer_stats = id_to_producer.second->commit_batching_stats_;
+    if (!producer_stats ||
+        tracing_session->data_source_instances.count(id_to_producer.first) ==
+            0) {
+      continue;
+    }
+    if (!batching_stats)
+      batching_stats = trace_stats.mutable_commit_batching_stats();
+    batching_stats->set_producers(batching_stats->producers() + 1);
+    batching_stats->set_commit_requests(batching_stats->commit_requests() +
+                                        producer_stats->commit_requests());
+    batching_stats->set_chunks_committed(batching_stats->chunks_committed() +
+                                         producer_stats->chunks_committed());
+    batching_stats->set_watermark_flushes(batching_stats->watermark_flushes() +
+                                          producer_stats->watermark_flushes());
+    batching_stats->set_max_last_batch_duration_ms(
+        std::max(batching_stats->max_last_batch_duration_ms(),
+                 producer_stats->last_batch_duration_ms()));
+  }
+
   for (BufferID buf_id : tracing_session->buffers_index) {
     TraceBuffer* buf = GetBufferByID(buf_id);
     if (!buf) {
@@ -3543,6 +3870,7 @@ void TracingServiceImpl::ConsumerEndpointImpl::QueryCapabilities(
   TracingServiceCapabilities caps;
   caps.set_has_query_capabilities(true);
   caps.set_has_trace_config_output_path(true);
+  caps.set_has_clone_session(true);
   caps.add_observable_events(ObservableEvents::TYPE_DATA_SOURCES_INSTANCES);
   caps.add_observable_events(ObservableEvents::TYPE_ALL_DATA_SOURCES_STARTED);
   static_assert(ObservableEvents::Type_MAX ==
@@ -3570,6 +3898,13 @@ void TracingServiceImpl::ConsumerEndpointImpl::SaveTraceForBugreport(
   }
 }
 
+void TracingServiceImpl::ConsumerEndpointImpl::CloneSession(
+    const std::string& unique_session_name,
+    CloneSessionCallback callback) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  service_->CloneSession(this, unique_session_name, std::move(callback));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // TracingServiceImpl::ProducerEndpointImpl implementation
 ////////////////////////////////////////////////////////////////////////////////
@@ -3687,6 +4022,10 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
     service_->NotifyFlushDoneForProducer(id_, req_untrusted.flush_request_id());
   }
 
+  // The counters are cumulative, only the most recent ones are kept.
+  if (req_untrusted.has_batching_stats())
+    commit_batching_stats_ = req_untrusted.batching_stats();
+
   // Keep this invocation last. ProducerIPCService::CommitData() relies on this
   // callback being invoked within the same callstack and not posted. If this
   // changes, the code there needs to be changed accordingly.
@@ -3808,6 +4147,11 @@ void TracingServiceImpl::ProducerEndpointImpl::SetupDataSource(
     const DataSourceConfig& config) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   allowed_target_buffers_.insert(static_cast<BufferID>(config.target_buffer()));
+  if (inproc_shmem_arbiter_) {
+    inproc_shmem_arbiter_->SetTraceFilterForBuffer(
+        static_cast<BufferID>(config.target_buffer()),
+        config.trace_filter_bytecode());
+  }
   auto weak_this = weak_ptr_factory_.GetWeakPtr();
   task_runner_->PostTask([weak_this, ds_id, config] {
     if (weak_this)
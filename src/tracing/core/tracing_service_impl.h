@@ -173,6 +173,10 @@ class TracingServiceImpl : public TracingService {
     // before use.
     std::map<WriterID, BufferID> writers_;
 
+    // The commit batching counters most recently reported by the producer, if
+    // it batches its commits. Untrusted, only used for TraceStats.
+    base::Optional<CommitDataRequest::BatchingStats> commit_batching_stats_;
+
     // This is used only in in-process configurations.
     // SharedMemoryArbiterImpl methods themselves are thread-safe.
     std::unique_ptr<SharedMemoryArbiterImpl> inproc_shmem_arbiter_;
@@ -207,6 +211,8 @@ class TracingServiceImpl : public TracingService {
     void QueryServiceState(QueryServiceStateCallback) override;
     void QueryCapabilities(QueryCapabilitiesCallback) override;
     void SaveTraceForBugreport(SaveTraceForBugreportCallback) override;
+    void CloneSession(const std::string& unique_session_name,
+                      CloneSessionCallback) override;
 
     // Will queue a task to notify the consumer about the state change.
     void OnDataSourceInstanceStateChange(const ProducerEndpointImpl&,
@@ -282,6 +288,9 @@ class TracingServiceImpl : public TracingService {
   void FlushAndDisableTracing(TracingSessionID);
   bool ReadBuffers(TracingSessionID, ConsumerEndpointImpl*);
   void FreeBuffers(TracingSessionID);
+  void CloneSession(ConsumerEndpointImpl*,
+                    const std::string& unique_session_name,
+                    ConsumerEndpoint::CloneSessionCallback);
 
   // Service implementation.
   std::unique_ptr<TracingService::ProducerEndpoint> ConnectProducer(
@@ -639,6 +648,7 @@ class TracingServiceImpl : public TracingService {
   void MaybeEmitReceivedTriggers(TracingSession*, std::vector<TracePacket>*);
   void MaybeNotifyAllDataSourcesStarted(TracingSession*);
   bool MaybeSaveTraceForBugreport(std::function<void()> callback);
+  base::Status FinishCloneSession(ConsumerEndpointImpl*, TracingSessionID);
   void OnFlushTimeout(TracingSessionID, FlushRequestID);
   void OnDisableTracingTimeout(TracingSessionID);
   void DisableTracingNotifyConsumerAndFlushFile(TracingSession*);
@@ -30,6 +30,7 @@
 #include "perfetto/tracing/core/data_source_config.h"
 #include "perfetto/tracing/core/data_source_descriptor.h"
 #include "src/base/test/test_task_runner.h"
+#include "src/protozero/filtering/filter_bytecode_generator.h"
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 #include "src/tracing/core/trace_writer_impl.h"
 #include "src/tracing/test/mock_consumer.h"
@@ -50,6 +51,7 @@ using ::testing::AssertionFailure;
 using ::testing::AssertionResult;
 using ::testing::AssertionSuccess;
 using ::testing::Contains;
+using ::testing::ElementsAre;
 using ::testing::ElementsAreArray;
 using ::testing::Eq;
 using ::testing::ExplainMatchResult;
@@ -153,6 +155,8 @@ class TracingServiceImplTest : public testing::Test {
     return std::move(svc->GetProducer(producer_id)->inproc_shmem_arbiter_);
   }
 
+  TraceStats GetTraceStats() { return svc->GetTraceStats(tracing_session()); }
+
   size_t GetNumPendingFlushes() {
     return tracing_session()->pending_flushes.size();
   }
@@ -1730,6 +1734,95 @@ TEST_F(TracingServiceImplTest, WriteIntoFileWithPath) {
                   Property(&protos::gen::TestEvent::str, Eq("payload")))));
 }
 
+namespace {
+
+// Trace -> TracePacket -> TestEvent, allowing only TestEvent.str.
+std::string MakeTestEventStrFilter() {
+  protozero::FilterBytecodeGenerator filter;
+  filter.AddNestedField(1 /* Trace.packet */, 1);
+  filter.EndMessage();
+  filter.AddNestedField(900 /* TracePacket.for_testing */, 2);
+  filter.EndMessage();
+  filter.AddSimpleField(1 /* TestEvent.str */);
+  filter.EndMessage();
+  return filter.Serialize();
+}
+
+}  // namespace
+
+// The parameter is TraceConfig.write_into_file: the filtered packets are
+// either handed over to the consumer or written straight into the file.
+class TracingServiceImplTraceFilterTest
+    : public TracingServiceImplTest,
+      public testing::WithParamInterface<bool> {};
+
+INSTANTIATE_TEST_SUITE_P(WriteIntoFile,
+                         TracingServiceImplTraceFilterTest,
+                         ::testing::Bool());
+
+TEST_P(TracingServiceImplTraceFilterTest, FilterPackets) {
+  const bool write_into_file = GetParam();
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.mutable_trace_filter()->set_bytecode(MakeTestEventStrFilter());
+  base::TempFile tmp_file = base::TempFile::Create();
+  if (write_into_file) {
+    trace_config.set_write_into_file(true);
+    consumer->EnableTracing(trace_config,
+                            base::ScopedFile(dup(tmp_file.fd())));
+  } else {
+    consumer->EnableTracing(trace_config);
+  }
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  for (uint32_t i = 0; i < 3; i++) {
+    auto tp = writer->NewTracePacket();
+    tp->set_timestamp(42);
+    tp->set_for_testing()->set_str("payload" + std::to_string(i));
+    tp->set_for_testing()->set_seq_value(i);
+  }
+  writer->Flush();
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  std::vector<protos::gen::TracePacket> packets;
+  if (write_into_file) {
+    std::string trace_raw;
+    ASSERT_TRUE(base::ReadFile(tmp_file.path(), &trace_raw));
+    protos::gen::Trace trace;
+    ASSERT_TRUE(trace.ParseFromString(trace_raw));
+    packets = trace.packet();
+  } else {
+    packets = consumer->ReadBuffers();
+  }
+  std::vector<std::string> payloads;
+  for (const protos::gen::TracePacket& packet : packets) {
+    EXPECT_FALSE(packet.has_timestamp());
+    if (!packet.has_for_testing())
+      continue;
+    EXPECT_FALSE(packet.for_testing().has_seq_value());
+    payloads.push_back(packet.for_testing().str());
+  }
+  EXPECT_THAT(payloads, ElementsAre("payload0", "payload1", "payload2"));
+}
+
 // Test the logic that allows the trace config to set the shm total size and
 // page size from the trace config. Also check that, if the config doesn't
 // specify a value we fall back on the hint provided by the producer.
@@ -3048,6 +3141,93 @@ TEST_F(TracingServiceImplTest, GetTraceStats) {
   consumer->WaitForTracingDisabled();
 }
 
+TEST_F(TracingServiceImplTest, CommitBatchingStats) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer_1 = CreateMockProducer();
+  producer_1->Connect(svc.get(), "mock_producer_1");
+  producer_1->RegisterDataSource("data_source_1");
+  std::unique_ptr<MockProducer> producer_2 = CreateMockProducer();
+  producer_2->Connect(svc.get(), "mock_producer_2");
+  producer_2->RegisterDataSource("data_source_2");
+  std::unique_ptr<MockProducer> producer_3 = CreateMockProducer();
+  producer_3->Connect(svc.get(), "mock_producer_3");
+  producer_3->RegisterDataSource("data_source_3");
+  // Not part of the tracing session.
+  std::unique_ptr<MockProducer> producer_4 = CreateMockProducer();
+  producer_4->Connect(svc.get(), "mock_producer_4");
+  producer_4->RegisterDataSource("data_source_4");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  for (const char* name : {"data_source_1", "data_source_2", "data_source_3"})
+    trace_config.add_data_sources()->mutable_config()->set_name(name);
+  consumer->EnableTracing(trace_config);
+  producer_1->WaitForTracingSetup();
+  producer_1->WaitForDataSourceSetup("data_source_1");
+  producer_2->WaitForTracingSetup();
+  producer_2->WaitForDataSourceSetup("data_source_2");
+  producer_3->WaitForTracingSetup();
+  producer_3->WaitForDataSourceSetup("data_source_3");
+  producer_1->WaitForDataSourceStart("data_source_1");
+  producer_2->WaitForDataSourceStart("data_source_2");
+  producer_3->WaitForDataSourceStart("data_source_3");
+
+  // No producer batches its commits yet.
+  EXPECT_FALSE(GetTraceStats().has_commit_batching_stats());
+
+  CommitDataRequest req_1;
+  auto* stats_1 = req_1.mutable_batching_stats();
+  stats_1->set_commit_requests(2);
+  stats_1->set_chunks_committed(10);
+  stats_1->set_watermark_flushes(1);
+  stats_1->set_last_batch_duration_ms(20);
+  producer_1->endpoint()->CommitData(req_1, {});
+
+  // Only the most recent counters of each producer are kept.
+  CommitDataRequest req_2;
+  auto* stats_2 = req_2.mutable_batching_stats();
+  stats_2->set_commit_requests(1);
+  stats_2->set_chunks_committed(3);
+  stats_2->set_last_batch_duration_ms(50);
+  producer_2->endpoint()->CommitData(req_2, {});
+  stats_2->set_commit_requests(3);
+  stats_2->set_chunks_committed(5);
+  stats_2->set_last_batch_duration_ms(5);
+  producer_2->endpoint()->CommitData(req_2, {});
+
+  // A producer that doesn't batch its commits doesn't report anything.
+  producer_3->endpoint()->CommitData(CommitDataRequest(), {});
+
+  // Nor does a producer without data sources in the tracing session.
+  CommitDataRequest req_4;
+  req_4.mutable_batching_stats()->set_commit_requests(100);
+  req_4.mutable_batching_stats()->set_last_batch_duration_ms(1000);
+  producer_4->endpoint()->CommitData(req_4, {});
+
+  TraceStats trace_stats = GetTraceStats();
+  ASSERT_TRUE(trace_stats.has_commit_batching_stats());
+  const auto& batching_stats = trace_stats.commit_batching_stats();
+  EXPECT_EQ(batching_stats.producers(), 2u);
+  EXPECT_EQ(batching_stats.commit_requests(), 5u);
+  EXPECT_EQ(batching_stats.chunks_committed(), 15u);
+  EXPECT_EQ(batching_stats.watermark_flushes(), 1u);
+  EXPECT_EQ(batching_stats.max_last_batch_duration_ms(), 20u);
+
+  // The counters of disconnected producers are dropped.
+  producer_1.reset();
+  task_runner.RunUntilIdle();
+  trace_stats = GetTraceStats();
+  EXPECT_EQ(trace_stats.commit_batching_stats().producers(), 1u);
+  EXPECT_EQ(trace_stats.commit_batching_stats().commit_requests(), 3u);
+
+  consumer->DisableTracing();
+  producer_2->WaitForDataSourceStop("data_source_2");
+  producer_3->WaitForDataSourceStop("data_source_3");
+  consumer->WaitForTracingDisabled();
+}
+
 TEST_F(TracingServiceImplTest, ObserveEventsDataSourceInstances) {
   std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
   consumer->Connect(svc.get());
@@ -3693,4 +3873,89 @@ TEST_F(TracingServiceImplTest, ProducerProvidedSMBInvalidSizes) {
   EXPECT_EQ(producer->endpoint()->shared_memory(), nullptr);
 }
 
+TEST_F(TracingServiceImplTest, CloneSession) {
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("ds_1");
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  trace_config.add_data_sources()->mutable_config()->set_name("ds_1");
+  trace_config.set_unique_session_name("my_session");
+  consumer->EnableTracing(trace_config);
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("ds_1");
+  producer->WaitForDataSourceStart("ds_1");
+
+  std::unique_ptr<TraceWriter> writer = producer->CreateTraceWriter("ds_1");
+  writer->NewTracePacket()->set_for_testing()->set_str("before_clone");
+
+  std::unique_ptr<MockConsumer> clone_consumer = CreateMockConsumer();
+  clone_consumer->Connect(svc.get());
+
+  // Cloning an unknown session or a session of another uid fails.
+  bool unknown_success = true;
+  clone_consumer->endpoint()->CloneSession(
+      "unknown_session",
+      [&unknown_success](bool success, const std::string&) {
+        unknown_success = success;
+      });
+  EXPECT_FALSE(unknown_success);
+
+  std::unique_ptr<MockConsumer> other_uid_consumer = CreateMockConsumer();
+  other_uid_consumer->Connect(svc.get(), /*uid=*/123);
+  bool other_uid_success = true;
+  other_uid_consumer->endpoint()->CloneSession(
+      "my_session", [&other_uid_success](bool success, const std::string&) {
+        other_uid_success = success;
+      });
+  EXPECT_FALSE(other_uid_success);
+
+  auto clone_done = task_runner.CreateCheckpoint("clone_done");
+  clone_consumer->endpoint()->CloneSession(
+      "my_session", [clone_done](bool success, const std::string& msg) {
+        EXPECT_TRUE(success) << msg;
+        clone_done();
+      });
+  producer->WaitForFlush(writer.get());
+  task_runner.RunUntilCheckpoint("clone_done");
+
+  // Data written after the clone must not show up in the clone.
+  writer->NewTracePacket()->set_for_testing()->set_str("after_clone");
+  writer->Flush();
+
+  auto clone_packets = clone_consumer->ReadBuffers();
+  EXPECT_THAT(clone_packets,
+              Contains(Property(
+                  &protos::gen::TracePacket::for_testing,
+                  Property(&protos::gen::TestEvent::str, Eq("before_clone")))));
+  EXPECT_THAT(clone_packets,
+              Not(Contains(Property(
+                  &protos::gen::TracePacket::for_testing,
+                  Property(&protos::gen::TestEvent::str, Eq("after_clone"))))));
+  clone_consumer->FreeBuffers();
+
+  // The source session is unaffected by the clone.
+  auto flush_request = consumer->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("ds_1");
+  consumer->WaitForTracingDisabled();
+
+  auto packets = consumer->ReadBuffers();
+  EXPECT_THAT(packets,
+              Contains(Property(
+                  &protos::gen::TracePacket::for_testing,
+                  Property(&protos::gen::TestEvent::str, Eq("before_clone")))));
+  EXPECT_THAT(packets,
+              Contains(Property(
+                  &protos::gen::TracePacket::for_testing,
+                  Property(&protos::gen::TestEvent::str, Eq("after_clone")))));
+}
+
 }  // namespace perfetto
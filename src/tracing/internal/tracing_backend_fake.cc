@@ -117,6 +117,8 @@ class UnsupportedConsumerEndpoint : public ConsumerEndpoint {
   void QueryCapabilities(QueryCapabilitiesCallback) override {}
 
   void SaveTraceForBugreport(SaveTraceForBugreportCallback) override {}
+  void CloneSession(const std::string& /*unique_session_name*/,
+                    CloneSessionCallback) override {}
 
  private:
   Consumer* const consumer_;
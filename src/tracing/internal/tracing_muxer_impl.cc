@@ -134,10 +134,12 @@ uint64_t ComputeConfigHash(const DataSourceConfig& config) {
 TracingMuxerImpl::ProducerImpl::ProducerImpl(
     TracingMuxerImpl* muxer,
     TracingBackendId backend_id,
-    uint32_t shmem_batch_commits_duration_ms)
+    uint32_t shmem_batch_commits_duration_ms,
+    bool shmem_adaptive_batch_commits)
     : muxer_(muxer),
       backend_id_(backend_id),
-      shmem_batch_commits_duration_ms_(shmem_batch_commits_duration_ms) {}
+      shmem_batch_commits_duration_ms_(shmem_batch_commits_duration_ms),
+      shmem_adaptive_batch_commits_(shmem_adaptive_batch_commits) {}
 
 TracingMuxerImpl::ProducerImpl::~ProducerImpl() = default;
 
@@ -193,6 +195,8 @@ void TracingMuxerImpl::ProducerImpl::OnTracingSetup() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   service_->MaybeSharedMemoryArbiter()->SetBatchCommitsDuration(
       shmem_batch_commits_duration_ms_);
+  service_->MaybeSharedMemoryArbiter()->SetAdaptiveBatchCommits(
+      shmem_adaptive_batch_commits_);
 }
 
 void TracingMuxerImpl::ProducerImpl::SetupDataSource(
@@ -724,7 +728,8 @@ void TracingMuxerImpl::Initialize(const TracingInitArgs& args) {
     rb.id = backend_id;
     rb.type = type;
     rb.producer.reset(new ProducerImpl(this, backend_id,
-                                       args.shmem_batch_commits_duration_ms));
+                                       args.shmem_batch_commits_duration_ms,
+                                       args.shmem_adaptive_batch_commits));
     rb.producer_conn_args.producer = rb.producer.get();
     rb.producer_conn_args.producer_name = platform_->GetCurrentProcessName();
     rb.producer_conn_args.task_runner = task_runner_.get();
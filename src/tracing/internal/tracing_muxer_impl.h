@@ -171,7 +171,8 @@ class TracingMuxerImpl : public TracingMuxer {
    public:
     ProducerImpl(TracingMuxerImpl*,
                  TracingBackendId,
-                 uint32_t shmem_batch_commits_duration_ms);
+                 uint32_t shmem_batch_commits_duration_ms,
+                 bool shmem_adaptive_batch_commits);
     ~ProducerImpl() override;
 
     void Initialize(std::unique_ptr<ProducerEndpoint> endpoint);
@@ -200,6 +201,7 @@ class TracingMuxerImpl : public TracingMuxer {
     uint32_t connection_id_ = 0;
 
     const uint32_t shmem_batch_commits_duration_ms_ = 0;
+    const bool shmem_adaptive_batch_commits_ = false;
 
     // Set of data sources that have been actually registered on this producer.
     // This can be a subset of the global |data_sources_|, because data sources
@@ -18,9 +18,12 @@
 
 #include <string.h>
 
+#include <algorithm>
 #include <cinttypes>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/task_runner.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/ipc/client.h"
 #include "perfetto/ext/tracing/core/consumer.h"
 #include "perfetto/ext/tracing/core/observable_events.h"
@@ -28,6 +31,10 @@
 #include "perfetto/tracing/core/trace_config.h"
 #include "perfetto/tracing/core/tracing_service_state.h"
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include "src/tracing/ipc/posix_shared_memory.h"
+#endif
+
 // TODO(fmayer): Add a test to check to what happens when ConsumerIPCClientImpl
 // gets destroyed w.r.t. the Consumer pointer. Also think to lifetime of the
 // Consumer* during the callbacks.
@@ -43,14 +50,27 @@ std::unique_ptr<TracingService::ConsumerEndpoint> ConsumerIPCClient::Connect(
       new ConsumerIPCClientImpl(service_sock_name, consumer, task_runner));
 }
 
+// static. (Declared in include/tracing/ipc/consumer_ipc_client.h).
+std::unique_ptr<TracingService::ConsumerEndpoint> ConsumerIPCClient::Connect(
+    const char* service_sock_name,
+    Consumer* consumer,
+    base::TaskRunner* task_runner,
+    size_t readback_shmem_size_bytes) {
+  return std::unique_ptr<TracingService::ConsumerEndpoint>(
+      new ConsumerIPCClientImpl(service_sock_name, consumer, task_runner,
+                                readback_shmem_size_bytes));
+}
+
 ConsumerIPCClientImpl::ConsumerIPCClientImpl(const char* service_sock_name,
                                              Consumer* consumer,
-                                             base::TaskRunner* task_runner)
+                                             base::TaskRunner* task_runner,
+                                             size_t readback_shmem_size_bytes)
     : consumer_(consumer),
       ipc_channel_(
           ipc::Client::CreateInstance({service_sock_name, /*sock_retry=*/false},
                                       task_runner)),
       consumer_port_(this /* event_listener */),
+      readback_shmem_size_bytes_(readback_shmem_size_bytes),
       weak_ptr_factory_(this) {
   ipc_channel_->BindService(consumer_port_.GetWeakPtr());
 }
@@ -156,6 +176,28 @@ void ConsumerIPCClientImpl::ReadBuffers() {
     return;
   }
 
+  protos::gen::ReadBuffersRequest req;
+  int readback_shmem_fd = -1;
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  if (readback_shmem_size_bytes_ && !readback_ring_) {
+    const size_t page_size = base::GetSysPageSize();
+    size_t size = std::min(std::max(readback_shmem_size_bytes_,
+                                    ReadbackRing::kMinSize),
+                           ReadbackRing::kMaxSize);
+    size = (size + page_size - 1) / page_size * page_size;
+    std::unique_ptr<PosixSharedMemory> shmem = PosixSharedMemory::Create(size);
+    if (shmem) {
+      readback_shmem_fd = shmem->fd();
+      readback_ring_.reset(new ReadbackRing::Reader(std::move(shmem)));
+      req.set_readback_shmem_fd_attached(true);
+    } else {
+      PERFETTO_ELOG("Couldn't create the readback shared memory, using IPC");
+      readback_shmem_size_bytes_ = 0;
+    }
+  }
+#endif
+  const bool readback_shmem_attached = req.readback_shmem_fd_attached();
+
   ipc::Deferred<protos::gen::ReadBuffersResponse> async_response;
 
   // The IPC layer guarantees that callbacks are destroyed after this object
@@ -163,20 +205,39 @@ void ConsumerIPCClientImpl::ReadBuffers() {
   // contract of this class expects the caller to not destroy the Consumer class
   // before having destroyed this class. Hence binding |this| here is safe.
   async_response.Bind(
-      [this](ipc::AsyncResult<protos::gen::ReadBuffersResponse> response) {
-        OnReadBuffersResponse(std::move(response));
+      [this, readback_shmem_attached](
+          ipc::AsyncResult<protos::gen::ReadBuffersResponse> response) {
+        OnReadBuffersResponse(std::move(response), readback_shmem_attached);
       });
-  consumer_port_.ReadBuffers(protos::gen::ReadBuffersRequest(),
-                             std::move(async_response));
+
+  // The fd is kept open by |readback_ring_|.
+  consumer_port_.ReadBuffers(req, std::move(async_response), readback_shmem_fd);
 }
 
 void ConsumerIPCClientImpl::OnReadBuffersResponse(
-    ipc::AsyncResult<protos::gen::ReadBuffersResponse> response) {
+    ipc::AsyncResult<protos::gen::ReadBuffersResponse> response,
+    bool readback_shmem_attached) {
   if (!response) {
+    if (readback_shmem_attached && connected_) {
+      // The service refused the readback shared memory. Read the buffers
+      // again, without it.
+      PERFETTO_ELOG("Readback shared memory rejected, using IPC");
+      readback_ring_.reset();
+      readback_shmem_size_bytes_ = 0;
+      ReadBuffers();
+      return;
+    }
     PERFETTO_DLOG("ReadBuffers() failed");
     return;
   }
   std::vector<TracePacket> trace_packets;
+  // The packets in the readback ring precede the slices of the reply (see
+  // ConsumerIPCService::RemoteConsumer::OnTraceData()).
+  if (readback_ring_ && response->has_readback_shmem_write_offset() &&
+      !readback_ring_->ReadUpTo(response->readback_shmem_write_offset(),
+                                &trace_packets)) {
+    PERFETTO_ELOG("Malformed readback shared memory, dropping packets");
+  }
   for (auto& resp_slice : response->slices()) {
     const std::string& slice_data = resp_slice.data();
     Slice slice = Slice::Allocate(slice_data.size());
@@ -459,4 +520,27 @@ void ConsumerIPCClientImpl::SaveTraceForBugreport(
   consumer_port_.SaveTraceForBugreport(req, std::move(async_response));
 }
 
+void ConsumerIPCClientImpl::CloneSession(const std::string& unique_session_name,
+                                         CloneSessionCallback callback) {
+  if (!connected_) {
+    PERFETTO_DLOG("Cannot CloneSession(), not connected to tracing service");
+    return;
+  }
+
+  protos::gen::CloneSessionRequest req;
+  req.set_unique_session_name(unique_session_name);
+  ipc::Deferred<protos::gen::CloneSessionResponse> async_response;
+  async_response.Bind(
+      [callback](ipc::AsyncResult<protos::gen::CloneSessionResponse> response) {
+        if (!response) {
+          // If the IPC fails, we are talking to an older version of the service
+          // that didn't support CloneSession at all.
+          callback(false, "The tracing service doesn't support CloneSession()");
+        } else {
+          callback(response->success(), response->error());
+        }
+      });
+  consumer_port_.CloneSession(req, std::move(async_response));
+}
+
 }  // namespace perfetto
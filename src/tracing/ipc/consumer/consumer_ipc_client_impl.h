@@ -17,6 +17,7 @@
 #ifndef SRC_TRACING_IPC_CONSUMER_CONSUMER_IPC_CLIENT_IMPL_H_
 #define SRC_TRACING_IPC_CONSUMER_CONSUMER_IPC_CLIENT_IMPL_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <list>
@@ -32,6 +33,7 @@
 #include "perfetto/tracing/core/forward_decls.h"
 
 #include "protos/perfetto/ipc/consumer_port.ipc.h"
+#include "src/tracing/ipc/readback_ring.h"
 
 namespace perfetto {
 
@@ -54,7 +56,8 @@ class ConsumerIPCClientImpl : public TracingService::ConsumerEndpoint,
  public:
   ConsumerIPCClientImpl(const char* service_sock_name,
                         Consumer*,
-                        base::TaskRunner*);
+                        base::TaskRunner*,
+                        size_t readback_shmem_size_bytes = 0);
   ~ConsumerIPCClientImpl() override;
 
   // TracingService::ConsumerEndpoint implementation.
@@ -74,6 +77,8 @@ class ConsumerIPCClientImpl : public TracingService::ConsumerEndpoint,
   void QueryServiceState(QueryServiceStateCallback) override;
   void QueryCapabilities(QueryCapabilitiesCallback) override;
   void SaveTraceForBugreport(SaveTraceForBugreportCallback) override;
+  void CloneSession(const std::string& unique_session_name,
+                    CloneSessionCallback) override;
 
   // ipc::ServiceProxy::EventListener implementation.
   // These methods are invoked by the IPC layer, which knows nothing about
@@ -93,7 +98,8 @@ class ConsumerIPCClientImpl : public TracingService::ConsumerEndpoint,
   using PendingQueryServiceRequests = std::list<PendingQueryServiceRequest>;
 
   void OnReadBuffersResponse(
-      ipc::AsyncResult<protos::gen::ReadBuffersResponse>);
+      ipc::AsyncResult<protos::gen::ReadBuffersResponse>,
+      bool readback_shmem_attached);
   void OnEnableTracingResponse(
       ipc::AsyncResult<protos::gen::EnableTracingResponse>);
   void OnQueryServiceStateResponse(
@@ -121,6 +127,14 @@ class ConsumerIPCClientImpl : public TracingService::ConsumerEndpoint,
   // one with |last_slice_for_packet| == true is received.
   TracePacket partial_packet_;
 
+  // Size of the shared memory buffer to pass with the first ReadBuffers(), or
+  // 0 to have all packets returned inline in the IPC replies. Reset to 0 if
+  // the buffer can't be created or the service rejects it.
+  size_t readback_shmem_size_bytes_;
+
+  // Created (and passed to the service) by the first ReadBuffers() call.
+  std::unique_ptr<ReadbackRing::Reader> readback_ring_;
+
   // Keep last.
   base::WeakPtrFactory<ConsumerIPCClientImpl> weak_ptr_factory_;
 };
@@ -49,8 +49,7 @@ std::unique_ptr<PosixSharedMemory> PosixSharedMemory::Create(size_t size) {
   bool is_memfd = !!fd;
 
   // In-tree builds only allow mem_fd, so we can inspect the seals to verify the
-  // fd is appropriately sealed. We'll crash in the PERFETTO_CHECK(fd) below if
-  // memfd_create failed.
+  // fd is appropriately sealed. Create() fails below if memfd_create failed.
 #if !PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
   if (!fd) {
     // TODO: if this fails on Android we should fall back on ashmem.
@@ -59,9 +58,15 @@ std::unique_ptr<PosixSharedMemory> PosixSharedMemory::Create(size_t size) {
   }
 #endif
 
-  PERFETTO_CHECK(fd);
+  if (!fd) {
+    PERFETTO_PLOG("Couldn't create the shared memory file");
+    return nullptr;
+  }
   int res = ftruncate(fd.get(), static_cast<off_t>(size));
-  PERFETTO_CHECK(res == 0);
+  if (res != 0) {
+    PERFETTO_PLOG("ftruncate() of the shared memory file failed");
+    return nullptr;
+  }
 
   if (is_memfd) {
     // When memfd is supported, file seals should be, too.
@@ -98,7 +103,10 @@ std::unique_ptr<PosixSharedMemory> PosixSharedMemory::AttachToFd(
 
   struct stat stat_buf = {};
   int res = fstat(fd.get(), &stat_buf);
-  PERFETTO_CHECK(res == 0 && stat_buf.st_size > 0);
+  if (res != 0 || stat_buf.st_size <= 0) {
+    PERFETTO_PLOG("Couldn't get the size of the shmem FD");
+    return nullptr;
+  }
   return MapFD(std::move(fd), static_cast<size_t>(stat_buf.st_size));
 }
 
@@ -109,7 +117,10 @@ std::unique_ptr<PosixSharedMemory> PosixSharedMemory::MapFD(base::ScopedFile fd,
   PERFETTO_DCHECK(size > 0);
   void* start =
       mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0);
-  PERFETTO_CHECK(start != MAP_FAILED);
+  if (start == MAP_FAILED) {
+    PERFETTO_PLOG("mmap() of the shared memory failed");
+    return nullptr;
+  }
   return std::unique_ptr<PosixSharedMemory>(
       new PosixSharedMemory(start, size, std::move(fd)));
 }
@@ -127,7 +138,9 @@ PosixSharedMemory::Factory::~Factory() {}
 
 std::unique_ptr<SharedMemory> PosixSharedMemory::Factory::CreateSharedMemory(
     size_t size) {
-  return PosixSharedMemory::Create(size);
+  std::unique_ptr<PosixSharedMemory> shm = PosixSharedMemory::Create(size);
+  PERFETTO_CHECK(shm);
+  return shm;
 }
 
 }  // namespace perfetto
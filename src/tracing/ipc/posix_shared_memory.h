@@ -42,7 +42,7 @@ class PosixSharedMemory : public SharedMemory {
     std::unique_ptr<SharedMemory> CreateSharedMemory(size_t) override;
   };
 
-  // Create a brand new SHM region.
+  // Create a brand new SHM region. Returns nullptr on failure (e.g. OOM).
   static std::unique_ptr<PosixSharedMemory> Create(size_t size);
 
   // Mmaps a file descriptor to an existing SHM region. If
@@ -224,6 +224,15 @@ void ProducerIPCClientImpl::OnConnectionInitialized(
   }
 }
 
+void ProducerIPCClientImpl::MaybeSetTraceFilter(const DataSourceConfig& cfg) {
+  // The arbiter is created when the service sends the SetupTracing command,
+  // which always precedes the first data source setup.
+  if (!shared_memory_arbiter_)
+    return;
+  shared_memory_arbiter_->SetTraceFilterForBuffer(
+      static_cast<BufferID>(cfg.target_buffer()), cfg.trace_filter_bytecode());
+}
+
 void ProducerIPCClientImpl::OnServiceRequest(
     const protos::gen::GetAsyncCommandResponse& cmd) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
@@ -234,6 +243,7 @@ void ProducerIPCClientImpl::OnServiceRequest(
     const auto& req = cmd.setup_data_source();
     const DataSourceInstanceID dsid = req.new_instance_id();
     data_sources_setup_.insert(dsid);
+    MaybeSetTraceFilter(req.config());
     producer_->SetupDataSource(dsid, req.config());
     return;
   }
@@ -245,6 +255,7 @@ void ProducerIPCClientImpl::OnServiceRequest(
     if (!data_sources_setup_.count(dsid)) {
       // When connecting with an older (Android P) service, the service will not
       // send a SetupDataSource message. We synthesize it here in that case.
+      MaybeSetTraceFilter(cfg);
       producer_->SetupDataSource(dsid, cfg);
     }
     producer_->StartDataSource(dsid, cfg);
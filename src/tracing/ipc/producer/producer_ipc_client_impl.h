@@ -99,6 +99,10 @@ class ProducerIPCClientImpl : public TracingService::ProducerEndpoint,
   // (e.g. start/stop a data source).
   void OnServiceRequest(const protos::gen::GetAsyncCommandResponse&);
 
+  // Forwards DataSourceConfig.trace_filter_bytecode to the arbiter, so that the
+  // trace writers for the data source filter their packets.
+  void MaybeSetTraceFilter(const DataSourceConfig&);
+
   // TODO think to destruction order, do we rely on any specific dtor sequence?
   Producer* const producer_;
   base::TaskRunner* const task_runner_;
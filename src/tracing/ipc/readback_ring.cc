@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/ipc/readback_ring.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/tracing/core/slice.h"
+
+namespace perfetto {
+
+// static
+constexpr size_t ReadbackRing::kHeaderSize;
+constexpr size_t ReadbackRing::kMinSize;
+constexpr size_t ReadbackRing::kMaxSize;
+
+// static
+bool ReadbackRing::IsValidSize(size_t size) {
+  return size >= kMinSize && size <= kMaxSize;
+}
+
+ReadbackRing::Writer::Writer(std::unique_ptr<SharedMemory> shmem)
+    : shmem_(std::move(shmem)),
+      data_(reinterpret_cast<uint8_t*>(shmem_->start()) + kHeaderSize),
+      capacity_(static_cast<uint32_t>(shmem_->size() - kHeaderSize)) {
+  PERFETTO_CHECK(IsValidSize(shmem_->size()));
+  // Normally 0, unless the consumer sent the same ring more than once.
+  write_offset_ =
+      GetHeader(shmem_.get())->read_offset.load(std::memory_order_acquire);
+  if (write_offset_ >= capacity_) {
+    PERFETTO_ELOG("Invalid readback ring read offset %u", write_offset_);
+    write_offset_ = 0;
+    broken_ = true;
+  }
+}
+
+ReadbackRing::Writer::~Writer() = default;
+
+bool ReadbackRing::Writer::TryWrite(const TracePacket& packet) {
+  if (broken_)
+    return false;
+  const uint32_t read_offset =
+      GetHeader(shmem_.get())->read_offset.load(std::memory_order_acquire);
+  if (read_offset >= capacity_) {
+    PERFETTO_ELOG("Invalid readback ring read offset %u", read_offset);
+    broken_ = true;
+    return false;
+  }
+  const size_t used = (write_offset_ + capacity_ - read_offset) % capacity_;
+  const size_t free_space = capacity_ - used - 1;
+  if (packet.size() > free_space || free_space - packet.size() < 4)
+    return false;
+
+  const uint32_t size = static_cast<uint32_t>(packet.size());
+  Copy(&size, sizeof(size));
+  for (const Slice& slice : packet.slices())
+    Copy(slice.start, slice.size);
+  return true;
+}
+
+void ReadbackRing::Writer::Copy(const void* src, size_t size) {
+  const size_t first = std::min<size_t>(size, capacity_ - write_offset_);
+  memcpy(data_ + write_offset_, src, first);
+  memcpy(data_, reinterpret_cast<const uint8_t*>(src) + first, size - first);
+  write_offset_ = static_cast<uint32_t>((write_offset_ + size) % capacity_);
+}
+
+ReadbackRing::Reader::Reader(std::unique_ptr<SharedMemory> shmem)
+    : shmem_(std::move(shmem)),
+      data_(reinterpret_cast<const uint8_t*>(shmem_->start()) + kHeaderSize),
+      capacity_(static_cast<uint32_t>(shmem_->size() - kHeaderSize)) {
+  PERFETTO_CHECK(IsValidSize(shmem_->size()));
+}
+
+ReadbackRing::Reader::~Reader() = default;
+
+bool ReadbackRing::Reader::ReadUpTo(uint32_t write_offset,
+                                    std::vector<TracePacket>* packets) {
+  if (write_offset >= capacity_)
+    return false;
+  bool success = true;
+  while (read_offset_ != write_offset) {
+    const size_t available =
+        (write_offset + capacity_ - read_offset_) % capacity_;
+    uint32_t size = 0;
+    if (available < sizeof(size)) {
+      success = false;
+      break;
+    }
+    Copy(&size, sizeof(size));
+    if (size > available - sizeof(size)) {
+      success = false;
+      break;
+    }
+    Slice slice = Slice::Allocate(size);
+    Copy(slice.own_data(), size);
+    TracePacket packet;
+    packet.AddSlice(std::move(slice));
+    packets->emplace_back(std::move(packet));
+  }
+  read_offset_ = write_offset;
+  GetHeader(shmem_.get())
+      ->read_offset.store(read_offset_, std::memory_order_release);
+  return success;
+}
+
+void ReadbackRing::Reader::Copy(void* dst, size_t size) {
+  const size_t first = std::min<size_t>(size, capacity_ - read_offset_);
+  memcpy(dst, data_ + read_offset_, first);
+  memcpy(reinterpret_cast<uint8_t*>(dst) + first, data_, size - first);
+  read_offset_ = static_cast<uint32_t>((read_offset_ + size) % capacity_);
+}
+
+}  // namespace perfetto
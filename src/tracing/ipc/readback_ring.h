@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_IPC_READBACK_RING_H_
+#define SRC_TRACING_IPC_READBACK_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "perfetto/ext/tracing/core/shared_memory.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+
+namespace perfetto {
+
+// A ring buffer of trace packets in a shared memory region created by a
+// consumer. The service writes the packets returned by ReadBuffers() into it,
+// instead of copying them through the 128 KB IPC replies. The IPC replies are
+// still sent, but only act as doorbells: each one carries the write offset up
+// to which the ring has been filled. There is no flow control: packets that
+// don't fit in the ring (e.g. because the consumer is slow in draining it) are
+// sent inline in the IPC replies as before.
+//
+// Layout of the region:
+// [Header] [data area: records of (uint32 size, packet bytes)]
+// Records wrap around the end of the data area. One byte of the data area is
+// always left empty, so that read offset == write offset means "empty".
+//
+// The read offset is the only state in the region written by the consumer.
+// The write offset is owned by the service and is never read back from the
+// region, so a misbehaving consumer can at most cause its own packets to be
+// dropped.
+class ReadbackRing {
+ public:
+  static constexpr size_t kHeaderSize = 64;
+  static constexpr size_t kMinSize = 4096;
+  static constexpr size_t kMaxSize = 64 * 1024 * 1024;
+
+  // Returns true if |size| is an acceptable size for the shared memory region.
+  static bool IsValidSize(size_t size);
+
+  // Used by the service.
+  class Writer {
+   public:
+    // |shmem| must satisfy IsValidSize().
+    explicit Writer(std::unique_ptr<SharedMemory> shmem);
+    ~Writer();
+
+    // Appends |packet| to the ring. Returns false if there isn't enough free
+    // space for it, in which case the packet must be sent inline.
+    bool TryWrite(const TracePacket& packet);
+
+    uint32_t write_offset() const { return write_offset_; }
+
+   private:
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    void Copy(const void* src, size_t size);
+
+    std::unique_ptr<SharedMemory> shmem_;
+    uint8_t* const data_;
+    const uint32_t capacity_;
+    uint32_t write_offset_ = 0;
+    // Set if the consumer wrote an out of bounds read offset.
+    bool broken_ = false;
+  };
+
+  // Used by the consumer.
+  class Reader {
+   public:
+    // |shmem| must satisfy IsValidSize() and be zero-initialized.
+    explicit Reader(std::unique_ptr<SharedMemory> shmem);
+    ~Reader();
+
+    // Appends all the packets up to |write_offset| to |packets| and frees
+    // their space in the ring. Returns false if the contents of the ring are
+    // malformed, in which case the remaining packets up to |write_offset| are
+    // skipped.
+    bool ReadUpTo(uint32_t write_offset, std::vector<TracePacket>* packets);
+
+    SharedMemory* shmem() const { return shmem_.get(); }
+
+   private:
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    void Copy(void* dst, size_t size);
+
+    std::unique_ptr<SharedMemory> shmem_;
+    const uint8_t* const data_;
+    const uint32_t capacity_;
+    uint32_t read_offset_ = 0;
+  };
+
+ private:
+  struct Header {
+    std::atomic<uint32_t> read_offset;
+  };
+  static_assert(sizeof(Header) <= kHeaderSize, "Header too big");
+
+  static Header* GetHeader(SharedMemory* shmem) {
+    return reinterpret_cast<Header*>(shmem->start());
+  }
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_IPC_READBACK_RING_H_
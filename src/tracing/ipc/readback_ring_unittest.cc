@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/ipc/readback_ring.h"
+
+#include <string.h>
+
+#include <atomic>
+#include <string>
+
+#include "perfetto/ext/tracing/core/slice.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+// A SharedMemory backed by a plain heap buffer, shared by a Writer and a
+// Reader through the raw pointer.
+class HeapSharedMemory : public SharedMemory {
+ public:
+  explicit HeapSharedMemory(size_t size) : size_(size), buf_(new char[size]) {
+    memset(buf_.get(), 0, size);
+  }
+  HeapSharedMemory(void* start, size_t size) : size_(size), start_(start) {}
+
+  void* start() const override { return start_ ? start_ : buf_.get(); }
+  size_t size() const override { return size_; }
+
+ private:
+  size_t size_;
+  std::unique_ptr<char[]> buf_;
+  void* start_ = nullptr;
+};
+
+constexpr size_t kSize = ReadbackRing::kMinSize;
+constexpr size_t kCapacity = kSize - ReadbackRing::kHeaderSize;
+
+class ReadbackRingTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    std::unique_ptr<HeapSharedMemory> shmem(new HeapSharedMemory(kSize));
+    void* start = shmem->start();
+    reader_.reset(new ReadbackRing::Reader(std::move(shmem)));
+    writer_.reset(new ReadbackRing::Writer(std::unique_ptr<SharedMemory>(
+        new HeapSharedMemory(start, kSize))));
+  }
+
+  static TracePacket MakePacket(const std::string& payload) {
+    // Split the payload in two slices, to check they are glued together.
+    TracePacket packet;
+    size_t half = payload.size() / 2;
+    Slice first = Slice::Allocate(half);
+    memcpy(first.own_data(), payload.data(), half);
+    Slice second = Slice::Allocate(payload.size() - half);
+    memcpy(second.own_data(), payload.data() + half, payload.size() - half);
+    packet.AddSlice(std::move(first));
+    packet.AddSlice(std::move(second));
+    return packet;
+  }
+
+  static std::string GetPayload(const TracePacket& packet) {
+    std::string payload;
+    for (const Slice& slice : packet.slices())
+      payload.append(reinterpret_cast<const char*>(slice.start), slice.size);
+    return payload;
+  }
+
+  std::unique_ptr<ReadbackRing::Reader> reader_;
+  std::unique_ptr<ReadbackRing::Writer> writer_;
+};
+
+TEST_F(ReadbackRingTest, WriteAndRead) {
+  ASSERT_TRUE(writer_->TryWrite(MakePacket("foo")));
+  ASSERT_TRUE(writer_->TryWrite(MakePacket("")));
+  ASSERT_TRUE(writer_->TryWrite(MakePacket("barbaz")));
+  EXPECT_EQ(writer_->write_offset(), 4u + 3u + 4u + 4u + 6u);
+
+  std::vector<TracePacket> packets;
+  ASSERT_TRUE(reader_->ReadUpTo(writer_->write_offset(), &packets));
+  ASSERT_EQ(packets.size(), 3u);
+  EXPECT_EQ(GetPayload(packets[0]), "foo");
+  EXPECT_EQ(GetPayload(packets[1]), "");
+  EXPECT_EQ(GetPayload(packets[2]), "barbaz");
+
+  packets.clear();
+  ASSERT_TRUE(reader_->ReadUpTo(writer_->write_offset(), &packets));
+  EXPECT_TRUE(packets.empty());
+}
+
+TEST_F(ReadbackRingTest, FullAndWrapAround) {
+  const std::string big(kCapacity / 2, 'x');
+  ASSERT_TRUE(writer_->TryWrite(MakePacket(big)));
+  // Doesn't fit until the reader has consumed the first packet.
+  EXPECT_FALSE(writer_->TryWrite(MakePacket(big + "y")));
+  uint32_t first_offset = writer_->write_offset();
+
+  std::vector<TracePacket> packets;
+  ASSERT_TRUE(reader_->ReadUpTo(first_offset, &packets));
+  ASSERT_EQ(packets.size(), 1u);
+
+  // These wrap around the end of the ring.
+  for (int i = 0; i < 10; i++) {
+    std::string payload = std::to_string(i) + big.substr(0, kCapacity / 3);
+    ASSERT_TRUE(writer_->TryWrite(MakePacket(payload)));
+    packets.clear();
+    ASSERT_TRUE(reader_->ReadUpTo(writer_->write_offset(), &packets));
+    ASSERT_EQ(packets.size(), 1u);
+    EXPECT_EQ(GetPayload(packets[0]), payload);
+  }
+}
+
+TEST_F(ReadbackRingTest, InvalidOffsets) {
+  ASSERT_TRUE(writer_->TryWrite(MakePacket("foo")));
+  std::vector<TracePacket> packets;
+  EXPECT_FALSE(reader_->ReadUpTo(kCapacity, &packets));
+  // Stops in the middle of a record.
+  EXPECT_FALSE(reader_->ReadUpTo(5, &packets));
+  EXPECT_TRUE(packets.empty());
+}
+
+TEST_F(ReadbackRingTest, WriterRejectsInvalidReadOffset) {
+  auto* read_offset =
+      reinterpret_cast<std::atomic<uint32_t>*>(reader_->shmem()->start());
+  read_offset->store(kCapacity + 1);
+  EXPECT_FALSE(writer_->TryWrite(MakePacket("foo")));
+  // The writer keeps refusing even if the offset goes back to a valid value.
+  read_offset->store(0);
+  EXPECT_FALSE(writer_->TryWrite(MakePacket("foo")));
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -18,6 +18,8 @@
 
 #include <cinttypes>
 
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/compiler.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/task_runner.h"
 #include "perfetto/ext/base/scoped_file.h"
@@ -32,8 +34,39 @@
 #include "perfetto/tracing/core/tracing_service_capabilities.h"
 #include "perfetto/tracing/core/tracing_service_state.h"
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "src/tracing/ipc/memfd.h"
+#include "src/tracing/ipc/posix_shared_memory.h"
+#endif
+
 namespace perfetto {
 
+namespace {
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+// The consumer is not trusted: before mapping its readback shared memory, the
+// fd must be a regular file of a size accepted by ReadbackRing and, if the
+// system supports memfd, sealed so that it can't be resized afterwards.
+bool IsValidReadbackShmemFd(int fd) {
+  struct stat stat_buf = {};
+  if (fstat(fd, &stat_buf) != 0 || !S_ISREG(stat_buf.st_mode) ||
+      stat_buf.st_size <= 0 ||
+      !ReadbackRing::IsValidSize(static_cast<size_t>(stat_buf.st_size))) {
+    return false;
+  }
+  if (!HasMemfdSupport())
+    return true;
+  const int kRequiredSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+  int seals = fcntl(fd, F_GET_SEALS);
+  return seals != -1 && (seals & kRequiredSeals) == kRequiredSeals;
+}
+#endif
+
+}  // namespace
+
 ConsumerIPCService::ConsumerIPCService(TracingService* core_service)
     : core_service_(core_service), weak_ptr_factory_(this) {}
 
@@ -105,9 +138,30 @@ void ConsumerIPCService::DisableTracing(
 }
 
 // Called by the IPC layer.
-void ConsumerIPCService::ReadBuffers(const protos::gen::ReadBuffersRequest&,
+void ConsumerIPCService::ReadBuffers(const protos::gen::ReadBuffersRequest& req,
                                      DeferredReadBuffersResponse resp) {
   RemoteConsumer* remote_consumer = GetConsumerForCurrentRequest();
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  if (req.readback_shmem_fd_attached()) {
+    // A bad fd fails the request. The consumer then retries without it and
+    // gets the packets inline in the IPC replies.
+    std::unique_ptr<PosixSharedMemory> shmem;
+    base::ScopedFile shmem_fd = ipc::Service::TakeReceivedFD();
+    if (shmem_fd && IsValidReadbackShmemFd(*shmem_fd)) {
+      shmem = PosixSharedMemory::AttachToFd(
+          std::move(shmem_fd), /*require_seals_if_supported=*/true);
+    }
+    if (!shmem || !ReadbackRing::IsValidSize(shmem->size())) {
+      PERFETTO_ELOG("Rejecting invalid consumer readback shared memory");
+      resp.Reject();
+      return;
+    }
+    remote_consumer->readback_ring.reset(
+        new ReadbackRing::Writer(std::move(shmem)));
+  }
+#else
+  base::ignore_result(req);
+#endif
   remote_consumer->read_buffers_response = std::move(resp);
   remote_consumer->service_endpoint->ReadBuffers();
 }
@@ -338,6 +392,34 @@ void ConsumerIPCService::OnSaveTraceForBugreportCallback(
   response.Resolve(std::move(resp));
 }
 
+void ConsumerIPCService::CloneSession(
+    const protos::gen::CloneSessionRequest& req,
+    DeferredCloneSessionResponse resp) {
+  RemoteConsumer* remote_consumer = GetConsumerForCurrentRequest();
+  auto it = pending_clone_session_responses_.insert(
+      pending_clone_session_responses_.end(), std::move(resp));
+  auto weak_this = weak_ptr_factory_.GetWeakPtr();
+  auto callback = [weak_this, it](bool success, const std::string& msg) {
+    if (weak_this)
+      weak_this->OnCloneSessionCallback(success, msg, std::move(it));
+  };
+  remote_consumer->service_endpoint->CloneSession(req.unique_session_name(),
+                                                  callback);
+}
+
+// Called by the service in response to service_endpoint->CloneSession().
+void ConsumerIPCService::OnCloneSessionCallback(
+    bool success,
+    const std::string& msg,
+    PendingCloneSessionResponses::iterator pending_response_it) {
+  DeferredCloneSessionResponse response(std::move(*pending_response_it));
+  pending_clone_session_responses_.erase(pending_response_it);
+  auto resp = ipc::AsyncResult<protos::gen::CloneSessionResponse>::Create();
+  resp->set_success(success);
+  resp->set_error(msg);
+  response.Resolve(std::move(resp));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // RemoteConsumer methods
 ////////////////////////////////////////////////////////////////////////////////
@@ -385,12 +467,25 @@ void ConsumerIPCService::RemoteConsumer::OnTraceData(
 
   auto send_ipc_reply = [this, &result](bool more) {
     result.set_has_more(more);
+    if (readback_ring)
+      result->set_readback_shmem_write_offset(readback_ring->write_offset());
     read_buffers_response.Resolve(std::move(result));
     result = ipc::AsyncResult<protos::gen::ReadBuffersResponse>::Create();
   };
 
   size_t approx_reply_size = 0;
   for (const TracePacket& trace_packet : trace_packets) {
+    // Packets go into the readback ring (if any) while it has space. The
+    // consumer drains the ring before looking at the slices of a reply, so
+    // once a reply has some slices, the following packets must be appended
+    // to it as well to keep them in order.
+    // There is no flow control on the ring itself: if the consumer doesn't
+    // drain it fast enough, TryWrite() fails and the packets fall back to
+    // the IPC replies, which are paced by the socket.
+    if (readback_ring && result->slices_size() == 0 &&
+        readback_ring->TryWrite(trace_packet)) {
+      continue;
+    }
     size_t num_slices_left_for_packet = trace_packet.slices().size();
     for (const Slice& slice : trace_packet.slices()) {
       // Check if this slice would cause the IPC to overflow its max size and,
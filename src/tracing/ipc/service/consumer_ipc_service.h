@@ -28,6 +28,7 @@
 #include "perfetto/ext/tracing/core/tracing_service.h"
 #include "perfetto/tracing/core/forward_decls.h"
 #include "protos/perfetto/ipc/consumer_port.ipc.h"
+#include "src/tracing/ipc/readback_ring.h"
 
 namespace perfetto {
 
@@ -71,6 +72,8 @@ class ConsumerIPCService : public protos::gen::ConsumerPort {
                          DeferredQueryCapabilitiesResponse) override;
   void SaveTraceForBugreport(const protos::gen::SaveTraceForBugreportRequest&,
                              DeferredSaveTraceForBugreportResponse) override;
+  void CloneSession(const protos::gen::CloneSessionRequest&,
+                    DeferredCloneSessionResponse) override;
   void OnClientDisconnected() override;
 
  private:
@@ -104,6 +107,10 @@ class ConsumerIPCService : public protos::gen::ConsumerPort {
     // allows to stream trace packets back to the client.
     DeferredReadBuffersResponse read_buffers_response;
 
+    // Set if the consumer passed a shared memory buffer with ReadBuffers().
+    // Packets that fit are written into it rather than inlined in the replies.
+    std::unique_ptr<ReadbackRing::Writer> readback_ring;
+
     // After EnableTracing() is invoked, this binds the async callback that
     // allows to send the OnTracingDisabled notification.
     DeferredEnableTracingResponse enable_tracing_response;
@@ -130,6 +137,7 @@ class ConsumerIPCService : public protos::gen::ConsumerPort {
       std::list<DeferredQueryCapabilitiesResponse>;
   using PendingSaveTraceForBugreportResponses =
       std::list<DeferredSaveTraceForBugreportResponse>;
+  using PendingCloneSessionResponses = std::list<DeferredCloneSessionResponse>;
 
   ConsumerIPCService(const ConsumerIPCService&) = delete;
   ConsumerIPCService& operator=(const ConsumerIPCService&) = delete;
@@ -148,6 +156,9 @@ class ConsumerIPCService : public protos::gen::ConsumerPort {
       bool success,
       const std::string& msg,
       PendingSaveTraceForBugreportResponses::iterator);
+  void OnCloneSessionCallback(bool success,
+                              const std::string& msg,
+                              PendingCloneSessionResponses::iterator);
 
   TracingService* const core_service_;
 
@@ -159,6 +170,7 @@ class ConsumerIPCService : public protos::gen::ConsumerPort {
   PendingQuerySvcResponses pending_query_service_responses_;
   PendingQueryCapabilitiesResponses pending_query_capabilities_responses_;
   PendingSaveTraceForBugreportResponses pending_bugreport_responses_;
+  PendingCloneSessionResponses pending_clone_session_responses_;
 
   base::WeakPtrFactory<ConsumerIPCService> weak_ptr_factory_;  // Keep last.
 };
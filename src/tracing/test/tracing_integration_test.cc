@@ -141,8 +141,9 @@ class TracingIntegrationTest : public ::testing::Test {
     producer_endpoint_->RegisterDataSource(ds_desc);
 
     // Create and connect a Consumer.
-    consumer_endpoint_ = ConsumerIPCClient::Connect(
-        kConsumerSock.name(), &consumer_, task_runner_.get());
+    consumer_endpoint_ =
+        ConsumerIPCClient::Connect(kConsumerSock.name(), &consumer_,
+                                   task_runner_.get(), GetReadbackShmemSize());
     auto on_consumer_connect =
         task_runner_->CreateCheckpoint("on_consumer_connect");
     EXPECT_CALL(consumer_, OnConnect()).WillOnce(Invoke(on_consumer_connect));
@@ -182,6 +183,8 @@ class TracingIntegrationTest : public ::testing::Test {
     return TracingService::ProducerSMBScrapingMode::kDefault;
   }
 
+  virtual size_t GetReadbackShmemSize() { return 0; }
+
   void WaitForTraceWritersChanged(ProducerID producer_id) {
     static int i = 0;
     auto checkpoint_name = "writers_changed_" + std::to_string(producer_id) +
@@ -558,6 +561,86 @@ TEST_F(TracingIntegrationTestWithSMBScrapingProducer, ScrapeOnFlush) {
   task_runner_->RunUntilCheckpoint("on_tracing_disabled");
 }
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+class TracingIntegrationTestWithReadbackShmem : public TracingIntegrationTest {
+ public:
+  // Deliberately tiny, so that the service has to fall back on IPC slices for
+  // most of the packets, interleaving them with the ones in shared memory.
+  size_t GetReadbackShmemSize() override { return 4096; }
+};
+
+TEST_F(TracingIntegrationTestWithReadbackShmem, PacketsInOrder) {
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096 * 10);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("perfetto.test");
+  ds_config->set_target_buffer(0);
+  consumer_endpoint_->EnableTracing(trace_config);
+
+  BufferID global_buf_id = 0;
+  auto on_create_ds_instance =
+      task_runner_->CreateCheckpoint("on_create_ds_instance");
+  EXPECT_CALL(producer_, OnTracingSetup());
+  EXPECT_CALL(producer_, SetupDataSource(_, _));
+  EXPECT_CALL(producer_, StartDataSource(_, _))
+      .WillOnce(Invoke([on_create_ds_instance, &global_buf_id](
+                           DataSourceInstanceID, const DataSourceConfig& cfg) {
+        global_buf_id = static_cast<BufferID>(cfg.target_buffer());
+        on_create_ds_instance();
+      }));
+  task_runner_->RunUntilCheckpoint("on_create_ds_instance");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer_endpoint_->CreateTraceWriter(global_buf_id);
+  ASSERT_TRUE(writer);
+
+  const size_t kNumPackets = 2000;
+  const std::string kPadding(100, 'x');
+  for (size_t i = 0; i < kNumPackets; i++) {
+    std::string payload = "evt_" + std::to_string(i) + kPadding;
+    writer->NewTracePacket()->set_for_testing()->set_str(payload);
+  }
+  auto on_data_committed = task_runner_->CreateCheckpoint("on_data_committed");
+  writer->Flush(on_data_committed);
+  task_runner_->RunUntilCheckpoint("on_data_committed");
+
+  // Read the buffers twice, to check that the shared memory set up by the
+  // first call keeps working.
+  for (int read = 0; read < 2; read++) {
+    consumer_endpoint_->ReadBuffers();
+    size_t num_pack_rx = 0;
+    std::string checkpoint = "all_packets_rx_" + std::to_string(read);
+    auto all_packets_rx = task_runner_->CreateCheckpoint(checkpoint);
+    EXPECT_CALL(consumer_, OnTracePackets(_, _))
+        .WillRepeatedly(Invoke([&num_pack_rx, &kPadding, all_packets_rx](
+                                   std::vector<TracePacket>* packets,
+                                   bool has_more) {
+          for (auto& encoded_packet : *packets) {
+            protos::gen::TracePacket packet;
+            ASSERT_TRUE(packet.ParseFromString(
+                encoded_packet.GetRawBytesForTesting()));
+            if (packet.has_for_testing()) {
+              EXPECT_EQ("evt_" + std::to_string(num_pack_rx++) + kPadding,
+                        packet.for_testing().str());
+            }
+          }
+          if (!has_more)
+            all_packets_rx();
+        }));
+    task_runner_->RunUntilCheckpoint(checkpoint);
+    ASSERT_EQ(read == 0 ? kNumPackets : 0u, num_pack_rx);
+  }
+
+  consumer_endpoint_->DisableTracing();
+  auto on_tracing_disabled =
+      task_runner_->CreateCheckpoint("on_tracing_disabled");
+  EXPECT_CALL(producer_, StopDataSource(_));
+  EXPECT_CALL(consumer_, OnTracingDisabled(_))
+      .WillOnce(InvokeWithoutArgs(on_tracing_disabled));
+  task_runner_->RunUntilCheckpoint("on_tracing_disabled");
+}
+#endif
+
 // TODO(primiano): add tests to cover:
 // - unknown fields preserved end-to-end.
 // - >1 data source.
@@ -116,14 +116,18 @@ void BenchmarkProducer(benchmark::State& state) {
   }
 }
 
-static void BenchmarkConsumer(benchmark::State& state) {
+// If |readback_shmem_size_bytes| is not 0, the trace data is read back
+// through a shared memory buffer of that size, rather than through the IPC
+// replies.
+static void BenchmarkConsumer(benchmark::State& state,
+                              size_t readback_shmem_size_bytes = 0) {
   base::TestTaskRunner task_runner;
 
   TestHelper helper(&task_runner);
   helper.StartServiceIfRequired();
 
   FakeProducer* producer = helper.ConnectFakeProducer();
-  helper.ConnectConsumer();
+  helper.ConnectConsumer(readback_shmem_size_bytes);
   helper.WaitForConsumerConnect();
 
   TraceConfig trace_config;
@@ -295,4 +299,14 @@ BENCHMARK(BM_EndToEnd_Consumer_ConstantRate)
     ->UseRealTime()
     ->Apply(ConstantRateConsumerArgs);
 
+static void BM_EndToEnd_Consumer_SaturateCpu_ReadbackShmem(
+    benchmark::State& state) {
+  BenchmarkConsumer(state, /*readback_shmem_size_bytes=*/1024 * 1024);
+}
+
+BENCHMARK(BM_EndToEnd_Consumer_SaturateCpu_ReadbackShmem)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime()
+    ->Apply(SaturateCpuConsumerArgs);
+
 }  // namespace perfetto
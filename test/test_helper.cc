@@ -123,11 +123,12 @@ FakeProducer* TestHelper::ConnectFakeProducer() {
   return fake_producer_thread_.producer();
 }
 
-void TestHelper::ConnectConsumer() {
+void TestHelper::ConnectConsumer(size_t readback_shmem_size_bytes) {
   cur_consumer_num_++;
   on_connect_callback_ = CreateCheckpoint("consumer.connected." +
                                           std::to_string(cur_consumer_num_));
-  endpoint_ = ConsumerIPCClient::Connect(consumer_socket_, this, task_runner_);
+  endpoint_ = ConsumerIPCClient::Connect(consumer_socket_, this, task_runner_,
+                                         readback_shmem_size_bytes);
 }
 
 void TestHelper::DetachConsumer(const std::string& key) {
@@ -227,7 +227,8 @@ class TestHelper : public Consumer {
   // RegisterDataSource() call.
   FakeProducer* ConnectFakeProducer();
 
-  void ConnectConsumer();
+  // See ConsumerIPCClient::Connect() for |readback_shmem_size_bytes|.
+  void ConnectConsumer(size_t readback_shmem_size_bytes = 0);
   void StartTracing(const TraceConfig& config,
                     base::ScopedFile = base::ScopedFile());
   void DisableTracing();
@@ -40,7 +40,9 @@ int SymbolizeProfile(std::istream* input, std::ostream* output) {
   const char* breakpad_dir = getenv("BREAKPAD_SYMBOL_DIR");
   if (breakpad_dir == nullptr) {
     symbolizer = profiling::LocalSymbolizerOrDie(
-        profiling::GetPerfettoBinaryPath(), getenv("PERFETTO_SYMBOLIZER_MODE"));
+        profiling::GetPerfettoBinaryPath(), getenv("PERFETTO_SYMBOLIZER_MODE"),
+        getenv("PERFETTO_SYMBOLIZER_BACKEND"),
+        getenv("PERFETTO_SYMBOL_INDEX_DIR"));
   } else {
     symbolizer.reset(new profiling::BreakpadSymbolizer(breakpad_dir));
   }
@@ -69,7 +69,9 @@ std::string GetRandomString(size_t n) {
 void MaybeSymbolize(trace_processor::TraceProcessor* tp) {
   std::unique_ptr<profiling::Symbolizer> symbolizer =
       profiling::LocalSymbolizerOrDie(profiling::GetPerfettoBinaryPath(),
-                                      getenv("PERFETTO_SYMBOLIZER_MODE"));
+                                      getenv("PERFETTO_SYMBOLIZER_MODE"),
+                                      getenv("PERFETTO_SYMBOLIZER_BACKEND"),
+                                      getenv("PERFETTO_SYMBOL_INDEX_DIR"));
   if (!symbolizer)
     return;
   profiling::SymbolizeDatabase(tp, symbolizer.get(),